@@ -0,0 +1,64 @@
+#include "Decomposition.h"
+
+#include <map>
+#include <sstream>
+
+void mmpbsa::set_atom_solvation(std::vector<mmpbsa::EMap>& atom_energies, const std::vector<mmpbsa_t>& atom_pb,
+		const std::vector<mmpbsa_t>& atom_areas, const mmpbsa_t& surf_tension) throw (mmpbsa::MMPBSAException)
+{
+	if((atom_pb.size() && atom_pb.size() != atom_energies.size())
+			|| (atom_areas.size() && atom_areas.size() != atom_energies.size()))
+	{
+		std::ostringstream error;
+		error << "mmpbsa::set_atom_solvation: Number of atom PB energies (" << atom_pb.size()
+				<< ") or areas (" << atom_areas.size() << ") does not match the number of atoms ("
+				<< atom_energies.size() << ")";
+		throw mmpbsa::MMPBSAException(error,mmpbsa::DATA_FORMAT_ERROR);
+	}
+
+	for(size_t i = 0;i<atom_energies.size();i++)
+	{
+		EMap& atom_energy = atom_energies[i];
+		atom_energy.set_elstat_solv((atom_pb.size()) ? atom_pb[i] : 0);
+		atom_energy.set_area((atom_areas.size()) ? atom_areas[i] : 0);
+		atom_energy.set_sasol(atom_energy.area*surf_tension);
+		atom_energy.molsurf_failed = (atom_areas.size() == 0);
+	}
+}
+
+std::vector<mmpbsa::residue_energy_t> mmpbsa::sum_by_residue(const std::vector<mmpbsa::atom_t>& atoms,
+		const std::vector<mmpbsa::EMap>& atom_energies) throw (mmpbsa::MMPBSAException)
+{
+	if(atoms.size() != atom_energies.size())
+	{
+		std::ostringstream error;
+		error << "mmpbsa::sum_by_residue: Number of atom energies (" << atom_energies.size()
+				<< ") does not match the number of atoms (" << atoms.size() << ")";
+		throw mmpbsa::MMPBSAException(error,mmpbsa::DATA_FORMAT_ERROR);
+	}
+
+	std::map<size_t,size_t> residue_index;//residue -> position in returnMe
+	std::vector<residue_energy_t> returnMe;
+	for(size_t i = 0;i<atoms.size();i++)
+	{
+		std::map<size_t,size_t>::iterator it = residue_index.find(atoms[i].residue);
+		if(it == residue_index.end())
+		{
+			residue_energy_t new_residue;
+			new_residue.residue = atoms[i].residue;
+			new_residue.name = atoms[i].residue_name;
+			new_residue.energy = atom_energies[i];
+			residue_index[atoms[i].residue] = returnMe.size();
+			returnMe.push_back(new_residue);
+		}
+		else
+			returnMe[it->second].energy += atom_energies[i];
+	}
+
+	//Atoms of a residue are contiguous in Amber and Gromacs topologies, but do not rely on it.
+	std::vector<residue_energy_t> sorted;
+	sorted.reserve(returnMe.size());
+	for(std::map<size_t,size_t>::const_iterator it = residue_index.begin();it != residue_index.end();it++)
+		sorted.push_back(returnMe[it->second]);
+	return sorted;
+}
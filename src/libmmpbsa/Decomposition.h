@@ -0,0 +1,56 @@
+/**
+ * @file Decomposition.h
+ * @brief Decomposition of the energies of a molecule by residue
+ *
+ * Energies are first decomposed by atom. Molecular mechanics terms are divided
+ * equally among the atoms of each term (cf EMap), PB solvation energy is
+ * q_i (phi_solv(r_i) - phi_ref(r_i)) / 2 and surface area is the area of each
+ * atom from the surface area engine (cf MeadInterface::surface_area). The atom energies of each residue are then summed, so that the
+ * residue energies of a molecule sum to its energies. The constant surface
+ * area offset is not attributed to residues.
+ */
+
+#ifndef DECOMPOSITION_H
+#define DECOMPOSITION_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string>
+#include <vector>
+
+#include "globals.h"
+#include "structs.h"
+#include "mmpbsa_exceptions.h"
+#include "EMap.h"
+
+namespace mmpbsa{
+
+/**
+ * Energies of one residue of a molecule.
+ */
+typedef struct {
+	size_t residue;///<Zero-indexed residue in the whole topology (cf atom_t)
+	std::string name;
+	mmpbsa::EMap energy;
+}residue_energy_t;
+
+/**
+ * Sets the PB solvation energy, surface area and surface area energy of each atom.
+ * atom_pb and atom_areas have one value per atom, or are empty if that
+ * part of the calculation was not done, e.g. if molsurf failed.
+ */
+void set_atom_solvation(std::vector<mmpbsa::EMap>& atom_energies, const std::vector<mmpbsa_t>& atom_pb,
+		const std::vector<mmpbsa_t>& atom_areas, const mmpbsa_t& surf_tension) throw (mmpbsa::MMPBSAException);
+
+/**
+ * Sums the energies of the atoms of each residue, in order of residue index.
+ * atom_energies[i] belongs to atoms[i].
+ */
+std::vector<mmpbsa::residue_energy_t> sum_by_residue(const std::vector<mmpbsa::atom_t>& atoms,
+		const std::vector<mmpbsa::EMap>& atom_energies) throw (mmpbsa::MMPBSAException);
+
+}//end namespace mmpbsa
+
+#endif//DECOMPOSITION_H
@@ -78,6 +78,40 @@ mmpbsa::EMap::EMap(const std::vector<atom_t>& atoms, const mmpbsa::forcefield_t&
     molsurf_failed = false;
 }
 
+mmpbsa::EMap::EMap(const std::vector<atom_t>& atoms, const mmpbsa::forcefield_t& ff, const std::valarray<Vector>& crds,
+		std::vector<mmpbsa::EMap>& atom_energies)
+{
+    using std::valarray;
+    const size_t natom = atoms.size();
+    valarray<mmpbsa_t> atom_bond(0.0,natom),atom_angle(0.0,natom),atom_dihed(0.0,natom);
+    valarray<mmpbsa_t> atom_vdw14(0.0,natom),atom_ele14(0.0,natom),atom_vdwaals(0.0,natom),atom_vacele(0.0,natom);
+
+    bond = mmpbsa::bond_energy_calc(ff.bonds_with_H,crds,&atom_bond) + mmpbsa::bond_energy_calc(ff.bonds_without_H,crds,&atom_bond);
+    angle = mmpbsa::angle_energy_calc(ff.angles_with_H,crds,&atom_angle) + mmpbsa::angle_energy_calc(ff.angles_without_H,crds,&atom_angle);
+    dihed = mmpbsa::dihedral_energy_calc(ff.dihedrals_with_H,crds,&atom_dihed) + mmpbsa::dihedral_energy_calc(ff.dihedrals_without_H,crds,&atom_dihed);
+    vdw14 = mmpbsa::vdw14_energy_calc(ff.dihedrals_with_H,crds,ff.inv_scnb,&atom_vdw14)+mmpbsa::vdw14_energy_calc(ff.dihedrals_without_H,crds,ff.inv_scnb,&atom_vdw14);
+    ele14 = mmpbsa::elstat14_energy_calc(ff.dihedrals_with_H,atoms,crds,ff.inv_scee,ff.dielc,&atom_ele14)+mmpbsa::elstat14_energy_calc(ff.dihedrals_without_H,atoms,crds,ff.inv_scee,ff.dielc,&atom_ele14);
+    vdwaals = mmpbsa::vdwaals_energy(atoms,ff.lj_params,crds,&atom_vdwaals);
+    vacele = mmpbsa::total_elstat_energy(atoms,crds,ff.coulomb_const,&atom_vacele);
+    elstat_solv = 0;
+    area = 0;
+    sasol = 0;
+    molsurf_failed = false;
+
+    atom_energies.assign(natom,EMap());
+    for(size_t i = 0;i<natom;i++)
+    {
+    	EMap& atom_energy = atom_energies[i];
+    	atom_energy.bond = atom_bond[i];
+    	atom_energy.angle = atom_angle[i];
+    	atom_energy.dihed = atom_dihed[i];
+    	atom_energy.vdw14 = atom_vdw14[i];
+    	atom_energy.ele14 = atom_ele14[i];
+    	atom_energy.vdwaals = atom_vdwaals[i];
+    	atom_energy.vacele = atom_vacele[i];
+    }
+}
+
 namespace mmpbsa{
 std::ostream& operator<<(std::ostream& theStream, const mmpbsa::EMap& toWrite)
 {
@@ -65,6 +65,14 @@ public:
 
     EMap(const std::vector<atom_t>& atoms, const mmpbsa::forcefield_t& ff, const std::valarray<Vector>& crds);
 
+    /**
+     * Calculates the molecular mechanics energies and, in the same pass, their
+     * decomposition by atom (cf Energy.h). atom_energies is replaced by one EMap
+     * per atom, whose terms sum to those of the molecule.
+     */
+    EMap(const std::vector<atom_t>& atoms, const mmpbsa::forcefield_t& ff, const std::valarray<Vector>& crds,
+    		std::vector<EMap>& atom_energies);
+
     ~EMap(){}
 
     /**
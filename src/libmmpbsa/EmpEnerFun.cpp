@@ -2,6 +2,7 @@
 #include "mmpbsa_io.h"
 #include "SanderParm.h"
 #include "Energy.h"
+#include "mmpbsa_utils.h"
 
 #include <cstdio>
 #include <vector>
@@ -752,11 +753,17 @@ void mmpbsa::EmpEnerFun::extract_atom_structs(std::vector<mmpbsa::atom_t>& atoms
 {
 	mmpbsa::atom_t new_atom;
 	new_atom.atomic_number = 0;
+	size_t residue = 0;
 	for(size_t i = 0;i<parminfo->natom;i++)
 	{
+		while(2*residue+1 < res_ranges.size() && i >= res_ranges[2*residue+1])
+			residue++;
+		new_atom.residue = residue;
+		new_atom.residue_name = (residue < parminfo->residue_labels.size()) ? parminfo->residue_labels[residue] : "";
 		new_atom.name = parminfo->atom_names[i];
 		new_atom.charge = parminfo->charges[i];
 		new_atom.atom_type = parminfo->atom_type_indices[i] - 1;
+		new_atom.type_name = (i < parminfo->amber_atom_types.size()) ? mmpbsa_utils::trimString(parminfo->amber_atom_types[i]) : "";
 		new_atom.exclusion_list.clear();
 		for(std::vector<size_t>::const_iterator it= this->exclst.at(i).begin();it != this->exclst.at(i).end();it++)
 			new_atom.exclusion_list.insert(*it + i + 1);
@@ -6,11 +6,12 @@
 #include "Energy.h"
 
 //Energy Calculations
-mmpbsa_t mmpbsa::bond_energy_calc(const std::vector<bond_t>& bonds,const std::valarray<mmpbsa::Vector>& crds)
+mmpbsa_t mmpbsa::bond_energy_calc(const std::vector<bond_t>& bonds,const std::valarray<mmpbsa::Vector>& crds,
+		std::valarray<mmpbsa_t>* atom_energies)
 {
 	using namespace mmpbsa;
 
-    mmpbsa_t totalEnergy = 0,distance;
+    mmpbsa_t totalEnergy = 0,distance,energy;
     Vector disp;
     std::vector<bond_t>::const_iterator bond;
    for(bond = bonds.begin();bond != bonds.end();bond++)
@@ -21,19 +22,25 @@ mmpbsa_t mmpbsa::bond_energy_calc(const std::vector<bond_t>& bonds,const std::va
 	   const mmpbsa_t& beq = bond->bond_energy->eq_distance;
 	   disp = c_i - c_j;
 	   distance = disp.modulus()-beq;
-	   totalEnergy += bconst*distance*distance;
+	   energy = bconst*distance*distance;
+	   totalEnergy += energy;
+	   if(atom_energies != 0)
+	   {
+		   (*atom_energies)[bond->atom_i] += energy/2;
+		   (*atom_energies)[bond->atom_j] += energy/2;
+	   }
     }
     return totalEnergy;
 
 }
 
 mmpbsa_t mmpbsa::angle_energy_calc(const std::vector<angle_t>& angles,
-		const std::valarray<mmpbsa::Vector>& crds)
+		const std::valarray<mmpbsa::Vector>& crds, std::valarray<mmpbsa_t>* atom_energies)
 {
 	using mmpbsa::Vector;
 
 	mmpbsa_t totalEnergy = 0;//total energy = \sum^N_m (const_m*(angle_m-eq_m)^2)
-    mmpbsa_t dotprod,net_angle;
+    mmpbsa_t dotprod,net_angle,energy;
     Vector r_ij,r_jk;
     std::vector<angle_t>::const_iterator angle;
     for(angle = angles.begin();angle != angles.end();angle++)
@@ -46,19 +53,27 @@ mmpbsa_t mmpbsa::angle_energy_calc(const std::vector<angle_t>& angles,
     	r_ij = c_i - c_j;r_ij /= r_ij.modulus();
     	r_jk = c_k - c_j;r_jk /= r_jk.modulus();
     	net_angle = acos(r_ij*r_jk) - angle_eq;
-        totalEnergy += angle_const*net_angle*net_angle;
+        energy = angle_const*net_angle*net_angle;
+        totalEnergy += energy;
+        if(atom_energies != 0)
+        {
+        	(*atom_energies)[angle->atom_i] += energy/3;
+        	(*atom_energies)[angle->atom_j] += energy/3;
+        	(*atom_energies)[angle->atom_k] += energy/3;
+        }
     }
     return totalEnergy;
 }
 
-mmpbsa_t mmpbsa::dihedral_energy_calc(const std::vector<dihedral_t>& dihedrals, const std::valarray<mmpbsa::Vector>& crds)
+mmpbsa_t mmpbsa::dihedral_energy_calc(const std::vector<dihedral_t>& dihedrals, const std::valarray<mmpbsa::Vector>& crds,
+		std::valarray<mmpbsa_t>* atom_energies)
 {
 	using namespace mmpbsa_utils;
     using mmpbsa::Vector;
     Vector r_ij, r_kj, r_kl,s;//Interatom vectors
 
     Vector d, g;//vectors normal to the dihedral planes
-    mmpbsa_t totalEnergy,nphi,phi,ap0;
+    mmpbsa_t totalEnergy,nphi,phi,ap0,energy;
 
     totalEnergy = 0;
 
@@ -92,15 +107,24 @@ mmpbsa_t mmpbsa::dihedral_energy_calc(const std::vector<dihedral_t>& dihedrals,
         nphi = dihedral->dihedral_energy->periodicity * phi;
         const mmpbsa_t& dihedral_constant = dihedral->dihedral_energy->energy_const;
         const mmpbsa_t& phase = dihedral->dihedral_energy->phase;
-        totalEnergy += dihedral_constant * (1+cos(nphi)*cos(phase)+sin(nphi)*sin(phase));
+        energy = dihedral_constant * (1+cos(nphi)*cos(phase)+sin(nphi)*sin(phase));
+        totalEnergy += energy;
+        if(atom_energies != 0)
+        {
+        	(*atom_energies)[dihedral->atom_i] += energy/4;
+        	(*atom_energies)[dihedral->atom_j] += energy/4;
+        	(*atom_energies)[dihedral->atom_k] += energy/4;
+        	(*atom_energies)[dihedral->atom_l] += energy/4;
+        }
     }
 
     return totalEnergy;
 }
 
-mmpbsa_t mmpbsa::vdw14_energy_calc(const std::vector<dihedral_t>& dihedrals,const std::valarray<mmpbsa::Vector>& crds,const mmpbsa_t& inv_scnb)
+mmpbsa_t mmpbsa::vdw14_energy_calc(const std::vector<dihedral_t>& dihedrals,const std::valarray<mmpbsa::Vector>& crds,const mmpbsa_t& inv_scnb,
+		std::valarray<mmpbsa_t>* atom_energies)
 {
-    mmpbsa_t rsqrd,inv_r6,inv_r12;
+    mmpbsa_t rsqrd,inv_r6,inv_r12,energy;
     mmpbsa_t totalEnergy = 0;
     bool period_mask,mask;
 
@@ -114,16 +138,23 @@ mmpbsa_t mmpbsa::vdw14_energy_calc(const std::vector<dihedral_t>& dihedrals,cons
             rsqrd = (crds[dihedral->atom_i]-crds[dihedral->atom_l])*(crds[dihedral->atom_i]-crds[dihedral->atom_l]);
             inv_r6 = 1/pow(rsqrd, 3);
             inv_r12 = inv_r6*inv_r6;
-            totalEnergy += dihedral->lj.c12*inv_r12 - dihedral->lj.c6*inv_r6;
+            energy = dihedral->lj.c12*inv_r12 - dihedral->lj.c6*inv_r6;
+            totalEnergy += energy;
+            if(atom_energies != 0)
+            {
+            	(*atom_energies)[dihedral->atom_i] += energy*inv_scnb/2;
+            	(*atom_energies)[dihedral->atom_l] += energy*inv_scnb/2;
+            }
         }
     }
     return totalEnergy*inv_scnb;
 
 }
 
-mmpbsa_t mmpbsa::elstat14_energy_calc(const std::vector<dihedral_t>& dihedrals, const std::vector<atom_t>& atoms, const std::valarray<mmpbsa::Vector>& crds, const mmpbsa_t& inv_scee, const mmpbsa_t& dielc)
+mmpbsa_t mmpbsa::elstat14_energy_calc(const std::vector<dihedral_t>& dihedrals, const std::vector<atom_t>& atoms, const std::valarray<mmpbsa::Vector>& crds, const mmpbsa_t& inv_scee, const mmpbsa_t& dielc,
+		std::valarray<mmpbsa_t>* atom_energies)
 {
-    mmpbsa_t rsqrd,q_i,q_l;
+    mmpbsa_t rsqrd,q_i,q_l,energy;
     mmpbsa_t totalEnergy = 0;
     bool mask,period_mask;
 
@@ -137,16 +168,23 @@ mmpbsa_t mmpbsa::elstat14_energy_calc(const std::vector<dihedral_t>& dihedrals,
     		rsqrd = (crds[dihedral->atom_i]-crds[dihedral->atom_l])*(crds[dihedral->atom_i]-crds[dihedral->atom_l]);
     		q_i = atoms.at(dihedral->atom_i).charge;
     		q_l = atoms.at(dihedral->atom_l).charge;
-    		totalEnergy += (inv_scee/dielc)*q_i*q_l/sqrt(rsqrd);//Ah, Coulomb's law :-)
+    		energy = (inv_scee/dielc)*q_i*q_l/sqrt(rsqrd);//Ah, Coulomb's law :-)
+    		totalEnergy += energy;
+    		if(atom_energies != 0)
+    		{
+    			(*atom_energies)[dihedral->atom_i] += energy/2;
+    			(*atom_energies)[dihedral->atom_l] += energy/2;
+    		}
         }
     }
     return totalEnergy;
 }
 
-mmpbsa_t mmpbsa::vdwaals_energy(const std::vector<atom_t>& atoms, const std::vector<lj_params_t>& lj_params,const std::valarray<mmpbsa::Vector>& crds)
+mmpbsa_t mmpbsa::vdwaals_energy(const std::vector<atom_t>& atoms, const std::vector<lj_params_t>& lj_params,const std::valarray<mmpbsa::Vector>& crds,
+		std::valarray<mmpbsa_t>* atom_energies)
 {
 	using mmpbsa::Vector;
-	mmpbsa_t totalEnergy = 0;
+	mmpbsa_t totalEnergy = 0,energy;
 	size_t natom,ntypes,type_row;
 	mmpbsa_t rsqrd;
 
@@ -166,7 +204,13 @@ mmpbsa_t mmpbsa::vdwaals_energy(const std::vector<atom_t>& atoms, const std::vec
 			{
 				const lj_params_t& lj = lj_params.at(type_row + atoms.at(j).atom_type);
 				rsqrd =(c_i-crds[j])*(c_i-crds[j]);
-				totalEnergy += lj.c12/pow(rsqrd,6) - lj.c6/pow(rsqrd,3);
+				energy = lj.c12/pow(rsqrd,6) - lj.c6/pow(rsqrd,3);
+				totalEnergy += energy;
+				if(atom_energies != 0)
+				{
+					(*atom_energies)[i] += energy/2;
+					(*atom_energies)[j] += energy/2;
+				}
 			}
 		}
 	}
@@ -174,10 +218,11 @@ mmpbsa_t mmpbsa::vdwaals_energy(const std::vector<atom_t>& atoms, const std::vec
 }
 
 
-mmpbsa_t mmpbsa::total_elstat_energy(const std::vector<mmpbsa::atom_t>& atoms, const std::valarray<mmpbsa::Vector>& crds, const mmpbsa_t& coulomb_const)
+mmpbsa_t mmpbsa::total_elstat_energy(const std::vector<mmpbsa::atom_t>& atoms, const std::valarray<mmpbsa::Vector>& crds, const mmpbsa_t& coulomb_const,
+		std::valarray<mmpbsa_t>* atom_energies)
 {
 	using mmpbsa::Vector;
-    mmpbsa_t totalEnergy = 0,atom_potential;
+    mmpbsa_t totalEnergy = 0,atom_potential,energy;
     mmpbsa_t r;
 
     size_t natom = atoms.size();
@@ -193,6 +238,12 @@ mmpbsa_t mmpbsa::total_elstat_energy(const std::vector<mmpbsa::atom_t>& atoms, c
     			const atom_t& atom = atoms.at(j);
     			r = (c_i-crds[j]).modulus();
     			atom_potential += atom.charge/r;
+    			if(atom_energies != 0)
+    			{
+    				energy = coulomb_const*atoms.at(i).charge*atom.charge/r;
+    				(*atom_energies)[i] += energy/2;
+    				(*atom_energies)[j] += energy/2;
+    			}
     		}
     	}
     	totalEnergy += atom_potential * atoms.at(i).charge;
@@ -153,6 +153,7 @@ void mmpbsa_io::get_gromacs_forcefield(const char* fn,mmpbsa::forcefield_t** spl
 	using namespace mmpbsa;
 	mmpbsa_io::gromacs_idx_offsets offsets;
 	size_t atom_offset = 0;
+	size_t residue_offset = 0;
 	//unused
 //	FILE *gp;
 	int         atot;
@@ -323,6 +324,9 @@ void mmpbsa_io::get_gromacs_forcefield(const char* fn,mmpbsa::forcefield_t** spl
 						new_atom.atomic_number = atom.atomnumber;
 						new_atom.charge = charge_units*atom.qB;
 						new_atom.name = (*mol.atoms.atomname[atom_idx]);
+						new_atom.type_name = (mol.atoms.atomtype != 0) ? (*mol.atoms.atomtype[atom_idx]) : "";
+						new_atom.residue = residue_offset + atom.resind;
+						new_atom.residue_name = (*mol.atoms.resinfo[atom.resind].name);
 						for(size_t ex_idx = mol.excls.index[atom_idx];ex_idx < mol.excls.index[atom_idx+1];ex_idx++)
 							new_atom.exclusion_list.insert(mol.excls.a[ex_idx]);
 						curr_atom_list->push_back(new_atom);
@@ -416,6 +420,7 @@ void mmpbsa_io::get_gromacs_forcefield(const char* fn,mmpbsa::forcefield_t** spl
 						}//end energy loop
 					}//end outer energy loop
 					atom_offset += mol.atoms.nr;
+					residue_offset += mol.atoms.nres;
 				}
 			}
 		}
@@ -15,6 +15,20 @@ mmpbsa::MMPBSAState::MMPBSAState()
     savePDB = false;
     keep_traj_in_mem = false;
     surface_area_only = false;
+    reuse_components = false;
+    component_tolerance = 0;
+    pose_scoring = false;
+    refine_fraction = 0;
+    cluster_rmsd = 0;
+    decompose = false;
+    snapshot_threads = 1;
+    snapshot_processes = 1;
+    dynamic_schedule = false;
+    pipeline_queue = 4;
+    convergence = 0;
+    convergence_min = 20;
+    convergence_stall = 0;
+    progressive_order = false;
     verbose = 0;
     overwrite = false;
 }
@@ -24,6 +38,7 @@ mmpbsa::MMPBSAState::MMPBSAState(const mmpbsa::MMPBSAState& orig)
     receptorStartPos = orig.receptorStartPos;
     ligandStartPos = orig.ligandStartPos;
     snapList = orig.snapList;
+    processedSnaps = orig.processedSnaps;
     checkpointCounter = orig.checkpointCounter;
     currentSnap = orig.currentSnap;
     fractionDone = orig.fractionDone;
@@ -37,8 +52,25 @@ mmpbsa::MMPBSAState::MMPBSAState(const mmpbsa::MMPBSAState& orig)
     trustPrmtop = orig.trustPrmtop;
     placeInQueue = orig.placeInQueue;
     weight = orig.weight;
+    queue_id = orig.queue_id;
+    prereqs = orig.prereqs;
     filename_map = orig.filename_map;
     surface_area_only = orig.surface_area_only;
+    reuse_components = orig.reuse_components;
+    component_tolerance = orig.component_tolerance;
+    pose_scoring = orig.pose_scoring;
+    refine_fraction = orig.refine_fraction;
+    cluster_rmsd = orig.cluster_rmsd;
+    decompose = orig.decompose;
+    snapshot_threads = orig.snapshot_threads;
+    snapshot_processes = orig.snapshot_processes;
+    dynamic_schedule = orig.dynamic_schedule;
+    pipeline_workers = orig.pipeline_workers;
+    pipeline_queue = orig.pipeline_queue;
+    convergence = orig.convergence;
+    convergence_min = orig.convergence_min;
+    convergence_stall = orig.convergence_stall;
+    progressive_order = orig.progressive_order;
     verbose = orig.verbose;
     overwrite = orig.overwrite;
 
@@ -52,6 +84,7 @@ mmpbsa::MMPBSAState& mmpbsa::MMPBSAState::operator=(const mmpbsa::MMPBSAState& o
     receptorStartPos = orig.receptorStartPos;
     ligandStartPos = orig.ligandStartPos;
     snapList = orig.snapList;
+    processedSnaps = orig.processedSnaps;
     checkpointCounter = orig.checkpointCounter;
     currentSnap = orig.currentSnap;
     fractionDone = orig.fractionDone;
@@ -65,8 +98,25 @@ mmpbsa::MMPBSAState& mmpbsa::MMPBSAState::operator=(const mmpbsa::MMPBSAState& o
     trustPrmtop = orig.trustPrmtop;
     placeInQueue = orig.placeInQueue;
     weight = orig.weight;
+    queue_id = orig.queue_id;
+    prereqs = orig.prereqs;
     filename_map = orig.filename_map;
     surface_area_only = orig.surface_area_only;
+    reuse_components = orig.reuse_components;
+    component_tolerance = orig.component_tolerance;
+    pose_scoring = orig.pose_scoring;
+    refine_fraction = orig.refine_fraction;
+    cluster_rmsd = orig.cluster_rmsd;
+    decompose = orig.decompose;
+    snapshot_threads = orig.snapshot_threads;
+    snapshot_processes = orig.snapshot_processes;
+    dynamic_schedule = orig.dynamic_schedule;
+    pipeline_workers = orig.pipeline_workers;
+    pipeline_queue = orig.pipeline_queue;
+    convergence = orig.convergence;
+    convergence_min = orig.convergence_min;
+    convergence_stall = orig.convergence_stall;
+    progressive_order = orig.progressive_order;
     verbose = orig.verbose;
     overwrite = orig.overwrite;
 
@@ -31,6 +31,7 @@ public:
     std::set<size_t> receptorStartPos;///<Starting positions for receptors. End positions are deduced from the parmtop file.
     std::set<size_t> ligandStartPos;///<Starting positions for ligands. End positions are deduced from the parmtop file.
     std::vector<size_t> snapList;///<List of snapshots to be used in the calculations. If the list is empty, all snapshots are used.
+    std::set<size_t> processedSnaps;///<Snapshots already added to the output, when snapshots are not calculated in trajectory order (cf progressive_order and dynamic_schedule). Saved by checkpoints.
 
     std::map<std::string,std::string> filename_map;///<Maps a file type flag (cf Amber Manual, Sander Section) to the filename
 
@@ -56,10 +57,27 @@ public:
     enum SimProcess{MMPBSA,SANDER,MOLSURF} currentProcess;
     int placeInQueue;//zero ordered place in queue.
     float weight;//factor by which to multiple time in queue(i.e. weight = 1 means process will take equal time as other processes).
+    std::string queue_id;///<Name of the job in the queue, by which other jobs refer to it in their prereq list. Default: empty
+    std::vector<std::string> prereqs;///<Names (queue_id) of the jobs of the queue that must finish before this one starts. Default: empty
 
     bool trustPrmtop;///<Flag to indicate if the sanity check of the SanderParm object should be ignored. This is not suggested, but if the sanity check fails and one *does* believe it should work, this is provided as a work around, for whatever reason might arise.
     bool keep_traj_in_mem;///<Flag to indicate whether or not the trajectory stream should stay in memory. Default: false
     bool surface_area_only;///<Flag to indicate that only SA should be done in PBSA
+    bool reuse_components;///<Flag to indicate that energies of a molecule whose coordinates have not changed are reused. Default: false
+    mmpbsa_t component_tolerance;///<Largest atom displacement (Angstroms) for which energies are reused. Zero requires identical coordinates. Default: 0
+    bool pose_scoring;///<Flag to indicate that ligand poses are scored with a precomputed receptor potential before MMPBSA. Default: false
+    mmpbsa_t refine_fraction;///<Fraction of the best scored poses on which full MMPBSA is performed. Zero means only poses are scored. Default: 0
+    mmpbsa_t cluster_rmsd;///<RMSD (Angstroms) over the binding site within which snapshots are clustered, so that MMPBSA is performed only on one representative of each cluster, weighted by its population. Zero means snapshots are not clustered. Default: 0
+    bool decompose;///<Flag to indicate that the energies of each snapshot are also decomposed by residue. Default: false
+    int snapshot_threads;///<Number of threads that calculate different snapshots at the same time. Default: 1
+    bool dynamic_schedule;///<Flag to indicate that MPI nodes claim snapshots, most expensive first, as they finish others, rather than each calculating every mpi_size-th snapshot. Default: false
+    int snapshot_processes;///<Number of forked worker processes that calculate different snapshots at the same time. One means snapshots are calculated by this process. Default: 1
+    std::vector<size_t> pipeline_workers;///<Number of workers of the read, MM, PB and SA stages of the snapshot pipeline. Empty if the pipeline is not used. Default: empty
+    size_t pipeline_queue;///<Number of snapshots that may wait between two stages of the pipeline. Default: 4
+    mmpbsa_t convergence;///<Standard error of DELTA G (kcal/mol), estimated with block averages, below which no more snapshots are calculated. Zero means all snapshots are calculated. Default: 0
+    size_t convergence_min;///<Number of snapshots calculated before the job may stop for convergence. Default: 20
+    size_t convergence_stall;///<Number of snapshots after which the job stops if the standard error of DELTA G has not reached a new minimum. Zero means never. Default: 0
+    bool progressive_order;///<Flag to indicate that snapshots are calculated in bit reversed order, so that the snapshots calculated so far are spread over the trajectory, rather than in trajectory order. Default: false
 
     int verbose;///<Flag to indicate whether the program needs to be verbose. Added in version 0.12.5. Not fully implemented yet
 
@@ -5,6 +5,9 @@
 #include "Vector.h"
 #include "EmpEnerFun.h"
 #include "EMap.h"
+#include "PBMultigrid.h"
+#include "PotentialGrid.h"
+#include "SurfaceArea.h"
 
 //molsurf
 #include "molsurf/molsurf.h"
@@ -26,6 +29,7 @@
 //system
 #include <cerrno>
 #include <cstring>
+#include <cmath>
 #ifdef _WIN32
 
 #include "winfork.cpp"
@@ -52,6 +56,17 @@ mmpbsa::MeadInterface::MeadInterface() {
     surf_offset = 0.92;// kcal/mol
     multithread = 0;
     snap_list_offset = 0;
+    fixed_grid = false;
+    pb_reference = REFERENCE_SOLVE;
+    reference_tolerance = 0.01;
+    pb_solver = PB_MEAD;
+    concurrent_pb = false;
+    grid_spacing = 0.25;
+    grid_memory = 0;
+    sa_method = SA_MOLSURF;
+    sa_points = 960;
+    sa_check = false;
+    sa_interface = false;
 }
 
 mmpbsa::MeadInterface::MeadInterface(const mmpbsa::MeadInterface& orig) {
@@ -61,6 +76,19 @@ mmpbsa::MeadInterface::MeadInterface(const mmpbsa::MeadInterface& orig) {
     surf_tension = orig.surf_tension;
     multithread = orig.multithread;
     snap_list_offset = orig.snap_list_offset;
+    fixed_grid = orig.fixed_grid;
+    pb_reference = orig.pb_reference;
+    reference_tolerance = orig.reference_tolerance;
+    pb_solver = orig.pb_solver;
+    concurrent_pb = orig.concurrent_pb;
+    grid_spacing = orig.grid_spacing;
+    grid_memory = orig.grid_memory;
+    istrength_list = orig.istrength_list;
+    dielectric_list = orig.dielectric_list;
+    sa_method = orig.sa_method;
+    sa_points = orig.sa_points;
+    sa_check = orig.sa_check;
+    sa_interface = orig.sa_interface;
 }
 
 mmpbsa::MeadInterface::~MeadInterface() {
@@ -71,32 +99,88 @@ FinDiffMethod mmpbsa::MeadInterface::createFDM(const std::valarray<mmpbsa::Vecto
         const std::valarray<mmpbsa::Vector>& receptorCrds, const std::valarray<mmpbsa::Vector>& ligandCrds,
         const int& outbox_grid_dim, const mmpbsa_t& fine_grid_spacing) throw (mmpbsa::MeadException)
 {
+    grid_plan_t plan;
+    clear_grid_plan(plan);
+    extend_grid_plan(plan,complexCrds,receptorCrds,ligandCrds);
+    return createFDM(plan,outbox_grid_dim,fine_grid_spacing);
+}
+
+void mmpbsa::MeadInterface::clear_grid_plan(mmpbsa::grid_plan_t& plan)
+{
+    for(size_t i = 0;i<3;i++)
+    {
+        plan.complex_min[i] = plan.complex_max[i] = 0;
+        plan.interaction_min[i] = plan.interaction_max[i] = 0;
+    }
+    plan.empty = true;
+}
+
+void mmpbsa::MeadInterface::extend_grid_plan(mmpbsa::grid_plan_t& plan, const std::valarray<mmpbsa::Vector>& complexCrds,
+        const std::valarray<mmpbsa::Vector>& receptorCrds, const std::valarray<mmpbsa::Vector>& ligandCrds) throw (mmpbsa::MeadException)
+{
+    using std::min;
     using std::max;
-    using mmpbsa::Vector;
-    
+
     if(complexCrds.size() == 0 || receptorCrds.size() == 0 || ligandCrds.size() == 0)
         throw MeadException("Trivial coordinates supplied to createFDM must be 3-D.",DATA_FORMAT_ERROR);
-    
-    //Obtain Complex dimensions and size
-    Vector comMax = complexCrds[0];
-    Vector comMin = complexCrds[0];
-    mmpbsa_t comSize[3];
-    mmpbsa_t maxComSize;
-    Vector geoCenter;
+
+    //Obtain Complex dimensions
+    mmpbsa_t comMin[3],comMax[3];
+    for(size_t j = 0;j<3;j++)
+        comMin[j] = comMax[j] = complexCrds[0].at(j);
     for(size_t i = 1;i<complexCrds.size();i++)
     {
         for(size_t j = 0;j<3;j++)
         {
-            if(complexCrds[i].at(j) > comMax.at(j))
-                comMax.at(j) = complexCrds[i].at(j);
-            if(complexCrds[i].at(j) < comMin.at(j))
-                comMin.at(j) = complexCrds[i].at(j);
+            if(complexCrds[i].at(j) > comMax[j])
+                comMax[j] = complexCrds[i].at(j);
+            if(complexCrds[i].at(j) < comMin[j])
+                comMin[j] = complexCrds[i].at(j);
         }
     }
 
+    mead_data_t * int_minmax = mmpbsa_utils::interaction_minmax(receptorCrds,ligandCrds);//order {min,max}
+    for(size_t j = 0;j<3;j++)
+    {
+        if(plan.empty)
+        {
+            plan.complex_min[j] = comMin[j];
+            plan.complex_max[j] = comMax[j];
+            plan.interaction_min[j] = int_minmax[j];
+            plan.interaction_max[j] = int_minmax[3+j];
+        }
+        else
+        {
+            plan.complex_min[j] = min(plan.complex_min[j],comMin[j]);
+            plan.complex_max[j] = max(plan.complex_max[j],comMax[j]);
+            plan.interaction_min[j] = min(plan.interaction_min[j],int_minmax[j]);
+            plan.interaction_max[j] = max(plan.interaction_max[j],int_minmax[3+j]);
+        }
+    }
+    plan.empty = false;
+    delete [] int_minmax;
+}
+
+std::vector<mmpbsa::grid_level_t> mmpbsa::MeadInterface::grid_levels(const mmpbsa::grid_plan_t& plan,
+        const int& outbox_grid_dim, const mmpbsa_t& fine_grid_spacing) throw (mmpbsa::MeadException)
+{
+    using std::max;
+
+    if(plan.empty)
+        throw MeadException("mmpbsa::MeadInterface::grid_levels: Grid plan does not cover any coordinates.",DATA_FORMAT_ERROR);
+
+    std::vector<grid_level_t> returnMe;
+    grid_level_t level;
+
+    //Complex size
+    mmpbsa_t comSize[3];
+    mmpbsa_t maxComSize;
+    mmpbsa_t geoCenter[3];
     for(size_t i = 0;i<3;i++)
-    	comSize[i] = comMax.at(i) - comMin.at(i);
-    geoCenter = (comMax+comMin)/2;
+    {
+    	comSize[i] = plan.complex_max[i] - plan.complex_min[i];
+    	geoCenter[i] = (plan.complex_max[i] + plan.complex_min[i])/2;
+    }
     
     maxComSize = comSize[0];
     if(comSize[1] > maxComSize)
@@ -104,13 +188,15 @@ FinDiffMethod mmpbsa::MeadInterface::createFDM(const std::valarray<mmpbsa::Vecto
     if(comSize[2] > maxComSize)
         maxComSize = comSize[2];
 
-    //initialize FinDiffMethod Object
-    FinDiffMethod fdm;
-    
     //determine outbox grid size and add level(s) accordingly
     mmpbsa_t outboxlen = maxComSize + 30.0;
     mmpbsa_t outbox_grid_spacing = outboxlen/(outbox_grid_dim - 1);
-    fdm.add_level(outbox_grid_dim,outbox_grid_spacing,ON_GEOM_CENT);
+    level.dim = outbox_grid_dim;
+    level.spacing = outbox_grid_spacing;
+    level.on_interaction = false;
+    for(size_t i = 0;i<3;i++)
+    	level.center[i] = geoCenter[i];
+    returnMe.push_back(level);
     if(outbox_grid_dim > 1.0)
     {
         mmpbsa_t med_grid_spacing = outbox_grid_spacing/2;
@@ -121,127 +207,341 @@ FinDiffMethod mmpbsa::MeadInterface::createFDM(const std::valarray<mmpbsa::Vecto
         if(med_grid_dim % 2 == 0)
             med_grid_dim++;
 
-        fdm.add_level(int(med_grid_dim), med_grid_spacing, ON_GEOM_CENT);
+        level.dim = med_grid_dim;
+        level.spacing = med_grid_spacing;
+        returnMe.push_back(level);
     }
 
     //add fine grid level
-    mead_data_t * int_minmax = mmpbsa_utils::interaction_minmax(receptorCrds,ligandCrds);//order {min,max}
     mead_data_t intSize[3];
     for(size_t i = 0;i<3;i++)
-        intSize[i] = int_minmax[3+i] - int_minmax[i];
+        intSize[i] = plan.interaction_max[i] - plan.interaction_min[i];
     mead_data_t maxIntSize = max(max(intSize[0],intSize[1]),intSize[2]);
     mead_data_t intCenter[3];
     for(size_t i = 0;i<3;i++)
-        intCenter[i] = (int_minmax[3+i]+int_minmax[i])/2;
+        intCenter[i] = (plan.interaction_max[i]+plan.interaction_min[i])/2;
     mead_data_t fine_dim = maxIntSize/mead_data_t(fine_grid_spacing) + mead_data_t(fine_grid_spacing);
     int fine_grid_dim = int(floor(fine_dim) + 1);
     if(fine_grid_dim % 2 == 0)
         fine_grid_dim++;
 
-    fdm.add_level(fine_grid_dim,fine_grid_spacing,ON_CENT_OF_INTR);
+    level.dim = fine_grid_dim;
+    level.spacing = fine_grid_spacing;
+    level.on_interaction = true;
+    for(size_t i = 0;i<3;i++)
+    	level.center[i] = intCenter[i];
+    returnMe.push_back(level);
+
+    return returnMe;
+}
+
+std::vector<mmpbsa::grid_level_t> mmpbsa::MeadInterface::adaptive_grid_levels(const mmpbsa::grid_plan_t& plan,
+        const mmpbsa_t& fine_grid_spacing, const size_t& max_bytes, const size_t& bytes_per_point,
+        const int& outbox_grid_dim) throw (mmpbsa::MeadException)
+{
+    using std::max;
+    using std::min;
+
+    if(plan.empty)
+        throw MeadException("mmpbsa::MeadInterface::adaptive_grid_levels: Grid plan does not cover any coordinates.",DATA_FORMAT_ERROR);
+    if(fine_grid_spacing <= 0 || outbox_grid_dim < 3)
+        throw MeadException("mmpbsa::MeadInterface::adaptive_grid_levels: Invalid grid spacing or dimension.",DATA_FORMAT_ERROR);
+
+    mmpbsa_t maxComSize = 0, maxIntSize = 0;
+    mmpbsa_t geoCenter[3], intCenter[3];
+    for(size_t i = 0;i<3;i++)
+    {
+        maxComSize = max(maxComSize,plan.complex_max[i] - plan.complex_min[i]);
+        maxIntSize = max(maxIntSize,mmpbsa_t(plan.interaction_max[i] - plan.interaction_min[i]));
+        geoCenter[i] = (plan.complex_max[i] + plan.complex_min[i])/2;
+        intCenter[i] = (plan.interaction_max[i] + plan.interaction_min[i])/2;
+    }
+
+    std::vector<grid_level_t> returnMe;
+    grid_level_t level;
+    mmpbsa_t outbox_grid_spacing = (maxComSize + 30.0)/(outbox_grid_dim - 1);
+    mmpbsa_t fine_spacing = fine_grid_spacing;
+    bool fits = false;
+    for(;!fits && fine_spacing <= 4*fine_grid_spacing;fine_spacing *= 1.1)
+    {
+        //Intermediate levels on the interaction region are dropped before the fine spacing is increased.
+        for(int intermediate = 1;!fits && intermediate >= 0;intermediate--)
+        {
+            returnMe.clear();
+
+            //outer box, on the complex
+            level.dim = outbox_grid_dim;
+            level.spacing = outbox_grid_spacing;
+            level.on_interaction = false;
+            for(size_t i = 0;i<3;i++)
+                level.center[i] = geoCenter[i];
+            returnMe.push_back(level);
+
+            //complex plus 10 Angstroms
+            level.spacing = outbox_grid_spacing/2;
+            if(level.spacing > fine_spacing)
+            {
+                level.dim = int(floor((maxComSize + 10.0)/level.spacing + level.spacing) + 1);
+                if(level.dim % 2 == 0)
+                    level.dim++;
+                returnMe.push_back(level);
+            }
+
+            //interaction region plus 10 Angstroms, no larger than the previous level
+            level.on_interaction = true;
+            for(size_t i = 0;i<3;i++)
+                level.center[i] = intCenter[i];
+            mmpbsa_t extent = min(maxIntSize,maxComSize) + 10.0;
+            while(intermediate && returnMe.back().spacing > 4*fine_spacing)
+            {
+                level.spacing = returnMe.back().spacing/2;
+                level.dim = int(floor(extent/level.spacing) + 1);
+                if(level.dim % 2 == 0)
+                    level.dim++;
+                returnMe.push_back(level);
+            }
+
+            //fine level, on the interaction region
+            level.spacing = fine_spacing;
+            level.dim = int(floor(maxIntSize/fine_spacing + fine_spacing) + 1);
+            if(level.dim % 2 == 0)
+                level.dim++;
+            returnMe.push_back(level);
+
+            fits = (max_bytes == 0 || grid_memory_estimate(returnMe,bytes_per_point) <= max_bytes);
+        }
+        if(fits)
+            break;
+    }
+
+    if(fine_spacing > 4*fine_grid_spacing)
+    {
+        std::ostringstream error;
+        error << "mmpbsa::MeadInterface::adaptive_grid_levels: The PB grid does not fit within " << max_bytes/1048576
+            << " MB, even with a spacing of " << 4*fine_grid_spacing << " Angstroms.";
+        throw MeadException(error,SYSTEM_ERROR);
+    }
+    return returnMe;
+}
+
+size_t mmpbsa::MeadInterface::grid_memory_estimate(const std::vector<mmpbsa::grid_level_t>& levels, const size_t& bytes_per_point)
+{
+    size_t returnMe = 0;
+    for(std::vector<grid_level_t>::const_iterator level = levels.begin();level != levels.end();level++)
+        returnMe += size_t(level->dim)*level->dim*level->dim*bytes_per_point;
+    return returnMe;
+}
+
+std::vector<mmpbsa::grid_level_t> mmpbsa::MeadInterface::plan_grid(const mmpbsa::grid_plan_t& plan) const throw (mmpbsa::MeadException)
+{
+    if(grid_memory == 0)
+        return grid_levels(plan,41,grid_spacing);
+
+    //Concurrent solves (complex, receptor and ligand) each need their own grids.
+    size_t max_bytes = grid_memory*1048576;
+    if(concurrent_pb)
+        max_bytes /= 3;
+    size_t bytes_per_point = (pb_solver == PB_MULTIGRID) ? PBMultigrid::bytes_per_grid_point() : MMPBSA_MEAD_BYTES_PER_GRID_POINT;
+    return adaptive_grid_levels(plan,grid_spacing,max_bytes,bytes_per_point);
+}
+
+std::vector<mmpbsa::pb_condition_t> mmpbsa::MeadInterface::pb_conditions() const
+{
+	std::vector<mmpbsa::pb_condition_t> returnMe;
+	std::vector<mmpbsa_t> strengths = istrength_list;
+	std::vector<mmpbsa_t> dielectrics = dielectric_list;
+	if(strengths.size() == 0)
+		strengths.push_back(istrength);
+	if(dielectrics.size() == 0)
+		dielectrics.push_back(1.0);
+	for(size_t i = 0;i<strengths.size();i++)
+		for(size_t j = 0;j<dielectrics.size();j++)
+		{
+			mmpbsa::pb_condition_t condition;
+			condition.istrength = strengths[i];
+			condition.interior_dielectric = dielectrics[j];
+			returnMe.push_back(condition);
+		}
+	return returnMe;
+}
+
+FinDiffMethod mmpbsa::MeadInterface::createFDM(const mmpbsa::grid_plan_t& plan,
+        const int& outbox_grid_dim, const mmpbsa_t& fine_grid_spacing) throw (mmpbsa::MeadException)
+{
+    return createFDM(grid_levels(plan,outbox_grid_dim,fine_grid_spacing));
+}
+
+FinDiffMethod mmpbsa::MeadInterface::createFDM(const std::vector<mmpbsa::grid_level_t>& levels) throw (mmpbsa::MeadException)
+{
+    const mmpbsa_t *geoCenter = 0, *intCenter = 0;
+
+    //initialize FinDiffMethod Object
+    FinDiffMethod fdm;
+    for(std::vector<grid_level_t>::const_iterator level = levels.begin();level != levels.end();level++)
+    {
+        fdm.add_level(level->dim,level->spacing,(level->on_interaction) ? ON_CENT_OF_INTR : ON_GEOM_CENT);
+        if(level->on_interaction)
+            intCenter = level->center;
+        else
+            geoCenter = level->center;
+    }
+    if(geoCenter == 0 || intCenter == 0)
+        throw MeadException("mmpbsa::MeadInterface::createFDM: Grid levels must include levels on the complex and on the interaction region.",DATA_FORMAT_ERROR);
     fdm.resolve(Coord(geoCenter[0],geoCenter[1],geoCenter[2]),Coord(intCenter[0],intCenter[1],intCenter[2]));
 
-    delete [] int_minmax;
     return fdm;
 }
 
 mmpbsa_t mmpbsa::MeadInterface::molsurf_area(const std::vector<mmpbsa::atom_t>& atoms,
 		const std::valarray<mmpbsa::Vector>& crds,
-		const std::map<std::string,mead_data_t>& radii)
+		const std::map<std::string,mead_data_t>& radii,
+		std::vector<mmpbsa_t>* atom_areas, int* error_flag) throw (mmpbsa::MeadException)
 {
 	size_t numCoords = crds.size();
-	REAL_T xs[numCoords],ys[numCoords],zs[numCoords];
-	REAL_T rads[numCoords];
-
+	if(error_flag != 0)
+		*error_flag = 0;
+	if(atom_areas != 0)
+		atom_areas->assign(numCoords,0);
+	if(numCoords == 0)
+		return 0;
+
+	std::vector<REAL_T> xs(numCoords),ys(numCoords),zs(numCoords);
+	std::vector<REAL_T> rads(numCoords);
 	for(size_t i = 0;i<numCoords;i++)
 	{
 		xs[i] = crds[i].x();
 		ys[i] = crds[i].y();
 		zs[i] = crds[i].z();
-		rads[i] = mmpbsa_utils::lookup_radius(atoms.at(i).name,radii) + MOLSURF_RADII_ADJUSTMENT;//SA radii are not necessarily the same as PB radii
 	}
-	return molsurf(xs,ys,zs,rads,numCoords,0);
+	std::vector<mead_data_t> atom_radii = lookup_radii(atoms,radii);
+	for(size_t i = 0;i<numCoords;i++)
+		rads[i] = atom_radii.at(i) + MOLSURF_RADII_ADJUSTMENT;//SA radii are not necessarily the same as PB radii
+
+	std::vector<REAL_T> areas((atom_areas != 0) ? numCoords : 0);
+	REAL_T returnMe = 0;
+	int molsurf_error = molsurf_calc(&xs[0],&ys[0],&zs[0],&rads[0],numCoords,0,
+			(atom_areas != 0) ? &areas[0] : NULL,&returnMe);
+	if(molsurf_error != MOLSURF_OK)
+	{
+		if(error_flag == 0)
+		{
+			std::ostringstream error;
+			error << "mmpbsa::MeadInterface::molsurf_area: molsurf failed: " << molsurf_strerror(molsurf_error);
+			throw mmpbsa::MeadException(error,mmpbsa::DATA_FORMAT_ERROR);
+		}
+		*error_flag = molsurf_error;
+		if(atom_areas != 0)
+			atom_areas->clear();
+		return 0;
+	}
+	if(atom_areas != 0)
+		atom_areas->assign(areas.begin(),areas.end());
+	return returnMe;
 }
 
-#ifndef _WIN32
-mmpbsa_t mmpbsa::MeadInterface::molsurf_posix(const std::vector<mmpbsa::atom_t>& atoms,
+//Shrake-Rupley uses the same expanded radii as molsurf.
+static std::vector<mmpbsa_t> shrake_rupley_radii(const std::vector<mmpbsa::atom_t>& atoms,
+		const std::map<std::string,mead_data_t>& radii)
+{
+	std::vector<mead_data_t> atom_radii = mmpbsa::MeadInterface::lookup_radii(atoms,radii);
+	std::vector<mmpbsa_t> returnMe(atom_radii.size());
+	for(size_t i = 0;i<atom_radii.size();i++)
+		returnMe[i] = atom_radii[i] + MOLSURF_RADII_ADJUSTMENT;
+	return returnMe;
+}
+
+mmpbsa_t mmpbsa::MeadInterface::surface_area(const std::vector<mmpbsa::atom_t>& atoms, const mmpbsa::forcefield_t& ff,
 		const std::valarray<mmpbsa::Vector>& crds,
 		const std::map<std::string,mead_data_t>& radii,
-		int *error_flag)
+		std::vector<mmpbsa_t>* atom_areas, int* error_flag) const throw (mmpbsa::MMPBSAException)
 {
-	using namespace mmpbsa;
-	// Start Molsurf and it's monitor
-	pid_t molsurf_pid;
-	mmpbsa_t areaval;
-	std::ostringstream molsurf_stdout, molsurf_stderr;
-	int molsurf_fd[2];
-	int mmpbsa_molsurf_error = 0;
-
-	molsurf_stdout << "molsurf.stdout." << getpid();
-	molsurf_stderr << "molsurf.stderr." << getpid();
-
+	switch(sa_method)
+	{
+	case SA_SHRAKE_RUPLEY:
+		if(error_flag != 0)
+			*error_flag = 0;
+		return mmpbsa::shrake_rupley_area(crds,shrake_rupley_radii(atoms,radii),sa_points,
+				(multithread > 1) ? multithread : 1,atom_areas);
+	case SA_LCPO:
+		if(error_flag != 0)
+			*error_flag = 0;
+		return mmpbsa::lcpo_area(crds,mmpbsa::lcpo_parameters(atoms,ff),atom_areas);
+	default:
+		return molsurf_area(atoms,crds,radii,atom_areas,error_flag);
+	}
+}
 
-	if(pipe(molsurf_fd) == -1)
+mmpbsa_t mmpbsa::MeadInterface::interface_surface_area(const std::vector<mmpbsa::atom_t>& atoms, const mmpbsa::forcefield_t& ff,
+		const std::valarray<mmpbsa::Vector>& crds,
+		const std::map<std::string,mead_data_t>& radii, const std::vector<bool>& in_ligand,
+		std::vector<mmpbsa_t>& atom_areas, size_t* num_recalculated) const throw (mmpbsa::MMPBSAException)
+{
+	std::vector<size_t> selection;
+	mmpbsa_t returnMe = 0;
+	switch(sa_method)
 	{
-		std::ostringstream error;
-		error << "mmpbsa::MeadInterface::pbsa_solvation: Could not setup pipe for molsurf. Reason(" << errno << "): " << strerror(errno);
-		perror("pipe error");
-		throw MeadException(error,SYSTEM_ERROR);
+	case SA_SHRAKE_RUPLEY:
+	{
+		std::vector<mmpbsa_t> sa_radii = shrake_rupley_radii(atoms,radii);
+		selection = mmpbsa::interface_atoms(crds,sa_radii,in_ligand);
+		returnMe = mmpbsa::shrake_rupley_area(crds,sa_radii,sa_points,(multithread > 1) ? multithread : 1,
+				&atom_areas,&selection);
+		break;
 	}
-	molsurf_pid = fork();
-	if(molsurf_pid == -1)
-	  {
-	    std::ostringstream error;
-	    error << "mmpbsa::MeadInterface::pbsa_solvation: Could not setup a fork for molsurf.\nReason(" << errno << "): " << strerror(errno);
-	    throw MeadException(error,SYSTEM_ERROR);
-	  }
-
-	if(molsurf_pid)
+	case SA_LCPO:
 	{
-		// parent
-		int molsurf_retval;
-		close(molsurf_fd[1]);// parent reads from child and does not write to child
-
-		molsurf_retval = read(molsurf_fd[0],&areaval,sizeof(mmpbsa_t));
-		if(molsurf_retval < 1)
-			mmpbsa_molsurf_error++;
-		close(molsurf_fd[0]);
-		if(waitpid(molsurf_pid,&molsurf_retval,0) != molsurf_pid)
-			fprintf(stderr,"wait error: %s\n",strerror(errno));
-		if(molsurf_retval != 0)
-			mmpbsa_molsurf_error++;
-		if(mmpbsa_molsurf_error != 0)
-			areaval = 0;
-
-		if(access(molsurf_stdout.str().c_str(),W_OK) != -1)
-			remove(molsurf_stdout.str().c_str());
-		if(access(molsurf_stderr.str().c_str(),W_OK) != -1)
-			remove(molsurf_stderr.str().c_str());
+		std::vector<mmpbsa::lcpo_params_t> params = mmpbsa::lcpo_parameters(atoms,ff);
+		std::vector<mmpbsa_t> sa_radii(params.size(),0);
+		for(size_t i = 0;i<params.size();i++)
+			if(params[i].radius > 0)
+				sa_radii[i] = params[i].radius + MMPBSA_LCPO_PROBE;
+		selection = mmpbsa::interface_atoms(crds,sa_radii,in_ligand);
+		returnMe = mmpbsa::lcpo_area(crds,params,&atom_areas,&selection);
+		break;
 	}
-	else
+	default:
+		throw mmpbsa::MMPBSAException("mmpbsa::MeadInterface::interface_surface_area: molsurf areas cannot be "
+				"recalculated at the interface alone. Use Shrake-Rupley or LCPO.",mmpbsa::COMMAND_LINE_ERROR);
+	}
+	if(num_recalculated != 0)
+		*num_recalculated = selection.size();
+	return returnMe;
+}
+
+#ifndef _WIN32
+//Writes or reads all of the bytes, continuing after partial transfers.
+static bool write_all(int fd, const void* buf, size_t size)
+{
+	const char* curr = (const char*) buf;
+	while(size > 0)
 	{
-		FILE* stdholders[2];
-		close(molsurf_fd[0]);//child writes molsurf data to parent
-
-		//capture stdout and stderr
-		stdholders[0] = freopen(molsurf_stdout.str().c_str(),"w",stdout);
-		stdholders[1] = freopen(molsurf_stderr.str().c_str(),"w",stderr);
-
-		// run molsurf
-		areaval = MeadInterface::molsurf_area(atoms,crds,radii);
-		write(molsurf_fd[1],&areaval,sizeof(mmpbsa_t));
-		close(molsurf_fd[1]);
-
-		//clean up
-		for(size_t i = 0;i<2;i++)
-			fclose(stdholders[i]);
-		exit(0);
+		ssize_t written = write(fd,curr,size);
+		if(written < 0 && errno == EINTR)
+			continue;
+		if(written <= 0)
+			return false;
+		curr += written;
+		size -= written;
 	}
-	if(error_flag != NULL)
-		*error_flag = mmpbsa_molsurf_error;
+	return true;
+}
 
-	return areaval;
+static bool read_all(int fd, void* buf, size_t size)
+{
+	char* curr = (char*) buf;
+	while(size > 0)
+	{
+		ssize_t num_read = read(fd,curr,size);
+		if(num_read < 0 && errno == EINTR)
+			continue;
+		if(num_read <= 0)
+			return false;
+		curr += num_read;
+		size -= num_read;
+	}
+	return true;
 }
+
 #else// windows environment
 mmpbsa_t mmpbsa::MeadInterface::molsurf_windows32(const std::vector<mmpbsa::atom_t>& atoms,
 						  const std::valarray<mmpbsa::Vector>& crds,
@@ -253,15 +553,34 @@ mmpbsa_t mmpbsa::MeadInterface::molsurf_windows32(const std::vector<mmpbsa::atom
 #endif
 
 
-mmpbsa_t mmpbsa::MeadInterface::pb_solvation(const std::vector<mmpbsa::atom_t>& atoms,
-		const std::valarray<mmpbsa::Vector>& crds,
-		const FinDiffMethod& fdm, const std::map<std::string,mead_data_t>& radii,
-		const std::map<std::string,std::string>& residueMap,
-		const mmpbsa_t& interactionStrength, const mmpbsa_t& exclusionRadius)
+std::vector<mead_data_t> mmpbsa::MeadInterface::lookup_radii(const std::vector<mmpbsa::atom_t>& atoms,
+		const std::map<std::string,mead_data_t>& radii)
 {
-	AtomSet atmSet;
+	std::vector<mead_data_t> returnMe(atoms.size());
+	mmpbsa_utils::radius_table_t radius_table = mmpbsa_utils::make_radius_table(radii);
+	mmpbsa_utils::radius_table_t resolved;//radii of names already found
+	mmpbsa_utils::radius_table_t::const_iterator match;
+	for(size_t i = 0;i<atoms.size();i++)
+	{
+		const std::string& atname = atoms[i].name;
+		match = resolved.find(atname);
+		if(match == resolved.end())
+			match = resolved.insert(std::make_pair(atname,mmpbsa_utils::lookup_radius(atname,radius_table))).first;
+		returnMe[i] = match->second;
+	}
+	return returnMe;
+}
+
+mmpbsa::mead_atom_set_t mmpbsa::MeadInterface::create_atom_set(const std::vector<mmpbsa::atom_t>& atoms,
+		const std::map<std::string,mead_data_t>& radii)
+{
+	mmpbsa::mead_atom_set_t returnMe;
+	std::vector<mead_data_t> atom_radii = lookup_radii(atoms,radii);
 	std::vector<mmpbsa::atom_t>::const_iterator atom;
+	std::vector<AtomID> keys;
+	keys.reserve(atoms.size());
 
+	returnMe.atoms = new AtomSet;
 	size_t i = 0;
 	for(atom = atoms.begin();atom != atoms.end();atom++,i++)
 	{
@@ -269,43 +588,365 @@ mmpbsa_t mmpbsa::MeadInterface::pb_solvation(const std::vector<mmpbsa::atom_t>&
 		currAtom.atname = atom->name;
 		currAtom.resname = "FOO";//FIX ME???
 		currAtom.resnum = i+1;//FIX ME???
-		currAtom.coord = ToCoord(crds[i]);
 		currAtom.charge = atom->charge;
-		currAtom.rad = mmpbsa_utils::lookup_radius(currAtom.atname,radii);
+		currAtom.rad = atom_radii[i];
 
 		if(currAtom.rad < 0.1 || currAtom.rad > 3.0)
 			std::cerr << "WARNING: strange radius, " << currAtom.rad << ", for atom "
 			<< currAtom.atname << " (index = " << i << ")";
-		atmSet.insert(currAtom);
+		returnMe.atoms->insert(currAtom);
+		keys.push_back(AtomID(currAtom.resnum,currAtom.atname));
+	}
+
+	//Entries of a map stay put as others are inserted. Therefore, they are found once the set is complete.
+	returnMe.entries.resize(keys.size());
+	for(i = 0;i<keys.size();i++)
+	{
+		AtomSet::iterator entry = returnMe.atoms->find(keys[i]);
+		if(entry == returnMe.atoms->end())
+		{
+			std::ostringstream error;
+			error << "mmpbsa::MeadInterface::create_atom_set: Atom " << atoms[i].name
+					<< " (index = " << i << ") does not have a distinct entry in the AtomSet";
+			delete returnMe.atoms;
+			throw MeadException(error,DATA_FORMAT_ERROR);
+		}
+		returnMe.entries[i] = &entry->second;
+	}
+	return returnMe;
+}
+
+void mmpbsa::MeadInterface::destroy_atom_set(mmpbsa::mead_atom_set_t& atmSet)
+{
+	delete atmSet.atoms;
+	atmSet.atoms = 0;
+	atmSet.entries.clear();
+}
+
+void mmpbsa::MeadInterface::update_atom_set(mmpbsa::mead_atom_set_t& atmSet, const std::valarray<mmpbsa::Vector>& crds) throw (mmpbsa::MeadException)
+{
+	if(atmSet.entries.size() != crds.size())
+	{
+		std::ostringstream error;
+		error << "mmpbsa::MeadInterface::update_atom_set: Number of coordinates (" << crds.size()
+				<< ") does not match the number of atoms (" << atmSet.entries.size() << ")";
+		throw MeadException(error,DATA_FORMAT_ERROR);
+	}
+
+	for(size_t i = 0;i<crds.size();i++)
+		atmSet.entries[i]->coord = ToCoord(crds[i]);
+}
+
+mmpbsa_t mmpbsa::MeadInterface::pb_solvation(const std::vector<mmpbsa::atom_t>& atoms,
+		const std::valarray<mmpbsa::Vector>& crds,
+		const FinDiffMethod& fdm, const std::map<std::string,mead_data_t>& radii,
+		const std::map<std::string,std::string>& residueMap,
+		const mmpbsa_t& interactionStrength, const mmpbsa_t& exclusionRadius)
+{
+	mmpbsa::mead_atom_set_t atmSet = create_atom_set(atoms,radii);
+	mmpbsa_t returnMe;
+	try
+	{
+		update_atom_set(atmSet,crds);
+		returnMe = pb_solvation(*atmSet.atoms,fdm,interactionStrength,exclusionRadius);
+	}
+	catch(...)
+	{
+		destroy_atom_set(atmSet);
+		throw;
+	}
+	destroy_atom_set(atmSet);
+	return returnMe;
+}
+
+void mmpbsa::MeadInterface::init_reference_cache(mmpbsa::pb_reference_cache_t& ref_cache, const mmpbsa_t& tolerance, bool validate)
+{
+	ref_cache.crds.clear();
+	ref_cache.energy = 0;
+	ref_cache.valid = false;
+	ref_cache.tolerance = tolerance;
+	ref_cache.validate = validate;
+	ref_cache.reused = ref_cache.solved = 0;
+	ref_cache.max_error = 0;
+}
+
+/**
+ * Determines whether the atoms of the AtomSet are within the tolerance of the
+ * coordinates of the cached reference solve.
+ */
+static bool reference_cache_matches(const mmpbsa::pb_reference_cache_t& ref_cache, const AtomSet& atmSet)
+{
+	if(!ref_cache.valid || ref_cache.crds.size() != 3*atmSet.size())
+		return false;
+	mmpbsa_t tol2 = ref_cache.tolerance*ref_cache.tolerance;
+	size_t i = 0;
+	for(AtomSet::const_iterator atom = atmSet.begin();atom != atmSet.end();atom++,i += 3)
+	{
+		const Coord& crd = atom->second.coord;
+		mmpbsa_t dx = crd.x - ref_cache.crds[i];
+		mmpbsa_t dy = crd.y - ref_cache.crds[i+1];
+		mmpbsa_t dz = crd.z - ref_cache.crds[i+2];
+		if(dx*dx + dy*dy + dz*dz > tol2)
+			return false;
+	}
+	return true;
+}
+
+static void store_reference(mmpbsa::pb_reference_cache_t& ref_cache, const AtomSet& atmSet, const mmpbsa_t& energy)
+{
+	ref_cache.crds.resize(3*atmSet.size());
+	size_t i = 0;
+	for(AtomSet::const_iterator atom = atmSet.begin();atom != atmSet.end();atom++,i += 3)
+	{
+		ref_cache.crds[i] = atom->second.coord.x;
+		ref_cache.crds[i+1] = atom->second.coord.y;
+		ref_cache.crds[i+2] = atom->second.coord.z;
+	}
+	ref_cache.energy = energy;
+	ref_cache.valid = true;
+}
+
+mmpbsa_t mmpbsa::MeadInterface::pb_solvation(const AtomSet& atmSet, const FinDiffMethod& fdm,
+		const mmpbsa_t& interactionStrength, const mmpbsa_t& exclusionRadius,
+		mmpbsa::pb_reference_cache_t* ref_cache)
+{
+	std::vector<mmpbsa::pb_condition_t> conditions(1);
+	conditions[0].istrength = interactionStrength;
+	conditions[0].interior_dielectric = 1.0;
+	return pb_solvation(atmSet,fdm,conditions,exclusionRadius,ref_cache)[0];
+}
+
+std::vector<mmpbsa_t> mmpbsa::MeadInterface::pb_solvation(const AtomSet& atmSet, const FinDiffMethod& fdm,
+		const std::vector<mmpbsa::pb_condition_t>& conditions, const mmpbsa_t& exclusionRadius,
+		mmpbsa::pb_reference_cache_t* ref_cache, std::vector<mmpbsa_t>* atom_energies) throw (mmpbsa::MeadException)
+{
+	if(conditions.size() == 0)
+		throw mmpbsa::MeadException("mmpbsa::MeadInterface::pb_solvation: No PB conditions were provided.",mmpbsa::DATA_FORMAT_ERROR);
+	AtomChargeSet rho_set(atmSet);
+	ChargeDist rho(&rho_set);
+
+	//Solvent energies
+	std::vector<mmpbsa_t> prod_sol(conditions.size());
+	for(size_t i = 0;i<conditions.size();i++)
+	{
+		TwoValueDielectricByAtoms tvdba(atmSet,conditions[i].interior_dielectric,80.0,1.4);
+		DielectricEnvironment eps(&tvdba);
+		ElectrolyteByAtoms eba(atmSet,conditions[i].istrength,exclusionRadius);
+		ElectrolyteEnvironment ely(&eba);
+		ElstatPot phi_solv(fdm, eps, rho, ely);
+		phi_solv.solve();
+		prod_sol[i] = mmpbsa_t(phi_solv * rho);
+		if(i == 0 && atom_energies != 0)
+		{
+			atom_energies->clear();
+			for(AtomSet::const_iterator atom = atmSet.begin();atom != atmSet.end();atom++)
+				atom_energies->push_back(atom->second.charge * phi_solv.value(atom->second.coord) / 2.0);
+		}
+	}
+
+	//Reference energy, with an interior dielectric of 1. Use the cached value, if the atoms have not moved.
+	mmpbsa_t prod_ref;
+	bool use_cache = (ref_cache != 0 && atom_energies == 0 && reference_cache_matches(*ref_cache,atmSet));
+	if(use_cache && !ref_cache->validate)
+	{
+		ref_cache->reused++;
+		prod_ref = ref_cache->energy;
+	}
+	else
+	{
+		//Electrolyte
+		UniformElectrolyte ue(0.0);
+		ElectrolyteEnvironment ely_ref(&ue);
+		UniformDielectric ud(1.0);
+		DielectricEnvironment  eps_ref(&ud);
+		ElstatPot phi_ref(fdm, eps_ref, rho, ely_ref);
+		phi_ref.solve();
+		prod_ref = mmpbsa_t(phi_ref * rho);
+		if(atom_energies != 0)
+		{
+			size_t i = 0;
+			for(AtomSet::const_iterator atom = atmSet.begin();atom != atmSet.end();atom++,i++)
+				(*atom_energies)[i] -= atom->second.charge * phi_ref.value(atom->second.coord) / (2.0*conditions[0].interior_dielectric);
+		}
+
+		if(ref_cache != 0)
+		{
+			ref_cache->solved++;
+			if(use_cache)//validating
+			{
+				mmpbsa_t error = fabs(prod_ref - ref_cache->energy) / 2.0;
+				if(error > ref_cache->max_error)
+					ref_cache->max_error = error;
+			}
+			else
+				store_reference(*ref_cache,atmSet,prod_ref);
+		}
 	}
 
+	std::vector<mmpbsa_t> returnMe(conditions.size());
+	for(size_t i = 0;i<conditions.size();i++)
+		returnMe[i] = (prod_sol[i] - prod_ref/conditions[i].interior_dielectric) / 2.0;
+	return returnMe;
+}
 
-	//Solvent energy
+void mmpbsa::MeadInterface::receptor_potential(const AtomSet& atmSet, const FinDiffMethod& fdm,
+		const mmpbsa_t& interactionStrength, const mmpbsa_t& exclusionRadius,
+		mmpbsa::PotentialGrid& grid)
+{
 	AtomChargeSet rho_set(atmSet);
 	ChargeDist rho(&rho_set);
 	TwoValueDielectricByAtoms tvdba(atmSet,1.0,80.0,1.4);
 	DielectricEnvironment eps(&tvdba);
 	ElectrolyteByAtoms eba(atmSet,interactionStrength,exclusionRadius);
 	ElectrolyteEnvironment ely(&eba);
-	ElstatPot phi_solv(fdm, eps, rho, ely);
-	phi_solv.solve();
-	mmpbsa_t prod_sol = mmpbsa_t(phi_solv * rho);
-
-	//Electrolyte
-	UniformElectrolyte ue(0.0);
-	ElectrolyteEnvironment ely_ref(&ue);
-	UniformDielectric ud(1.0);
-	DielectricEnvironment  eps_ref(&ud);
-#if 1 // testing mead memory usage
-	ElstatPot phi_ref(fdm, eps_ref, rho, ely_ref);
-	phi_ref.solve();
-	mmpbsa_t prod_ref = mmpbsa_t(phi_ref * rho);
-	return (prod_sol - prod_ref) / 2.0;
-#else
-	return 42.0;
-#endif
+	ElstatPot phi(fdm, eps, rho, ely);
+	phi.solve();
+
+	for(int i = 0;i<grid.dim[0];i++)
+		for(int j = 0;j<grid.dim[1];j++)
+			for(int k = 0;k<grid.dim[2];k++)
+				grid.values[grid.index(i,j,k)] = phi.value(ToCoord(grid.point(i,j,k)));
 }
 
+#ifndef _WIN32
+/*
+ * Result sent by a pb_solvation_forked child: status (0 = success), energy and, if
+ * the solve had a reference cache, the cache's contents after the solve.
+ */
+static void write_pb_result(int fd, const std::vector<mmpbsa_t>& energies, const mmpbsa::pb_reference_cache_t* ref_cache)
+{
+	int status = 0;
+	size_t num_energies = energies.size();
+	write_all(fd,&status,sizeof(int));
+	write_all(fd,&num_energies,sizeof(size_t));
+	write_all(fd,&energies[0],num_energies*sizeof(mmpbsa_t));
+	if(ref_cache == 0)
+		return;
+	size_t num_crds = ref_cache->crds.size();
+	write_all(fd,&ref_cache->energy,sizeof(mmpbsa_t));
+	write_all(fd,&ref_cache->valid,sizeof(bool));
+	write_all(fd,&ref_cache->reused,sizeof(size_t));
+	write_all(fd,&ref_cache->solved,sizeof(size_t));
+	write_all(fd,&ref_cache->max_error,sizeof(mmpbsa_t));
+	write_all(fd,&num_crds,sizeof(size_t));
+	if(num_crds)
+		write_all(fd,&ref_cache->crds[0],num_crds*sizeof(mmpbsa_t));
+}
+
+static bool read_pb_result(int fd, std::vector<mmpbsa_t>& energies, mmpbsa::pb_reference_cache_t* ref_cache)
+{
+	int status;
+	size_t num_energies;
+	if(!read_all(fd,&status,sizeof(int)) || status != 0)
+		return false;
+	if(!read_all(fd,&num_energies,sizeof(size_t)) || num_energies == 0)
+		return false;
+	energies.resize(num_energies);
+	if(!read_all(fd,&energies[0],num_energies*sizeof(mmpbsa_t)))
+		return false;
+	if(ref_cache == 0)
+		return true;
+	size_t num_crds;
+	if(!read_all(fd,&ref_cache->energy,sizeof(mmpbsa_t)) || !read_all(fd,&ref_cache->valid,sizeof(bool))
+			|| !read_all(fd,&ref_cache->reused,sizeof(size_t)) || !read_all(fd,&ref_cache->solved,sizeof(size_t))
+			|| !read_all(fd,&ref_cache->max_error,sizeof(mmpbsa_t)) || !read_all(fd,&num_crds,sizeof(size_t)))
+		return false;
+	ref_cache->crds.resize(num_crds);
+	return num_crds == 0 || read_all(fd,&ref_cache->crds[0],num_crds*sizeof(mmpbsa_t));
+}
+
+/*
+ * Waits for a child process, retrying when interrupted by a signal, so that it is
+ * always reaped. Returns true if it exited normally with status 0.
+ */
+static bool reap_child(const pid_t& pid)
+{
+	int child_retval;
+	pid_t result;
+	do
+		result = waitpid(pid,&child_retval,0);
+	while(result == -1 && errno == EINTR);
+	return result == pid && WIFEXITED(child_retval) && WEXITSTATUS(child_retval) == 0;
+}
+
+void mmpbsa::MeadInterface::pb_solvation_forked(const std::vector<AtomSet*>& atom_sets, const FinDiffMethod& fdm,
+		const std::vector<mmpbsa::pb_condition_t>& conditions, const mmpbsa_t& exclusionRadius,
+		const std::vector<mmpbsa::pb_reference_cache_t*>& ref_caches,
+		std::vector<std::vector<mmpbsa_t> >& energies) throw (mmpbsa::MeadException)
+{
+	size_t num_solves = atom_sets.size();
+	if(ref_caches.size() != num_solves)
+		throw mmpbsa::MeadException("mmpbsa::MeadInterface::pb_solvation_forked: Each AtomSet needs a (possibly null) reference cache.",mmpbsa::DATA_FORMAT_ERROR);
+	energies.resize(num_solves);
+	std::vector<pid_t> pids(num_solves,-1);
+	std::vector<int> fds(num_solves,-1);
+
+	//Buffered output would otherwise be written by every child as well.
+	std::cout.flush();
+	std::cerr.flush();
+	fflush(stdout);
+	fflush(stderr);
+
+	std::ostringstream error;
+	for(size_t i = 0;i<num_solves;i++)
+	{
+		int pb_fd[2];
+		if(pipe(pb_fd) == -1)
+		{
+			error << "mmpbsa::MeadInterface::pb_solvation_forked: Could not setup pipe. Reason(" << errno << "): " << strerror(errno);
+			break;
+		}
+		pids[i] = fork();
+		if(pids[i] == -1)
+		{
+			error << "mmpbsa::MeadInterface::pb_solvation_forked: Could not fork.\nReason(" << errno << "): " << strerror(errno);
+			close(pb_fd[0]);
+			close(pb_fd[1]);
+			break;
+		}
+		if(pids[i] == 0)
+		{
+			//child: solve one molecule and report back.
+			close(pb_fd[0]);
+			for(size_t j = 0;j<i;j++)
+				close(fds[j]);
+			int retval = 0;
+			try
+			{
+				std::vector<mmpbsa_t> solved = pb_solvation(*atom_sets[i],fdm,conditions,exclusionRadius,ref_caches[i]);
+				write_pb_result(pb_fd[1],solved,ref_caches[i]);
+			}
+			catch(...)
+			{
+				int status = 1;
+				write_all(pb_fd[1],&status,sizeof(int));
+				retval = 1;
+			}
+			close(pb_fd[1]);
+			_exit(retval);
+		}
+		close(pb_fd[1]);
+		fds[i] = pb_fd[0];
+	}
+
+	//Results are collected in order, so that the merge does not depend on timing.
+	//Every child that was started is reaped, even if another has failed, before any error is thrown.
+	for(size_t i = 0;i<num_solves;i++)
+	{
+		if(pids[i] <= 0)
+			continue;
+		bool success = read_pb_result(fds[i],energies[i],ref_caches[i]);
+		close(fds[i]);
+		if(!reap_child(pids[i]))
+			success = false;
+		if(!success && error.str().size() == 0)
+			error << "mmpbsa::MeadInterface::pb_solvation_forked: PB solve " << i << " failed in process " << pids[i];
+	}
+	if(error.str().size())
+		throw mmpbsa::MeadException(error,mmpbsa::SYSTEM_ERROR);
+}
+#endif
+
 Coord ToCoord(const mmpbsa::Vector& v)
 {
 	return Coord(v.x(),v.y(),v.z());
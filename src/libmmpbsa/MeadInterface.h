@@ -17,12 +17,15 @@
 //forward declare mead class
 class FinDiffMethod;
 class Coord;
+class Atom;
+class AtomSet;
 
 namespace mmpbsa{
 //forward declarations
 class Vector;
 class EMap;
 class EmpEnerFun;
+class PotentialGrid;
 
 class MeadException : public MMPBSAException {
     public:
@@ -47,6 +50,71 @@ class MeadException : public MMPBSAException {
         }
     };
 
+/**
+ * Region covered by the finite difference grid. The coarse levels are centered
+ * on the geometric center of the complex; the fine level covers the region
+ * where receptor and ligand interact.
+ *
+ * A plan may be extended with several snapshots, in which case the grid covers
+ * each of them, allowing one grid to be used for a whole job.
+ */
+typedef struct {
+	mmpbsa_t complex_min[3],complex_max[3];
+	mead_data_t interaction_min[3],interaction_max[3];
+	bool empty;
+}grid_plan_t;
+
+/**
+ * Reference (vacuum) energy, phi_ref * rho, of the last reference solve of a molecule.
+ *
+ * The reference state has a uniform dielectric and no electrolyte. Therefore, it depends
+ * only on the charges, their positions and the grid. If the atoms have not moved by more
+ * than the tolerance, and the grid is unchanged, the cached energy is used instead of
+ * another finite difference solve.
+ */
+typedef struct {
+	std::vector<mmpbsa_t> crds;///<Coordinates (x,y,z per atom) of the last reference solve
+	mmpbsa_t energy;
+	bool valid;
+	mmpbsa_t tolerance;///<Largest atom displacement, in Angstroms, for which the cached energy is used.
+	bool validate;///<If true, the reference is solved anyway and compared with the cached energy.
+	size_t reused, solved;
+	mmpbsa_t max_error;///<Largest difference, in kcal/mol, between cached and solved solvation energy (validate only)
+}pb_reference_cache_t;
+
+/**
+ * MEAD AtomSet of a molecule, with the AtomSet entry of each atom of the atom list
+ * it was created from, so that coordinates are updated by atom list position.
+ *
+ * @see MeadInterface::create_atom_set
+ */
+typedef struct {
+	AtomSet* atoms;
+	std::vector<Atom*> entries;///<AtomSet entry of each atom, in atom list order
+}mead_atom_set_t;
+
+/**
+ * One focusing level of the finite difference grid.
+ */
+typedef struct {
+	int dim;///<Number of grid points along each axis
+	mmpbsa_t spacing;///<Angstroms
+	mmpbsa_t center[3];
+	bool on_interaction;///<Centered on the receptor/ligand interaction region, rather than the complex.
+}grid_level_t;
+
+/**
+ * Solvent conditions of a PB solve. The solvent dielectric is 80.
+ */
+typedef struct {
+	mmpbsa_t istrength;///<Ionic strength (molar)
+	mmpbsa_t interior_dielectric;///<Dielectric constant of the solute
+}pb_condition_t;
+
+//Estimated memory used per grid point by MEAD's finite difference solve (potential,
+//charge, dielectric and electrolyte arrays, in single precision), in bytes.
+#define MMPBSA_MEAD_BYTES_PER_GRID_POINT 32
+
 class MeadInterface {
 public:
 
@@ -67,6 +135,41 @@ public:
 
     int multithread;///<used to indicate number of threads to be used in MMPBSA calculations. Default = 1
 
+    bool fixed_grid;///<Use one finite difference grid, covering every snapshot, for the whole job. Default = false
+
+    /**
+     * Method used to obtain the reference (vacuum) energy in pb_solvation
+     */
+    enum PBReference {REFERENCE_SOLVE/*always solve*/, REFERENCE_CACHE/*reuse while atoms are unchanged*/,
+    	REFERENCE_CHECK/*solve and compare with cache*/};
+    PBReference pb_reference;///<Default = REFERENCE_SOLVE
+    mmpbsa_t reference_tolerance;///<Angstroms. Default = 0.01
+
+    /**
+     * Poisson-Boltzmann solver. PB_MULTIGRID uses mmpbsa::PBMultigrid on the grid levels that
+     * would be given to MEAD.
+     */
+    enum PBSolver {PB_MEAD, PB_MULTIGRID};
+    PBSolver pb_solver;///<Default = PB_MEAD
+
+    bool concurrent_pb;///<Solve the complex, receptor and ligand PB energies of a snapshot at the same time. Default = false
+
+    mmpbsa_t grid_spacing;///<Spacing of the finest PB grid level, in Angstroms. Default = 0.25
+    size_t grid_memory;///<Megabytes available to the PB grids. Zero means the grid geometry is not adapted. Default = 0
+
+    std::vector<mmpbsa_t> istrength_list;///<Ionic strengths (molar) of a PB sweep. Empty means istrength alone.
+    std::vector<mmpbsa_t> dielectric_list;///<Interior dielectric constants of a PB sweep. Empty means 1 alone.
+
+    /**
+     * Surface area engine (cf SurfaceArea.h). SA_SHRAKE_RUPLEY uses the same radii as
+     * molsurf. SA_LCPO uses its own radii, based upon atom types.
+     */
+    enum SAMethod {SA_MOLSURF, SA_SHRAKE_RUPLEY, SA_LCPO};
+    SAMethod sa_method;///<Default = SA_MOLSURF
+    size_t sa_points;///<Number of sphere points per atom for SA_SHRAKE_RUPLEY. Default = 960
+    bool sa_check;///<Also calculate the area with molsurf, to measure the deviation of the other engines. Default = false
+    bool sa_interface;///<Recalculate only the interface atoms of the complex, from the separated molecules' atom areas. Default = false
+
 
     /**
      * MeadInteraface stores variable values that are used by Mead
@@ -95,17 +198,92 @@ public:
         const std::valarray<mmpbsa::Vector>& receptorCrds, const std::valarray<mmpbsa::Vector>& ligandCrds,
         const int& outbox_grid_dim = 41, const mmpbsa_t& fine_grid_spacing = 0.25) throw (mmpbsa::MeadException);
 
+    /**
+     * Sets up a Finite Difference Method object covering the region described by
+     * the grid plan.
+     *
+     * @see extend_grid_plan
+     */
+    static FinDiffMethod createFDM(const mmpbsa::grid_plan_t& plan,
+        const int& outbox_grid_dim = 41, const mmpbsa_t& fine_grid_spacing = 0.25) throw (mmpbsa::MeadException);
+
+    /**
+     * Returns the focusing levels, coarsest first, of the grid described by the
+     * grid plan. These are the levels createFDM gives to MEAD.
+     */
+    static std::vector<mmpbsa::grid_level_t> grid_levels(const mmpbsa::grid_plan_t& plan,
+        const int& outbox_grid_dim = 41, const mmpbsa_t& fine_grid_spacing = 0.25) throw (mmpbsa::MeadException);
+
+    /**
+     * Returns every combination of the ionic strengths and interior dielectric
+     * constants of the sweep (istrength_list and dielectric_list), ionic strength
+     * varying slowest. Without a sweep, the only condition is istrength with an
+     * interior dielectric of 1.
+     */
+    std::vector<mmpbsa::pb_condition_t> pb_conditions() const;
+
+    /**
+     * Determines whether PB energies are calculated for a list of conditions.
+     */
+    bool pb_sweep() const {return istrength_list.size() != 0 || dielectric_list.size() != 0;}
+
+    /**
+     * Returns focusing levels, coarsest first, that fit within a memory ceiling.
+     *
+     * The outer level has outbox_grid_dim points and extends 15 Angstroms beyond the
+     * complex; the next level has half its spacing and covers the complex plus 10 Angstroms.
+     * Further levels, centered on the interaction region, halve the spacing until it is
+     * within a factor of four of the fine spacing. Levels whose spacing would be finer than
+     * the fine level are omitted, so that small molecules do not get unnecessary levels.
+     *
+     * If the levels need more than max_bytes, the levels between the complex and fine levels
+     * are dropped. If that is not enough, the fine spacing is increased, 10% at a time,
+     * up to four times the requested spacing, after which a MeadException is thrown.
+     * The spacing that was used is that of the last level.
+     *
+     * @param plan
+     * @param fine_grid_spacing Requested spacing of the finest level (Angstroms)
+     * @param max_bytes Memory ceiling. Zero means no ceiling.
+     * @param bytes_per_point Memory used by the PB solver per grid point
+     * @param outbox_grid_dim
+     */
+    static std::vector<mmpbsa::grid_level_t> adaptive_grid_levels(const mmpbsa::grid_plan_t& plan,
+        const mmpbsa_t& fine_grid_spacing, const size_t& max_bytes, const size_t& bytes_per_point,
+        const int& outbox_grid_dim = 41) throw (mmpbsa::MeadException);
+
+    /**
+     * Memory, in bytes, needed to store the levels, given the memory per grid point.
+     */
+    static size_t grid_memory_estimate(const std::vector<mmpbsa::grid_level_t>& levels, const size_t& bytes_per_point);
+
+    /**
+     * Focusing levels for the grid plan using this object's grid settings, i.e.
+     * grid_spacing, grid_memory, pb_solver and concurrent_pb. Without a memory
+     * ceiling, these are the levels of grid_levels.
+     */
+    std::vector<mmpbsa::grid_level_t> plan_grid(const mmpbsa::grid_plan_t& plan) const throw (mmpbsa::MeadException);
+
+    /**
+     * Sets up a Finite Difference Method object with the provided focusing levels.
+     */
+    static FinDiffMethod createFDM(const std::vector<mmpbsa::grid_level_t>& levels) throw (mmpbsa::MeadException);
+
+    /**
+     * Empties the grid plan.
+     */
+    static void clear_grid_plan(mmpbsa::grid_plan_t& plan);
+
+    /**
+     * Enlarges the grid plan, if necessary, so that it covers the provided snapshot.
+     */
+    static void extend_grid_plan(mmpbsa::grid_plan_t& plan, const std::valarray<mmpbsa::Vector>& complexCrds,
+        const std::valarray<mmpbsa::Vector>& receptorCrds, const std::valarray<mmpbsa::Vector>& ligandCrds) throw (mmpbsa::MeadException);
+
 #ifdef _WIN32 // not posix
     static mmpbsa_t molsurf_windows32(const std::vector<mmpbsa::atom_t>& atoms,
 				      const std::valarray<mmpbsa::Vector>& crds,
 				      const std::map<std::string,mead_data_t>& radii,
 				      int *error_flag);
-
-#else // posix
-    static mmpbsa_t molsurf_posix(const std::vector<mmpbsa::atom_t>& atoms,
-    		const std::valarray<mmpbsa::Vector>& crds,
-    		const std::map<std::string,mead_data_t>& radii,
-    		int *error_flag);
 #endif
 
 
@@ -166,9 +344,139 @@ public:
     		const std::map<std::string,std::string>& residueMap,
     		const mmpbsa_t& interactionStrength = 0.0, const mmpbsa_t& exclusionRadius = 2.0);
 
+    /**
+     * Returns the radius of each atom, in the order of the atom list. Each distinct
+     * atom name is resolved once, using mmpbsa_utils::lookup_radius.
+     */
+    static std::vector<mead_data_t> lookup_radii(const std::vector<mmpbsa::atom_t>& atoms,
+    		const std::map<std::string,mead_data_t>& radii);
+
+    /**
+     * Creates the MEAD AtomSet of a molecule. Names, charges and radii do not change
+     * from snapshot to snapshot. Therefore, the AtomSet may be created once per job and
+     * only its coordinates updated, using update_atom_set, for each snapshot.
+     *
+     * The AtomSet must be freed with destroy_atom_set.
+     */
+    static mmpbsa::mead_atom_set_t create_atom_set(const std::vector<mmpbsa::atom_t>& atoms,
+    		const std::map<std::string,mead_data_t>& radii);
+
+    static void destroy_atom_set(mmpbsa::mead_atom_set_t& atmSet);
+
+    /**
+     * Replaces the coordinates of the atoms in the AtomSet with the provided coordinates,
+     * which must be in the order of the atom list used to create the AtomSet.
+     */
+    static void update_atom_set(mmpbsa::mead_atom_set_t& atmSet, const std::valarray<mmpbsa::Vector>& crds) throw (mmpbsa::MeadException);
+
+    /**
+     * Calculates the PB solvation energy of the atoms in the AtomSet.
+     *
+     * If a reference cache is provided, the reference (vacuum) solve is skipped when the
+     * atoms have not moved beyond the cache's tolerance since the cached solve. The cache
+     * does not know about the grid; it must only be used with a grid that is fixed for
+     * the whole job.
+     *
+     * @see create_atom_set
+     */
+    static mmpbsa_t pb_solvation(const AtomSet& atmSet, const FinDiffMethod& fdm,
+    		const mmpbsa_t& interactionStrength = 0.0, const mmpbsa_t& exclusionRadius = 2.0,
+    		mmpbsa::pb_reference_cache_t* ref_cache = 0);
+
+    /**
+     * Calculates the PB solvation energy of the atoms in the AtomSet for each of the
+     * conditions, in the order of the conditions. The charge distribution and the
+     * reference (vacuum) energy are shared by all conditions. The reference energy
+     * is solved once, with an interior dielectric of 1, and scaled by the inverse
+     * of each interior dielectric, which is exact for a uniform dielectric. The reference
+     * cache is used as in the single condition pb_solvation.
+     *
+     * If atom_energies is not null, it is replaced by the energy of the first condition
+     * decomposed by atom, q_i (phi_solv(r_i) - phi_ref(r_i)) / 2, in the iteration order
+     * of the AtomSet. The reference potential is then always solved, as the cache only
+     * holds its energy.
+     */
+    static std::vector<mmpbsa_t> pb_solvation(const AtomSet& atmSet, const FinDiffMethod& fdm,
+    		const std::vector<mmpbsa::pb_condition_t>& conditions, const mmpbsa_t& exclusionRadius = 2.0,
+    		mmpbsa::pb_reference_cache_t* ref_cache = 0,
+    		std::vector<mmpbsa_t>* atom_energies = 0) throw (mmpbsa::MeadException);
+
+    /**
+     * Empties the reference cache and sets whether cached energies are used or only validated.
+     */
+    static void init_reference_cache(mmpbsa::pb_reference_cache_t& ref_cache, const mmpbsa_t& tolerance, bool validate);
+
+#ifndef _WIN32
+    /**
+     * Calculates the PB solvation energies of several AtomSets at once. Each solve
+     * runs in a forked process, which isolates MEAD's global state, and returns its
+     * energies to the parent through a pipe.
+     *
+     * energies[i] belongs to atom_sets[i], regardless of the order in which the
+     * processes finish, and holds one energy per condition. Reference caches (which may be null) are updated in the
+     * parent exactly as serial calls to pb_solvation would have updated them.
+     */
+    static void pb_solvation_forked(const std::vector<AtomSet*>& atom_sets, const FinDiffMethod& fdm,
+    		const std::vector<mmpbsa::pb_condition_t>& conditions, const mmpbsa_t& exclusionRadius,
+    		const std::vector<mmpbsa::pb_reference_cache_t*>& ref_caches,
+    		std::vector<std::vector<mmpbsa_t> >& energies) throw (mmpbsa::MeadException);
+#endif
+
+    /**
+     * Solves for the electrostatic potential of the atoms in the AtomSet in solvent,
+     * with the same dielectric and electrolyte model as pb_solvation, and stores it
+     * at each point of the potential grid. Points outside of the finest focusing
+     * level take the potential of the finest level containing them.
+     *
+     * The interaction energy of another molecule's charges with this potential
+     * (cf PotentialGrid::interaction_energy) is its Coulomb plus reaction field
+     * interaction with these atoms, neglecting the change of the dielectric boundary
+     * caused by the other molecule.
+     */
+    static void receptor_potential(const AtomSet& atmSet, const FinDiffMethod& fdm,
+    		const mmpbsa_t& interactionStrength, const mmpbsa_t& exclusionRadius,
+    		mmpbsa::PotentialGrid& grid);
+
+    /**
+     * Calculates the solvent accessible surface area with molsurf. If atom_areas
+     * is not null, it is replaced by the contact area of each atom. With the zero probe
+     * radius used here, these sum to the total area.
+     *
+     * molsurf runs in the calling process and thread, and may be called by several
+     * threads at once. If it fails, e.g. for a geometry it cannot handle, zero is
+     * returned and error_flag is set to the molsurf error code (cf molsurf_calc),
+     * or, if error_flag is null, a MeadException is thrown.
+     */
     static mmpbsa_t molsurf_area(const std::vector<mmpbsa::atom_t>& atoms,
     		const std::valarray<mmpbsa::Vector>& crds,
-    		const std::map<std::string,mead_data_t>& radii);
+    		const std::map<std::string,mead_data_t>& radii,
+    		std::vector<mmpbsa_t>* atom_areas = 0, int* error_flag = 0) throw (mmpbsa::MeadException);
+
+    /**
+     * Calculates the solvent accessible surface area with the engine selected by
+     * sa_method. Shrake-Rupley uses multithread threads. atom_areas and error_flag are
+     * as in molsurf_area; only molsurf sets error_flag.
+     */
+    mmpbsa_t surface_area(const std::vector<mmpbsa::atom_t>& atoms, const mmpbsa::forcefield_t& ff,
+    		const std::valarray<mmpbsa::Vector>& crds,
+    		const std::map<std::string,mead_data_t>& radii,
+    		std::vector<mmpbsa_t>* atom_areas = 0, int* error_flag = 0) const throw (mmpbsa::MMPBSAException);
+
+    /**
+     * Calculates the surface area of a complex from the atom areas of its separated
+     * receptor and ligand. On input, atom_areas holds the area of each atom of the
+     * complex in its own molecule; in_ligand[i] is true if atom i belongs to the ligand.
+     * Only the atoms at the interface (cf mmpbsa::interface_atoms) are recalculated,
+     * so the result is the same as that of surface_area. atom_areas is replaced by the
+     * atom areas of the complex. Throws an exception if sa_method is SA_MOLSURF, whose
+     * atom areas cannot be recalculated separately.
+     *
+     * If num_recalculated is not null, it is set to the number of atoms recalculated.
+     */
+    mmpbsa_t interface_surface_area(const std::vector<mmpbsa::atom_t>& atoms, const mmpbsa::forcefield_t& ff,
+    		const std::valarray<mmpbsa::Vector>& crds,
+    		const std::map<std::string,mead_data_t>& radii, const std::vector<bool>& in_ligand,
+    		std::vector<mmpbsa_t>& atom_areas, size_t* num_recalculated = 0) const throw (mmpbsa::MMPBSAException);
 
 };
 
@@ -0,0 +1,974 @@
+#include "PBMultigrid.h"
+
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+#ifdef USE_PTHREADS
+#include <pthread.h>
+#endif
+
+//kappa^2 per unit of ionic strength (molar), in Angstrom^-2, for water (dielectric 80) at 300K.
+#define PB_KAPPA2_PER_MOLAR 0.10532
+
+//Weighted Jacobi smoothing used by the multigrid V-cycle.
+#define PB_JACOBI_WEIGHT 0.8
+#define PB_SMOOTHING_SWEEPS 2
+#define PB_COARSEST_SWEEPS 50
+
+//Grids smaller than this are not split among threads.
+#define PB_MIN_THREADED_DIM 32
+
+/**
+ * One grid of the multigrid hierarchy. Node (i,j,k) is stored at (k*n + j)*n + i.
+ */
+typedef struct {
+	int n;
+	mmpbsa_t h;
+	mmpbsa_t origin[3];
+	std::vector<float> ex,ey,ez;///<h times the dielectric constant of the face between a node and its +x, +y, +z neighbor
+	std::vector<float> k2;///<Dielectric constant times kappa^2 at each node
+	std::vector<double> diag;
+}pb_lattice_t;
+
+typedef struct {
+	std::vector<pb_lattice_t*> lat;///<lat[0] is the grid being solved
+	std::vector<pb_lattice_t> coarse;
+	std::vector<std::vector<double> > r,e,t;
+	mmpbsa::pb_thread_pool_t* pool;
+}pb_multigrid_t;
+
+static inline size_t node(const int& n, const int& i, const int& j, const int& k)
+{
+	return (size_t(k)*n + j)*n + i;
+}
+
+static inline bool is_boundary(const int& n, const int& i, const int& j, const int& k)
+{
+	return i == 0 || j == 0 || k == 0 || i == n-1 || j == n-1 || k == n-1;
+}
+
+/**
+ * Smallest odd dimension, at least dim, that can be halved down to a grid of
+ * at most seven points.
+ */
+static int multigrid_dim(const int& dim)
+{
+	for(int N = (dim % 2) ? dim : dim + 1;;N += 2)
+	{
+		int m = N - 1;
+		while(m > 6 && m % 2 == 0)
+			m /= 2;
+		if(m <= 6)
+			return N;
+	}
+}
+
+static bool can_coarsen(const int& n)
+{
+	return n > 7 && (n - 1) % 2 == 0;
+}
+
+/*
+ * Threads divide the interior of a grid into slabs of constant k.
+ */
+typedef void (*slab_function)(void* arg, int kbegin, int kend);
+
+#ifdef USE_PTHREADS
+/**
+ * Worker threads of a solver. They are started with the solver's first threaded
+ * solve and sleep between sweeps. For each sweep, the calling thread posts the
+ * slab function, wakes the workers and does the first slab itself. Worker t does
+ * slab t.
+ */
+struct mmpbsa::pb_thread_pool_t {
+	std::vector<pthread_t> threads;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;///<Signaled when a sweep is posted or the pool shuts down
+	pthread_cond_t done;///<Signaled when the last worker finishes its slab
+	slab_function f;
+	void* arg;
+	int n;
+	size_t sweep;///<Number of sweeps posted
+	size_t running;///<Workers that have not finished the current sweep
+	bool shutdown;
+};
+
+typedef struct {
+	mmpbsa::pb_thread_pool_t* pool;
+	size_t index;
+}pool_worker_t;
+
+static void slab_bounds(const int& n, const size_t& slab, const size_t& num_slabs, int& kbegin, int& kend)
+{
+	int interior = n - 2;
+	kbegin = 1 + int(slab*interior/num_slabs);
+	kend = 1 + int((slab+1)*interior/num_slabs);
+}
+
+static void* run_pool_worker(void* arg)
+{
+	pool_worker_t* worker = (pool_worker_t*) arg;
+	mmpbsa::pb_thread_pool_t& pool = *worker->pool;
+	const size_t slab = worker->index;
+	delete worker;
+
+	size_t seen = 0;
+	pthread_mutex_lock(&pool.lock);
+	for(;;)
+	{
+		while(!pool.shutdown && pool.sweep == seen)
+			pthread_cond_wait(&pool.wake,&pool.lock);
+		if(pool.shutdown)
+			break;
+		seen = pool.sweep;
+		slab_function f = pool.f;
+		void* f_arg = pool.arg;
+		int kbegin,kend;
+		slab_bounds(pool.n,slab,pool.threads.size() + 1,kbegin,kend);
+		pthread_mutex_unlock(&pool.lock);
+
+		f(f_arg,kbegin,kend);
+
+		pthread_mutex_lock(&pool.lock);
+		if(--pool.running == 0)
+			pthread_cond_signal(&pool.done);
+	}
+	pthread_mutex_unlock(&pool.lock);
+	return 0;
+}
+
+/**
+ * Starts up to nthreads - 1 workers. Fewer are kept if threads cannot be created.
+ */
+static mmpbsa::pb_thread_pool_t* create_thread_pool(const int& nthreads)
+{
+	mmpbsa::pb_thread_pool_t* pool = new mmpbsa::pb_thread_pool_t;
+	pthread_mutex_init(&pool->lock,NULL);
+	pthread_cond_init(&pool->wake,NULL);
+	pthread_cond_init(&pool->done,NULL);
+	pool->f = 0;
+	pool->arg = 0;
+	pool->n = 0;
+	pool->sweep = pool->running = 0;
+	pool->shutdown = false;
+
+	//Workers only read the pool size once a sweep is posted, i.e. after this is done.
+	pthread_mutex_lock(&pool->lock);
+	for(int t = 1;t<nthreads;t++)
+	{
+		pthread_t thread;
+		pool_worker_t* worker = new pool_worker_t;
+		worker->pool = pool;
+		worker->index = pool->threads.size() + 1;
+		if(pthread_create(&thread,NULL,run_pool_worker,worker) != 0)
+		{
+			delete worker;
+			break;
+		}
+		pool->threads.push_back(thread);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return pool;
+}
+
+static void destroy_thread_pool(mmpbsa::pb_thread_pool_t* pool)
+{
+	if(pool == 0)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = true;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+	for(size_t t = 0;t<pool->threads.size();t++)
+		pthread_join(pool->threads[t],NULL);
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->wake);
+	pthread_mutex_destroy(&pool->lock);
+	delete pool;
+}
+#endif
+
+static void parallel_slabs(mmpbsa::pb_thread_pool_t* pool, const int& n, slab_function f, void* arg)
+{
+#ifdef USE_PTHREADS
+	if(pool != 0 && pool->threads.size() && n >= PB_MIN_THREADED_DIM)
+	{
+		int kbegin,kend;
+		pthread_mutex_lock(&pool->lock);
+		pool->f = f;
+		pool->arg = arg;
+		pool->n = n;
+		pool->running = pool->threads.size();
+		pool->sweep++;
+		pthread_cond_broadcast(&pool->wake);
+		pthread_mutex_unlock(&pool->lock);
+
+		slab_bounds(n,0,pool->threads.size() + 1,kbegin,kend);
+		f(arg,kbegin,kend);
+
+		pthread_mutex_lock(&pool->lock);
+		while(pool->running > 0)
+			pthread_cond_wait(&pool->done,&pool->lock);
+		pthread_mutex_unlock(&pool->lock);
+		return;
+	}
+#endif
+	f(arg,1,n-1);
+}
+
+typedef struct {
+	const pb_lattice_t* lat;
+	const std::vector<double>* x;
+	std::vector<double>* y;
+	const std::vector<double>* r;
+}slab_arg_t;
+
+//y = A x on interior nodes. Boundary values of y are not written.
+static void apply_slab(void* arg, int kbegin, int kend)
+{
+	slab_arg_t* a = (slab_arg_t*) arg;
+	const pb_lattice_t& L = *a->lat;
+	const double* x = &(*a->x)[0];
+	double* y = &(*a->y)[0];
+	const int n = L.n;
+	const size_t nn = size_t(n)*n;
+	for(int k = kbegin;k<kend;k++)
+		for(int j = 1;j<n-1;j++)
+		{
+			size_t c = node(n,1,j,k);
+			for(int i = 1;i<n-1;i++,c++)
+				y[c] = L.diag[c]*x[c]
+				       - L.ex[c]*x[c+1] - L.ex[c-1]*x[c-1]
+				       - L.ey[c]*x[c+n] - L.ey[c-n]*x[c-n]
+				       - L.ez[c]*x[c+nn] - L.ez[c-nn]*x[c-nn];
+		}
+}
+
+//x += weight*(r - y)/diag, where y = A x.
+static void jacobi_slab(void* arg, int kbegin, int kend)
+{
+	slab_arg_t* a = (slab_arg_t*) arg;
+	const pb_lattice_t& L = *a->lat;
+	double* x = &(*a->y)[0];
+	const double* r = &(*a->r)[0];
+	const double* Ax = &(*a->x)[0];
+	const int n = L.n;
+	for(int k = kbegin;k<kend;k++)
+		for(int j = 1;j<n-1;j++)
+		{
+			size_t c = node(n,1,j,k);
+			for(int i = 1;i<n-1;i++,c++)
+				x[c] += PB_JACOBI_WEIGHT*(r[c] - Ax[c])/L.diag[c];
+		}
+}
+
+static void apply(const pb_lattice_t& L, const std::vector<double>& x, std::vector<double>& y, mmpbsa::pb_thread_pool_t* pool)
+{
+	slab_arg_t arg = {&L,&x,&y,0};
+	parallel_slabs(pool,L.n,apply_slab,&arg);
+}
+
+static void jacobi(const pb_lattice_t& L, const std::vector<double>& r, std::vector<double>& x,
+		std::vector<double>& scratch, const size_t& sweeps, mmpbsa::pb_thread_pool_t* pool)
+{
+	for(size_t sweep = 0;sweep<sweeps;sweep++)
+	{
+		apply(L,x,scratch,pool);
+		slab_arg_t arg = {&L,&scratch,&x,&r};
+		parallel_slabs(pool,L.n,jacobi_slab,&arg);
+	}
+}
+
+static void set_diagonal(pb_lattice_t& L)
+{
+	const int n = L.n;
+	const size_t nn = size_t(n)*n;
+	mmpbsa_t h3 = L.h*L.h*L.h;
+	L.diag.assign(nn*n,1.0);
+	for(int k = 1;k<n-1;k++)
+		for(int j = 1;j<n-1;j++)
+			for(int i = 1;i<n-1;i++)
+			{
+				size_t c = node(n,i,j,k);
+				L.diag[c] = L.ex[c] + L.ex[c-1] + L.ey[c] + L.ey[c-n] + L.ez[c] + L.ez[c-nn] + L.k2[c]*h3;
+			}
+}
+
+/**
+ * Coarse grid coefficients: faces combine the two fine faces along the same line in
+ * series; the ionic term is taken from the coincident fine node.
+ */
+static float series_face(const float& a, const float& b)
+{
+	return (a + b > 0) ? 4*a*b/(a + b) : 0;
+}
+
+static void coarsen(const pb_lattice_t& fine, pb_lattice_t& coarse)
+{
+	const int n = fine.n;
+	const size_t nn = size_t(n)*n;
+	const int nc = (n + 1)/2;
+	size_t size = size_t(nc)*nc*nc;
+	coarse.n = nc;
+	coarse.h = 2*fine.h;
+	for(size_t i = 0;i<3;i++)
+		coarse.origin[i] = fine.origin[i];
+	coarse.ex.assign(size,0);
+	coarse.ey.assign(size,0);
+	coarse.ez.assign(size,0);
+	coarse.k2.assign(size,0);
+	for(int K = 0;K<nc;K++)
+		for(int J = 0;J<nc;J++)
+			for(int I = 0;I<nc;I++)
+			{
+				size_t c = node(nc,I,J,K);
+				size_t f = node(n,2*I,2*J,2*K);
+				coarse.k2[c] = fine.k2[f];
+				if(I+1 < nc)
+					coarse.ex[c] = series_face(fine.ex[f],fine.ex[f+1]);
+				if(J+1 < nc)
+					coarse.ey[c] = series_face(fine.ey[f],fine.ey[f+n]);
+				if(K+1 < nc)
+					coarse.ez[c] = series_face(fine.ez[f],fine.ez[f+nn]);
+			}
+	set_diagonal(coarse);
+}
+
+//Full weighting restriction. This is the transpose of prolong_add.
+static void restrict_residual(const pb_lattice_t& fine, const std::vector<double>& r,
+		const pb_lattice_t& coarse, std::vector<double>& rc)
+{
+	static const double w[3] = {0.5,1.0,0.5};
+	const int n = fine.n;
+	const int nc = coarse.n;
+	for(int K = 1;K<nc-1;K++)
+		for(int J = 1;J<nc-1;J++)
+			for(int I = 1;I<nc-1;I++)
+			{
+				double sum = 0;
+				for(int dk = -1;dk<=1;dk++)
+					for(int dj = -1;dj<=1;dj++)
+						for(int di = -1;di<=1;di++)
+							sum += w[di+1]*w[dj+1]*w[dk+1]*r[node(n,2*I+di,2*J+dj,2*K+dk)];
+				rc[node(nc,I,J,K)] = sum;
+			}
+}
+
+//Trilinear interpolation of the coarse correction, added to interior fine nodes.
+static void prolong_add(const pb_lattice_t& coarse, const std::vector<double>& ec,
+		const pb_lattice_t& fine, std::vector<double>& e)
+{
+	const int n = fine.n;
+	const int nc = coarse.n;
+	int lo[3],hi[3];
+	double w[3];
+	for(int k = 1;k<n-1;k++)
+	{
+		lo[2] = k/2; hi[2] = (k+1)/2;
+		for(int j = 1;j<n-1;j++)
+		{
+			lo[1] = j/2; hi[1] = (j+1)/2;
+			for(int i = 1;i<n-1;i++)
+			{
+				lo[0] = i/2; hi[0] = (i+1)/2;
+				//Even fine nodes coincide with a coarse node; odd ones lie halfway between two.
+				for(size_t d = 0;d<3;d++)
+					w[d] = (lo[d] == hi[d]) ? 1.0 : 0.5;
+				double sum = 0;
+				for(int K = lo[2];K<=hi[2];K++)
+					for(int J = lo[1];J<=hi[1];J++)
+						for(int I = lo[0];I<=hi[0];I++)
+							sum += ec[node(nc,I,J,K)];
+				e[node(n,i,j,k)] += w[0]*w[1]*w[2]*sum;
+			}
+		}
+	}
+}
+
+//Approximately solves A e = r on level l; r is mg.r[l], the result is left in mg.e[l].
+static void vcycle(pb_multigrid_t& mg, const size_t& l)
+{
+	const pb_lattice_t& L = *mg.lat[l];
+	std::vector<double>& r = mg.r[l];
+	std::vector<double>& e = mg.e[l];
+	std::vector<double>& t = mg.t[l];
+	std::fill(e.begin(),e.end(),0.0);
+	if(l + 1 == mg.lat.size())
+	{
+		jacobi(L,r,e,t,PB_COARSEST_SWEEPS,mg.pool);
+		return;
+	}
+
+	jacobi(L,r,e,t,PB_SMOOTHING_SWEEPS,mg.pool);
+	apply(L,e,t,mg.pool);
+	const int n = L.n;
+	for(int k = 1;k<n-1;k++)
+		for(int j = 1;j<n-1;j++)
+			for(int i = 1;i<n-1;i++)
+			{
+				size_t c = node(n,i,j,k);
+				t[c] = r[c] - t[c];
+			}
+	restrict_residual(L,t,*mg.lat[l+1],mg.r[l+1]);
+	vcycle(mg,l+1);
+	prolong_add(*mg.lat[l+1],mg.e[l+1],L,e);
+	jacobi(L,r,e,t,PB_SMOOTHING_SWEEPS,mg.pool);
+}
+
+static void build_multigrid(pb_lattice_t& L, pb_multigrid_t& mg, mmpbsa::pb_thread_pool_t* pool)
+{
+	size_t num_coarse = 0;
+	for(int n = L.n;can_coarsen(n);n = (n + 1)/2)
+		num_coarse++;
+	mg.coarse.resize(num_coarse);
+	mg.lat.assign(1,&L);
+	for(size_t i = 0;i<num_coarse;i++)
+	{
+		coarsen(*mg.lat.back(),mg.coarse[i]);
+		mg.lat.push_back(&mg.coarse[i]);
+	}
+	mg.r.resize(mg.lat.size());
+	mg.e.resize(mg.lat.size());
+	mg.t.resize(mg.lat.size());
+	for(size_t i = 0;i<mg.lat.size();i++)
+	{
+		size_t size = size_t(mg.lat[i]->n)*mg.lat[i]->n*mg.lat[i]->n;
+		mg.r[i].assign(size,0);
+		mg.e[i].assign(size,0);
+		mg.t[i].assign(size,0);
+	}
+	mg.pool = pool;
+}
+
+static double inner_product(const std::vector<double>& a, const std::vector<double>& b)
+{
+	double sum = 0;
+	for(size_t i = 0;i<a.size();i++)
+		sum += a[i]*b[i];
+	return sum;
+}
+
+/**
+ * Solves A x = b with multigrid preconditioned conjugate gradients. Boundary values of x
+ * are fixed. Boundary values of b are ignored.
+ *
+ * @return number of iterations
+ */
+static size_t pcg(pb_lattice_t& L, const std::vector<double>& b, std::vector<double>& x,
+		const mmpbsa_t& tolerance, const size_t& max_iterations, mmpbsa::pb_thread_pool_t* pool)
+{
+	pb_multigrid_t mg;
+	build_multigrid(L,mg,pool);
+	const int n = L.n;
+	size_t size = x.size();
+	std::vector<double> r(size,0),p(size,0),q(size,0);
+
+	apply(L,x,q,pool);
+	double bnorm = 0;
+	for(int k = 1;k<n-1;k++)
+		for(int j = 1;j<n-1;j++)
+			for(int i = 1;i<n-1;i++)
+			{
+				size_t c = node(n,i,j,k);
+				r[c] = b[c] - q[c];
+				bnorm += b[c]*b[c];
+			}
+	double rnorm = sqrt(inner_product(r,r));
+	bnorm = std::max(sqrt(bnorm),rnorm);
+	if(rnorm == 0)
+		return 0;
+
+	mg.r[0] = r;
+	vcycle(mg,0);
+	p = mg.e[0];
+	double rz = inner_product(r,mg.e[0]);
+	size_t iteration = 0;
+	for(;iteration < max_iterations;)
+	{
+		apply(L,p,q,pool);
+		double pq = inner_product(p,q);
+		if(pq <= 0)
+			break;
+		double alpha = rz/pq;
+		for(size_t c = 0;c<size;c++)
+		{
+			x[c] += alpha*p[c];
+			r[c] -= alpha*q[c];
+		}
+		iteration++;
+		if(sqrt(inner_product(r,r)) <= tolerance*bnorm)
+			break;
+		mg.r[0] = r;
+		vcycle(mg,0);
+		double rz_new = inner_product(r,mg.e[0]);
+		double beta = rz_new/rz;
+		rz = rz_new;
+		for(size_t c = 0;c<size;c++)
+			p[c] = mg.e[0][c] + beta*p[c];
+	}
+	if(iteration == max_iterations)
+		std::cerr << "mmpbsa::PBMultigrid: WARNING: Grid with " << n << "^3 points did not converge in "
+			<< max_iterations << " iterations." << std::endl;
+	return iteration;
+}
+
+/**
+ * Sets uniform dielectric and no electrolyte, i.e. the reference (vacuum) environment.
+ */
+static void uniform_environment(pb_lattice_t& L, const mmpbsa_t& dielectric)
+{
+	size_t size = size_t(L.n)*L.n*L.n;
+	L.ex.assign(size,L.h*dielectric);
+	L.ey.assign(size,L.h*dielectric);
+	L.ez.assign(size,L.h*dielectric);
+	L.k2.assign(size,0);
+	set_diagonal(L);
+}
+
+/**
+ * Marks nodes within radius of the point with flag.
+ */
+static void stamp_sphere(const pb_lattice_t& L, std::vector<unsigned char>& flags, const mmpbsa_t* pos,
+		const mmpbsa_t& radius, const unsigned char& flag)
+{
+	const int n = L.n;
+	int lo[3],hi[3];
+	for(size_t d = 0;d<3;d++)
+	{
+		lo[d] = std::max(0,int(ceil((pos[d] - radius - L.origin[d])/L.h)));
+		hi[d] = std::min(n-1,int(floor((pos[d] + radius - L.origin[d])/L.h)));
+		if(lo[d] > hi[d])
+			return;
+	}
+	mmpbsa_t r2 = radius*radius;
+	for(int k = lo[2];k<=hi[2];k++)
+	{
+		mmpbsa_t dz = L.origin[2] + k*L.h - pos[2];
+		for(int j = lo[1];j<=hi[1];j++)
+		{
+			mmpbsa_t dy = L.origin[1] + j*L.h - pos[1];
+			mmpbsa_t dyz2 = dy*dy + dz*dz;
+			if(dyz2 > r2)
+				continue;
+			size_t c = node(n,lo[0],j,k);
+			for(int i = lo[0];i<=hi[0];i++,c++)
+			{
+				mmpbsa_t dx = L.origin[0] + i*L.h - pos[0];
+				if(dx*dx + dyz2 < r2)
+					flags[c] |= flag;
+			}
+		}
+	}
+}
+
+/**
+ * Sets the solute dielectric inside the molecular surface and the solvent dielectric
+ * outside of it. Ions are excluded within the atomic radius plus the exclusion radius.
+ *
+ * As in MEAD, the dielectric of a face is that of the point midway between its two
+ * nodes. Therefore, points are classified on a lattice with half of the spacing, on
+ * which nodes have even and face midpoints mixed indices.
+ *
+ * The molecular surface is found by placing probe spheres at every point of that
+ * lattice that is outside of the solvent accessible surface and adjacent to it.
+ * Points within the solvent accessible surface, which no probe reaches, are solute.
+ */
+static void environment_by_atoms(pb_lattice_t& L, const std::valarray<mmpbsa::Vector>& crds,
+		const std::vector<mead_data_t>& radii, const mmpbsa_t& eps_in, const mmpbsa_t& eps_out,
+		const mmpbsa_t& probe, const mmpbsa_t& kappa2, const mmpbsa_t& exclusion)
+{
+	enum {ACCESSIBLE_INTERIOR = 1, ION_EXCLUDED = 2, PROBE_REACHED = 4};
+	const int n = L.n;
+	const size_t nn = size_t(n)*n;
+	size_t size = nn*n;
+	pb_lattice_t H;
+	H.n = 2*n - 1;
+	H.h = L.h/2;
+	for(size_t d = 0;d<3;d++)
+		H.origin[d] = L.origin[d];
+	const int m = H.n;
+	const size_t mm = size_t(m)*m;
+	std::vector<unsigned char> flags(mm*m,0);
+	mmpbsa_t pos[3];
+
+	for(size_t a = 0;a<crds.size();a++)
+	{
+		for(size_t d = 0;d<3;d++)
+			pos[d] = crds[a].at(d);
+		stamp_sphere(H,flags,pos,radii[a] + probe,ACCESSIBLE_INTERIOR);
+		stamp_sphere(H,flags,pos,radii[a] + exclusion,ION_EXCLUDED);
+	}
+
+	if(probe > 0)
+	{
+		for(int k = 0;k<m;k++)
+			for(int j = 0;j<m;j++)
+				for(int i = 0;i<m;i++)
+				{
+					size_t c = node(m,i,j,k);
+					if(flags[c] & ACCESSIBLE_INTERIOR)
+						continue;
+					bool on_surface = (i > 0 && (flags[c-1] & ACCESSIBLE_INTERIOR)) || (i < m-1 && (flags[c+1] & ACCESSIBLE_INTERIOR))
+						|| (j > 0 && (flags[c-m] & ACCESSIBLE_INTERIOR)) || (j < m-1 && (flags[c+m] & ACCESSIBLE_INTERIOR))
+						|| (k > 0 && (flags[c-mm] & ACCESSIBLE_INTERIOR)) || (k < m-1 && (flags[c+mm] & ACCESSIBLE_INTERIOR));
+					if(!on_surface)
+						continue;
+					pos[0] = H.origin[0] + i*H.h;
+					pos[1] = H.origin[1] + j*H.h;
+					pos[2] = H.origin[2] + k*H.h;
+					stamp_sphere(H,flags,pos,probe,PROBE_REACHED);
+				}
+	}
+
+	L.k2.resize(size);
+	L.ex.assign(size,0);
+	L.ey.assign(size,0);
+	L.ez.assign(size,0);
+	const float face_in = L.h*eps_in, face_out = L.h*eps_out;
+	for(int k = 0;k<n;k++)
+		for(int j = 0;j<n;j++)
+			for(int i = 0;i<n;i++)
+			{
+				size_t c = node(n,i,j,k);
+				size_t f = node(m,2*i,2*j,2*k);
+				L.k2[c] = (flags[f] & ION_EXCLUDED) ? 0 : eps_out*kappa2;
+				if(i < n-1)
+					L.ex[c] = ((flags[f+1] & ACCESSIBLE_INTERIOR) && !(flags[f+1] & PROBE_REACHED)) ? face_in : face_out;
+				if(j < n-1)
+					L.ey[c] = ((flags[f+m] & ACCESSIBLE_INTERIOR) && !(flags[f+m] & PROBE_REACHED)) ? face_in : face_out;
+				if(k < n-1)
+					L.ez[c] = ((flags[f+mm] & ACCESSIBLE_INTERIOR) && !(flags[f+mm] & PROBE_REACHED)) ? face_in : face_out;
+			}
+	set_diagonal(L);
+}
+
+/**
+ * Trilinear interpolation of the potential. Returns false if the point is outside the grid.
+ */
+static bool interpolate(const pb_lattice_t& L, const std::vector<double>& phi, const mmpbsa_t* pos, double& value)
+{
+	int i0[3];
+	double g[3];
+	for(size_t d = 0;d<3;d++)
+	{
+		g[d] = (pos[d] - L.origin[d])/L.h;
+		if(g[d] < 0 || g[d] > L.n - 1)
+			return false;
+		i0[d] = std::min(int(floor(g[d])),L.n - 2);
+		g[d] -= i0[d];
+	}
+	value = 0;
+	for(int c = 0;c<8;c++)
+	{
+		int di = c & 1, dj = (c >> 1) & 1, dk = (c >> 2) & 1;
+		double w = ((di) ? g[0] : 1 - g[0])*((dj) ? g[1] : 1 - g[1])*((dk) ? g[2] : 1 - g[2]);
+		value += w*phi[node(L.n,i0[0]+di,i0[1]+dj,i0[2]+dk)];
+	}
+	return true;
+}
+
+mmpbsa::PBMultigrid::PBMultigrid(const std::vector<mmpbsa::atom_t>& atoms, const std::map<std::string,mead_data_t>& radii,
+		const mmpbsa_t& interactionStrength, const mmpbsa_t& exclusionRadius)
+{
+	solute_dielectric = 1.0;
+	solvent_dielectric = 80.0;
+	probe_radius = 1.4;
+	tolerance = 1e-6;
+	max_iterations = 200;
+	nthreads = 1;
+	last_iterations = 0;
+	pool = 0;
+	pool_size = 0;
+	istrength = interactionStrength;
+	exclusion_radius = exclusionRadius;
+
+	atom_radii = mmpbsa::MeadInterface::lookup_radii(atoms,radii);
+	charges.resize(atoms.size());
+	for(size_t i = 0;i<atoms.size();i++)
+		charges[i] = atoms[i].charge;
+}
+
+mmpbsa::PBMultigrid::~PBMultigrid()
+{
+#ifdef USE_PTHREADS
+	destroy_thread_pool(pool);
+#endif
+}
+
+void mmpbsa::PBMultigrid::start_threads()
+{
+#ifdef USE_PTHREADS
+	if(pool_size == nthreads)
+		return;
+	destroy_thread_pool(pool);
+	pool = (nthreads > 1) ? create_thread_pool(nthreads) : 0;
+	pool_size = nthreads;
+#endif
+}
+
+std::vector<mmpbsa::grid_level_t> mmpbsa::PBMultigrid::prepare_levels(const std::valarray<mmpbsa::Vector>& crds,
+		const std::vector<mmpbsa::grid_level_t>& levels) throw (mmpbsa::MMPBSAException)
+{
+	if(crds.size() != charges.size())
+	{
+		std::ostringstream error;
+		error << "mmpbsa::PBMultigrid::pb_solvation: Number of coordinates (" << crds.size()
+				<< ") does not match the number of atoms (" << charges.size() << ")";
+		throw mmpbsa::MMPBSAException(error,mmpbsa::DATA_FORMAT_ERROR);
+	}
+	if(levels.size() == 0)
+		throw mmpbsa::MMPBSAException("mmpbsa::PBMultigrid::pb_solvation: No grid levels were provided.",mmpbsa::DATA_FORMAT_ERROR);
+
+	//Enlarge grids so that they may be coarsened.
+	std::vector<grid_level_t> mg_levels = levels;
+	for(size_t i = 0;i<mg_levels.size();i++)
+		mg_levels[i].dim = multigrid_dim(levels[i].dim);
+
+	//Previous potentials are only a useful start on the same grid.
+	bool same_grid = (warm_levels.size() == mg_levels.size());
+	for(size_t i = 0;same_grid && i<mg_levels.size();i++)
+	{
+		same_grid = (warm_levels[i].dim == mg_levels[i].dim && warm_levels[i].spacing == mg_levels[i].spacing);
+		for(size_t d = 0;same_grid && d<3;d++)
+			same_grid = (warm_levels[i].center[d] == mg_levels[i].center[d]);
+	}
+	if(!same_grid)
+	{
+		warm_solvent.clear();
+		warm_reference.clear();
+		warm_levels = mg_levels;
+	}
+
+	return mg_levels;
+}
+
+mmpbsa_t mmpbsa::PBMultigrid::pb_solvation(const std::valarray<mmpbsa::Vector>& crds,
+		const std::vector<mmpbsa::grid_level_t>& levels) throw (mmpbsa::MMPBSAException)
+{
+	std::vector<mmpbsa::pb_condition_t> conditions(1);
+	conditions[0].istrength = istrength;
+	conditions[0].interior_dielectric = solute_dielectric;
+	return pb_solvation(crds,levels,conditions)[0];
+}
+
+std::vector<mmpbsa_t> mmpbsa::PBMultigrid::pb_solvation(const std::valarray<mmpbsa::Vector>& crds,
+		const std::vector<mmpbsa::grid_level_t>& levels,
+		const std::vector<mmpbsa::pb_condition_t>& conditions,
+		std::vector<mmpbsa_t>* atom_energies) throw (mmpbsa::MMPBSAException)
+{
+	if(conditions.size() == 0)
+		throw mmpbsa::MMPBSAException("mmpbsa::PBMultigrid::pb_solvation: No PB conditions were provided.",mmpbsa::DATA_FORMAT_ERROR);
+	std::vector<grid_level_t> mg_levels = prepare_levels(crds,levels);
+	start_threads();
+	const mmpbsa_t orig_dielectric = solute_dielectric;
+	const mmpbsa_t orig_istrength = istrength;
+	std::vector<mmpbsa_t> returnMe(conditions.size());
+	std::vector<mmpbsa_t> atom_ref,atom_sol;
+
+	last_iterations = 0;
+	solute_dielectric = 1.0;
+	mmpbsa_t prod_ref = solve_levels(crds,mg_levels,true,warm_reference,(atom_energies != 0) ? &atom_ref : 0);
+	for(size_t i = 0;i<conditions.size();i++)
+	{
+		solute_dielectric = conditions[i].interior_dielectric;
+		istrength = conditions[i].istrength;
+		mmpbsa_t prod_sol = solve_levels(crds,mg_levels,false,warm_solvent,(i == 0 && atom_energies != 0) ? &atom_sol : 0);
+		returnMe[i] = (prod_sol - prod_ref/conditions[i].interior_dielectric) / 2.0;
+	}
+	if(atom_energies != 0)
+	{
+		atom_energies->resize(crds.size());
+		for(size_t a = 0;a<crds.size();a++)
+			(*atom_energies)[a] = (atom_sol[a] - atom_ref[a]/conditions[0].interior_dielectric) / 2.0;
+	}
+	solute_dielectric = orig_dielectric;
+	istrength = orig_istrength;
+	return returnMe;
+}
+
+mmpbsa_t mmpbsa::PBMultigrid::solve_levels(const std::valarray<mmpbsa::Vector>& crds,
+		const std::vector<mmpbsa::grid_level_t>& levels, bool reference,
+		std::vector<std::vector<double> >& warm_start,
+		std::vector<mmpbsa_t>* atom_products)
+{
+	const size_t num_levels = levels.size();
+	const mmpbsa_t kappa2 = PB_KAPPA2_PER_MOLAR*istrength;
+	const mmpbsa_t boundary_eps = (reference) ? solute_dielectric : solvent_dielectric;
+	const mmpbsa_t boundary_kappa = (reference) ? 0 : sqrt(kappa2);
+	std::vector<pb_lattice_t> grids(num_levels);
+	std::vector<std::vector<double> > phi(num_levels);
+	mmpbsa_t pos[3];
+
+	for(size_t l = 0;l<num_levels;l++)
+	{
+		pb_lattice_t& L = grids[l];
+		L.n = levels[l].dim;
+		L.h = levels[l].spacing;
+		for(size_t d = 0;d<3;d++)
+			L.origin[d] = levels[l].center[d] - L.h*(L.n - 1)/2;
+		const int n = L.n;
+		size_t size = size_t(n)*n*n;
+
+		if(reference)
+			uniform_environment(L,solute_dielectric);
+		else
+			environment_by_atoms(L,crds,atom_radii,solute_dielectric,solvent_dielectric,probe_radius,kappa2,exclusion_radius);
+
+		if(warm_start.size() == num_levels && warm_start[l].size() == size)
+			phi[l] = warm_start[l];
+		else
+			phi[l].assign(size,0);
+
+		//Boundary values from the coarser level or, outside of it, Debye-Huckel potential of the charges.
+		for(int k = 0;k<n;k++)
+			for(int j = 0;j<n;j++)
+				for(int i = 0;i<n;i++)
+				{
+					if(!is_boundary(n,i,j,k))
+					{
+						i = n - 2;//skip to the far face.
+						continue;
+					}
+					pos[0] = L.origin[0] + i*L.h;
+					pos[1] = L.origin[1] + j*L.h;
+					pos[2] = L.origin[2] + k*L.h;
+					double value;
+					if(l > 0 && interpolate(grids[l-1],phi[l-1],pos,value))
+					{
+						phi[l][node(n,i,j,k)] = value;
+						continue;
+					}
+					value = 0;
+					for(size_t a = 0;a<crds.size();a++)
+					{
+						mmpbsa_t dx = crds[a].x() - pos[0],dy = crds[a].y() - pos[1],dz = crds[a].z() - pos[2];
+						mmpbsa_t r = sqrt(dx*dx + dy*dy + dz*dz);
+						if(r < L.h)
+							r = L.h;
+						value += charges[a]*exp(-boundary_kappa*r)/(boundary_eps*r);
+					}
+					phi[l][node(n,i,j,k)] = value;
+				}
+
+		//Charges are distributed to the eight surrounding nodes.
+		std::vector<double> b(size,0);
+		for(size_t a = 0;a<crds.size();a++)
+		{
+			int i0[3];
+			double g[3];
+			bool inside = true;
+			for(size_t d = 0;d<3 && inside;d++)
+			{
+				g[d] = (crds[a].at(d) - L.origin[d])/L.h;
+				inside = (g[d] >= 0 && g[d] <= n - 1);
+				i0[d] = std::min(int(floor(g[d])),n - 2);
+				g[d] -= i0[d];
+			}
+			if(!inside)
+				continue;
+			for(int c = 0;c<8;c++)
+			{
+				int di = c & 1, dj = (c >> 1) & 1, dk = (c >> 2) & 1;
+				if(is_boundary(n,i0[0]+di,i0[1]+dj,i0[2]+dk))
+					continue;
+				double w = ((di) ? g[0] : 1 - g[0])*((dj) ? g[1] : 1 - g[1])*((dk) ? g[2] : 1 - g[2]);
+				b[node(n,i0[0]+di,i0[1]+dj,i0[2]+dk)] += 4*M_PI*charges[a]*w;
+			}
+		}
+
+		last_iterations += pcg(L,b,phi[l],tolerance,max_iterations,pool);
+	}
+
+	//phi * rho, using the finest level that contains each atom.
+	mmpbsa_t returnMe = 0;
+	if(atom_products != 0)
+		atom_products->assign(crds.size(),0);
+	for(size_t a = 0;a<crds.size();a++)
+	{
+		for(size_t d = 0;d<3;d++)
+			pos[d] = crds[a].at(d);
+		for(size_t l = num_levels;l > 0;l--)
+		{
+			double value;
+			if(interpolate(grids[l-1],phi[l-1],pos,value))
+			{
+				returnMe += charges[a]*value;
+				if(atom_products != 0)
+					(*atom_products)[a] = charges[a]*value;
+				break;
+			}
+		}
+	}
+
+	warm_start.swap(phi);
+	return returnMe;
+}
+
+#ifdef USE_PTHREADS
+typedef struct {
+	mmpbsa::PBMultigrid* solver;
+	const std::valarray<mmpbsa::Vector>* crds;
+	const std::vector<mmpbsa::grid_level_t>* levels;
+	const std::vector<mmpbsa::pb_condition_t>* conditions;
+	std::vector<mmpbsa_t> energies;
+	std::string error;
+	mmpbsa::MMPBSAErrorTypes error_type;
+}concurrent_solve_t;
+
+static void* run_concurrent_solve(void* arg)
+{
+	concurrent_solve_t* solve = (concurrent_solve_t*) arg;
+	try
+	{
+		solve->energies = solve->solver->pb_solvation(*solve->crds,*solve->levels,*solve->conditions);
+	}
+	catch(const mmpbsa::MMPBSAException& e)
+	{
+		solve->error = e.what();
+		solve->error_type = e.getErrType();
+	}
+	return 0;
+}
+#endif
+
+void mmpbsa::PBMultigrid::pb_solvation_concurrent(const std::vector<mmpbsa::PBMultigrid*>& solvers,
+		const std::vector<const std::valarray<mmpbsa::Vector>*>& crds,
+		const std::vector<mmpbsa::grid_level_t>& levels,
+		const std::vector<mmpbsa::pb_condition_t>& conditions,
+		std::vector<std::vector<mmpbsa_t> >& energies) throw (mmpbsa::MMPBSAException)
+{
+	if(solvers.size() != crds.size())
+		throw mmpbsa::MMPBSAException("mmpbsa::PBMultigrid::pb_solvation_concurrent: Each solver needs a set of coordinates.",mmpbsa::DATA_FORMAT_ERROR);
+	energies.resize(solvers.size());
+#ifdef USE_PTHREADS
+	std::vector<concurrent_solve_t> solves(solvers.size());
+	std::vector<pthread_t> threads(solvers.size());
+	std::vector<bool> started(solvers.size(),false);
+	for(size_t i = 0;i<solvers.size();i++)
+	{
+		solves[i].solver = solvers[i];
+		solves[i].crds = crds[i];
+		solves[i].levels = &levels;
+		solves[i].conditions = &conditions;
+		started[i] = (pthread_create(&threads[i],NULL,run_concurrent_solve,&solves[i]) == 0);
+	}
+	for(size_t i = 0;i<solvers.size();i++)
+	{
+		if(started[i])
+			pthread_join(threads[i],NULL);
+		else
+			run_concurrent_solve(&solves[i]);
+	}
+	for(size_t i = 0;i<solvers.size();i++)
+	{
+		if(solves[i].error.size())
+			throw mmpbsa::MMPBSAException(solves[i].error,solves[i].error_type);
+		energies[i] = solves[i].energies;
+	}
+#else
+	for(size_t i = 0;i<solvers.size();i++)
+		energies[i] = solvers[i]->pb_solvation(*crds[i],levels,conditions);
+#endif
+}
@@ -0,0 +1,155 @@
+/**
+ * @class mmpbsa::PBMultigrid
+ * @brief Multigrid Poisson-Boltzmann solver
+ *
+ * Solves the linearized Poisson-Boltzmann equation on the same focusing levels that
+ * are given to MEAD (cf MeadInterface::grid_levels), as an alternative to MEAD's
+ * successive over-relaxation.
+ *
+ * Each level is solved with conjugate gradients, preconditioned by a geometric
+ * multigrid V-cycle with weighted Jacobi smoothing. When compiled with pthreads,
+ * the operator and the smoother are applied by several threads. The
+ * potential of the previous call is used as the starting guess when the grid is
+ * unchanged, e.g. with fixed_grid.
+ *
+ * The model matches the one used with MEAD in MeadInterface::pb_solvation:
+ * the solute dielectric region is bounded by the molecular surface (probe
+ * radius 1.4), the dielectric of the face between two grid points is the one
+ * at its midpoint, ions are excluded within the atomic radius plus the exclusion
+ * radius, the coarsest level has Debye-Huckel boundary values and each finer
+ * level takes its boundary values from the level before it. The solvation
+ * energy is the difference of the solvent and vacuum (reference) solves,
+ * both on the same grid, so that grid self energies cancel.
+ *
+ * Units are those of Amber charges, i.e. energies are in kcal/mol.
+ */
+
+#ifndef PBMULTIGRID_H
+#define PBMULTIGRID_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <vector>
+#include <valarray>
+#include <map>
+#include <string>
+
+#include "globals.h"
+#include "structs.h"
+#include "mmpbsa_exceptions.h"
+#include "Vector.h"
+#include "MeadInterface.h"
+
+namespace mmpbsa{
+
+struct pb_thread_pool_t;
+
+class PBMultigrid {
+public:
+	mmpbsa_t solute_dielectric;///<Default = 1
+	mmpbsa_t solvent_dielectric;///<Default = 80
+	mmpbsa_t probe_radius;///<Angstroms. Default = 1.4
+	mmpbsa_t tolerance;///<Relative residual at which a level is considered solved. Default = 1e-6
+	size_t max_iterations;///<Conjugate gradient iterations allowed per level. Default = 200
+	int nthreads;///<Threads used for smoothing and operator application. They are kept by the solver between solves. Default = 1
+
+	size_t last_iterations;///<Total number of conjugate gradient iterations used by the last call to pb_solvation
+
+	/**
+	 * Stores the atom data (charges and radii) of the molecule. These do not
+	 * change from snapshot to snapshot.
+	 *
+	 * @param atoms
+	 * @param radii
+	 * @param interactionStrength Ionic strength (molar)
+	 * @param exclusionRadius Ion exclusion radius (Angstroms)
+	 */
+	PBMultigrid(const std::vector<mmpbsa::atom_t>& atoms, const std::map<std::string,mead_data_t>& radii,
+			const mmpbsa_t& interactionStrength = 0.0, const mmpbsa_t& exclusionRadius = 2.0);
+	virtual ~PBMultigrid();
+
+	/**
+	 * Calculates the PB solvation energy of the molecule with the provided coordinates,
+	 * on the provided focusing levels (coarsest first).
+	 *
+	 * To allow multigrid coarsening, each level may be enlarged by a few grid points.
+	 * Spacing and center of each level are unchanged.
+	 */
+	mmpbsa_t pb_solvation(const std::valarray<mmpbsa::Vector>& crds,
+			const std::vector<mmpbsa::grid_level_t>& levels) throw (mmpbsa::MMPBSAException);
+
+	/**
+	 * Calculates the PB solvation energy for each of the conditions, in their order.
+	 * The reference (vacuum) potential is solved once, with an interior dielectric
+	 * of 1, and its energy scaled by the inverse of each interior dielectric. Each solvent
+	 * solve starts from the potential of the one before it. The solute dielectric and
+	 * ionic strength of the solver are unchanged.
+	 *
+	 * If atom_energies is not null, it is replaced by the energy of the first condition
+	 * decomposed by atom, q_i (phi_solv(r_i) - phi_ref(r_i)) / 2.
+	 */
+	std::vector<mmpbsa_t> pb_solvation(const std::valarray<mmpbsa::Vector>& crds,
+			const std::vector<mmpbsa::grid_level_t>& levels,
+			const std::vector<mmpbsa::pb_condition_t>& conditions,
+			std::vector<mmpbsa_t>* atom_energies = 0) throw (mmpbsa::MMPBSAException);
+
+	/**
+	 * Estimated memory, in bytes, used per grid point during a solve, including the
+	 * potentials kept for warm starts and the enlargement of levels for coarsening.
+	 */
+	static size_t bytes_per_grid_point(){return 136;}
+
+	/**
+	 * Calls pb_solvation of each solver with the corresponding coordinates, all
+	 * on the same grid levels and conditions. With pthreads, each solver runs in its
+	 * own thread. energies[i] belongs to solvers[i] and holds one energy per condition.
+	 */
+	static void pb_solvation_concurrent(const std::vector<PBMultigrid*>& solvers,
+			const std::vector<const std::valarray<mmpbsa::Vector>*>& crds,
+			const std::vector<mmpbsa::grid_level_t>& levels,
+			const std::vector<mmpbsa::pb_condition_t>& conditions,
+			std::vector<std::vector<mmpbsa_t> >& energies) throw (mmpbsa::MMPBSAException);
+
+private:
+	PBMultigrid(const PBMultigrid& orig);
+	PBMultigrid& operator=(const PBMultigrid& orig);
+
+	/**
+	 * Checks the coordinates and levels and returns the levels enlarged for coarsening.
+	 * Warm start potentials are discarded if the grid has changed.
+	 */
+	std::vector<mmpbsa::grid_level_t> prepare_levels(const std::valarray<mmpbsa::Vector>& crds,
+			const std::vector<mmpbsa::grid_level_t>& levels) throw (mmpbsa::MMPBSAException);
+
+	/**
+	 * Solves all levels with either the solvent or the reference environment and
+	 * returns phi * rho. If atom_products is not null, it is replaced by q_i phi(r_i).
+	 */
+	mmpbsa_t solve_levels(const std::valarray<mmpbsa::Vector>& crds,
+			const std::vector<mmpbsa::grid_level_t>& levels, bool reference,
+			std::vector<std::vector<double> >& warm_start,
+			std::vector<mmpbsa_t>* atom_products = 0);
+
+	std::vector<mmpbsa_t> charges;
+	std::vector<mead_data_t> atom_radii;
+	mmpbsa_t istrength;
+	mmpbsa_t exclusion_radius;
+
+	//Grid of the previous call and its potentials, for warm starts
+	std::vector<mmpbsa::grid_level_t> warm_levels;
+	std::vector<std::vector<double> > warm_solvent, warm_reference;
+
+	/**
+	 * Starts the worker threads, or restarts them if nthreads has changed.
+	 */
+	void start_threads();
+
+	pb_thread_pool_t* pool;///<Worker threads, started by the first threaded solve
+	int pool_size;///<Value of nthreads when the pool was started
+};
+
+}//end namespace mmpbsa
+
+#endif//PBMULTIGRID_H
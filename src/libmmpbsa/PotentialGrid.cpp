@@ -0,0 +1,169 @@
+#include "PotentialGrid.h"
+
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+mmpbsa::PotentialGrid::PotentialGrid()
+{
+	for(size_t i = 0;i<3;i++)
+	{
+		dim[i] = 0;
+		origin[i] = 0;
+	}
+	spacing = 0;
+	signature = 0;
+}
+
+mmpbsa::PotentialGrid::PotentialGrid(const mmpbsa_t* min_corner, const mmpbsa_t* max_corner, const mmpbsa_t& spacing) throw (mmpbsa::MMPBSAException)
+{
+	if(spacing <= 0)
+		throw mmpbsa::MMPBSAException("mmpbsa::PotentialGrid: grid spacing must be positive.",mmpbsa::DATA_FORMAT_ERROR);
+	this->spacing = spacing;
+	signature = 0;
+	size_t num_points = 1;
+	for(size_t i = 0;i<3;i++)
+	{
+		if(max_corner[i] < min_corner[i])
+			throw mmpbsa::MMPBSAException("mmpbsa::PotentialGrid: the grid's box is empty.",mmpbsa::DATA_FORMAT_ERROR);
+		origin[i] = min_corner[i];
+		dim[i] = int(ceil((max_corner[i] - min_corner[i])/spacing)) + 1;
+		if(dim[i] < 2)
+			dim[i] = 2;
+		num_points *= dim[i];
+	}
+	values.assign(num_points,0);
+}
+
+mmpbsa::Vector mmpbsa::PotentialGrid::point(const int& i, const int& j, const int& k) const
+{
+	return mmpbsa::Vector(origin[0] + i*spacing,origin[1] + j*spacing,origin[2] + k*spacing);
+}
+
+bool mmpbsa::PotentialGrid::covers(const std::valarray<mmpbsa::Vector>& crds) const
+{
+	if(values.size() == 0)
+		return false;
+	for(size_t i = 0;i<crds.size();i++)
+		for(size_t axis = 0;axis<3;axis++)
+		{
+			mmpbsa_t offset = (crds[i][axis] - origin[axis])/spacing;
+			if(offset < 0 || offset > dim[axis] - 1)
+				return false;
+		}
+	return true;
+}
+
+mmpbsa_t mmpbsa::PotentialGrid::potential(const mmpbsa::Vector& r) const throw (mmpbsa::MMPBSAException)
+{
+	int lower[3];
+	mmpbsa_t frac[3];
+	for(size_t axis = 0;axis<3;axis++)
+	{
+		mmpbsa_t offset = (r[axis] - origin[axis])/spacing;
+		if(offset < 0 || offset > dim[axis] - 1)
+		{
+			std::ostringstream error;
+			error << "mmpbsa::PotentialGrid::potential: (" << r.x() << ", " << r.y() << ", " << r.z()
+					<< ") is outside of the potential grid.";
+			throw mmpbsa::MMPBSAException(error,mmpbsa::INVALID_ARRAY_SIZE);
+		}
+		lower[axis] = int(offset);
+		if(lower[axis] == dim[axis] - 1)//upper face
+			lower[axis]--;
+		frac[axis] = offset - lower[axis];
+	}
+
+	mmpbsa_t returnMe = 0;
+	for(int di = 0;di<2;di++)
+		for(int dj = 0;dj<2;dj++)
+			for(int dk = 0;dk<2;dk++)
+			{
+				mmpbsa_t weight = ((di) ? frac[0] : 1 - frac[0])
+						* ((dj) ? frac[1] : 1 - frac[1])
+						* ((dk) ? frac[2] : 1 - frac[2]);
+				returnMe += weight * values[index(lower[0]+di,lower[1]+dj,lower[2]+dk)];
+			}
+	return returnMe;
+}
+
+mmpbsa_t mmpbsa::PotentialGrid::interaction_energy(const std::valarray<mmpbsa::Vector>& crds,
+		const std::vector<mmpbsa::atom_t>& atoms) const throw (mmpbsa::MMPBSAException)
+{
+	if(crds.size() != atoms.size())
+	{
+		std::ostringstream error;
+		error << "mmpbsa::PotentialGrid::interaction_energy: Number of coordinates (" << crds.size()
+				<< ") does not match the number of atoms (" << atoms.size() << ")";
+		throw mmpbsa::MMPBSAException(error,mmpbsa::DATA_FORMAT_ERROR);
+	}
+	mmpbsa_t returnMe = 0;
+	for(size_t i = 0;i<crds.size();i++)
+		if(atoms[i].charge != 0)
+			returnMe += atoms[i].charge * potential(crds[i]);
+	return returnMe;
+}
+
+void mmpbsa::PotentialGrid::save(const std::string& filename) const throw (mmpbsa::MMPBSAException)
+{
+	std::fstream gridFile(filename.c_str(),std::ios::out | std::ios::binary);
+	if(!gridFile.good())
+		throw mmpbsa::MMPBSAException("mmpbsa::PotentialGrid::save: Could not open " + filename,mmpbsa::FILE_IO_ERROR);
+
+	int header[2] = {MMPBSA_POTENTIAL_GRID_MAGIC,MMPBSA_POTENTIAL_GRID_VERSION};
+	unsigned long long sig = signature;
+	gridFile.write((const char*)header,sizeof(header));
+	gridFile.write((const char*)&sig,sizeof(sig));
+	gridFile.write((const char*)dim,sizeof(dim));
+	gridFile.write((const char*)origin,sizeof(origin));
+	gridFile.write((const char*)&spacing,sizeof(mmpbsa_t));
+	if(values.size())
+		gridFile.write((const char*)&values[0],values.size()*sizeof(mead_data_t));
+	if(!gridFile.good())
+		throw mmpbsa::MMPBSAException("mmpbsa::PotentialGrid::save: Could not write " + filename,mmpbsa::FILE_IO_ERROR);
+	gridFile.close();
+}
+
+void mmpbsa::PotentialGrid::load(const std::string& filename) throw (mmpbsa::MMPBSAException)
+{
+	std::fstream gridFile(filename.c_str(),std::ios::in | std::ios::binary);
+	if(!gridFile.good())
+		throw mmpbsa::MMPBSAException("mmpbsa::PotentialGrid::load: Could not open " + filename,mmpbsa::FILE_IO_ERROR);
+
+	int header[2];
+	unsigned long long sig;
+	int new_dim[3];
+	mmpbsa_t new_origin[3],new_spacing;
+	gridFile.read((char*)header,sizeof(header));
+	if(!gridFile.good() || header[0] != MMPBSA_POTENTIAL_GRID_MAGIC)
+		throw mmpbsa::MMPBSAException("mmpbsa::PotentialGrid::load: " + filename + " is not a potential grid file, "
+				"or was written on a host with a different byte order.",mmpbsa::DATA_FORMAT_ERROR);
+	if(header[1] != MMPBSA_POTENTIAL_GRID_VERSION)
+	{
+		std::ostringstream error;
+		error << "mmpbsa::PotentialGrid::load: " << filename << " has version " << header[1]
+		      << " of the potential grid format. Version " << MMPBSA_POTENTIAL_GRID_VERSION << " is supported.";
+		throw mmpbsa::MMPBSAException(error,mmpbsa::DATA_FORMAT_ERROR);
+	}
+	gridFile.read((char*)&sig,sizeof(sig));
+	gridFile.read((char*)new_dim,sizeof(new_dim));
+	gridFile.read((char*)new_origin,sizeof(new_origin));
+	gridFile.read((char*)&new_spacing,sizeof(mmpbsa_t));
+	if(!gridFile.good() || new_spacing <= 0 || new_dim[0] < 2 || new_dim[1] < 2 || new_dim[2] < 2)
+		throw mmpbsa::MMPBSAException("mmpbsa::PotentialGrid::load: The header of " + filename + " is corrupt.",mmpbsa::DATA_FORMAT_ERROR);
+
+	std::vector<mead_data_t> new_values(size_t(new_dim[0])*new_dim[1]*new_dim[2]);
+	gridFile.read((char*)&new_values[0],new_values.size()*sizeof(mead_data_t));
+	if(gridFile.gcount() != std::streamsize(new_values.size()*sizeof(mead_data_t)))
+		throw mmpbsa::MMPBSAException("mmpbsa::PotentialGrid::load: " + filename + " ends before its last grid point.",mmpbsa::UNEXPECTED_EOF);
+	gridFile.close();
+
+	signature = size_t(sig);
+	for(size_t i = 0;i<3;i++)
+	{
+		dim[i] = new_dim[i];
+		origin[i] = new_origin[i];
+	}
+	spacing = new_spacing;
+	values.swap(new_values);
+}
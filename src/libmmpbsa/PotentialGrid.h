@@ -0,0 +1,107 @@
+/**
+ * @class mmpbsa::PotentialGrid
+ * @brief Electrostatic potential of a molecule, sampled on a regular grid
+ *
+ * Stores the potential of a rigid receptor, in solvent, at the points of a
+ * regular grid covering the region where ligand atoms may be found. The interaction
+ * energy of a ligand pose with the receptor, including the receptor's reaction
+ * field, is then the sum of each ligand charge times the potential at its position,
+ * which is obtained by trilinear interpolation. This allows many poses to be scored
+ * with one finite difference solve (cf MeadInterface::receptor_potential).
+ *
+ * The potential is in the units of Amber charges, i.e. charge times potential is
+ * in kcal/mol.
+ *
+ * Grids may be saved to and loaded from a binary file, so that one receptor solve
+ * can be used by several jobs. The file consists of the magic number, a format
+ * version, the signature, the three grid dimensions, the origin and the spacing,
+ * followed by the potential values (x varies slowest). Values are written in the
+ * byte order of the host; files are not portable between hosts of different endianness,
+ * which is detected by the magic number.
+ */
+
+#ifndef POTENTIALGRID_H
+#define POTENTIALGRID_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string>
+#include <vector>
+#include <valarray>
+
+#include "globals.h"
+#include "structs.h"
+#include "mmpbsa_exceptions.h"
+#include "Vector.h"
+
+//First bytes of a potential grid file ("MMPG" in host byte order) and the version of its layout.
+#define MMPBSA_POTENTIAL_GRID_MAGIC 0x4d4d5047
+#define MMPBSA_POTENTIAL_GRID_VERSION 1
+
+namespace mmpbsa{
+
+class PotentialGrid {
+public:
+	int dim[3];///<Number of grid points along each axis
+	mmpbsa_t origin[3];///<Position of the first grid point (Angstroms)
+	mmpbsa_t spacing;///<Angstroms
+	size_t signature;///<Identifies the molecule whose potential is stored, e.g. a hash of its coordinates. Zero if unknown.
+	std::vector<mead_data_t> values;
+
+	/**
+	 * Empty grid.
+	 */
+	PotentialGrid();
+
+	/**
+	 * Grid, with zero potential, whose points cover the box from min_corner to max_corner.
+	 */
+	PotentialGrid(const mmpbsa_t* min_corner, const mmpbsa_t* max_corner, const mmpbsa_t& spacing) throw (mmpbsa::MMPBSAException);
+
+	virtual ~PotentialGrid(){}
+
+	size_t size() const {return values.size();}
+
+	size_t index(const int& i, const int& j, const int& k) const {return (size_t(i)*dim[1] + j)*dim[2] + k;}
+
+	/**
+	 * Position of the grid point (i,j,k).
+	 */
+	mmpbsa::Vector point(const int& i, const int& j, const int& k) const;
+
+	/**
+	 * Determines whether every coordinate lies within the grid.
+	 */
+	bool covers(const std::valarray<mmpbsa::Vector>& crds) const;
+
+	/**
+	 * Trilinear interpolation of the potential at the provided position. Throws
+	 * an exception if the position is outside of the grid.
+	 */
+	mmpbsa_t potential(const mmpbsa::Vector& r) const throw (mmpbsa::MMPBSAException);
+
+	/**
+	 * Interaction energy of the charges with the stored potential, sum_i q_i phi(r_i),
+	 * in kcal/mol. atoms[i] is the atom at crds[i].
+	 */
+	mmpbsa_t interaction_energy(const std::valarray<mmpbsa::Vector>& crds,
+			const std::vector<mmpbsa::atom_t>& atoms) const throw (mmpbsa::MMPBSAException);
+
+	/**
+	 * Writes the grid to a binary file.
+	 */
+	void save(const std::string& filename) const throw (mmpbsa::MMPBSAException);
+
+	/**
+	 * Replaces the grid with the one stored in the file. Throws a FILE_IO_ERROR if
+	 * the file cannot be opened and a DATA_FORMAT_ERROR if it is not a potential grid
+	 * file written by a host with the same byte order.
+	 */
+	void load(const std::string& filename) throw (mmpbsa::MMPBSAException);
+};
+
+}//end namespace mmpbsa
+
+#endif//POTENTIALGRID_H
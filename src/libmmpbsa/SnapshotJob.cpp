@@ -0,0 +1,1240 @@
+#include "SnapshotJob.h"
+
+#include <cmath>
+#include <iomanip>
+#include <algorithm>
+#include <set>
+#include <iostream>
+#include <sstream>
+
+#include "mmpbsa_utils.h"
+#include "Decomposition.h"
+
+#ifdef USE_PTHREADS
+#include <pthread.h>
+#endif
+
+#ifdef USE_MPI
+#include "mmpbsa_mpi.h"
+#endif
+
+bool mmpbsa::should_calculate_snapshot(const snapshot_run_t& run, const size_t& currentSnap, const std::vector<size_t>& snapList)
+{
+#ifndef USE_MPI
+  return true;
+#else
+  if(snapList.size() == 0)
+    return (currentSnap-1) % run.num_nodes == run.node;
+
+  for(size_t i = 0;i<snapList.size();i++)
+    {
+      //Is the requested snap shot in the list?
+      if(snapList.at(i) == currentSnap)
+	if(i % run.num_nodes == run.node)//If so should this host do it?
+	  return true;
+	else
+	  return false;
+    }
+
+  return false;//If the snapshot is not in the list, don't do it.
+
+#endif
+
+}
+
+void mmpbsa::split_snapshot(const std::valarray<mmpbsa::Vector>& snapshot, const std::valarray<mmpbsa::MMPBSAState::MOLECULE>& mol_list,
+		    std::valarray<mmpbsa::Vector>& complexSnap, std::valarray<mmpbsa::Vector>& receptorSnap, std::valarray<mmpbsa::Vector>& ligandSnap)
+{
+  using mmpbsa::MMPBSAState;
+  size_t complexCoordIndex = 0;
+  size_t receptorCoordIndex = 0;
+  size_t ligandCoordIndex = 0;
+  for(size_t i = 0;i<mol_list.size();i++)
+    {
+      const mmpbsa::Vector& currCoord = snapshot[i];
+      if(mol_list[i] == MMPBSAState::RECEPTOR)
+	{
+	  complexSnap[complexCoordIndex++] = currCoord;
+	  receptorSnap[receptorCoordIndex++] = currCoord;
+	}
+      else if(mol_list[i] == MMPBSAState::LIGAND)
+	{
+	  complexSnap[complexCoordIndex++] = currCoord;
+	  ligandSnap[ligandCoordIndex++] = currCoord;
+	}
+    }
+}
+
+size_t mmpbsa::coordinate_hash(const std::valarray<mmpbsa::Vector>& crds)
+{
+  size_t returnMe = 2166136261u;
+  for(size_t i = 0;i<crds.size();i++)
+    for(size_t j = 0;j<3;j++)
+      {
+	const unsigned char* bytes = (const unsigned char*) &crds[i].at(j);
+	for(size_t k = 0;k<sizeof(mmpbsa_t);k++)
+	  returnMe = (returnMe ^ bytes[k])*16777619u;
+      }
+  return returnMe;
+}
+
+static bool same_grid(const std::vector<mmpbsa::grid_level_t>& a, const std::vector<mmpbsa::grid_level_t>& b)
+{
+  if(a.size() != b.size())
+    return false;
+  for(size_t i = 0;i<a.size();i++)
+    {
+      if(a[i].dim != b[i].dim || a[i].spacing != b[i].spacing || a[i].on_interaction != b[i].on_interaction)
+	return false;
+      for(size_t j = 0;j<3;j++)
+	if(a[i].center[j] != b[i].center[j])
+	  return false;
+    }
+  return true;
+}
+
+static void init_component_cache(mmpbsa::component_cache_t& cache)
+{
+  cache.valid = false;
+  cache.hash = 0;
+  cache.snapshot = 0;
+  cache.reused = cache.calculated = 0;
+}
+
+/**
+ * Determines whether the cached energies of a molecule apply to the provided coordinates
+ * and grid. With a tolerance of zero, coordinates must be identical. Otherwise, no atom
+ * may have moved farther than the tolerance since the cached calculation.
+ */
+static bool component_cache_matches(const mmpbsa::component_cache_t& cache, const std::valarray<mmpbsa::Vector>& crds,
+			     const std::vector<mmpbsa::grid_level_t>& levels, const mmpbsa_t& tolerance)
+{
+  if(!cache.valid || cache.crds.size() != crds.size() || !same_grid(cache.levels,levels))
+    return false;
+  if(tolerance <= 0 && cache.hash != coordinate_hash(crds))
+    return false;
+  mmpbsa_t tolsqrd = tolerance*tolerance;
+  for(size_t i = 0;i<crds.size();i++)
+    {
+      mmpbsa_t distsqrd = 0;
+      for(size_t j = 0;j<3;j++)
+	distsqrd += (crds[i].at(j) - cache.crds[i].at(j))*(crds[i].at(j) - cache.crds[i].at(j));
+      if(distsqrd > tolsqrd)
+	return false;
+    }
+  return true;
+}
+
+static void store_component(mmpbsa::component_cache_t& cache, const std::valarray<mmpbsa::Vector>& crds,
+		     const std::vector<mmpbsa::grid_level_t>& levels, const mmpbsa::EMap& energies,
+		     const std::vector<mmpbsa_t>& sweep_energies, const size_t& snapshot)
+{
+  cache.valid = true;
+  cache.hash = coordinate_hash(crds);
+  cache.crds.resize(crds.size());
+  cache.crds = crds;
+  cache.levels = levels;
+  cache.energies = energies;
+  cache.sweep_energies = sweep_energies;
+  cache.snapshot = snapshot;
+  cache.calculated++;
+}
+
+/**
+ * Records the focusing levels of a PB grid, coarsest first. Each level is one
+ * "level" node, whose text is: dimension spacing center_x center_y center_z
+ */
+static mmpbsa_utils::XMLNode* grid_levels_xml(const std::vector<mmpbsa::grid_level_t>& levels)
+{
+  mmpbsa_utils::XMLNode* returnMe = new mmpbsa_utils::XMLNode("grid");
+  for(std::vector<mmpbsa::grid_level_t>::const_iterator level = levels.begin();level != levels.end();level++)
+    {
+      std::ostringstream level_text;
+      level_text << level->dim << " " << level->spacing << " " << level->center[0] << " " << level->center[1] << " " << level->center[2];
+      returnMe->insertChild("level",level_text.str());
+    }
+  return returnMe;
+}
+
+/**
+ * Records the conditions of a PB sweep. Each condition is one "condition" node,
+ * whose text is: ionic_strength interior_dielectric. The PB energies of each molecule
+ * are added to this node with sweep_energies_xml.
+ */
+static mmpbsa_utils::XMLNode* pb_sweep_xml(const std::vector<mmpbsa::pb_condition_t>& conditions)
+{
+  mmpbsa_utils::XMLNode* returnMe = new mmpbsa_utils::XMLNode("pb_sweep");
+  for(std::vector<mmpbsa::pb_condition_t>::const_iterator condition = conditions.begin();condition != conditions.end();condition++)
+    {
+      std::ostringstream condition_text;
+      condition_text << condition->istrength << " " << condition->interior_dielectric;
+      returnMe->insertChild("condition",condition_text.str());
+    }
+  return returnMe;
+}
+
+/**
+ * PB energies of one molecule, one per condition of the PB sweep, separated by spaces.
+ */
+static mmpbsa_utils::XMLNode* sweep_energies_xml(const std::string& mol_name, const std::vector<mmpbsa_t>& energies)
+{
+  std::ostringstream energy_text;
+  for(size_t i = 0;i<energies.size();i++)
+    energy_text << ((i) ? " " : "") << energies[i];
+  return new mmpbsa_utils::XMLNode(mol_name,energy_text.str());
+}
+
+/**
+ * Energies of each residue of one molecule, one residue per line: residue number (one-indexed),
+ * name, internal, van der Waals, electrostatic, PB solvation, surface area and SA energies.
+ */
+static mmpbsa_utils::XMLNode* decomposition_xml(const std::string& mol_name, const std::vector<mmpbsa::residue_energy_t>& residues)
+{
+  mmpbsa_utils::XMLNode* returnMe = new mmpbsa_utils::XMLNode(mol_name);
+  for(std::vector<mmpbsa::residue_energy_t>::const_iterator residue = residues.begin();residue != residues.end();residue++)
+    {
+      const mmpbsa::EMap& energy = residue->energy;
+      std::ostringstream row;
+      row << MMPBSA_FORMAT << (residue->residue + 1) << " " << mmpbsa_utils::trimString(residue->name)
+	  << " " << energy.total_internal_energy() << " " << energy.total_vdw_energy()
+	  << " " << energy.total_elec_energy() << " " << energy.elstat_solv
+	  << " " << energy.area << " " << energy.sasol;
+      returnMe->insertChild("residue",row.str());
+    }
+  return returnMe;
+}
+
+/**
+ * Calculates the PB energies of molecules first_molecule through END_OF_MOLECULES - 1
+ * of a snapshot at the same time, except those for which skip is true. MEAD solves run
+ * in forked processes, multigrid solves in threads. energies and the other arrays are
+ * indexed by molecule. Each molecule has one energy per condition.
+ */
+static void concurrent_pb_solvation(const mmpbsa::MeadInterface& mi, const size_t& first_molecule, const bool* skip,
+			     const std::valarray<mmpbsa::Vector>* const* mol_crds, mmpbsa::mead_atom_set_t* atom_sets,
+			     mmpbsa::pb_reference_cache_t* const* ref_caches, mmpbsa::PBMultigrid* const* mg_solvers,
+			     const FinDiffMethod& fdm, const std::vector<mmpbsa::grid_level_t>& levels,
+			     const std::vector<mmpbsa::pb_condition_t>& conditions, std::vector<mmpbsa_t>* energies)
+{
+  using mmpbsa::MeadInterface;
+  using mmpbsa::MMPBSAState;
+  std::vector<std::vector<mmpbsa_t> > solved;
+  std::vector<size_t> molecules;
+  for(size_t i = first_molecule;i<MMPBSAState::END_OF_MOLECULES;i++)
+    if(!skip[i])
+      molecules.push_back(i);
+  if(molecules.size() == 0)
+    return;
+
+  if(mi.pb_solver == MeadInterface::PB_MULTIGRID)
+    {
+      std::vector<mmpbsa::PBMultigrid*> solvers;
+      std::vector<const std::valarray<mmpbsa::Vector>*> crds;
+      for(std::vector<size_t>::const_iterator mol = molecules.begin();mol != molecules.end();mol++)
+	{
+	  size_t i = *mol;
+	  solvers.push_back(mg_solvers[i]);
+	  crds.push_back(mol_crds[i]);
+	}
+      mmpbsa::PBMultigrid::pb_solvation_concurrent(solvers,crds,levels,conditions,solved);
+    }
+  else
+    {
+      std::vector<AtomSet*> sets;
+      std::vector<mmpbsa::pb_reference_cache_t*> caches;
+      for(std::vector<size_t>::const_iterator mol = molecules.begin();mol != molecules.end();mol++)
+	{
+	  size_t i = *mol;
+	  MeadInterface::update_atom_set(atom_sets[i],*mol_crds[i]);
+	  sets.push_back(atom_sets[i].atoms);
+	  caches.push_back(ref_caches[i]);
+	}
+#ifndef _WIN32
+      MeadInterface::pb_solvation_forked(sets,fdm,conditions,2.0,caches,solved);
+#else
+      for(size_t i = 0;i<sets.size();i++)
+	solved.push_back(MeadInterface::pb_solvation(*sets[i],fdm,conditions,2.0,caches[i]));
+#endif
+    }
+  for(size_t i = 0;i<solved.size();i++)
+    energies[molecules[i]] = solved[i];
+}
+
+size_t mmpbsa::interface_surface_areas(const mmpbsa::MeadInterface& mi, const std::vector<mmpbsa::atom_t>* atom_lists,
+			       const mmpbsa::forcefield_t* split_ff, const std::valarray<mmpbsa::MMPBSAState::MOLECULE>& mol_list,
+			       const std::valarray<mmpbsa::Vector>* const* mol_crds, const std::map<std::string,float>& radii,
+			       sa_cache_t* caches, mmpbsa_t* areas, std::vector<mmpbsa_t>* atom_areas)
+{
+  using mmpbsa::MMPBSAState;
+  for(size_t i = MMPBSAState::RECEPTOR;i<MMPBSAState::END_OF_MOLECULES;i++)
+    {
+      sa_cache_t& cache = caches[i];
+      const std::valarray<mmpbsa::Vector>& crds = *mol_crds[i];
+      bool unchanged = cache.valid && cache.crds.size() == crds.size();
+      for(size_t j = 0;unchanged && j<crds.size();j++)
+	unchanged = (cache.crds[j] == crds[j]);
+      if(unchanged)
+	cache.reused++;
+      else
+	{
+	  cache.area = mi.surface_area(atom_lists[i],split_ff[i],crds,radii,&cache.atom_areas);
+	  cache.crds.resize(crds.size());
+	  cache.crds = crds;
+	  cache.valid = true;
+	  cache.calculated++;
+	}
+      areas[i] = cache.area;
+      atom_areas[i] = cache.atom_areas;
+    }
+
+  //Atom areas of the separated molecules, in the order of the complex
+  std::vector<bool> in_ligand;
+  std::vector<mmpbsa_t>& complex_areas = atom_areas[MMPBSAState::COMPLEX];
+  complex_areas.clear();
+  size_t receptor_index = 0,ligand_index = 0;
+  for(size_t i = 0;i<mol_list.size();i++)
+    if(mol_list[i] == MMPBSAState::RECEPTOR)
+      {
+	complex_areas.push_back(atom_areas[MMPBSAState::RECEPTOR].at(receptor_index++));
+	in_ligand.push_back(false);
+      }
+    else if(mol_list[i] == MMPBSAState::LIGAND)
+      {
+	complex_areas.push_back(atom_areas[MMPBSAState::LIGAND].at(ligand_index++));
+	in_ligand.push_back(true);
+      }
+
+  size_t returnMe = 0;
+  areas[MMPBSAState::COMPLEX] = mi.interface_surface_area(atom_lists[MMPBSAState::COMPLEX],split_ff[MMPBSAState::COMPLEX],
+							  *mol_crds[MMPBSAState::COMPLEX],radii,in_ligand,complex_areas,&returnMe);
+  return returnMe;
+}
+
+bool mmpbsa::next_job_snapshot(mmpbsa_io::trajectory_t& trajFile, const mmpbsa::MMPBSAState& currState,
+		       std::valarray<mmpbsa::Vector>& snapshot, size_t& snap_counter)
+{
+  while(!mmpbsa_io::eof(trajFile))
+    {
+      try
+	{
+	  if(!mmpbsa_io::get_next_snap(trajFile,snapshot))
+	    return false;
+	}
+      catch(const mmpbsa::MMPBSAException& e)
+	{
+	  if(e.getErrType() == mmpbsa::UNEXPECTED_EOF)
+	    return false;
+	  throw e;
+	}
+      snap_counter++;
+      if(currState.snapList.size() == 0 || mmpbsa_utils::contains(currState.snapList,snap_counter))
+	return true;
+    }
+  return false;
+}
+
+/**
+ * Orders snapshots by the bit reversal of their index, e.g. 1, 5, 3, 7, 2, 6, 4, 8, so that
+ * every prefix of the order is spread evenly over the list.
+ */
+static std::vector<size_t> progressive_snapshot_order(const std::vector<size_t>& snaps)
+{
+  std::vector<size_t> returnMe;
+  size_t num_bits = 0;
+  while((size_t(1) << num_bits) < snaps.size())
+    num_bits++;
+  for(size_t i = 0;i < (size_t(1) << num_bits);i++)
+    {
+      size_t reversed = 0;
+      for(size_t bit = 0;bit<num_bits;bit++)
+	if(i & (size_t(1) << bit))
+	  reversed |= size_t(1) << (num_bits - 1 - bit);
+      if(reversed < snaps.size())
+	returnMe.push_back(snaps[reversed]);
+    }
+  return returnMe;
+}
+
+void mmpbsa::init_snapshot_run(snapshot_run_t& run, const int& node, const int& num_nodes)
+{
+  run.order.active = false;
+  run.order.next = 0;
+  run.convergence.active = run.convergence.stopped = false;
+  run.clusters.active = false;
+  run.clusters.num_site_atoms = 0;
+  run.node = node;
+  run.num_nodes = num_nodes;
+#ifdef USE_MPI
+  run.schedule.active = false;
+#endif
+}
+
+size_t mmpbsa::snapshot_place(const snapshot_order_t& order, const size_t& snap)
+{
+  if(!order.active)
+    return snap;
+  std::map<size_t,size_t>::const_iterator place = order.places.find(snap);
+  if(place == order.places.end())
+    throw mmpbsa::MMPBSAException("snapshot_place: the snapshot is not in the progressive order.",mmpbsa::DATA_FORMAT_ERROR);
+  return place->second;
+}
+
+size_t mmpbsa::snapshot_at_place(const snapshot_order_t& order, const size_t& place)
+{
+  return (order.active) ? order.snaps.at(place) : place;
+}
+
+void mmpbsa::start_snapshot_order(snapshot_order_t& order, mmpbsa_io::trajectory_t& trajFile, const mmpbsa::MMPBSAState& currState,
+			  std::valarray<mmpbsa::Vector>& snapshot) throw (mmpbsa::MMPBSAException)
+{
+  order.active = false;
+  order.snaps.clear();
+  order.places.clear();
+  order.next = 0;
+  if(!currState.progressive_order)
+    return;
+
+  std::vector<size_t> snaps = currState.snapList;
+  if(snaps.size() == 0)
+    {
+      size_t snap_counter = 0;
+      mmpbsa_io::seek(trajFile,1);
+      while(next_job_snapshot(trajFile,currState,snapshot,snap_counter))
+	snaps.push_back(snap_counter);
+      mmpbsa_io::seek(trajFile,(currState.currentSnap) ? currState.currentSnap : 1);
+    }
+  std::sort(snaps.begin(),snaps.end());
+  snaps.erase(std::unique(snaps.begin(),snaps.end()),snaps.end());
+  std::vector<size_t> ordered = progressive_snapshot_order(snaps);
+  for(size_t i = 0;i<ordered.size();i++)
+    if(currState.processedSnaps.find(ordered[i]) == currState.processedSnaps.end())
+      {
+	order.places[ordered[i]] = order.snaps.size();
+	order.snaps.push_back(ordered[i]);
+      }
+  order.active = true;
+  std::cout << "Calculating " << order.snaps.size() << " of " << snaps.size() << " snapshots in progressive order" << std::endl;
+}
+
+#ifdef USE_MPI
+/**
+ * Claims the next snapshot of the dynamic schedule for this node and sets snap to its
+ * number. Returns false if every snapshot has been claimed.
+ */
+static bool claim_snapshot(mmpbsa::snapshot_schedule_t& schedule, size_t& snap) throw (mmpbsa::MMPBSAException)
+{
+  long index = long(schedule.snaps.size());
+#if MPI_VERSION >= 3
+  long one = 1;
+  if(MPI_Win_lock(MPI_LOCK_SHARED,MMPBSA_MASTER,0,schedule.window) != MPI_SUCCESS
+     || MPI_Fetch_and_op(&one,&index,MPI_LONG,MMPBSA_MASTER,0,MPI_SUM,schedule.window) != MPI_SUCCESS
+     || MPI_Win_unlock(MMPBSA_MASTER,schedule.window) != MPI_SUCCESS)
+    throw mmpbsa::MMPBSAException("claim_snapshot: Could not claim a snapshot from the master.",mmpbsa::MPI_ERROR);
+#endif
+  if(index >= long(schedule.snaps.size()))
+    {
+      if(schedule.finish == 0)
+	schedule.finish = MPI_Wtime();
+      return false;
+    }
+  snap = schedule.snaps[index];
+  schedule.claimed++;
+  schedule.claimed_cost += schedule.costs[index];
+  return true;
+}
+#endif
+
+bool mmpbsa::next_node_snapshot(snapshot_run_t& run, mmpbsa_io::trajectory_t& trajFile, const mmpbsa::MMPBSAState& currState,
+			std::valarray<mmpbsa::Vector>& snapshot, size_t& snap_counter)
+{
+  if(run.convergence.stopped)
+    return false;
+  bool taken = false;
+  if(run.order.active)
+    {
+      if(run.order.next >= run.order.snaps.size())
+	return false;
+      snap_counter = run.order.snaps[run.order.next++];
+      taken = true;
+    }
+#ifdef USE_MPI
+  if(run.schedule.active)
+    {
+      if(!claim_snapshot(run.schedule,snap_counter))
+	return false;
+      taken = true;
+    }
+#endif
+  if(taken)
+    {
+      mmpbsa_io::seek(trajFile,snap_counter);
+      if(!mmpbsa_io::get_next_snap(trajFile,snapshot))
+	{
+	  std::ostringstream error;
+	  error << "next_node_snapshot: Error in loading snapshot #" << snap_counter;
+	  throw mmpbsa::MMPBSAException(error,mmpbsa::BROKEN_TRAJECTORY_FILE);
+	}
+      std::cout << "Running Snapshot #" << snap_counter << std::endl;
+      return true;
+    }
+  const std::vector<size_t>& snapList = currState.snapList;
+  while(true)
+    {
+      if(snapList.size() && snap_counter >= *(snapList.end()-1))
+	return false;
+      if(!next_job_snapshot(trajFile,currState,snapshot,snap_counter))
+	return false;
+      if(should_calculate_snapshot(run,snap_counter,snapList))
+	break;
+      std::cout << "Skipping snapshot #" << snap_counter << std::endl;
+    }
+  std::cout << "Running Snapshot #" << snap_counter << std::endl;
+  return true;
+}
+
+void mmpbsa::init_snapshot_worker(snapshot_worker_t& worker, const snapshot_job_t& job)
+{
+  using mmpbsa::MeadInterface;
+  using mmpbsa::MMPBSAState;
+  const MeadInterface& mi = *job.mi;
+  worker.snapshot.resize(job.mol_list->size());
+  worker.complex_snap.resize(job.complex_size);
+  worker.receptor_snap.resize(job.receptor_size);
+  worker.ligand_snap.resize(job.ligand_size);
+  worker.sa_interface_atoms = worker.sa_interface_snaps = 0;
+  worker.reported_spacing = false;
+  for(size_t i = 0;i<MMPBSAState::END_OF_MOLECULES;i++)
+    {
+      //MEAD atom data (names, charges, radii) is the same for every snapshot. Only coordinates are updated.
+      worker.atom_sets[i] = MeadInterface::create_atom_set(job.atom_lists[i],*job.radii);
+
+      //Reference (vacuum) energies may be reused while a molecule does not move, e.g. a rigid receptor.
+      MeadInterface::init_reference_cache(worker.ref_caches[i],mi.reference_tolerance,(mi.pb_reference == MeadInterface::REFERENCE_CHECK));
+
+      //Energies of molecules that have not moved, e.g. a rigid receptor, may be reused.
+      init_component_cache(worker.component_caches[i]);
+
+      worker.sa_caches[i].valid = false;
+      worker.sa_caches[i].area = 0;
+      worker.sa_caches[i].reused = worker.sa_caches[i].calculated = 0;
+      worker.sa_max_deviation[i] = worker.sa_sum_deviation[i] = 0;
+      worker.sa_checked[i] = 0;
+
+      //Multigrid solvers keep their potentials between snapshots, to start the next solve.
+      worker.mg_solvers[i] = 0;
+      if(mi.pb_solver != MeadInterface::PB_MULTIGRID)
+	continue;
+      worker.mg_solvers[i] = new mmpbsa::PBMultigrid(job.atom_lists[i],*job.radii,mi.istrength,2.0);
+      worker.mg_solvers[i]->nthreads = (mi.multithread > 1) ? mi.multithread : 1;
+    }
+}
+
+void mmpbsa::destroy_snapshot_worker(snapshot_worker_t& worker)
+{
+  for(size_t i = 0;i<mmpbsa::MMPBSAState::END_OF_MOLECULES;i++)
+    {
+      mmpbsa::MeadInterface::destroy_atom_set(worker.atom_sets[i]);
+      delete worker.mg_solvers[i];
+      worker.mg_solvers[i] = 0;
+    }
+}
+
+/**
+ * Locks the MEAD mutex of the job, if snapshots are calculated by several threads.
+ */
+static void lock_mead(const mmpbsa::snapshot_job_t& job)
+{
+#ifdef USE_PTHREADS
+  if(job.mead_mutex != 0)
+    pthread_mutex_lock((pthread_mutex_t*)job.mead_mutex);
+#endif
+}
+
+static void unlock_mead(const mmpbsa::snapshot_job_t& job)
+{
+#ifdef USE_PTHREADS
+  if(job.mead_mutex != 0)
+    pthread_mutex_unlock((pthread_mutex_t*)job.mead_mutex);
+#endif
+}
+
+mmpbsa_utils::XMLNode* mmpbsa::new_snapshot_xml(const snapshot_job_t& job, const size_t& snap)
+{
+  const snapshot_clusters_t& clusters = job.run->clusters;
+  std::ostringstream strSnapNumber;
+  strSnapNumber << snap;//Node used to output energy data
+  mmpbsa_utils::XMLNode* returnMe = new mmpbsa_utils::XMLNode("snapshot");
+  returnMe->insertChild("ID",strSnapNumber.str());
+  if(job.mi->snap_list_offset != 0)
+    {
+      strSnapNumber.str("");
+      strSnapNumber << job.mi->snap_list_offset;
+      returnMe->insertChild("snap_list_offset",strSnapNumber.str());
+    }
+  if(clusters.active)
+    {
+      std::map<size_t,size_t>::const_iterator weight = clusters.weights.find(snap);
+      if(weight != clusters.weights.end())
+	{
+	  strSnapNumber.str("");
+	  strSnapNumber << weight->second;
+	  returnMe->insertChild("weight",strSnapNumber.str());
+	}
+    }
+  return returnMe;
+}
+
+/**
+ * DELTA G of a snapshot's output: the total energy of the complex less those of the receptor and ligand.
+ */
+static mmpbsa_t snapshot_delta_g(const mmpbsa_utils::XMLNode* snapshotXML)
+{
+  mmpbsa_t returnMe = 0;
+  for(const mmpbsa_utils::XMLNode* molecule = snapshotXML->children;molecule != 0;molecule = molecule->siblings)
+    {
+      mmpbsa_t sign;
+      if(molecule->getName() == "COMPLEX")
+	sign = 1;
+      else if(molecule->getName() == "RECEPTOR" || molecule->getName() == "LIGAND")
+	sign = -1;
+      else
+	continue;
+      mmpbsa::EMap energies = mmpbsa::EMap::loadXML(molecule);
+      returnMe += sign*(energies.total_gas_energy() + energies.elstat_solv + energies.sasol);
+    }
+  return returnMe;
+}
+
+/**
+ * Standard error of the mean of correlated data, by block averaging: the data are divided
+ * into blocks of 1, 2, 4, ... values, as long as there are at least eight blocks, and the
+ * largest standard error of the block means is used, since that of small blocks is
+ * underestimated when consecutive values are correlated. The block size of that error is
+ * stored in block_size.
+ */
+static mmpbsa_t block_standard_error(const std::vector<mmpbsa_t>& data, size_t& block_size)
+{
+  const size_t min_blocks = 8;
+  mmpbsa_t returnMe = 0;
+  block_size = 1;
+  for(size_t size = 1;data.size()/size >= min_blocks;size *= 2)
+    {
+      size_t num_blocks = data.size()/size;
+      mmpbsa_t sum = 0,sumsq = 0;
+      for(size_t i = 0;i<num_blocks;i++)
+	{
+	  mmpbsa_t block_mean = 0;
+	  for(size_t j = 0;j<size;j++)
+	    block_mean += data[i*size+j];
+	  block_mean /= size;
+	  sum += block_mean;
+	  sumsq += block_mean*block_mean;
+	}
+      mmpbsa_t variance = (sumsq - sum*sum/num_blocks)/(num_blocks - 1);
+      mmpbsa_t error = (variance > 0) ? sqrt(variance/num_blocks) : 0;
+      if(size == 1 || error > returnMe)
+	{
+	  returnMe = error;
+	  block_size = size;
+	}
+    }
+  return returnMe;
+}
+
+void mmpbsa::start_convergence(snapshot_run_t& run, const mmpbsa::MMPBSAState& currState, mmpbsa_utils::XMLParser& energy_data)
+{
+  convergence_t& convergence = run.convergence;
+  convergence.active = (currState.convergence > 0 || currState.convergence_stall > 0);
+  convergence.delta_g.clear();
+  convergence.error = convergence.best_error = 0;
+  convergence.block_size = 1;
+  convergence.best_at = 0;
+  convergence.stopped = false;
+  if(!convergence.active || energy_data.getHead() == 0)
+    return;
+  for(const mmpbsa_utils::XMLNode* snapshotXML = energy_data.getHead()->children;snapshotXML != 0;snapshotXML = snapshotXML->siblings)
+    if(snapshotXML->getName() == "snapshot")
+      convergence.delta_g.push_back(snapshot_delta_g(snapshotXML));
+  if(convergence.delta_g.size())
+    std::cout << "Convergence of DELTA G continues from the " << convergence.delta_g.size() << " snapshots in the output" << std::endl;
+}
+
+void mmpbsa::update_convergence(convergence_t& convergence, const mmpbsa::MMPBSAState& currState, mmpbsa_utils::XMLNode* snapshotXML)
+{
+  if(!convergence.active)
+    return;
+  convergence.delta_g.push_back(snapshot_delta_g(snapshotXML));
+  const size_t& num_snaps = convergence.delta_g.size();
+  mmpbsa_t mean = 0;
+  for(size_t i = 0;i<num_snaps;i++)
+    mean += convergence.delta_g[i];
+  mean /= num_snaps;
+  convergence.error = block_standard_error(convergence.delta_g,convergence.block_size);
+  const bool estimated = (num_snaps >= 8 && num_snaps >= currState.convergence_min);//enough snapshots to trust the error
+  if(!estimated)
+    convergence.best_at = 0;
+  else if(convergence.best_at == 0 || convergence.error < convergence.best_error)
+    {
+      convergence.best_error = convergence.error;
+      convergence.best_at = num_snaps;
+    }
+
+  std::string reason;
+  if(estimated && !convergence.stopped)
+    {
+      std::ostringstream buff;
+      if(currState.convergence > 0 && convergence.error <= currState.convergence)
+	buff << "standard error below " << currState.convergence;
+      else if(currState.convergence_stall && num_snaps - convergence.best_at >= currState.convergence_stall)
+	buff << "standard error not improved for " << currState.convergence_stall << " snapshots";
+      reason = buff.str();
+    }
+
+  std::ostringstream buff;
+  mmpbsa_utils::XMLNode* convergenceXML = new mmpbsa_utils::XMLNode("convergence");
+  buff << num_snaps;
+  convergenceXML->insertChild("snapshots",buff.str());
+  buff.str("");
+  buff << mean;
+  convergenceXML->insertChild("DELTA_G",buff.str());
+  buff.str("");
+  buff << convergence.error;
+  convergenceXML->insertChild("standard_error",buff.str());
+  buff.str("");
+  buff << convergence.block_size;
+  convergenceXML->insertChild("block_size",buff.str());
+  if(reason.size())
+    {
+      convergence.stopped = true;
+      convergenceXML->insertChild("stopped",reason);
+      std::cout << "DELTA G converged after " << num_snaps << " snapshots (" << reason << "): " << mean
+		<< " +/- " << convergence.error << " kcal/mol, with blocks of " << convergence.block_size << " snapshots" << std::endl;
+    }
+  snapshotXML->insertChild(convergenceXML);
+}
+
+void mmpbsa::report_convergence(const convergence_t& convergence)
+{
+  if(!convergence.active || convergence.stopped || convergence.delta_g.size() == 0)
+    return;
+  std::cout << "DELTA G did not converge: standard error " << convergence.error << " kcal/mol after "
+	    << convergence.delta_g.size() << " snapshots, with blocks of " << convergence.block_size << " snapshots" << std::endl;
+}
+
+void mmpbsa::append_snapshot(const snapshot_job_t& job, mmpbsa_utils::XMLParser& energy_data, mmpbsa::MMPBSAState& currState,
+			     const size_t& snap, mmpbsa_utils::XMLNode* snapshotXML)
+{
+  snapshot_run_t& run = *job.run;
+  update_convergence(run.convergence,currState,snapshotXML);
+  energy_data.getHead()->insertChild(snapshotXML);
+  //Snapshots taken out of trajectory order are checkpointed as a set, which is what a
+  //restart resumes from (cf start_snapshot_order and start_snapshot_schedule).
+  bool taken = run.order.active;
+#ifdef USE_MPI
+  taken |= run.schedule.active;
+#endif
+  if(taken)
+    currState.processedSnaps.insert(snap);
+  else
+    currState.currentSnap = snap + 1;
+  currState.currentMolecule = mmpbsa::MMPBSAState::COMPLEX;
+  job.hooks.progress(currState,1);
+  if(job.hooks.write_data != 0)
+    job.hooks.write_data(energy_data,currState);
+  job.hooks.checkpoint(currState);
+}
+
+void mmpbsa::write_snapshot_pdbs(const snapshot_job_t& job, const mmpbsa::MMPBSAState& state,
+			 const std::valarray<mmpbsa::Vector>* const* mol_crds)
+{
+  using mmpbsa::MMPBSAState;
+  job.hooks.write_pdb(job.atom_lists[MMPBSAState::COMPLEX],job.split_ff[MMPBSAState::COMPLEX],*mol_crds[MMPBSAState::COMPLEX],state,"complex");
+  job.hooks.write_pdb(job.atom_lists[MMPBSAState::RECEPTOR],job.split_ff[MMPBSAState::RECEPTOR],*mol_crds[MMPBSAState::RECEPTOR],state,"receptor");
+  job.hooks.write_pdb(job.atom_lists[MMPBSAState::LIGAND],job.split_ff[MMPBSAState::LIGAND],*mol_crds[MMPBSAState::LIGAND],state,"ligand");
+}
+
+std::vector<mmpbsa::grid_level_t> mmpbsa::snapshot_grid(const snapshot_job_t& job, const std::valarray<mmpbsa::Vector>* const* mol_crds)
+{
+  using mmpbsa::MeadInterface;
+  using mmpbsa::MMPBSAState;
+  const MeadInterface& mi = *job.mi;
+  mmpbsa::grid_plan_t snap_plan = *job.job_plan;
+  if(!mi.fixed_grid)
+    {
+      MeadInterface::clear_grid_plan(snap_plan);
+      MeadInterface::extend_grid_plan(snap_plan,*mol_crds[MMPBSAState::COMPLEX],*mol_crds[MMPBSAState::RECEPTOR],*mol_crds[MMPBSAState::LIGAND]);
+    }
+  return (mi.fixed_grid) ? *job.job_levels : mi.plan_grid(snap_plan);
+}
+
+void mmpbsa::report_grid_spacing(const mmpbsa::MeadInterface& mi, const std::vector<mmpbsa::grid_level_t>& levels, bool& reported_spacing)
+{
+  if(reported_spacing || levels.back().spacing == mi.grid_spacing)
+    return;
+  std::cerr << "Warning: Fine grid spacing increased from " << mi.grid_spacing << " to " << levels.back().spacing
+	    << " Angstroms to fit within " << mi.grid_memory << " MB." << std::endl;
+  reported_spacing = true;
+}
+
+void mmpbsa::start_snapshot_xml(const snapshot_job_t& job, const bool& decompose, const std::vector<mmpbsa::grid_level_t>& levels,
+			mmpbsa_utils::XMLNode* snapshotXML, mmpbsa_utils::XMLNode** sweepXML, mmpbsa_utils::XMLNode** decompositionXML)
+{
+  snapshotXML->insertChild(grid_levels_xml(levels));
+
+  // Energies of each condition of a PB sweep are recorded side by side.
+  *sweepXML = 0;
+  if(job.mi->pb_sweep())
+    {
+      *sweepXML = pb_sweep_xml(*job.pb_conditions);
+      snapshotXML->insertChild(*sweepXML);
+    }
+
+  // Per-residue energies are tabulated for each molecule.
+  *decompositionXML = 0;
+  if(decompose)
+    {
+      *decompositionXML = new mmpbsa_utils::XMLNode("decomposition");
+      (*decompositionXML)->insertChild("columns","RESIDUE NAME INTERNAL VDW ELE PBSOL AREA SASOL");
+      snapshotXML->insertChild(*decompositionXML);
+    }
+}
+
+void mmpbsa::prepare_mead_grid(const snapshot_job_t& job, snapshot_worker_t& worker, const std::vector<mmpbsa::grid_level_t>& levels)
+{
+  using mmpbsa::MeadInterface;
+  if(job.mi->pb_solver != MeadInterface::PB_MEAD)
+    return;
+  lock_mead(job);
+  try
+    {
+      worker.fdm = (job.job_fdm != 0) ? *job.job_fdm : MeadInterface::createFDM(levels);
+    }
+  catch(const mmpbsa::MMPBSAException& e)
+    {
+      unlock_mead(job);
+      throw e;
+    }
+  unlock_mead(job);
+}
+
+void mmpbsa::molecule_mm(const snapshot_job_t& job, const size_t& mol, const std::valarray<mmpbsa::Vector>& crds,
+		 const bool& decompose, molecule_energy_t& result)
+{
+  result.atom_energies.clear();
+  if(decompose)
+    result.energies = mmpbsa::EMap(job.atom_lists[mol],job.split_ff[mol],crds,result.atom_energies);
+  else
+    result.energies = mmpbsa::EMap(job.atom_lists[mol],job.split_ff[mol],crds);
+}
+
+void mmpbsa::molecule_pb(const snapshot_job_t& job, snapshot_worker_t& worker, const size_t& mol, const std::valarray<mmpbsa::Vector>& crds,
+		 const std::vector<mmpbsa::grid_level_t>& levels, const bool& decompose, molecule_energy_t& result)
+{
+  using mmpbsa::MeadInterface;
+  std::vector<mmpbsa_t>* atom_pb_ptr = (decompose) ? &result.atom_pb : 0;
+  if(worker.mg_solvers[mol] != 0)
+    {
+      result.pb_energies = worker.mg_solvers[mol]->pb_solvation(crds,levels,*job.pb_conditions,atom_pb_ptr);
+      return;
+    }
+  mmpbsa::pb_reference_cache_t* ref_cache = (job.mi->pb_reference == MeadInterface::REFERENCE_SOLVE) ? 0 : &worker.ref_caches[mol];
+  lock_mead(job);
+  try
+    {
+      MeadInterface::update_atom_set(worker.atom_sets[mol],crds);
+      result.pb_energies = MeadInterface::pb_solvation(*worker.atom_sets[mol].atoms,worker.fdm,*job.pb_conditions,2.0,
+						       ref_cache,atom_pb_ptr);
+    }
+  catch(const mmpbsa::MMPBSAException& e)
+    {
+      unlock_mead(job);
+      throw e;
+    }
+  unlock_mead(job);
+}
+
+void mmpbsa::molecule_sa(const snapshot_job_t& job, const size_t& mol, const std::valarray<mmpbsa::Vector>& crds,
+		 const bool& decompose, molecule_energy_t& result)
+{
+  result.molsurf_error_flag = 0;
+  result.area = job.mi->surface_area(job.atom_lists[mol],job.split_ff[mol],crds,*job.radii,
+				     (decompose) ? &result.atom_areas : 0,&result.molsurf_error_flag);
+}
+
+void mmpbsa::check_surface_area(const snapshot_job_t& job, snapshot_worker_t& worker, const size_t& mol,
+			const std::valarray<mmpbsa::Vector>& crds, const molecule_energy_t& result)
+{
+  using mmpbsa::MeadInterface;
+  const MeadInterface& mi = *job.mi;
+  const char* mol_names[] = {"COMPLEX","RECEPTOR","LIGAND"};
+  if(!mi.sa_check || mi.sa_method == MeadInterface::SA_MOLSURF || result.molsurf_error_flag != 0)
+    return;
+  int check_error_flag = 0;
+  mmpbsa_t molsurf_energy = MeadInterface::molsurf_area(job.atom_lists[mol],crds,*job.radii,0,&check_error_flag);
+  if(check_error_flag != 0 || molsurf_energy <= 0)
+    return;
+  mmpbsa_t deviation = (result.area - molsurf_energy)/molsurf_energy;
+  std::cout << mol_names[mol] << " area " << result.area << ", molsurf area " << molsurf_energy
+	    << " (" << 100*deviation << "%)" << std::endl;
+  worker.sa_max_deviation[mol] = std::max(worker.sa_max_deviation[mol],fabs(deviation));
+  worker.sa_sum_deviation[mol] += deviation;
+  worker.sa_checked[mol]++;
+}
+
+void mmpbsa::molecule_output(const snapshot_job_t& job, const size_t& mol, const std::string& mol_name, molecule_energy_t& result,
+		     mmpbsa_utils::XMLNode* sweepXML, mmpbsa_utils::XMLNode* decompositionXML)
+{
+  const mmpbsa::MeadInterface& mi = *job.mi;
+  mmpbsa::EMap& results = result.energies;
+  results.set_elstat_solv(result.pb_energies[0]);
+  if(sweepXML != 0)
+    sweepXML->insertChild(sweep_energies_xml(mol_name,result.pb_energies));
+
+  if(result.molsurf_error_flag != 0)
+    {
+      results.molsurf_failed = true;
+      results.set_area(0.0);
+      results.set_sasol(0.0);
+    }
+  else
+    {
+      results.molsurf_failed = false;
+      results.set_area(result.area);
+      results.set_sasol(result.area*mi.surf_tension+mi.surf_offset);
+    }
+
+  if(decompositionXML != 0)
+    {
+      if(result.molsurf_error_flag != 0)
+	result.atom_areas.clear();
+      set_atom_solvation(result.atom_energies,result.atom_pb,result.atom_areas,mi.surf_tension);
+      decompositionXML->insertChild(decomposition_xml(mol_name,sum_by_residue(job.atom_lists[mol],result.atom_energies)));
+    }
+}
+
+void mmpbsa::calculate_snapshot(const snapshot_job_t& job, snapshot_worker_t& worker, mmpbsa::MMPBSAState& state,
+			mmpbsa_utils::XMLNode* snapshotXML, const bool& checkpoint)
+{
+  using namespace mmpbsa;
+  using mmpbsa::MMPBSAState;
+  const MeadInterface& mi = *job.mi;
+
+  //separate coordinates
+  split_snapshot(worker.snapshot,*job.mol_list,worker.complex_snap,worker.receptor_snap,worker.ligand_snap);
+  const std::valarray<Vector>* mol_crds[MMPBSAState::END_OF_MOLECULES] = {&worker.complex_snap,&worker.receptor_snap,&worker.ligand_snap};
+
+  //write PDB information, if requested.
+  if(state.savePDB)
+    write_snapshot_pdbs(job,state,mol_crds);
+
+  std::vector<grid_level_t> levels = snapshot_grid(job,mol_crds);
+  report_grid_spacing(mi,levels,worker.reported_spacing);
+  prepare_mead_grid(job,worker,levels);
+  mmpbsa_utils::XMLNode *sweepXML,*decompositionXML;
+  start_snapshot_xml(job,state.decompose,levels,snapshotXML,&sweepXML,&decompositionXML);
+
+  // Molecules with the same geometry and grid as their last calculation reuse its energies.
+  bool reuse[MMPBSAState::END_OF_MOLECULES];
+  for(size_t i = 0;i<MMPBSAState::END_OF_MOLECULES;i++)
+    reuse[i] = state.reuse_components
+      && component_cache_matches(worker.component_caches[i],*mol_crds[i],levels,state.component_tolerance);
+
+  // Optionally, solve PB for the remaining molecules together, before their MM and SA.
+  std::vector<mmpbsa_t> pb_energies[MMPBSAState::END_OF_MOLECULES];
+  if(mi.concurrent_pb)
+    {
+      pb_reference_cache_t* ref_cache_ptrs[MMPBSAState::END_OF_MOLECULES];
+      for(size_t i = 0;i<MMPBSAState::END_OF_MOLECULES;i++)
+	ref_cache_ptrs[i] = (mi.pb_reference == MeadInterface::REFERENCE_SOLVE) ? 0 : &worker.ref_caches[i];
+      concurrent_pb_solvation(mi,state.currentMolecule,reuse,mol_crds,worker.atom_sets,ref_cache_ptrs,worker.mg_solvers,
+			      worker.fdm,levels,*job.pb_conditions,pb_energies);
+    }
+
+  // Optionally, calculate the SA of the separated molecules first, so that only the complex's interface is recalculated.
+  mmpbsa_t sa_areas[MMPBSAState::END_OF_MOLECULES];
+  std::vector<mmpbsa_t> sa_atom_areas[MMPBSAState::END_OF_MOLECULES];
+  bool sa_done = mi.sa_interface && state.currentMolecule == MMPBSAState::COMPLEX;
+  if(sa_done)
+    {
+      worker.sa_interface_atoms += interface_surface_areas(mi,job.atom_lists,job.split_ff,*job.mol_list,mol_crds,*job.radii,
+							   worker.sa_caches,sa_areas,sa_atom_areas);
+      worker.sa_interface_snaps++;
+    }
+
+  // Iterate through the three parts of the complex and calculate energies
+  const char* mol_names[] = {"COMPLEX","RECEPTOR","LIGAND"};
+  for(;state.currentMolecule < MMPBSAState::END_OF_MOLECULES;++state.currentMolecule)
+    {
+      if(state.currentMolecule < MMPBSAState::COMPLEX)
+	throw MMPBSAException("calculate_snapshot: invalid molecule.",mmpbsa::DATA_FORMAT_ERROR);
+      const size_t mol = state.currentMolecule;
+      const std::string mol_name = mol_names[mol];
+
+      if(reuse[mol])
+	{
+	  component_cache_t& cache = worker.component_caches[mol];
+	  std::cout << "Reusing " << mol_name << " energies of snapshot " << cache.snapshot << std::endl;
+	  cache.reused++;
+	  std::ostringstream reused_from;
+	  reused_from << cache.snapshot;
+	  mmpbsa_utils::XMLNode* reusedXML = new mmpbsa_utils::XMLNode("reused");
+	  reusedXML->insertChild("molecule",mol_name);
+	  reusedXML->insertChild("snapshot",reused_from.str());
+	  snapshotXML->insertChild(reusedXML);
+	  if(sweepXML != 0)
+	    sweepXML->insertChild(sweep_energies_xml(mol_name,cache.sweep_energies));
+	  if(checkpoint)
+	    job.hooks.checkpoint_molecule(mol_name.c_str(),cache.energies,state,snapshotXML,NULL);
+	  else
+	    snapshotXML->insertChild(cache.energies.toXML(mol_name));
+	  continue;
+	}
+
+      std::cout << "Calculating " << mol_name << " of snapshot " << state.currentSnap << std::endl;
+      molecule_energy_t result;
+      molecule_mm(job,mol,*mol_crds[mol],state.decompose,result);
+
+      if(mi.concurrent_pb)//solved above
+	result.pb_energies = pb_energies[mol];
+      else
+	molecule_pb(job,worker,mol,*mol_crds[mol],levels,state.decompose,result);
+
+      if(sa_done)
+	{
+	  result.area = sa_areas[mol];
+	  result.molsurf_error_flag = 0;
+	  if(state.decompose)
+	    result.atom_areas.swap(sa_atom_areas[mol]);
+	}
+      else
+	molecule_sa(job,mol,*mol_crds[mol],state.decompose,result);
+      check_surface_area(job,worker,mol,*mol_crds[mol],result);
+
+      molecule_output(job,mol,mol_name,result,sweepXML,decompositionXML);
+
+      if(state.reuse_components)
+	store_component(worker.component_caches[mol],*mol_crds[mol],levels,result.energies,result.pb_energies,state.currentSnap);
+
+      // Current molecule calculation has finished. Checkpoint.
+      if(checkpoint)
+	job.hooks.checkpoint_molecule(mol_name.c_str(),result.energies,state,snapshotXML,NULL);
+      else
+	snapshotXML->insertChild(result.energies.toXML(mol_name));
+    }
+}
+
+void mmpbsa::report_snapshot_workers(const snapshot_job_t& job, const snapshot_worker_t* workers, const size_t& num_workers,
+			     const mmpbsa::MMPBSAState& currState)
+{
+  using mmpbsa::MeadInterface;
+  using mmpbsa::MMPBSAState;
+  const MeadInterface& mi = *job.mi;
+  const char* mol_names[] = {"COMPLEX","RECEPTOR","LIGAND"};
+  size_t reused[MMPBSAState::END_OF_MOLECULES],calculated[MMPBSAState::END_OF_MOLECULES];
+  size_t sa_reused[MMPBSAState::END_OF_MOLECULES],sa_calculated[MMPBSAState::END_OF_MOLECULES];
+  size_t ref_reused[MMPBSAState::END_OF_MOLECULES],ref_solved[MMPBSAState::END_OF_MOLECULES];
+  size_t sa_checked[MMPBSAState::END_OF_MOLECULES];
+  mmpbsa_t sa_max_deviation[MMPBSAState::END_OF_MOLECULES],sa_sum_deviation[MMPBSAState::END_OF_MOLECULES];
+  mmpbsa_t ref_max_error[MMPBSAState::END_OF_MOLECULES];
+  size_t sa_interface_atoms = 0,sa_interface_snaps = 0;
+  for(size_t i = 0;i<MMPBSAState::END_OF_MOLECULES;i++)
+    {
+      reused[i] = calculated[i] = sa_reused[i] = sa_calculated[i] = ref_reused[i] = ref_solved[i] = sa_checked[i] = 0;
+      sa_max_deviation[i] = sa_sum_deviation[i] = ref_max_error[i] = 0;
+      for(size_t w = 0;w<num_workers;w++)
+	{
+	  const snapshot_worker_t& worker = workers[w];
+	  reused[i] += worker.component_caches[i].reused;
+	  calculated[i] += worker.component_caches[i].calculated;
+	  sa_reused[i] += worker.sa_caches[i].reused;
+	  sa_calculated[i] += worker.sa_caches[i].calculated;
+	  ref_reused[i] += worker.ref_caches[i].reused;
+	  ref_solved[i] += worker.ref_caches[i].solved;
+	  ref_max_error[i] = std::max(ref_max_error[i],worker.ref_caches[i].max_error);
+	  sa_checked[i] += worker.sa_checked[i];
+	  sa_sum_deviation[i] += worker.sa_sum_deviation[i];
+	  sa_max_deviation[i] = std::max(sa_max_deviation[i],worker.sa_max_deviation[i]);
+	}
+    }
+  for(size_t w = 0;w<num_workers;w++)
+    {
+      sa_interface_atoms += workers[w].sa_interface_atoms;
+      sa_interface_snaps += workers[w].sa_interface_snaps;
+    }
+
+  if(currState.reuse_components)
+    {
+      for(size_t i = 0;i<MMPBSAState::END_OF_MOLECULES;i++)
+	std::cout << mol_names[i] << ": energies reused " << reused[i] << " times, calculated "
+		  << calculated[i] << " times" << std::endl;
+    }
+
+  if(sa_interface_snaps)
+    {
+      std::cout << "Interface SA: " << sa_interface_atoms/double(sa_interface_snaps) << " of "
+		<< job.atom_lists[MMPBSAState::COMPLEX].size() << " complex atom areas recalculated per snapshot" << std::endl;
+      for(size_t i = MMPBSAState::RECEPTOR;i<MMPBSAState::END_OF_MOLECULES;i++)
+	std::cout << mol_names[i] << ": atom areas reused " << sa_reused[i] << " times, calculated "
+		  << sa_calculated[i] << " times" << std::endl;
+    }
+
+  if(mi.sa_check && mi.sa_method != MeadInterface::SA_MOLSURF)
+    {
+      for(size_t i = 0;i<MMPBSAState::END_OF_MOLECULES;i++)
+	if(sa_checked[i])
+	  std::cout << mol_names[i] << ": area deviates from molsurf by " << 100*sa_sum_deviation[i]/sa_checked[i]
+		    << "% on average, at most " << 100*sa_max_deviation[i] << "%, in " << sa_checked[i] << " snapshots" << std::endl;
+    }
+
+  if(mi.pb_reference != MeadInterface::REFERENCE_SOLVE && mi.pb_solver == MeadInterface::PB_MEAD)
+    {
+      for(size_t i = 0;i<MMPBSAState::END_OF_MOLECULES;i++)
+	{
+	  std::cout << mol_names[i] << ": reference energy reused " << ref_reused[i] << " times, solved "
+		    << ref_solved[i] << " times";
+	  if(num_workers && workers[0].ref_caches[i].validate)
+	    std::cout << ", largest cache error " << ref_max_error[i] << " kcal/mol";
+	  std::cout << std::endl;
+	}
+    }
+}
+
+#ifdef USE_MPI
+/**
+ * Returns, on the master, the snapshots that any node has added to its output according to
+ * its checkpoint (cf processedSnaps), which every node must call. Other nodes get an empty set.
+ */
+static std::set<size_t> gather_processed_snapshots(const mmpbsa::snapshot_run_t& run, const mmpbsa::MMPBSAState& currState)
+{
+  std::vector<unsigned long> mine(currState.processedSnaps.begin(),currState.processedSnaps.end());
+  int num_mine = int(mine.size());
+  std::vector<int> counts(run.num_nodes,0),offsets(run.num_nodes,0);
+  MPI_Gather(&num_mine,1,MPI_INT,&counts[0],1,MPI_INT,MMPBSA_MASTER,MPI_COMM_WORLD);
+  int total = 0;
+  for(int i = 0;i<run.num_nodes;i++)
+    {
+      offsets[i] = total;
+      total += counts[i];
+    }
+  std::vector<unsigned long> all(total + 1);
+  mine.push_back(0);//Keeps &mine[0] valid when this node has none.
+  MPI_Gatherv(&mine[0],num_mine,MPI_UNSIGNED_LONG,&all[0],&counts[0],&offsets[0],MPI_UNSIGNED_LONG,MMPBSA_MASTER,MPI_COMM_WORLD);
+  std::set<size_t> returnMe;
+  if(run.node == MMPBSA_MASTER)
+    returnMe.insert(all.begin(),all.begin() + total);
+  return returnMe;
+}
+
+void mmpbsa::start_snapshot_schedule(snapshot_run_t& run, const snapshot_job_t& job, snapshot_worker_t& worker,
+				     mmpbsa_io::trajectory_t& trajFile, const mmpbsa::MMPBSAState& currState) throw (mmpbsa::MMPBSAException)
+{
+  using mmpbsa::MMPBSAState;
+  snapshot_schedule_t& schedule = run.schedule;
+  std::set<size_t> processed = gather_processed_snapshots(run,currState);
+
+  //The master alone orders the snapshots, so that every node claims from the same list.
+  std::vector<unsigned long> snaps;
+  std::vector<double> costs;
+  if(run.node == MMPBSA_MASTER)
+    {
+      const std::valarray<mmpbsa::Vector>* mol_crds[MMPBSAState::END_OF_MOLECULES] = {&worker.complex_snap,&worker.receptor_snap,&worker.ligand_snap};
+      size_t snap_counter = 0;
+      std::multimap<double,size_t> by_cost;
+      mmpbsa_io::seek(trajFile,1);
+      while(!(currState.snapList.size() && snap_counter >= *(currState.snapList.end()-1))
+	    && next_job_snapshot(trajFile,currState,worker.snapshot,snap_counter))
+	{
+	  if(processed.find(snap_counter) != processed.end())
+	    continue;
+	  split_snapshot(worker.snapshot,*job.mol_list,worker.complex_snap,worker.receptor_snap,worker.ligand_snap);
+	  std::vector<mmpbsa::grid_level_t> levels = snapshot_grid(job,mol_crds);
+	  double cost = 0;
+	  for(size_t i = 0;i<levels.size();i++)
+	    cost += double(levels[i].dim)*levels[i].dim*levels[i].dim;
+	  by_cost.insert(std::pair<double,size_t>(-cost,snap_counter));
+	}
+      mmpbsa_io::seek(trajFile,(currState.currentSnap) ? currState.currentSnap : 1);
+      for(std::multimap<double,size_t>::const_iterator it = by_cost.begin();it != by_cost.end();it++)
+	{
+	  snaps.push_back(it->second);
+	  costs.push_back(-it->first);
+	}
+      std::cout << "Scheduling " << snaps.size() << " snapshots, " << processed.size() << " of which were already calculated" << std::endl;
+    }
+  unsigned long num_snaps = snaps.size();
+  MPI_Bcast(&num_snaps,1,MPI_UNSIGNED_LONG,MMPBSA_MASTER,MPI_COMM_WORLD);
+  snaps.resize(num_snaps + 1);//Keeps &snaps[0] valid for an empty schedule.
+  costs.resize(num_snaps + 1);
+  MPI_Bcast(&snaps[0],int(num_snaps),MPI_UNSIGNED_LONG,MMPBSA_MASTER,MPI_COMM_WORLD);
+  MPI_Bcast(&costs[0],int(num_snaps),MPI_DOUBLE,MMPBSA_MASTER,MPI_COMM_WORLD);
+  schedule.snaps.assign(snaps.begin(),snaps.begin() + num_snaps);
+  schedule.costs.assign(costs.begin(),costs.begin() + num_snaps);
+
+  schedule.claimed = 0;
+  schedule.claimed_cost = 0;
+  schedule.finish = 0;
+  schedule.counter = 0;
+#if MPI_VERSION >= 3
+  MPI_Aint window_size = (run.node == MMPBSA_MASTER) ? sizeof(long) : 0;
+  if(MPI_Win_allocate(window_size,sizeof(long),MPI_INFO_NULL,MPI_COMM_WORLD,&schedule.counter,&schedule.window) != MPI_SUCCESS)
+    throw mmpbsa::MMPBSAException("start_snapshot_schedule: Could not create the snapshot counter.",mmpbsa::MPI_ERROR);
+  if(run.node == MMPBSA_MASTER)
+    {
+      MPI_Win_lock(MPI_LOCK_EXCLUSIVE,MMPBSA_MASTER,0,schedule.window);
+      *schedule.counter = 0;
+      MPI_Win_unlock(MMPBSA_MASTER,schedule.window);
+    }
+  MPI_Barrier(MPI_COMM_WORLD);
+#endif
+  schedule.active = true;
+  schedule.start = MPI_Wtime();
+}
+
+void mmpbsa::finish_snapshot_schedule(snapshot_run_t& run)
+{
+  snapshot_schedule_t& schedule = run.schedule;
+  if(!schedule.active)
+    return;
+  if(schedule.finish == 0)
+    schedule.finish = MPI_Wtime();
+  double mine[3] = {double(schedule.claimed),schedule.claimed_cost,schedule.finish - schedule.start};
+  std::vector<double> nodes(3*run.num_nodes);
+  MPI_Gather(mine,3,MPI_DOUBLE,&nodes[0],3,MPI_DOUBLE,MMPBSA_MASTER,MPI_COMM_WORLD);
+#if MPI_VERSION >= 3
+  MPI_Win_free(&schedule.window);
+#endif
+  schedule.active = false;
+  if(run.node != MMPBSA_MASTER)
+    return;
+
+  double total_cost = 0,first_done = 0,last_done = 0;
+  for(int i = 0;i<run.num_nodes;i++)
+    {
+      total_cost += nodes[3*i+1];
+      first_done = (i == 0) ? nodes[3*i+2] : std::min(first_done,nodes[3*i+2]);
+      last_done = std::max(last_done,nodes[3*i+2]);
+    }
+  for(int i = 0;i<run.num_nodes;i++)
+    {
+      std::cout << "Node " << i << ": " << nodes[3*i] << " snapshots, "
+		<< ((total_cost > 0) ? 100*nodes[3*i+1]/total_cost : 0) << "% of the estimated cost, "
+		<< nodes[3*i+2] << " seconds";
+      if(nodes[3*i+1] > 0)
+	std::cout << ", " << 1e6*nodes[3*i+2]/nodes[3*i+1] << " seconds per million grid points";
+      std::cout << std::endl;
+    }
+  std::cout << "The last node finished " << last_done - first_done << " seconds after the first" << std::endl;
+}
+#endif
+
+void mmpbsa::resume_whole_snapshots(const snapshot_job_t& job, mmpbsa_io::trajectory_t& trajFile, mmpbsa::MMPBSAState& currState)
+{
+  using mmpbsa::MMPBSAState;
+  if(currState.currentMolecule == MMPBSAState::END_OF_MOLECULES)
+    {
+      job.hooks.progress(currState,1);
+      currState.currentSnap += 1;
+    }
+  currState.currentMolecule = MMPBSAState::COMPLEX;
+  mmpbsa_io::seek(trajFile,currState.currentSnap);
+}
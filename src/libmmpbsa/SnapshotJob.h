@@ -0,0 +1,435 @@
+/**
+ * @file SnapshotJob.h
+ * @brief Calculation of the snapshots of an MMPBSA job
+ *
+ * The data of a job (snapshot_job_t) is shared by every snapshot, each of which is
+ * calculated by a worker (snapshot_worker_t) that keeps caches and multigrid
+ * potentials from one snapshot to the next. Which snapshots are calculated, in which
+ * order and until when is kept by the job in its snapshot_run_t. The drivers that
+ * hand snapshots to workers are in their own files: one snapshot at a time
+ * (SnapshotSerial.h), threads (SnapshotThreads.h), a pipeline of stages
+ * (SnapshotPipeline.h) and forked processes (SnapshotProcesses.h).
+ */
+
+#ifndef SNAPSHOTJOB_H
+#define SNAPSHOTJOB_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string>
+#include <vector>
+#include <valarray>
+#include <map>
+
+#include "globals.h"
+#include "structs.h"
+#include "mmpbsa_exceptions.h"
+#include "mmpbsa_io.h"
+#include "EMap.h"
+#include "MMPBSAState.h"
+#include "MeadInterface.h"
+#include "PBMultigrid.h"
+#include "XMLNode.h"
+#include "XMLParser.h"
+
+#include "MEAD/FinDiffMethod.h"
+
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
+
+#if !defined(_WIN32) && !defined(USE_BOINC) && !defined(USE_MPI)
+//Snapshots may be calculated by forked worker processes (cf snapshot_processes).
+#define USE_SNAPSHOT_PROCESSES
+#endif
+
+namespace mmpbsa{
+
+/**
+ * Energies of the last calculation of a molecule (complex, receptor or ligand), which
+ * are reused while its coordinates and PB grid do not change, e.g. a rigid receptor.
+ */
+typedef struct {
+	bool valid;
+	size_t hash;///<Hash of the bits of the coordinates
+	std::valarray<mmpbsa::Vector> crds;
+	std::vector<mmpbsa::grid_level_t> levels;
+	mmpbsa::EMap energies;
+	std::vector<mmpbsa_t> sweep_energies;///<PB energies of each condition of a PB sweep
+	size_t snapshot;///<Snapshot in which the energies were calculated
+	size_t reused, calculated;
+}component_cache_t;
+
+/**
+ * Atom areas of the last surface area calculation of a separated receptor or ligand,
+ * which are reused while its coordinates do not change (cf sa_interface).
+ */
+typedef struct {
+	bool valid;
+	std::valarray<mmpbsa::Vector> crds;
+	std::vector<mmpbsa_t> atom_areas;
+	mmpbsa_t area;
+	size_t reused, calculated;
+}sa_cache_t;
+
+/**
+ * Energies of one molecule of a snapshot, which are calculated in turn by molecule_mm,
+ * molecule_pb and molecule_sa and combined by molecule_output.
+ */
+typedef struct {
+	mmpbsa::EMap energies;
+	std::vector<mmpbsa::EMap> atom_energies;///<MM energies of each atom, if decomposing
+	std::vector<mmpbsa_t> pb_energies;///<One per PB condition
+	std::vector<mmpbsa_t> atom_pb;///<PB energy of each atom, if decomposing
+	std::vector<mmpbsa_t> atom_areas;///<Area of each atom, if decomposing
+	mmpbsa_t area;
+	int molsurf_error_flag;
+}molecule_energy_t;
+
+/**
+ * Running estimate of DELTA G over the snapshots added to the output, with which a
+ * job stops calculating snapshots once it has converged (cf convergence flag).
+ */
+typedef struct {
+	bool active;
+	std::vector<mmpbsa_t> delta_g;///<DELTA G of each snapshot, in the order they were added to the output
+	mmpbsa_t error;///<Standard error of the mean of delta_g, from block averages
+	size_t block_size;///<Number of snapshots per block of the largest error, which is used
+	mmpbsa_t best_error;///<Smallest error so far
+	size_t best_at;///<Number of snapshots when best_error was reached
+	bool stopped;///<The job has converged. No more snapshots are started.
+}convergence_t;
+
+/**
+ * Order in which the snapshots of a job are calculated when it is not that of the
+ * trajectory (cf progressive_order). Snapshots are taken in turn by next_node_snapshot.
+ */
+typedef struct {
+	bool active;
+	std::vector<size_t> snaps;///<Snapshots of the job that have not been calculated, in the order in which they are calculated
+	std::map<size_t,size_t> places;///<Index in snaps of each snapshot
+	size_t next;///<Index in snaps of the next snapshot
+}snapshot_order_t;
+
+/**
+ * Clusters of structurally similar snapshots (cf cluster_rmsd). MMPBSA is only performed
+ * on the representative of each cluster, whose output is weighted by the population of
+ * its cluster.
+ */
+typedef struct {
+	bool active;
+	std::map<size_t,size_t> weights;///<Number of snapshots in the cluster of each representative
+	size_t num_site_atoms;///<Number of binding site atoms over which RMSD is calculated
+}snapshot_clusters_t;
+
+#ifdef USE_MPI
+/**
+ * Dynamic schedule of the snapshots of an MPI job (cf dynamic_schedule). The master
+ * orders the job's snapshots by decreasing estimated cost and sends the order to every
+ * node, which claims the next one from a counter on the master whenever it is ready for
+ * another, so that faster nodes calculate more snapshots and the cheapest snapshots are
+ * calculated last. Whole snapshots are scheduled; a claimed snapshot is not taken back.
+ */
+typedef struct {
+	bool active;
+	std::vector<size_t> snaps;///<Snapshots of the job, in the order in which they are claimed
+	std::vector<double> costs;///<Estimated cost of each of snaps: the number of points of its PB grids
+#if MPI_VERSION >= 3
+	MPI_Win window;///<Exposes counter, on the master
+#endif
+	long* counter;///<Index in snaps of the next snapshot to claim. Only allocated on the master.
+	size_t claimed;///<Snapshots claimed by this node
+	double claimed_cost;
+	double start,finish;///<MPI_Wtime of the start of the schedule and of this node's first unsuccessful claim
+}snapshot_schedule_t;
+#endif
+
+/**
+ * Which snapshots of a job are calculated, in which order and until when. Each job has
+ * its own (cf snapshot_job_t), which is changed as snapshots are taken and added to the
+ * output, one at a time, by the driver of the snapshots.
+ */
+typedef struct {
+	snapshot_order_t order;
+	convergence_t convergence;
+	snapshot_clusters_t clusters;
+	int node,num_nodes;///<MPI rank of this node and number of nodes. Zero and one without MPI.
+#ifdef USE_MPI
+	snapshot_schedule_t schedule;
+#endif
+}snapshot_run_t;
+
+/**
+ * Functions of the program with which snapshots are checkpointed and written, which
+ * depend on how it is built, e.g. with BOINC or MPI.
+ */
+typedef struct {
+	void (*progress)(mmpbsa::MMPBSAState& state, const double& increment);///<Adds the fraction of a snapshot that was calculated to the job's progress
+	void (*checkpoint)(mmpbsa::MMPBSAState& state);
+	void (*checkpoint_molecule)(const char* mol_name, const mmpbsa::EMap& energies, mmpbsa::MMPBSAState& state,
+			mmpbsa_utils::XMLNode* snapshotXML, void* mutex);///<Adds the energies of a molecule to its snapshot and checkpoints
+	int (*write_data)(mmpbsa_utils::XMLParser& energy_data, const mmpbsa::MMPBSAState& state);///<Writes the energy data after each snapshot. Null if it is only written at the end, e.g. with MPI.
+	void (*write_pdb)(const std::vector<mmpbsa::atom_t>& atoms, const mmpbsa::forcefield_t& ff,
+			const std::valarray<mmpbsa::Vector>& crds, const mmpbsa::MMPBSAState& state, const std::string& molecule);
+}snapshot_hooks_t;
+
+/**
+ * Data of an MMPBSA job that is shared by the calculation of every snapshot and
+ * does not change while snapshots are calculated (cf calculate_snapshot), except
+ * for run.
+ */
+typedef struct {
+	const mmpbsa::MeadInterface* mi;
+	const mmpbsa::forcefield_t* split_ff;///<Indexed by molecule
+	const std::vector<mmpbsa::atom_t>* atom_lists;///<Indexed by molecule
+	const std::valarray<mmpbsa::MMPBSAState::MOLECULE>* mol_list;
+	const std::map<std::string,mead_data_t>* radii;
+	const mmpbsa::grid_plan_t* job_plan;///<Used with fixed_grid
+	const std::vector<mmpbsa::grid_level_t>* job_levels;///<Used with fixed_grid
+	const FinDiffMethod* job_fdm;///<Null unless fixed_grid is used with MEAD
+	const std::vector<mmpbsa::pb_condition_t>* pb_conditions;
+	size_t complex_size,receptor_size,ligand_size;
+	void* mead_mutex;///<Held during MEAD calls, which use global data, if snapshots are calculated by several threads. Otherwise, null.
+	snapshot_run_t* run;///<Snapshots of this job that are calculated
+	snapshot_hooks_t hooks;
+}snapshot_job_t;
+
+/**
+ * State that is kept from one snapshot to the next, e.g. caches and multigrid
+ * potentials, and the statistics of the snapshots calculated with it. Each thread
+ * that calculates snapshots has its own (cf snapshot_threads).
+ */
+typedef struct {
+	std::valarray<mmpbsa::Vector> snapshot,complex_snap,receptor_snap,ligand_snap;
+	mmpbsa::mead_atom_set_t atom_sets[mmpbsa::MMPBSAState::END_OF_MOLECULES];
+	mmpbsa::PBMultigrid* mg_solvers[mmpbsa::MMPBSAState::END_OF_MOLECULES];
+	FinDiffMethod fdm;
+	mmpbsa::pb_reference_cache_t ref_caches[mmpbsa::MMPBSAState::END_OF_MOLECULES];
+	component_cache_t component_caches[mmpbsa::MMPBSAState::END_OF_MOLECULES];
+	sa_cache_t sa_caches[mmpbsa::MMPBSAState::END_OF_MOLECULES];
+	size_t sa_interface_atoms,sa_interface_snaps;
+	mmpbsa_t sa_max_deviation[mmpbsa::MMPBSAState::END_OF_MOLECULES],sa_sum_deviation[mmpbsa::MMPBSAState::END_OF_MOLECULES];///<Deviation of the surface area engine from molsurf (cf sa_check)
+	size_t sa_checked[mmpbsa::MMPBSAState::END_OF_MOLECULES];
+	bool reported_spacing;
+}snapshot_worker_t;
+
+/**
+ * Separates the coordinates of a snapshot into those of the complex, receptor and ligand.
+ */
+void split_snapshot(const std::valarray<mmpbsa::Vector>& snapshot, const std::valarray<mmpbsa::MMPBSAState::MOLECULE>& mol_list,
+		std::valarray<mmpbsa::Vector>& complexSnap, std::valarray<mmpbsa::Vector>& receptorSnap, std::valarray<mmpbsa::Vector>& ligandSnap);
+
+/**
+ * Reads the next snapshot that will be calculated, counting snapshots with snap_counter.
+ * Returns false at the end of the trajectory.
+ */
+bool next_job_snapshot(mmpbsa_io::trajectory_t& trajFile, const mmpbsa::MMPBSAState& currState,
+		std::valarray<mmpbsa::Vector>& snapshot, size_t& snap_counter);
+
+/**
+ * Determines whether a snapshot is calculated by this node, when snapshots are divided
+ * among MPI nodes in turn. Without MPI, every snapshot is.
+ */
+bool should_calculate_snapshot(const snapshot_run_t& run, const size_t& currentSnap, const std::vector<size_t>& snapList);
+
+/**
+ * FNV-1a hash of the bits of the coordinates. Identical coordinates have identical hashes.
+ */
+size_t coordinate_hash(const std::valarray<mmpbsa::Vector>& crds);
+
+/**
+ * Calculates the surface areas of the complex, receptor and ligand of a snapshot, for
+ * sa_interface. The atom areas of the receptor and ligand are calculated, or taken from
+ * their caches if they have not moved, and only the interface atoms of the complex are
+ * recalculated. areas and atom_areas are indexed by molecule. Returns the number of
+ * atoms of the complex that were recalculated.
+ */
+size_t interface_surface_areas(const mmpbsa::MeadInterface& mi, const std::vector<mmpbsa::atom_t>* atom_lists,
+		const mmpbsa::forcefield_t* split_ff, const std::valarray<mmpbsa::MMPBSAState::MOLECULE>& mol_list,
+		const std::valarray<mmpbsa::Vector>* const* mol_crds, const std::map<std::string,float>& radii,
+		sa_cache_t* caches, mmpbsa_t* areas, std::vector<mmpbsa_t>* atom_areas);
+
+/**
+ * Starts the run of a job's snapshots on MPI node node of num_nodes: every snapshot is
+ * calculated in trajectory order, without clusters or convergence, until these are started.
+ */
+void init_snapshot_run(snapshot_run_t& run, const int& node, const int& num_nodes);
+
+/**
+ * Place of a snapshot in the order in which snapshots are taken, by which the output of
+ * snapshots calculated at the same time is merged: its place in the progressive order,
+ * if there is one, or else its number.
+ */
+size_t snapshot_place(const snapshot_order_t& order, const size_t& snap);
+
+/**
+ * Snapshot at a place given by snapshot_place.
+ */
+size_t snapshot_at_place(const snapshot_order_t& order, const size_t& place);
+
+/**
+ * Starts calculating the snapshots of the job in progressive order, skipping those that
+ * were added to the output before a restart (currState.processedSnaps). The snapshots
+ * are those of snap_list or, without one, every snapshot of the trajectory, which is
+ * read once to count them.
+ */
+void start_snapshot_order(snapshot_order_t& order, mmpbsa_io::trajectory_t& trajFile, const mmpbsa::MMPBSAState& currState,
+		std::valarray<mmpbsa::Vector>& snapshot) throw (mmpbsa::MMPBSAException);
+
+/**
+ * Reads the next snapshot to be calculated by this node (cf should_calculate_snapshot),
+ * counting snapshots with snap_counter. With a dynamic MPI schedule or a progressive
+ * order, the snapshot is taken from it instead and snap_counter is set to its number.
+ * Returns false if there are none left, or the job has converged.
+ */
+bool next_node_snapshot(snapshot_run_t& run, mmpbsa_io::trajectory_t& trajFile, const mmpbsa::MMPBSAState& currState,
+		std::valarray<mmpbsa::Vector>& snapshot, size_t& snap_counter);
+
+/**
+ * Creates the atom sets, multigrid solvers and caches of a snapshot worker.
+ */
+void init_snapshot_worker(snapshot_worker_t& worker, const snapshot_job_t& job);
+void destroy_snapshot_worker(snapshot_worker_t& worker);
+
+/**
+ * Starts the output of a snapshot.
+ */
+mmpbsa_utils::XMLNode* new_snapshot_xml(const snapshot_job_t& job, const size_t& snap);
+
+/**
+ * Starts the convergence estimate of a job with the snapshots already in its output,
+ * e.g. those of a restarted job.
+ */
+void start_convergence(snapshot_run_t& run, const mmpbsa::MMPBSAState& currState, mmpbsa_utils::XMLParser& energy_data);
+
+/**
+ * Adds a snapshot to the convergence estimate and records the estimate in its output.
+ * If the standard error is below currState.convergence, or has not improved for
+ * currState.convergence_stall snapshots, the job stops and the reason is recorded.
+ * Snapshots must be added in the order of the output.
+ */
+void update_convergence(convergence_t& convergence, const mmpbsa::MMPBSAState& currState, mmpbsa_utils::XMLNode* snapshotXML);
+
+/**
+ * Prints the final convergence estimate of a job that did not stop.
+ */
+void report_convergence(const convergence_t& convergence);
+
+/**
+ * Adds the output of a calculated snapshot to the energy data, writes it and checkpoints,
+ * so that a restart begins with the next snapshot. Snapshots must be added in order.
+ */
+void append_snapshot(const snapshot_job_t& job, mmpbsa_utils::XMLParser& energy_data, mmpbsa::MMPBSAState& currState,
+		const size_t& snap, mmpbsa_utils::XMLNode* snapshotXML);
+
+/**
+ * Writes the complex, receptor and ligand of snapshot state.currentSnap to PDB files.
+ */
+void write_snapshot_pdbs(const snapshot_job_t& job, const mmpbsa::MMPBSAState& state,
+		const std::valarray<mmpbsa::Vector>* const* mol_crds);
+
+/**
+ * Finite difference grid levels of a snapshot. The grid depends only on the complex,
+ * so the receptor and ligand share it.
+ */
+std::vector<mmpbsa::grid_level_t> snapshot_grid(const snapshot_job_t& job, const std::valarray<mmpbsa::Vector>* const* mol_crds);
+
+/**
+ * Warns that the fine grid spacing had to be increased, unless reported_spacing is already true.
+ */
+void report_grid_spacing(const mmpbsa::MeadInterface& mi, const std::vector<mmpbsa::grid_level_t>& levels, bool& reported_spacing);
+
+/**
+ * Adds the grid levels of a snapshot, and the PB sweep and decomposition tables, if these
+ * are used, to its output. The tables are filled by molecule_output.
+ */
+void start_snapshot_xml(const snapshot_job_t& job, const bool& decompose, const std::vector<mmpbsa::grid_level_t>& levels,
+		mmpbsa_utils::XMLNode* snapshotXML, mmpbsa_utils::XMLNode** sweepXML, mmpbsa_utils::XMLNode** decompositionXML);
+
+/**
+ * Sets the worker's finite difference method to the grid levels of a snapshot, if MEAD is used.
+ */
+void prepare_mead_grid(const snapshot_job_t& job, snapshot_worker_t& worker, const std::vector<mmpbsa::grid_level_t>& levels);
+
+/**
+ * MM energies of molecule mol and, if decompose is true, their decomposition by atom.
+ */
+void molecule_mm(const snapshot_job_t& job, const size_t& mol, const std::valarray<mmpbsa::Vector>& crds,
+		const bool& decompose, molecule_energy_t& result);
+
+/**
+ * PB energies of molecule mol, one per condition, and, if decompose is true, the energy
+ * of the first condition by atom. MEAD uses the worker's finite difference method (cf prepare_mead_grid).
+ */
+void molecule_pb(const snapshot_job_t& job, snapshot_worker_t& worker, const size_t& mol, const std::valarray<mmpbsa::Vector>& crds,
+		const std::vector<mmpbsa::grid_level_t>& levels, const bool& decompose, molecule_energy_t& result);
+
+/**
+ * Surface area of molecule mol and, if decompose is true, the area of each atom.
+ */
+void molecule_sa(const snapshot_job_t& job, const size_t& mol, const std::valarray<mmpbsa::Vector>& crds,
+		const bool& decompose, molecule_energy_t& result);
+
+/**
+ * If sa_check is used, compares the surface area of molecule mol with that of molsurf
+ * and adds the deviation to the worker's statistics.
+ */
+void check_surface_area(const snapshot_job_t& job, snapshot_worker_t& worker, const size_t& mol,
+		const std::valarray<mmpbsa::Vector>& crds, const molecule_energy_t& result);
+
+/**
+ * Completes the energies of a molecule with its PB and SA energies and fills its
+ * rows of the PB sweep and decomposition tables, if these are used.
+ */
+void molecule_output(const snapshot_job_t& job, const size_t& mol, const std::string& mol_name, molecule_energy_t& result,
+		mmpbsa_utils::XMLNode* sweepXML, mmpbsa_utils::XMLNode* decompositionXML);
+
+/**
+ * Calculates the energies of the molecules of snapshot state.currentSnap, beginning with
+ * state.currentMolecule, and adds them to snapshotXML. When this returns, state.currentMolecule
+ * is END_OF_MOLECULES. If checkpoint is true, the state is checkpointed after each molecule.
+ * Otherwise, it is left to the caller, which allows several snapshots to be calculated at the
+ * same time, each with its own worker and state.
+ */
+void calculate_snapshot(const snapshot_job_t& job, snapshot_worker_t& worker, mmpbsa::MMPBSAState& state,
+		mmpbsa_utils::XMLNode* snapshotXML, const bool& checkpoint);
+
+/**
+ * Prints the statistics of the caches and surface area checks, summed over the workers.
+ */
+void report_snapshot_workers(const snapshot_job_t& job, const snapshot_worker_t* workers, const size_t& num_workers,
+		const mmpbsa::MMPBSAState& currState);
+
+#ifdef USE_MPI
+/**
+ * Starts the dynamic schedule of the job's remaining snapshots (cf snapshot_schedule_t),
+ * which every node must call. The remaining snapshots are those of the job that no node
+ * has added to its output, according to the processedSnaps of each node's checkpoint.
+ * The master reads them from the trajectory and estimates the cost of each by the number
+ * of points of its PB grids, which is what varies between snapshots, as a snapshot's grids
+ * cover its complex (cf snapshot_grid). Snapshots of equal cost keep their order. The
+ * estimates are not revised from the times observed while the job runs.
+ */
+void start_snapshot_schedule(snapshot_run_t& run, const snapshot_job_t& job, snapshot_worker_t& worker,
+		mmpbsa_io::trajectory_t& trajFile, const mmpbsa::MMPBSAState& currState) throw (mmpbsa::MMPBSAException);
+
+/**
+ * Ends the dynamic schedule, which every node must call once it has claimed its last
+ * snapshot. The master prints the share of the estimated cost of each node, its observed
+ * time per million grid points and the time between the first and the last node
+ * running out of snapshots.
+ */
+void finish_snapshot_schedule(snapshot_run_t& run);
+#endif
+
+/**
+ * Prepares the trajectory for calculating whole snapshots, beginning with snapshot
+ * currState.currentSnap. A snapshot interrupted during a previous run is restarted.
+ */
+void resume_whole_snapshots(const snapshot_job_t& job, mmpbsa_io::trajectory_t& trajFile, mmpbsa::MMPBSAState& currState);
+
+}//end namespace mmpbsa
+
+#endif	/* SNAPSHOTJOB_H */
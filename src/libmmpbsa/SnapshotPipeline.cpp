@@ -0,0 +1,365 @@
+#include "SnapshotPipeline.h"
+
+#ifdef USE_PTHREADS
+
+#include <iostream>
+
+#include <pthread.h>
+#include <sys/time.h>
+
+/**
+ * Wall clock time, in seconds, for the pipeline statistics.
+ */
+static double pipeline_seconds()
+{
+  struct timeval now;
+  gettimeofday(&now,NULL);
+  return now.tv_sec + 1e-6*now.tv_usec;
+}
+
+/**
+ * Records the first error of the pipeline and wakes every thread. The pipeline's mutex must be held.
+ */
+static void fail_pipeline(mmpbsa::pipeline_t& pipeline, const mmpbsa::MMPBSAException& e)
+{
+  if(!pipeline.failed)
+    {
+      pipeline.failed = true;
+      pipeline.error = e.what();
+      pipeline.error_type = e.getErrType();
+    }
+  pthread_cond_broadcast(&pipeline.changed);
+}
+
+/**
+ * Reads the next snapshot to be calculated by this node. Returns null if there are
+ * none left. The pipeline's mutex must be held.
+ */
+static mmpbsa::pipeline_item_t* read_pipeline_item(mmpbsa::pipeline_t& pipeline, std::valarray<mmpbsa::Vector>& snapshot)
+{
+  if(!mmpbsa::next_node_snapshot(*pipeline.job->run,*pipeline.trajFile,*pipeline.currState,snapshot,pipeline.snap_counter))
+    return 0;
+  mmpbsa::pipeline_item_t* returnMe = new mmpbsa::pipeline_item_t;
+  returnMe->snap = pipeline.snap_counter;
+  returnMe->sequence = pipeline.num_read++;
+  return returnMe;
+}
+
+/**
+ * Performs the work of a stage, other than reading and writing, on a snapshot.
+ */
+static void run_pipeline_stage(mmpbsa::pipeline_thread_t& thread, mmpbsa::pipeline_item_t& item)
+{
+  using mmpbsa::MMPBSAState;
+  const mmpbsa::snapshot_job_t& job = *thread.pipeline->job;
+  const mmpbsa::MeadInterface& mi = *job.mi;
+  const bool& decompose = thread.state.decompose;
+  const std::valarray<mmpbsa::Vector>* mol_crds[MMPBSAState::END_OF_MOLECULES] = {&item.crds[0],&item.crds[1],&item.crds[2]};
+  switch(thread.stage)
+    {
+    case mmpbsa::PIPELINE_READ:
+      {
+	for(size_t i = 0;i<MMPBSAState::END_OF_MOLECULES;i++)
+	  item.crds[i].resize((i == MMPBSAState::COMPLEX) ? job.complex_size : ((i == MMPBSAState::RECEPTOR) ? job.receptor_size : job.ligand_size));
+	mmpbsa::split_snapshot(thread.snapshot,*job.mol_list,item.crds[MMPBSAState::COMPLEX],item.crds[MMPBSAState::RECEPTOR],item.crds[MMPBSAState::LIGAND]);
+	if(thread.state.savePDB)
+	  {
+	    thread.state.currentSnap = item.snap;
+	    mmpbsa::write_snapshot_pdbs(job,thread.state,mol_crds);
+	  }
+	item.levels = mmpbsa::snapshot_grid(job,mol_crds);
+	break;
+      }
+    case mmpbsa::PIPELINE_MM:
+      for(size_t i = 0;i<MMPBSAState::END_OF_MOLECULES;i++)
+	mmpbsa::molecule_mm(job,i,item.crds[i],decompose,item.molecules[i]);
+      break;
+    case mmpbsa::PIPELINE_PB:
+      mmpbsa::prepare_mead_grid(job,*thread.worker,item.levels);
+      for(size_t i = 0;i<MMPBSAState::END_OF_MOLECULES;i++)
+	mmpbsa::molecule_pb(job,*thread.worker,i,item.crds[i],item.levels,decompose,item.molecules[i]);
+      break;
+    case mmpbsa::PIPELINE_SA:
+      if(mi.sa_interface)
+	{
+	  mmpbsa_t areas[MMPBSAState::END_OF_MOLECULES];
+	  std::vector<mmpbsa_t> atom_areas[MMPBSAState::END_OF_MOLECULES];
+	  thread.worker->sa_interface_atoms += mmpbsa::interface_surface_areas(mi,job.atom_lists,job.split_ff,*job.mol_list,mol_crds,*job.radii,
+								       thread.worker->sa_caches,areas,atom_areas);
+	  thread.worker->sa_interface_snaps++;
+	  for(size_t i = 0;i<MMPBSAState::END_OF_MOLECULES;i++)
+	    {
+	      item.molecules[i].area = areas[i];
+	      item.molecules[i].molsurf_error_flag = 0;
+	      if(decompose)
+		item.molecules[i].atom_areas.swap(atom_areas[i]);
+	    }
+	}
+      else
+	for(size_t i = 0;i<MMPBSAState::END_OF_MOLECULES;i++)
+	  mmpbsa::molecule_sa(job,i,item.crds[i],decompose,item.molecules[i]);
+      for(size_t i = 0;i<MMPBSAState::END_OF_MOLECULES;i++)
+	mmpbsa::check_surface_area(job,*thread.worker,i,item.crds[i],item.molecules[i]);
+      break;
+    default:
+      throw mmpbsa::MMPBSAException("run_pipeline_stage: invalid stage.",mmpbsa::DATA_FORMAT_ERROR);
+    }
+}
+
+/**
+ * Adds a calculated snapshot to the energy data, writes it and checkpoints.
+ */
+static void write_pipeline_item(mmpbsa::pipeline_t& pipeline, mmpbsa::pipeline_item_t& item)
+{
+  using mmpbsa::MMPBSAState;
+  const mmpbsa::snapshot_job_t& job = *pipeline.job;
+  mmpbsa::MMPBSAState& currState = *pipeline.currState;
+  const char* mol_names[] = {"COMPLEX","RECEPTOR","LIGAND"};
+  mmpbsa_utils::XMLNode* snapshotXML = mmpbsa::new_snapshot_xml(job,item.snap);
+  mmpbsa_utils::XMLNode *sweepXML,*decompositionXML;
+  mmpbsa::start_snapshot_xml(job,currState.decompose,item.levels,snapshotXML,&sweepXML,&decompositionXML);
+  for(size_t i = 0;i<MMPBSAState::END_OF_MOLECULES;i++)
+    {
+      mmpbsa::molecule_output(job,i,mol_names[i],item.molecules[i],sweepXML,decompositionXML);
+      snapshotXML->insertChild(item.molecules[i].energies.toXML(mol_names[i]));
+    }
+  mmpbsa::append_snapshot(job,*pipeline.energy_data,*pipeline.currState,item.snap,snapshotXML);
+}
+
+/**
+ * Runs one worker of a stage of the pipeline until the stage before it has finished,
+ * or, for the read stage, the trajectory has been read, or the pipeline fails.
+ */
+static void* run_pipeline_thread(void* args)
+{
+  mmpbsa::pipeline_thread_t& thread = *(mmpbsa::pipeline_thread_t*)args;
+  mmpbsa::pipeline_t& pipeline = *thread.pipeline;
+  const mmpbsa::PipelineStage stage = thread.stage;
+  mmpbsa::pipeline_stats_t& stats = pipeline.stats[stage];
+  mmpbsa::pipeline_queue_t* input = (stage == mmpbsa::PIPELINE_READ) ? 0 : &pipeline.queues[stage-1];
+  mmpbsa::pipeline_queue_t& output = pipeline.queues[stage];
+  while(true)
+    {
+      mmpbsa::pipeline_item_t* item = 0;
+      double start = pipeline_seconds(),received,processed;
+
+      // Take the next snapshot. Reading the trajectory counts as work.
+      pthread_mutex_lock(&pipeline.mutex);
+      if(input == 0)
+	{
+	  try
+	    {
+	      if(!pipeline.failed)
+		item = read_pipeline_item(pipeline,thread.snapshot);
+	    }
+	  catch(const mmpbsa::MMPBSAException& e)
+	    {
+	      fail_pipeline(pipeline,e);
+	    }
+	}
+      else
+	{
+	  while(!pipeline.failed && input->items.empty() && input->producers > 0)
+	    pthread_cond_wait(&pipeline.changed,&pipeline.mutex);
+	  if(!pipeline.failed && !input->items.empty())
+	    {
+	      item = input->items.front();
+	      input->items.pop_front();
+	      pthread_cond_broadcast(&pipeline.changed);
+	    }
+	}
+      pthread_mutex_unlock(&pipeline.mutex);
+      if(item == 0)
+	break;
+      received = pipeline_seconds();
+
+      try
+	{
+	  run_pipeline_stage(thread,*item);
+	}
+      catch(const mmpbsa::MMPBSAException& e)
+	{
+	  delete item;
+	  pthread_mutex_lock(&pipeline.mutex);
+	  fail_pipeline(pipeline,e);
+	  pthread_mutex_unlock(&pipeline.mutex);
+	  break;
+	}
+      processed = pipeline_seconds();
+
+      // Pass it on, once the next stage has room for it.
+      pthread_mutex_lock(&pipeline.mutex);
+      while(!pipeline.failed && output.items.size() >= output.capacity)
+	pthread_cond_wait(&pipeline.changed,&pipeline.mutex);
+      if(pipeline.failed)
+	delete item;
+      else
+	{
+	  if(stage == mmpbsa::PIPELINE_READ)
+	    mmpbsa::report_grid_spacing(*pipeline.job->mi,item->levels,pipeline.reported_spacing);
+	  output.items.push_back(item);
+	  pthread_cond_broadcast(&pipeline.changed);
+	}
+      stats.snapshots++;
+      if(input == 0)
+	stats.busy += processed - start;
+      else
+	{
+	  stats.starved += received - start;
+	  stats.busy += processed - received;
+	}
+      stats.blocked += pipeline_seconds() - processed;
+      bool failed = pipeline.failed;
+      pthread_mutex_unlock(&pipeline.mutex);
+      if(failed)
+	break;
+    }
+
+  pthread_mutex_lock(&pipeline.mutex);
+  output.producers--;
+  pthread_cond_broadcast(&pipeline.changed);
+  pthread_mutex_unlock(&pipeline.mutex);
+  return 0;
+}
+
+void mmpbsa::run_snapshot_pipeline(const mmpbsa::snapshot_job_t& job, mmpbsa::snapshot_worker_t* workers, const std::vector<size_t>& stage_workers,
+			   const size_t& queue_size, mmpbsa_io::trajectory_t& trajFile, mmpbsa::MMPBSAState& currState,
+			   mmpbsa_utils::XMLParser& energy_data) throw (mmpbsa::MMPBSAException)
+{
+  mmpbsa::resume_whole_snapshots(job,trajFile,currState);
+
+  mmpbsa::pipeline_t pipeline;
+  pipeline.job = &job;
+  pipeline.trajFile = &trajFile;
+  pipeline.currState = &currState;
+  pipeline.energy_data = &energy_data;
+  pipeline.snap_counter = currState.currentSnap - 1;
+  pipeline.num_read = 0;
+  pipeline.reported_spacing = false;
+  pipeline.failed = false;
+  pipeline.error_type = mmpbsa::UNKNOWN_ERROR;
+  pthread_mutex_init(&pipeline.mutex,NULL);
+  pthread_cond_init(&pipeline.changed,NULL);
+  for(size_t s = 0;s<mmpbsa::PIPELINE_STAGES;s++)
+    {
+      mmpbsa::pipeline_stats_t& stats = pipeline.stats[s];
+      stats.workers = (s == mmpbsa::PIPELINE_WRITE) ? 1 : stage_workers.at(s);
+      stats.snapshots = 0;
+      stats.busy = stats.starved = stats.blocked = 0;
+      if(s == mmpbsa::PIPELINE_WRITE)
+	continue;
+      pipeline.queues[s].capacity = (queue_size > 0) ? queue_size : 1;
+      pipeline.queues[s].producers = stats.workers;
+    }
+
+  std::vector<mmpbsa::pipeline_thread_t> threads;
+  for(size_t s = 0;s<mmpbsa::PIPELINE_WRITE;s++)
+    for(size_t i = 0;i<stage_workers[s];i++)
+      {
+	mmpbsa::pipeline_thread_t thread;
+	thread.pipeline = &pipeline;
+	thread.stage = mmpbsa::PipelineStage(s);
+	thread.worker = 0;
+	if(s == mmpbsa::PIPELINE_PB)
+	  thread.worker = &workers[i];
+	else if(s == mmpbsa::PIPELINE_SA)
+	  thread.worker = &workers[stage_workers[mmpbsa::PIPELINE_PB] + i];
+	thread.state = currState;
+	thread.snapshot.resize(job.mol_list->size());
+	threads.push_back(thread);
+      }
+
+  double start = pipeline_seconds();
+  std::vector<pthread_t> thread_ids(threads.size());
+  std::vector<bool> started(threads.size(),false);
+  for(size_t i = 0;i<threads.size();i++)
+    {
+      started[i] = (pthread_create(&thread_ids[i],NULL,run_pipeline_thread,(void*)&threads[i]) == 0);
+      if(started[i])
+	continue;
+      //The other workers of the stage do its work. A stage without workers would lose every snapshot.
+      pthread_mutex_lock(&pipeline.mutex);
+      mmpbsa::PipelineStage stage = threads[i].stage;
+      pipeline.queues[stage].producers--;
+      if(--pipeline.stats[stage].workers == 0)
+	fail_pipeline(pipeline,mmpbsa::MMPBSAException("run_snapshot_pipeline: Could not start a thread for each stage.",mmpbsa::UNKNOWN_ERROR));
+      pthread_cond_broadcast(&pipeline.changed);
+      pthread_mutex_unlock(&pipeline.mutex);
+    }
+
+  //Write snapshots in the order in which they were read.
+  mmpbsa::pipeline_queue_t& input = pipeline.queues[mmpbsa::PIPELINE_SA];
+  mmpbsa::pipeline_stats_t& write_stats = pipeline.stats[mmpbsa::PIPELINE_WRITE];
+  std::map<size_t,mmpbsa::pipeline_item_t*> pending;
+  size_t next_sequence = 0;
+  while(true)
+    {
+      mmpbsa::pipeline_item_t* item = 0;
+      double waiting = pipeline_seconds(),received;
+      pthread_mutex_lock(&pipeline.mutex);
+      while(!pipeline.failed && input.items.empty() && input.producers > 0)
+	pthread_cond_wait(&pipeline.changed,&pipeline.mutex);
+      if(!pipeline.failed && !input.items.empty())
+	{
+	  item = input.items.front();
+	  input.items.pop_front();
+	  pthread_cond_broadcast(&pipeline.changed);
+	}
+      pthread_mutex_unlock(&pipeline.mutex);
+      if(item == 0)
+	break;
+      received = pipeline_seconds();
+      write_stats.starved += received - waiting;
+
+      pending[item->sequence] = item;
+      try
+	{
+	  while(pending.size() && pending.begin()->first == next_sequence)
+	    {
+	      write_pipeline_item(pipeline,*pending.begin()->second);
+	      delete pending.begin()->second;
+	      pending.erase(pending.begin());
+	      next_sequence++;
+	      write_stats.snapshots++;
+	    }
+	}
+      catch(const mmpbsa::MMPBSAException& e)
+	{
+	  pthread_mutex_lock(&pipeline.mutex);
+	  fail_pipeline(pipeline,e);
+	  pthread_mutex_unlock(&pipeline.mutex);
+	  break;
+	}
+      write_stats.busy += pipeline_seconds() - received;
+    }
+
+  for(size_t i = 0;i<threads.size();i++)
+    if(started[i])
+      pthread_join(thread_ids[i],NULL);
+  double elapsed = pipeline_seconds() - start;
+
+  //Snapshots that were not written, after a failure.
+  for(std::map<size_t,mmpbsa::pipeline_item_t*>::iterator it = pending.begin();it != pending.end();it++)
+    delete it->second;
+  for(size_t s = 0;s<mmpbsa::PIPELINE_WRITE;s++)
+    for(std::deque<mmpbsa::pipeline_item_t*>::iterator it = pipeline.queues[s].items.begin();it != pipeline.queues[s].items.end();it++)
+      delete *it;
+  pthread_cond_destroy(&pipeline.changed);
+  pthread_mutex_destroy(&pipeline.mutex);
+
+  const char* stage_names[] = {"read","MM","PB","SA","write"};
+  std::cout << "Pipeline ran for " << elapsed << " seconds" << std::endl;
+  for(size_t s = 0;s<mmpbsa::PIPELINE_STAGES;s++)
+    {
+      const mmpbsa::pipeline_stats_t& stats = pipeline.stats[s];
+      double occupancy = (stats.workers && elapsed > 0) ? stats.busy/(stats.workers*elapsed) : 0;
+      std::cout << stage_names[s] << " stage: " << stats.workers << " workers, " << stats.snapshots << " snapshots, "
+		<< 100*occupancy << "% busy, " << stats.starved << " s waiting for input, "
+		<< stats.blocked << " s waiting for output" << std::endl;
+    }
+
+  if(pipeline.failed)
+    throw mmpbsa::MMPBSAException("run_snapshot_pipeline: " + pipeline.error,pipeline.error_type);
+}
+
+#endif //USE_PTHREADS
@@ -0,0 +1,109 @@
+/**
+ * @file SnapshotPipeline.h
+ * @brief Calculation of the snapshots of a job in a pipeline of stages
+ *
+ * Threads of each stage (read, MM, PB, SA) pass snapshots to the next stage through
+ * bounded queues, and the calling thread writes them in the order in which they were read.
+ */
+
+#ifndef SNAPSHOTPIPELINE_H
+#define SNAPSHOTPIPELINE_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "SnapshotJob.h"
+
+#ifdef USE_PTHREADS
+#include <deque>
+#include <pthread.h>
+
+namespace mmpbsa{
+
+/**
+ * Stages of the snapshot pipeline (cf run_snapshot_pipeline). Each stage passes
+ * snapshots to the next through a bounded queue.
+ */
+enum PipelineStage {PIPELINE_READ = 0,PIPELINE_MM,PIPELINE_PB,PIPELINE_SA,PIPELINE_WRITE,PIPELINE_STAGES};
+
+/**
+ * Snapshot passed between the stages of the pipeline.
+ */
+typedef struct {
+	size_t snap;
+	size_t sequence;///<Order in which the snapshot was read, which is the order of output
+	std::valarray<mmpbsa::Vector> crds[mmpbsa::MMPBSAState::END_OF_MOLECULES];
+	std::vector<mmpbsa::grid_level_t> levels;
+	molecule_energy_t molecules[mmpbsa::MMPBSAState::END_OF_MOLECULES];
+}pipeline_item_t;
+
+/**
+ * Bounded queue between two stages of the pipeline.
+ */
+typedef struct {
+	std::deque<pipeline_item_t*> items;
+	size_t capacity;
+	size_t producers;///<Workers of the stage that fills the queue that are still running
+}pipeline_queue_t;
+
+/**
+ * Statistics of a stage of the pipeline. Times are in seconds, summed over the stage's workers.
+ */
+typedef struct {
+	size_t workers;
+	size_t snapshots;
+	double busy;
+	double starved;///<Waiting for a snapshot from the previous stage
+	double blocked;///<Waiting for room in the queue of the next stage
+}pipeline_stats_t;
+
+/**
+ * Shared data of the pipeline. Everything but job is guarded by mutex.
+ */
+typedef struct {
+	const snapshot_job_t* job;
+	mmpbsa_io::trajectory_t* trajFile;
+	mmpbsa::MMPBSAState* currState;///<Checkpointed after each snapshot is added to energy_data
+	mmpbsa_utils::XMLParser* energy_data;
+	pthread_mutex_t mutex;
+	pthread_cond_t changed;///<Broadcast when a queue changes or the pipeline fails
+	pipeline_queue_t queues[PIPELINE_WRITE];///<queues[s] holds the snapshots finished by stage s
+	pipeline_stats_t stats[PIPELINE_STAGES];
+	size_t snap_counter;///<Last snapshot read from the trajectory
+	size_t num_read;
+	bool reported_spacing;
+	bool failed;
+	std::string error;
+	mmpbsa::MMPBSAErrorTypes error_type;
+}pipeline_t;
+
+/**
+ * Argument of run_pipeline_thread.
+ */
+typedef struct {
+	pipeline_t* pipeline;
+	PipelineStage stage;
+	snapshot_worker_t* worker;///<Used by the PB and SA stages
+	mmpbsa::MMPBSAState state;///<Copy of the job's state
+	std::valarray<mmpbsa::Vector> snapshot;///<Used by the read stage
+}pipeline_thread_t;
+
+/**
+ * Calculates the remaining snapshots of the trajectory in a pipeline of stages: reading
+ * and separating snapshots, MM, PB, SA and writing. The first four stages have the number
+ * of workers given by stage_workers, and each passes snapshots to the next through a queue
+ * of at most queue_size snapshots, so that, e.g., the MM and SA of some snapshots overlap
+ * the PB of others. This thread writes the snapshots, and checkpoints, in the order in which
+ * they were read, so output is the same as that of the serial loop. The PB and SA workers each
+ * use one of workers, PB first. The busy and waiting times of each stage are printed at the end.
+ */
+void run_snapshot_pipeline(const snapshot_job_t& job, snapshot_worker_t* workers, const std::vector<size_t>& stage_workers,
+		const size_t& queue_size, mmpbsa_io::trajectory_t& trajFile, mmpbsa::MMPBSAState& currState,
+		mmpbsa_utils::XMLParser& energy_data) throw (mmpbsa::MMPBSAException);
+
+}//end namespace mmpbsa
+
+#endif //USE_PTHREADS
+
+#endif	/* SNAPSHOTPIPELINE_H */
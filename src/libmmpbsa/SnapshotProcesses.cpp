@@ -0,0 +1,488 @@
+#include "SnapshotProcesses.h"
+
+#ifdef USE_SNAPSHOT_PROCESSES
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <sstream>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+
+/**
+ * Writes size bytes to a pipe, retrying after interruptions and partial writes.
+ * Returns false if the pipe was closed.
+ */
+static bool write_fully(int fd, const void* buffer, size_t size)
+{
+  const char* curr = (const char*)buffer;
+  while(size)
+    {
+      ssize_t written = write(fd,curr,size);
+      if(written < 0 && errno == EINTR)
+	continue;
+      if(written <= 0)
+	return false;
+      curr += written;
+      size -= written;
+    }
+  return true;
+}
+
+/**
+ * Reads size bytes from a pipe, retrying after interruptions and partial reads.
+ * Returns false at the end of the pipe.
+ */
+static bool read_fully(int fd, void* buffer, size_t size)
+{
+  char* curr = (char*)buffer;
+  while(size)
+    {
+      ssize_t num_read = read(fd,curr,size);
+      if(num_read < 0 && errno == EINTR)
+	continue;
+      if(num_read <= 0)
+	return false;
+      curr += num_read;
+      size -= num_read;
+    }
+  return true;
+}
+
+/**
+ * Appends a binary copy of an XML tree to record: the node's name and text, each
+ * preceded by its length, then its number of children and each child in turn.
+ */
+static void pack_xml(const mmpbsa_utils::XMLNode* node, std::string& record)
+{
+  size_t length = node->getName().size();
+  record.append((const char*)&length,sizeof(length));
+  record.append(node->getName());
+  length = node->getText().size();
+  record.append((const char*)&length,sizeof(length));
+  record.append(node->getText());
+  size_t num_children = 0;
+  for(const mmpbsa_utils::XMLNode* child = node->children;child != 0;child = child->siblings)
+    num_children++;
+  record.append((const char*)&num_children,sizeof(num_children));
+  for(const mmpbsa_utils::XMLNode* child = node->children;child != 0;child = child->siblings)
+    pack_xml(child,record);
+}
+
+/**
+ * Reads a size_t from a record, beginning at pos, which is advanced past it.
+ */
+static size_t unpack_size(const std::string& record, size_t& pos) throw (mmpbsa::MMPBSAException)
+{
+  size_t returnMe;
+  if(pos + sizeof(returnMe) > record.size())
+    throw mmpbsa::MMPBSAException("unpack_size: Snapshot record is truncated.",mmpbsa::DATA_FORMAT_ERROR);
+  memcpy(&returnMe,record.data() + pos,sizeof(returnMe));
+  pos += sizeof(returnMe);
+  return returnMe;
+}
+
+/**
+ * Reads a string, preceded by its length, from a record, beginning at pos, which is advanced past it.
+ */
+static std::string unpack_string(const std::string& record, size_t& pos) throw (mmpbsa::MMPBSAException)
+{
+  size_t length = unpack_size(record,pos);
+  if(length > record.size() - pos)
+    throw mmpbsa::MMPBSAException("unpack_string: Snapshot record is truncated.",mmpbsa::DATA_FORMAT_ERROR);
+  pos += length;
+  return record.substr(pos - length,length);
+}
+
+/**
+ * Rebuilds an XML tree written by pack_xml, beginning at pos, which is advanced past it.
+ */
+static mmpbsa_utils::XMLNode* unpack_xml(const std::string& record, size_t& pos) throw (mmpbsa::MMPBSAException)
+{
+  std::string name = unpack_string(record,pos);
+  std::string text = unpack_string(record,pos);
+  size_t num_children = unpack_size(record,pos);
+  mmpbsa_utils::XMLNode* returnMe = new mmpbsa_utils::XMLNode(name,text);
+  try
+    {
+      for(size_t i = 0;i<num_children;i++)
+	returnMe->insertChild(unpack_xml(record,pos));
+    }
+  catch(const mmpbsa::MMPBSAException& e)
+    {
+      delete returnMe;
+      throw e;
+    }
+  return returnMe;
+}
+
+/**
+ * Copies the statistics of a snapshot worker (cf mmpbsa::report_snapshot_workers).
+ */
+static mmpbsa::worker_statistics_t get_worker_statistics(const mmpbsa::snapshot_worker_t& worker)
+{
+  mmpbsa::worker_statistics_t returnMe;
+  for(size_t i = 0;i<mmpbsa::MMPBSAState::END_OF_MOLECULES;i++)
+    {
+      returnMe.reused[i] = worker.component_caches[i].reused;
+      returnMe.calculated[i] = worker.component_caches[i].calculated;
+      returnMe.sa_reused[i] = worker.sa_caches[i].reused;
+      returnMe.sa_calculated[i] = worker.sa_caches[i].calculated;
+      returnMe.ref_reused[i] = worker.ref_caches[i].reused;
+      returnMe.ref_solved[i] = worker.ref_caches[i].solved;
+      returnMe.ref_max_error[i] = worker.ref_caches[i].max_error;
+      returnMe.sa_checked[i] = worker.sa_checked[i];
+      returnMe.sa_max_deviation[i] = worker.sa_max_deviation[i];
+      returnMe.sa_sum_deviation[i] = worker.sa_sum_deviation[i];
+    }
+  returnMe.sa_interface_atoms = worker.sa_interface_atoms;
+  returnMe.sa_interface_snaps = worker.sa_interface_snaps;
+  return returnMe;
+}
+
+/**
+ * Replaces the statistics of a snapshot worker with those of a worker process.
+ */
+static void set_worker_statistics(mmpbsa::snapshot_worker_t& worker, const mmpbsa::worker_statistics_t& stats)
+{
+  for(size_t i = 0;i<mmpbsa::MMPBSAState::END_OF_MOLECULES;i++)
+    {
+      worker.component_caches[i].reused = stats.reused[i];
+      worker.component_caches[i].calculated = stats.calculated[i];
+      worker.sa_caches[i].reused = stats.sa_reused[i];
+      worker.sa_caches[i].calculated = stats.sa_calculated[i];
+      worker.ref_caches[i].reused = stats.ref_reused[i];
+      worker.ref_caches[i].solved = stats.ref_solved[i];
+      worker.ref_caches[i].max_error = stats.ref_max_error[i];
+      worker.sa_checked[i] = stats.sa_checked[i];
+      worker.sa_max_deviation[i] = stats.sa_max_deviation[i];
+      worker.sa_sum_deviation[i] = stats.sa_sum_deviation[i];
+    }
+  worker.sa_interface_atoms = stats.sa_interface_atoms;
+  worker.sa_interface_snaps = stats.sa_interface_snaps;
+}
+
+/**
+ * Sends a record, a header followed by data, to the master. Returns false if the master has gone.
+ */
+static bool send_process_record(int fd, mmpbsa::process_record_t record, const std::string& data)
+{
+  record.length = data.size();
+  return write_fully(fd,&record,sizeof(record)) && write_fully(fd,data.data(),data.size());
+}
+
+/**
+ * Body of a worker process. Calculates the snapshots whose numbers are read from task_fd,
+ * reading them from its own copy of the trajectory, and writes their output to result_fd,
+ * until it reads zero. Then, it writes the statistics of its worker.
+ */
+static void run_snapshot_process(const mmpbsa::snapshot_job_t& job, mmpbsa::snapshot_worker_t& worker, mmpbsa::MMPBSAState& state,
+			  mmpbsa_io::trajectory_t& trajFile, int task_fd, int result_fd)
+{
+  size_t snap;
+  while(read_fully(task_fd,&snap,sizeof(snap)) && snap != 0)
+    {
+      mmpbsa::process_record_t record;
+      record.snap = snap;
+      record.error_type = 0;
+      std::string data;
+      mmpbsa_utils::XMLNode* snapshotXML = mmpbsa::new_snapshot_xml(job,snap);
+      try
+	{
+	  mmpbsa_io::seek(trajFile,snap);
+	  if(!mmpbsa_io::get_next_snap(trajFile,worker.snapshot))
+	    throw mmpbsa::MMPBSAException("run_snapshot_process: Could not read the snapshot from the trajectory.",mmpbsa::UNEXPECTED_EOF);
+	  state.currentSnap = snap;
+	  state.currentMolecule = mmpbsa::MMPBSAState::COMPLEX;
+	  mmpbsa::calculate_snapshot(job,worker,state,snapshotXML,false);
+	  record.type = mmpbsa::PROCESS_SNAPSHOT;
+	  pack_xml(snapshotXML,data);
+	}
+      catch(const mmpbsa::MMPBSAException& e)
+	{
+	  record.type = mmpbsa::PROCESS_ERROR;
+	  record.error_type = e.getErrType();
+	  data = e.what();
+	}
+      delete snapshotXML;
+      if(!send_process_record(result_fd,record,data))
+	return;
+    }
+
+  mmpbsa::process_record_t record;
+  record.type = mmpbsa::PROCESS_STATISTICS;
+  record.error_type = 0;
+  record.snap = 0;
+  mmpbsa::worker_statistics_t stats = get_worker_statistics(worker);
+  send_process_record(result_fd,record,std::string((const char*)&stats,sizeof(stats)));
+}
+
+/**
+ * Writes a snapshot number to a worker process. Zero stops the process.
+ */
+static void dispatch_snapshot(mmpbsa::snapshot_process_t& process, const size_t& snap)
+{
+  process.snap = snap;
+  if(snap == 0)
+    process.stopped = true;
+  if(!write_fully(process.task_fd,&snap,sizeof(snap)))
+    {
+      //The process has gone. Its result pipe reports it.
+      process.stopped = true;
+    }
+}
+
+void mmpbsa::run_snapshot_processes(const mmpbsa::snapshot_job_t& job, mmpbsa::snapshot_worker_t* workers, const size_t& num_processes,
+			    mmpbsa_io::trajectory_t& trajFile, mmpbsa::MMPBSAState& currState,
+			    mmpbsa_utils::XMLParser& energy_data) throw (mmpbsa::MMPBSAException)
+{
+  mmpbsa::resume_whole_snapshots(job,trajFile,currState);
+  size_t snap_counter = currState.currentSnap - 1;
+
+  //Buffered output would otherwise be written by each process.
+  std::cout.flush();
+  std::cerr.flush();
+  fflush(stdout);
+  fflush(stderr);
+  void (*old_sigpipe)(int) = signal(SIGPIPE,SIG_IGN);
+
+  std::vector<mmpbsa::snapshot_process_t> processes;
+  for(size_t i = 0;i<num_processes;i++)
+    {
+      int tasks[2],results[2];
+      if(pipe(tasks) != 0)
+	break;
+      if(pipe(results) != 0)
+	{
+	  close(tasks[0]);
+	  close(tasks[1]);
+	  break;
+	}
+      pid_t pid = fork();
+      if(pid == 0)
+	{
+	  int status = 0;
+	  close(tasks[1]);
+	  close(results[0]);
+	  for(size_t j = 0;j<processes.size();j++)
+	    {
+	      close(processes[j].task_fd);
+	      close(processes[j].result_fd);
+	    }
+	  try
+	    {
+	      run_snapshot_process(job,workers[i],currState,trajFile,tasks[0],results[1]);
+	    }
+	  catch(...)
+	    {
+	      status = EXIT_FAILURE;
+	    }
+	  std::cout.flush();
+	  std::cerr.flush();
+	  _exit(status);
+	}
+      close(tasks[0]);
+      close(results[1]);
+      if(pid < 0)
+	{
+	  close(tasks[1]);
+	  close(results[0]);
+	  break;
+	}
+      mmpbsa::snapshot_process_t process;
+      process.pid = pid;
+      process.task_fd = tasks[1];
+      process.result_fd = results[0];
+      process.snap = 0;
+      process.stopped = process.finished = false;
+      processes.push_back(process);
+    }
+  if(processes.size() == 0)
+    {
+      signal(SIGPIPE,old_sigpipe);
+      throw mmpbsa::MMPBSAException("run_snapshot_processes: Could not start a worker process.",mmpbsa::SYSTEM_ERROR);
+    }
+  if(processes.size() < num_processes)
+    std::cerr << "Warning: only " << processes.size() << " of " << num_processes << " worker processes could be started." << std::endl;
+
+  std::set<size_t> running;
+  std::map<size_t,mmpbsa_utils::XMLNode*> finished;
+  std::valarray<mmpbsa::Vector> snapshot(job.mol_list->size());
+  bool no_more_snapshots = false,failed = false;
+  std::string error;
+  mmpbsa::MMPBSAErrorTypes error_type = mmpbsa::UNKNOWN_ERROR;
+  while(true)
+    {
+      //Hand snapshots to idle processes, or stop them.
+      for(size_t i = 0;i<processes.size();i++)
+	{
+	  mmpbsa::snapshot_process_t& process = processes[i];
+	  if(process.snap != 0 || process.stopped)
+	    continue;
+	  if(!failed && !no_more_snapshots)
+	    {
+	      try
+		{
+		  no_more_snapshots = !mmpbsa::next_node_snapshot(*job.run,trajFile,currState,snapshot,snap_counter);
+		}
+	      catch(const mmpbsa::MMPBSAException& e)
+		{
+		  failed = true;
+		  error = e.what();
+		  error_type = e.getErrType();
+		}
+	    }
+	  if(failed || no_more_snapshots)
+	    {
+	      dispatch_snapshot(process,0);
+	      continue;
+	    }
+	  running.insert(mmpbsa::snapshot_place(job.run->order,snap_counter));
+	  dispatch_snapshot(process,snap_counter);
+	}
+
+      //Wait for records of the processes that have not finished.
+      std::vector<struct pollfd> fds;
+      std::vector<size_t> fd_processes;
+      for(size_t i = 0;i<processes.size();i++)
+	if(!processes[i].finished)
+	  {
+	    struct pollfd fd;
+	    fd.fd = processes[i].result_fd;
+	    fd.events = POLLIN;
+	    fd.revents = 0;
+	    fds.push_back(fd);
+	    fd_processes.push_back(i);
+	  }
+      if(fds.size() == 0)
+	break;
+      if(poll(&fds[0],fds.size(),-1) < 0)
+	{
+	  if(errno == EINTR)
+	    continue;
+	  failed = true;
+	  error = "Could not wait for the worker processes.";
+	  error_type = mmpbsa::SYSTEM_ERROR;
+	  break;
+	}
+
+      for(size_t f = 0;f<fds.size();f++)
+	{
+	  if(fds[f].revents == 0)
+	    continue;
+	  mmpbsa::snapshot_process_t& process = processes[fd_processes[f]];
+	  mmpbsa::process_record_t record;
+	  std::string data;
+	  bool have_record = read_fully(process.result_fd,&record,sizeof(record));
+	  if(have_record)
+	    {
+	      data.resize(record.length);
+	      have_record = (record.length == 0 || read_fully(process.result_fd,&data[0],record.length));
+	    }
+	  if(!have_record)
+	    {
+	      //The process ended without its statistics.
+	      if(!failed)
+		{
+		  std::ostringstream message;
+		  message << "Worker process " << process.pid << " stopped unexpectedly";
+		  if(process.snap)
+		    message << " while calculating snapshot #" << process.snap;
+		  failed = true;
+		  error = message.str();
+		  error_type = mmpbsa::SYSTEM_ERROR;
+		}
+	      process.snap = 0;
+	      process.stopped = process.finished = true;
+	      continue;
+	    }
+
+	  if(record.type == mmpbsa::PROCESS_STATISTICS)
+	    {
+	      mmpbsa::worker_statistics_t stats;
+	      if(data.size() == sizeof(stats))
+		{
+		  memcpy(&stats,data.data(),sizeof(stats));
+		  set_worker_statistics(workers[fd_processes[f]],stats);
+		}
+	      process.finished = true;
+	      continue;
+	    }
+
+	  process.snap = 0;
+	  if(record.type == mmpbsa::PROCESS_ERROR)
+	    {
+	      //The snapshot stays in running, so that it and those after it are not checkpointed.
+	      if(!failed)
+		{
+		  failed = true;
+		  error = data;
+		  error_type = mmpbsa::MMPBSAErrorTypes(record.error_type);
+		}
+	      continue;
+	    }
+	  try
+	    {
+	      size_t pos = 0;
+	      mmpbsa_utils::XMLNode* snapshotXML = unpack_xml(data,pos);
+	      running.erase(mmpbsa::snapshot_place(job.run->order,record.snap));
+	      finished[mmpbsa::snapshot_place(job.run->order,record.snap)] = snapshotXML;
+	    }
+	  catch(const mmpbsa::MMPBSAException& e)
+	    {
+	      if(!failed)
+		{
+		  failed = true;
+		  error = e.what();
+		  error_type = e.getErrType();
+		}
+	    }
+	}
+
+      //Merge the snapshots that no running snapshot precedes.
+      try
+	{
+	  while(finished.size() && (running.size() == 0 || finished.begin()->first < *running.begin()))
+	    {
+	      std::map<size_t,mmpbsa_utils::XMLNode*>::iterator next = finished.begin();
+	      size_t snap = mmpbsa::snapshot_at_place(job.run->order,next->first);
+	      mmpbsa_utils::XMLNode* snapshotXML = next->second;
+	      finished.erase(next);
+	      mmpbsa::append_snapshot(job,energy_data,currState,snap,snapshotXML);
+	    }
+	}
+      catch(const mmpbsa::MMPBSAException& e)
+	{
+	  if(!failed)
+	    {
+	      failed = true;
+	      error = e.what();
+	      error_type = e.getErrType();
+	    }
+	}
+    }
+
+  for(size_t i = 0;i<processes.size();i++)
+    {
+      close(processes[i].task_fd);
+      close(processes[i].result_fd);
+      if(!processes[i].finished)
+	kill(processes[i].pid,SIGTERM);
+      waitpid(processes[i].pid,NULL,0);
+    }
+  signal(SIGPIPE,old_sigpipe);
+
+  //Snapshots after a failed one are not kept.
+  for(std::map<size_t,mmpbsa_utils::XMLNode*>::iterator it = finished.begin();it != finished.end();it++)
+    delete it->second;
+  if(failed)
+    throw mmpbsa::MMPBSAException("run_snapshot_processes: " + error,error_type);
+}
+
+#endif //USE_SNAPSHOT_PROCESSES
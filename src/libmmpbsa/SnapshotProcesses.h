@@ -0,0 +1,87 @@
+/**
+ * @file SnapshotProcesses.h
+ * @brief Calculation of the snapshots of a job with forked worker processes
+ *
+ * The master hands snapshot numbers to worker processes over pipes and merges the
+ * output they send back in the order in which snapshots are taken.
+ */
+
+#ifndef SNAPSHOTPROCESSES_H
+#define SNAPSHOTPROCESSES_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "SnapshotJob.h"
+
+#ifdef USE_SNAPSHOT_PROCESSES
+#include <sys/types.h>
+
+namespace mmpbsa{
+
+/**
+ * Statistics of the snapshot worker of a worker process (cf report_snapshot_workers),
+ * which the process sends to the master when it finishes. Plain data, which is
+ * written to the pipe as is.
+ */
+typedef struct {
+	size_t reused[mmpbsa::MMPBSAState::END_OF_MOLECULES],calculated[mmpbsa::MMPBSAState::END_OF_MOLECULES];
+	size_t sa_reused[mmpbsa::MMPBSAState::END_OF_MOLECULES],sa_calculated[mmpbsa::MMPBSAState::END_OF_MOLECULES];
+	size_t ref_reused[mmpbsa::MMPBSAState::END_OF_MOLECULES],ref_solved[mmpbsa::MMPBSAState::END_OF_MOLECULES];
+	mmpbsa_t ref_max_error[mmpbsa::MMPBSAState::END_OF_MOLECULES];
+	size_t sa_checked[mmpbsa::MMPBSAState::END_OF_MOLECULES];
+	mmpbsa_t sa_max_deviation[mmpbsa::MMPBSAState::END_OF_MOLECULES],sa_sum_deviation[mmpbsa::MMPBSAState::END_OF_MOLECULES];
+	size_t sa_interface_atoms,sa_interface_snaps;
+}worker_statistics_t;
+
+/**
+ * Kinds of records sent by a worker process to the master.
+ */
+enum ProcessRecord {PROCESS_SNAPSHOT = 0,///<Output of a snapshot, packed by pack_xml
+		    PROCESS_ERROR,///<Message of the exception that stopped a snapshot
+		    PROCESS_STATISTICS///<worker_statistics_t, sent last
+};
+
+/**
+ * Header of a record sent by a worker process to the master, followed by length bytes.
+ */
+typedef struct {
+	int type;///<ProcessRecord
+	int error_type;///<mmpbsa::MMPBSAErrorTypes of a PROCESS_ERROR
+	size_t snap;
+	size_t length;
+}process_record_t;
+
+/**
+ * Worker process of run_snapshot_processes, as seen by the master.
+ */
+typedef struct {
+	pid_t pid;
+	int task_fd;///<Snapshot numbers are written to it. Zero stops the process.
+	int result_fd;///<process_record_t records are read from it.
+	size_t snap;///<Snapshot being calculated. Zero if none.
+	bool stopped;///<Zero was written to task_fd
+	bool finished;///<The statistics were read, or result_fd was closed.
+}snapshot_process_t;
+
+/**
+ * Calculates the remaining snapshots of the trajectory with num_processes forked worker
+ * processes, which share the job (topology, radii, grids) with this process through
+ * copy-on-write. Each process uses workers[i], so MEAD and molsurf, whose global data
+ * prevents calculating snapshots with several threads, run in parallel. This process
+ * reads the trajectory, only to find the snapshots this node calculates, and hands their
+ * numbers to idle processes over pipes. Processes read the snapshot from their copy of the
+ * trajectory and return its output, whose records are merged, written and checkpointed in
+ * snapshot order, so the output is that of the serial loop. The statistics of each process
+ * are copied to its worker when it finishes.
+ */
+void run_snapshot_processes(const snapshot_job_t& job, snapshot_worker_t* workers, const size_t& num_processes,
+		mmpbsa_io::trajectory_t& trajFile, mmpbsa::MMPBSAState& currState,
+		mmpbsa_utils::XMLParser& energy_data) throw (mmpbsa::MMPBSAException);
+
+}//end namespace mmpbsa
+
+#endif //USE_SNAPSHOT_PROCESSES
+
+#endif	/* SNAPSHOTPROCESSES_H */
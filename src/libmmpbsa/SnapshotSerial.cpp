@@ -0,0 +1,142 @@
+#include "SnapshotSerial.h"
+
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+
+#include "mmpbsa_utils.h"
+
+/**
+ * Calculates the snapshots given by next_node_snapshot one at a time, when they are taken
+ * from the dynamic MPI schedule or the progressive order rather than read in turn.
+ */
+static void calculate_claimed_snapshots(const mmpbsa::snapshot_job_t& job, mmpbsa::snapshot_worker_t& worker, mmpbsa_io::trajectory_t& trajFile,
+				 mmpbsa::MMPBSAState& currState, mmpbsa_utils::XMLParser& energy_data) throw (mmpbsa::MMPBSAException)
+{
+  size_t snap = 0;
+  while(mmpbsa::next_node_snapshot(*job.run,trajFile,currState,worker.snapshot,snap))
+    {
+      mmpbsa_utils::XMLNode* snapshotXML = mmpbsa::new_snapshot_xml(job,snap);
+      currState.currentSnap = snap;
+      currState.currentMolecule = mmpbsa::MMPBSAState::COMPLEX;
+      try
+	{
+	  mmpbsa::calculate_snapshot(job,worker,currState,snapshotXML,false);
+	}
+      catch(const mmpbsa::MMPBSAException& e)
+	{
+	  delete snapshotXML;
+	  throw e;
+	}
+      mmpbsa::append_snapshot(job,energy_data,currState,snap,snapshotXML);
+    }
+}
+
+void mmpbsa::run_snapshot_loop(const snapshot_job_t& job, snapshot_worker_t& worker, mmpbsa_io::trajectory_t& trajFile,
+			       mmpbsa::MMPBSAState& currState, mmpbsa_utils::XMLParser& energy_data) throw (mmpbsa::MMPBSAException)
+{
+  using namespace mmpbsa;
+  using mmpbsa::MMPBSAState;
+  using mmpbsa_io::get_next_snap;
+  snapshot_run_t& run = *job.run;
+  bool taken_snapshots = run.order.active;
+#ifdef USE_MPI
+  taken_snapshots |= run.schedule.active;
+#endif
+  if(taken_snapshots)
+    {
+      calculate_claimed_snapshots(job,worker,trajFile,currState,energy_data);
+      return;
+    }
+
+  //Walk through the snapshots. This is where MMPBSA is actually done.
+  while(!run.convergence.stopped && !mmpbsa_io::eof(trajFile))
+    {
+      try{
+	//if a list of snaps to be run is provided, check to see if this snapshot
+	//should be used. Remember: snapcounter is 1-indexed.
+	//
+	//Additionally, check to see if the snapshot should be run by this node
+	//if multiple nodes are used, e.g. MPI
+	if(currState.snapList.size())//check if the current snapshot should be skipped
+	  {
+	    if(!mmpbsa_utils::contains(currState.snapList,currState.currentSnap) || !should_calculate_snapshot(run,currState.currentSnap, currState.snapList))
+	      {
+		try
+		  {
+		    mmpbsa_io::seek(trajFile,trajFile.curr_snap+1);
+		    std::cout << "Skipping Snapshot #" << currState.currentSnap << std::endl;
+		    currState.currentSnap += 1;
+		    currState.currentMolecule = MMPBSAState::COMPLEX;
+		    continue;
+		  }
+		catch(const mmpbsa::MMPBSAException& mmpbsae)
+		  {
+		    if(mmpbsae.getErrType() == mmpbsa::FILE_IO_ERROR && mmpbsa_io::eof(trajFile))
+		      break;// Done with snapshots.
+		    printf("Throwing exception type: %d as opposed to %d  EOF = %d Message: %s\n",mmpbsae.getErrType(),mmpbsa::FILE_IO_ERROR,((mmpbsa_io::eof(trajFile))?1:0),mmpbsae.what());fflush(stdout);
+		    
+		    throw mmpbsae;
+		  }
+	      }
+	  }
+        
+	//Can the snapshot be loaded, and if so, should it be run by this node, if multiple
+	//nodes are used.
+	if(get_next_snap(trajFile, worker.snapshot) && should_calculate_snapshot(run,currState.currentSnap, currState.snapList))
+	  std::cout << "Running Snapshot #" << currState.currentSnap << std::endl;
+	else if(!should_calculate_snapshot(run,currState.currentSnap,currState.snapList))
+	  {
+	    std::cout << "Skipping snapshot #" << currState.currentSnap++ << std::endl;
+	    continue;
+	  }
+	else
+	  {
+	    std::ostringstream error;
+	    error << "mmpbsa_run: Error in loading snapshot #"  << ++(currState.currentSnap) << std::endl;
+	    throw MMPBSAException(error,BROKEN_TRAJECTORY_FILE);
+	  }
+      }
+      catch(const MMPBSAException& e)
+        {
+	  if(e.getErrType() == UNEXPECTED_EOF)
+	    break;//return 0;
+	  throw e;
+        }
+
+      //Check to see if we just ended one snap shot and need to start the
+      //next snap shot at the beginning (which is the whole COMPLEX. If
+      //so, reset the current Molecule to Complex and increment the snap count.
+      if(currState.currentMolecule == MMPBSAState::END_OF_MOLECULES)
+        {
+	  currState.currentMolecule = MMPBSAState::COMPLEX;
+	  job.hooks.progress(currState,1);
+	  currState.currentSnap += 1;
+	  continue;//Restarted program at the end of a snapshot. So, move on.
+        }
+
+      //retrieve snapshot ID and start a snapshot XML dataset.
+      mmpbsa_utils::XMLNode* snapshotXML = new_snapshot_xml(job,currState.currentSnap);
+      calculate_snapshot(job,worker,currState,snapshotXML,true);
+
+      //MMPBSA is complete. Save the state and update the process on the
+      //status, if monitoring is being done, e.g. BOINC.
+      update_convergence(run.convergence,currState,snapshotXML);
+      job.hooks.checkpoint(currState);
+      energy_data.getHead()->insertChild(snapshotXML);
+      currState.currentMolecule = MMPBSAState::COMPLEX;//Reset current molecule
+      currState.currentSnap += 1;
+
+      if(job.hooks.write_data != 0)
+	job.hooks.write_data(energy_data,currState);
+
+      //If there was a snapshot list, has the list been completed?
+      if(currState.snapList.size())
+	if(*(currState.snapList.end()-1) == currState.currentSnap - 1)//decrement currentSnap because it was increment above.
+	  break;
+      if(run.convergence.stopped)
+	break;
+
+
+    }//end of snapshot loop
+}
@@ -0,0 +1,31 @@
+/**
+ * @file SnapshotSerial.h
+ * @brief Calculation of the snapshots of a job one at a time
+ *
+ * A single worker calculates the snapshots in the order of the trajectory, or in the
+ * order they are claimed when the job's snapshot_run_t takes them from the progressive
+ * order or the dynamic MPI schedule.
+ */
+
+#ifndef SNAPSHOTSERIAL_H
+#define SNAPSHOTSERIAL_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "SnapshotJob.h"
+
+namespace mmpbsa{
+
+/**
+ * Calculates the job's snapshots, beginning with snapshot currState.currentSnap, with
+ * one worker. Each snapshot is added to energy_data as it is finished, followed by a
+ * checkpoint.
+ */
+void run_snapshot_loop(const snapshot_job_t& job, snapshot_worker_t& worker, mmpbsa_io::trajectory_t& trajFile,
+		mmpbsa::MMPBSAState& currState, mmpbsa_utils::XMLParser& energy_data) throw (mmpbsa::MMPBSAException);
+
+}//end namespace mmpbsa
+
+#endif	/* SNAPSHOTSERIAL_H */
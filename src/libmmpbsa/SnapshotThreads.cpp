@@ -0,0 +1,150 @@
+#include "SnapshotThreads.h"
+
+#ifdef USE_PTHREADS
+
+#include <iostream>
+
+#include <pthread.h>
+
+/**
+ * Records the first error of the snapshot threads. The queue's mutex must be held.
+ */
+static void fail_snapshot_queue(mmpbsa::snapshot_queue_t& queue, const mmpbsa::MMPBSAException& e)
+{
+  if(queue.failed)
+    return;
+  queue.failed = true;
+  queue.error = e.what();
+  queue.error_type = e.getErrType();
+}
+
+/**
+ * Reads the next snapshot to be calculated by this node into snapshot and sets snap
+ * to its number. Returns false if there are none left. The queue's mutex must be held.
+ */
+static bool next_queue_snapshot(mmpbsa::snapshot_queue_t& queue, std::valarray<mmpbsa::Vector>& snapshot, size_t& snap)
+{
+  if(!mmpbsa::next_node_snapshot(*queue.job->run,*queue.trajFile,*queue.currState,snapshot,queue.snap_counter))
+    return false;
+  snap = queue.snap_counter;
+  return true;
+}
+
+/**
+ * Adds the finished snapshots that are not preceded by a running one to the energy
+ * data, in the order in which snapshots are taken (cf mmpbsa::snapshot_place), and checkpoints after each. The queue's mutex must be held.
+ */
+static void flush_snapshot_queue(mmpbsa::snapshot_queue_t& queue)
+{
+  while(queue.finished.size() && (queue.running.size() == 0 || queue.finished.begin()->first < *queue.running.begin()))
+    {
+      std::map<size_t,mmpbsa_utils::XMLNode*>::iterator next = queue.finished.begin();
+      size_t snap = mmpbsa::snapshot_at_place(queue.job->run->order,next->first);
+      mmpbsa_utils::XMLNode* snapshotXML = next->second;
+      queue.finished.erase(next);
+      mmpbsa::append_snapshot(*queue.job,*queue.energy_data,*queue.currState,snap,snapshotXML);
+    }
+}
+
+/**
+ * Calculates snapshots from the queue until none are left or a thread fails.
+ */
+static void* run_snapshot_thread(void* args)
+{
+  mmpbsa::snapshot_thread_t* thread = (mmpbsa::snapshot_thread_t*)args;
+  mmpbsa::snapshot_queue_t& queue = *thread->queue;
+  while(true)
+    {
+      size_t snap = 0;
+      bool have_snap = false;
+      pthread_mutex_lock(&queue.mutex);
+      try
+	{
+	  have_snap = !queue.failed && next_queue_snapshot(queue,thread->worker->snapshot,snap);
+	}
+      catch(const mmpbsa::MMPBSAException& e)
+	{
+	  fail_snapshot_queue(queue,e);
+	}
+      if(have_snap)
+	queue.running.insert(mmpbsa::snapshot_place(queue.job->run->order,snap));
+      pthread_mutex_unlock(&queue.mutex);
+      if(!have_snap)
+	break;
+
+      mmpbsa_utils::XMLNode* snapshotXML = mmpbsa::new_snapshot_xml(*queue.job,snap);
+      thread->state.currentSnap = snap;
+      thread->state.currentMolecule = mmpbsa::MMPBSAState::COMPLEX;
+      try
+	{
+	  mmpbsa::calculate_snapshot(*queue.job,*thread->worker,thread->state,snapshotXML,false);
+	}
+      catch(const mmpbsa::MMPBSAException& e)
+	{
+	  //The snapshot stays in running, so that it and those after it are not checkpointed.
+	  delete snapshotXML;
+	  pthread_mutex_lock(&queue.mutex);
+	  fail_snapshot_queue(queue,e);
+	  pthread_mutex_unlock(&queue.mutex);
+	  break;
+	}
+
+      pthread_mutex_lock(&queue.mutex);
+      queue.running.erase(mmpbsa::snapshot_place(queue.job->run->order,snap));
+      queue.finished[mmpbsa::snapshot_place(queue.job->run->order,snap)] = snapshotXML;
+      try
+	{
+	  flush_snapshot_queue(queue);
+	}
+      catch(const mmpbsa::MMPBSAException& e)
+	{
+	  fail_snapshot_queue(queue,e);
+	}
+      pthread_mutex_unlock(&queue.mutex);
+    }
+  return 0;
+}
+
+void mmpbsa::run_snapshot_threads(const mmpbsa::snapshot_job_t& job, mmpbsa::snapshot_worker_t* workers, const size_t& num_workers,
+			  mmpbsa_io::trajectory_t& trajFile, mmpbsa::MMPBSAState& currState,
+			  mmpbsa_utils::XMLParser& energy_data) throw (mmpbsa::MMPBSAException)
+{
+  mmpbsa::resume_whole_snapshots(job,trajFile,currState);
+
+  mmpbsa::snapshot_queue_t queue;
+  queue.job = &job;
+  queue.trajFile = &trajFile;
+  queue.currState = &currState;
+  queue.energy_data = &energy_data;
+  queue.snap_counter = currState.currentSnap - 1;
+  queue.failed = false;
+  queue.error_type = mmpbsa::UNKNOWN_ERROR;
+  pthread_mutex_init(&queue.mutex,NULL);
+
+  std::vector<mmpbsa::snapshot_thread_t> threads(num_workers);
+  std::vector<pthread_t> thread_ids(num_workers);
+  std::vector<bool> started(num_workers,false);
+  for(size_t i = 0;i<num_workers;i++)
+    {
+      threads[i].queue = &queue;
+      threads[i].worker = &workers[i];
+      threads[i].state = currState;
+    }
+
+  //Thread 0 is this one. If a thread cannot be created, the others calculate its snapshots.
+  for(size_t i = 1;i<num_workers;i++)
+    started[i] = (pthread_create(&thread_ids[i],NULL,run_snapshot_thread,(void*)&threads[i]) == 0);
+  run_snapshot_thread((void*)&threads[0]);
+  for(size_t i = 1;i<num_workers;i++)
+    if(started[i])
+      pthread_join(thread_ids[i],NULL);
+  pthread_mutex_destroy(&queue.mutex);
+
+  //Snapshots after a failed one are not kept.
+  for(std::map<size_t,mmpbsa_utils::XMLNode*>::iterator it = queue.finished.begin();it != queue.finished.end();it++)
+    delete it->second;
+  if(queue.failed)
+    throw mmpbsa::MMPBSAException("run_snapshot_threads: " + queue.error,queue.error_type);
+}
+
+#endif //USE_PTHREADS
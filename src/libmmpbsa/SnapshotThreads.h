@@ -0,0 +1,67 @@
+/**
+ * @file SnapshotThreads.h
+ * @brief Calculation of the snapshots of a job with threads
+ *
+ * Each thread has its own worker and reads snapshots from the trajectory in turn. Their
+ * output is added to the energy data in the order in which snapshots are taken.
+ */
+
+#ifndef SNAPSHOTTHREADS_H
+#define SNAPSHOTTHREADS_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "SnapshotJob.h"
+
+#ifdef USE_PTHREADS
+#include <set>
+#include <pthread.h>
+
+namespace mmpbsa{
+
+/**
+ * Snapshots shared by the threads of run_snapshot_threads. Threads read snapshots
+ * from the trajectory in turn and queue their output, which is added to the energy
+ * data in snapshot order. Every member is guarded by mutex.
+ */
+typedef struct {
+	const snapshot_job_t* job;
+	mmpbsa_io::trajectory_t* trajFile;
+	mmpbsa::MMPBSAState* currState;///<Checkpointed after each snapshot is added to energy_data
+	mmpbsa_utils::XMLParser* energy_data;
+	pthread_mutex_t mutex;
+	size_t snap_counter;///<Last snapshot read from the trajectory
+	std::set<size_t> running;///<Snapshots being calculated
+	std::map<size_t,mmpbsa_utils::XMLNode*> finished;///<Snapshots that wait for those before them
+	bool failed;
+	std::string error;
+	mmpbsa::MMPBSAErrorTypes error_type;
+}snapshot_queue_t;
+
+/**
+ * Argument of run_snapshot_thread.
+ */
+typedef struct {
+	snapshot_queue_t* queue;
+	snapshot_worker_t* worker;
+	mmpbsa::MMPBSAState state;///<Copy of the job's state, whose currentSnap and currentMolecule are those of the thread
+}snapshot_thread_t;
+
+/**
+ * Calculates the remaining snapshots of the trajectory with one thread per worker. Each
+ * thread reads the next snapshot, calculates it with its own worker and queues its output,
+ * which is added to energy_data, written and checkpointed in snapshot order. Output is
+ * therefore the same as that of one thread, except for state kept by workers between
+ * snapshots (cf snapshot_threads). MEAD calls are serialized with the job's mead_mutex.
+ */
+void run_snapshot_threads(const snapshot_job_t& job, snapshot_worker_t* workers, const size_t& num_workers,
+		mmpbsa_io::trajectory_t& trajFile, mmpbsa::MMPBSAState& currState,
+		mmpbsa_utils::XMLParser& energy_data) throw (mmpbsa::MMPBSAException);
+
+}//end namespace mmpbsa
+
+#endif //USE_PTHREADS
+
+#endif	/* SNAPSHOTTHREADS_H */
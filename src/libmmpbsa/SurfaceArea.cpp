@@ -0,0 +1,604 @@
+#include "SurfaceArea.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <sstream>
+#include <string>
+
+#ifdef USE_PTHREADS
+#include <pthread.h>
+#endif
+
+//Maximum number of cells of a NeighborGrid per atom. Larger grids are coarsened.
+#define NEIGHBOR_GRID_CELLS_PER_ATOM 2
+
+//Neighbors are tested in blocks of this size, so that the test of a block may be vectorized.
+#define SR_NEIGHBOR_BLOCK 8
+
+mmpbsa::NeighborGrid::NeighborGrid(const std::valarray<mmpbsa::Vector>& crds, const mmpbsa_t& cutoff) throw (mmpbsa::MMPBSAException)
+{
+	if(cutoff <= 0)
+		throw mmpbsa::MMPBSAException("mmpbsa::NeighborGrid: the cutoff must be positive.",mmpbsa::DATA_FORMAT_ERROR);
+
+	size_t num_atoms = crds.size();
+	mmpbsa_t max_corner[3];
+	for(size_t axis = 0;axis<3;axis++)
+	{
+		origin[axis] = (num_atoms) ? crds[0][axis] : 0;
+		max_corner[axis] = origin[axis];
+	}
+	for(size_t i = 1;i<num_atoms;i++)
+		for(size_t axis = 0;axis<3;axis++)
+		{
+			origin[axis] = std::min(origin[axis],crds[i][axis]);
+			max_corner[axis] = std::max(max_corner[axis],crds[i][axis]);
+		}
+
+	//Sparse systems would have mostly empty cells; coarsen the grid until there are few cells per atom.
+	cell_size = cutoff;
+	double num_cells;
+	while(true)
+	{
+		num_cells = 1;
+		for(size_t axis = 0;axis<3;axis++)
+		{
+			dim[axis] = int((max_corner[axis] - origin[axis])/cell_size) + 1;
+			num_cells *= dim[axis];
+		}
+		if(num_cells <= NEIGHBOR_GRID_CELLS_PER_ATOM*num_atoms + 27)
+			break;
+		cell_size *= 2;
+	}
+
+	//Counting sort of the atoms by cell.
+	std::vector<size_t> atom_cell(num_atoms);
+	cell_start.assign(size_t(num_cells) + 1,0);
+	for(size_t i = 0;i<num_atoms;i++)
+	{
+		atom_cell[i] = (size_t(cell(crds[i][0],0))*dim[1] + cell(crds[i][1],1))*dim[2] + cell(crds[i][2],2);
+		cell_start[atom_cell[i] + 1]++;
+	}
+	for(size_t c = 1;c<cell_start.size();c++)
+		cell_start[c] += cell_start[c-1];
+	std::vector<size_t> next(cell_start.begin(),cell_start.end()-1);
+	cell_atoms.resize(num_atoms);
+	for(size_t i = 0;i<num_atoms;i++)
+		cell_atoms[next[atom_cell[i]]++] = i;
+}
+
+int mmpbsa::NeighborGrid::cell(const mmpbsa_t& coord, const size_t& axis) const
+{
+	int returnMe = int(floor((coord - origin[axis])/cell_size));
+	if(returnMe < 0)
+		return 0;
+	if(returnMe >= dim[axis])
+		return dim[axis] - 1;
+	return returnMe;
+}
+
+void mmpbsa::NeighborGrid::candidates(const mmpbsa::Vector& r, std::vector<size_t>& candidates) const
+{
+	int center[3];
+	for(size_t axis = 0;axis<3;axis++)
+		center[axis] = cell(r[axis],axis);
+	for(int i = std::max(center[0]-1,0);i <= std::min(center[0]+1,dim[0]-1);i++)
+		for(int j = std::max(center[1]-1,0);j <= std::min(center[1]+1,dim[1]-1);j++)
+			for(int k = std::max(center[2]-1,0);k <= std::min(center[2]+1,dim[2]-1);k++)
+			{
+				size_t c = (size_t(i)*dim[1] + j)*dim[2] + k;
+				candidates.insert(candidates.end(),cell_atoms.begin() + cell_start[c],cell_atoms.begin() + cell_start[c+1]);
+			}
+}
+
+std::vector<mmpbsa::Vector> mmpbsa::sphere_points(const size_t& num_points)
+{
+	std::vector<mmpbsa::Vector> returnMe;
+	returnMe.reserve(num_points);
+	mmpbsa_t golden_angle = MMPBSA_PI*(3 - sqrt(5.0));
+	for(size_t k = 0;k<num_points;k++)
+	{
+		mmpbsa_t z = 1 - (2*k + 1)/mmpbsa_t(num_points);
+		mmpbsa_t rho = sqrt(1 - z*z);
+		mmpbsa_t phi = golden_angle*k;
+		returnMe.push_back(mmpbsa::Vector(rho*cos(phi),rho*sin(phi),z));
+	}
+	return returnMe;
+}
+
+/*
+ * Data shared by the threads of shrake_rupley_area. Coordinates and the sphere points
+ * are stored as separate x, y and z arrays, so that the distance test of a point
+ * against a block of neighbors is a simple loop over contiguous arrays.
+ */
+typedef struct {
+	const std::vector<mmpbsa_t>* xs,*ys,*zs,*radii;
+	const std::vector<mmpbsa_t>* ux,*uy,*uz;
+	const std::valarray<mmpbsa::Vector>* crds;
+	const mmpbsa::NeighborGrid* grid;
+	const std::vector<size_t>* todo;///<atoms whose areas are calculated
+	std::vector<mmpbsa_t>* areas;
+	size_t begin,end;///<range of todo
+}sr_job_t;
+
+static void* run_shrake_rupley(void* arg)
+{
+	sr_job_t* job = (sr_job_t*) arg;
+	const std::vector<mmpbsa_t>& xs = *job->xs,&ys = *job->ys,&zs = *job->zs,&radii = *job->radii;
+	const std::vector<mmpbsa_t>& ux = *job->ux,&uy = *job->uy,&uz = *job->uz;
+	size_t num_points = ux.size();
+
+	std::vector<size_t> candidates;
+	std::vector<mmpbsa_t> nx,ny,nz,nr2;
+	for(size_t t = job->begin;t<job->end;t++)
+	{
+		size_t i = (*job->todo)[t];
+		mmpbsa_t r_i = radii[i];
+		candidates.clear();
+		job->grid->candidates((*job->crds)[i],candidates);
+		nx.clear();ny.clear();nz.clear();nr2.clear();
+		for(size_t c = 0;c<candidates.size();c++)
+		{
+			size_t j = candidates[c];
+			if(j == i)
+				continue;
+			mmpbsa_t dx = xs[j] - xs[i],dy = ys[j] - ys[i],dz = zs[j] - zs[i];
+			mmpbsa_t cutoff = r_i + radii[j];
+			if(dx*dx + dy*dy + dz*dz >= cutoff*cutoff)
+				continue;
+			nx.push_back(dx);
+			ny.push_back(dy);
+			nz.push_back(dz);
+			nr2.push_back(radii[j]*radii[j]);
+		}
+		size_t num_neighbors = nx.size();
+		//pad to a whole number of blocks with neighbors that bury nothing
+		while(nx.size() % SR_NEIGHBOR_BLOCK)
+		{
+			nx.push_back(0);ny.push_back(0);nz.push_back(0);nr2.push_back(-1);
+		}
+
+		size_t accessible = 0;
+		size_t last_occluder = 0;//the neighbor that buried the previous point usually buries the next
+		for(size_t k = 0;k<num_points;k++)
+		{
+			mmpbsa_t px = r_i*ux[k],py = r_i*uy[k],pz = r_i*uz[k];
+			if(num_neighbors)
+			{
+				mmpbsa_t dx = px - nx[last_occluder],dy = py - ny[last_occluder],dz = pz - nz[last_occluder];
+				if(dx*dx + dy*dy + dz*dz < nr2[last_occluder])
+					continue;
+			}
+			bool buried = false;
+			for(size_t block = 0;block<nx.size() && !buried;block += SR_NEIGHBOR_BLOCK)
+			{
+				const mmpbsa_t* bx = &nx[block],*by = &ny[block],*bz = &nz[block],*br2 = &nr2[block];
+				int inside = 0;
+				for(size_t j = 0;j<SR_NEIGHBOR_BLOCK;j++)
+				{
+					mmpbsa_t dx = px - bx[j],dy = py - by[j],dz = pz - bz[j];
+					inside |= (dx*dx + dy*dy + dz*dz < br2[j]);
+				}
+				if(inside)
+				{
+					buried = true;
+					for(size_t j = 0;j<SR_NEIGHBOR_BLOCK;j++)
+					{
+						mmpbsa_t dx = px - bx[j],dy = py - by[j],dz = pz - bz[j];
+						if(dx*dx + dy*dy + dz*dz < br2[j])
+						{
+							last_occluder = block + j;
+							break;
+						}
+					}
+				}
+			}
+			if(!buried)
+				accessible++;
+		}
+		(*job->areas)[i] = MMPBSA_4_PI*r_i*r_i*accessible/num_points;
+	}
+	return 0;
+}
+
+/*
+ * Checks the atom selection of an area calculation and returns the atoms
+ * whose areas are calculated. With a selection, the other areas are taken from atom_areas.
+ */
+static std::vector<size_t> area_todo(const char* caller, const size_t& num_atoms,
+		std::vector<mmpbsa_t>* atom_areas, const std::vector<size_t>* selection) throw (mmpbsa::MMPBSAException)
+{
+	std::vector<size_t> returnMe;
+	if(selection == 0)
+	{
+		if(atom_areas != 0)
+			atom_areas->assign(num_atoms,0);
+		returnMe.resize(num_atoms);
+		for(size_t i = 0;i<num_atoms;i++)
+			returnMe[i] = i;
+		return returnMe;
+	}
+	if(atom_areas == 0 || atom_areas->size() != num_atoms)
+	{
+		std::ostringstream error;
+		error << caller << ": With an atom selection, the areas of all " << num_atoms << " atoms must be provided.";
+		throw mmpbsa::MMPBSAException(error,mmpbsa::DATA_FORMAT_ERROR);
+	}
+	for(size_t t = 0;t<selection->size();t++)
+		if(selection->at(t) >= num_atoms)
+		{
+			std::ostringstream error;
+			error << caller << ": Selected atom " << selection->at(t) << " does not exist.";
+			throw mmpbsa::MMPBSAException(error,mmpbsa::INVALID_ARRAY_SIZE);
+		}
+	return *selection;
+}
+
+mmpbsa_t mmpbsa::shrake_rupley_area(const std::valarray<mmpbsa::Vector>& crds, const std::vector<mmpbsa_t>& radii,
+		const size_t& num_points, const int& nthreads, std::vector<mmpbsa_t>* atom_areas,
+		const std::vector<size_t>* selection) throw (mmpbsa::MMPBSAException)
+{
+	size_t num_atoms = crds.size();
+	if(radii.size() != num_atoms)
+	{
+		std::ostringstream error;
+		error << "mmpbsa::shrake_rupley_area: Number of radii (" << radii.size()
+				<< ") does not match the number of atoms (" << num_atoms << ")";
+		throw mmpbsa::MMPBSAException(error,mmpbsa::DATA_FORMAT_ERROR);
+	}
+	if(num_points == 0)
+		throw mmpbsa::MMPBSAException("mmpbsa::shrake_rupley_area: At least one sphere point is needed.",mmpbsa::DATA_FORMAT_ERROR);
+	std::vector<size_t> todo = area_todo("mmpbsa::shrake_rupley_area",num_atoms,atom_areas,selection);
+	std::vector<mmpbsa_t> areas;
+	if(selection != 0)
+		areas = *atom_areas;
+	else
+		areas.assign(num_atoms,0);
+
+	if(todo.size())
+	{
+		std::vector<mmpbsa_t> xs(num_atoms),ys(num_atoms),zs(num_atoms);
+		mmpbsa_t max_radius = 0;
+		for(size_t i = 0;i<num_atoms;i++)
+		{
+			xs[i] = crds[i].x();
+			ys[i] = crds[i].y();
+			zs[i] = crds[i].z();
+			max_radius = std::max(max_radius,radii[i]);
+		}
+		std::vector<mmpbsa::Vector> points = sphere_points(num_points);
+		std::vector<mmpbsa_t> ux(num_points),uy(num_points),uz(num_points);
+		for(size_t k = 0;k<num_points;k++)
+		{
+			ux[k] = points[k].x();
+			uy[k] = points[k].y();
+			uz[k] = points[k].z();
+		}
+		mmpbsa::NeighborGrid grid(crds,(max_radius > 0) ? 2*max_radius : 1);
+
+		sr_job_t whole;
+		whole.xs = &xs;whole.ys = &ys;whole.zs = &zs;whole.radii = &radii;
+		whole.ux = &ux;whole.uy = &uy;whole.uz = &uz;
+		whole.crds = &crds;
+		whole.grid = &grid;
+		whole.todo = &todo;
+		whole.areas = &areas;
+		whole.begin = 0;
+		whole.end = todo.size();
+
+#ifdef USE_PTHREADS
+		if(nthreads > 1 && todo.size() > size_t(nthreads))
+		{
+			std::vector<pthread_t> threads(nthreads);
+			std::vector<sr_job_t> jobs(nthreads,whole);
+			std::vector<bool> started(nthreads,false);
+			for(int t = 0;t<nthreads;t++)
+			{
+				jobs[t].begin = t*todo.size()/nthreads;
+				jobs[t].end = (t+1)*todo.size()/nthreads;
+			}
+			for(int t = 1;t<nthreads;t++)
+				started[t] = (pthread_create(&threads[t],NULL,run_shrake_rupley,&jobs[t]) == 0);
+			run_shrake_rupley(&jobs[0]);
+			for(int t = 1;t<nthreads;t++)
+			{
+				if(started[t])
+					pthread_join(threads[t],NULL);
+				else
+					run_shrake_rupley(&jobs[t]);//could not start a thread; do the work here.
+			}
+		}
+		else
+#endif
+			run_shrake_rupley(&whole);
+	}
+
+	mmpbsa_t returnMe = 0;
+	for(size_t i = 0;i<num_atoms;i++)
+		returnMe += areas[i];
+	if(atom_areas != 0)
+		atom_areas->swap(areas);
+	return returnMe;
+}
+
+static mmpbsa::lcpo_params_t lcpo(const mmpbsa_t& radius, const mmpbsa_t& p1, const mmpbsa_t& p2,
+		const mmpbsa_t& p3, const mmpbsa_t& p4)
+{
+	mmpbsa::lcpo_params_t returnMe;
+	returnMe.radius = radius;
+	returnMe.p1 = p1;
+	returnMe.p2 = p2;
+	returnMe.p3 = p3;
+	returnMe.p4 = p4;
+	return returnMe;
+}
+
+/*
+ * Atomic number of an atom, from the first letters of its Amber (or GAFF) atom type
+ * or, if it has no type, from its atomic number.
+ */
+static int lcpo_element(const mmpbsa::atom_t& atom)
+{
+	const std::string& type = atom.type_name;
+	if(type.size() == 0)
+		return atom.atomic_number;
+	char second = (type.size() > 1) ? type[1] : ' ';
+	switch(toupper(type[0]))
+	{
+	case 'H':
+		return 1;
+	case 'C':
+		return (second == 'l' || second == 'L') ? 17 : 6;
+	case 'N':
+		return (second == 'a') ? 11 : 7;
+	case 'O':
+		return 8;
+	case 'S':
+		return 16;
+	case 'P':
+		return 15;
+	default:
+		return atom.atomic_number;
+	}
+}
+
+std::vector<mmpbsa::lcpo_params_t> mmpbsa::lcpo_parameters(const std::vector<mmpbsa::atom_t>& atoms,
+		const mmpbsa::forcefield_t& ff)
+{
+	size_t num_atoms = atoms.size();
+	std::vector<int> elements(num_atoms);
+	for(size_t i = 0;i<num_atoms;i++)
+		elements[i] = lcpo_element(atoms[i]);
+
+	std::vector<int> heavy_bonds(num_atoms,0);
+	const std::vector<mmpbsa::bond_t>* bond_lists[2] = {&ff.bonds_with_H,&ff.bonds_without_H};
+	for(size_t list = 0;list<2;list++)
+		for(std::vector<mmpbsa::bond_t>::const_iterator bond = bond_lists[list]->begin();bond != bond_lists[list]->end();bond++)
+		{
+			if(bond->atom_i >= num_atoms || bond->atom_j >= num_atoms)
+				continue;
+			if(elements[bond->atom_j] != 1)
+				heavy_bonds[bond->atom_i]++;
+			if(elements[bond->atom_i] != 1)
+				heavy_bonds[bond->atom_j]++;
+		}
+
+	std::vector<mmpbsa::lcpo_params_t> returnMe(num_atoms);
+	for(size_t i = 0;i<num_atoms;i++)
+	{
+		std::string type = atoms[i].type_name;
+		for(size_t c = 0;c<type.size();c++)
+			type[c] = toupper(type[c]);
+		int bonds = heavy_bonds[i];
+		switch(elements[i])
+		{
+		case 1://hydrogens are covered by the heavy atoms' radii
+			returnMe[i] = lcpo(0,0,0,0,0);
+			break;
+		case 6:
+			if(type == "CT" || type == "C3")//sp3
+			{
+				if(bonds <= 1)
+					returnMe[i] = lcpo(1.70,0.77887,-0.28063,-0.0012968,0.00039328);
+				else if(bonds == 2)
+					returnMe[i] = lcpo(1.70,0.56482,-0.19608,-0.0010219,0.0002658);
+				else if(bonds == 3)
+					returnMe[i] = lcpo(1.70,0.23348,-0.072627,-0.00020079,0.00007967);
+				else
+					returnMe[i] = lcpo(1.70,0,0,0,0);
+			}
+			else if(bonds <= 2)
+				returnMe[i] = lcpo(1.70,0.51245,-0.15966,-0.00019781,0.00016392);
+			else
+				returnMe[i] = lcpo(1.70,0.070344,-0.019015,-0.000022009,0.000016875);
+			break;
+		case 7:
+			if(type == "N3" || type == "N4")//sp3
+			{
+				if(bonds <= 1)
+					returnMe[i] = lcpo(1.65,0.078602,-0.29198,-0.0006537,0.00036247);
+				else if(bonds == 2)
+					returnMe[i] = lcpo(1.65,0.22599,-0.036648,-0.0012297,0.000080038);
+				else
+					returnMe[i] = lcpo(1.65,0.051481,-0.012603,-0.00032006,0.000024774);
+			}
+			else if(bonds <= 1)
+				returnMe[i] = lcpo(1.65,0.73511,-0.22116,-0.00089148,0.0002523);
+			else if(bonds == 2)
+				returnMe[i] = lcpo(1.65,0.41102,-0.12254,-0.000075448,0.00011804);
+			else
+				returnMe[i] = lcpo(1.65,0.062577,-0.017874,-0.00008312,0.000019849);
+			break;
+		case 8:
+			if(type == "O")//carbonyl
+				returnMe[i] = lcpo(1.60,0.68563,-0.1868,-0.00135573,0.00023743);
+			else if(type == "O2")//carboxylate and phosphate
+				returnMe[i] = lcpo(1.60,0.88857,-0.33421,-0.0018683,0.00049372);
+			else if(bonds <= 1)
+				returnMe[i] = lcpo(1.60,0.77914,-0.25262,-0.0016056,0.00035071);
+			else
+				returnMe[i] = lcpo(1.60,0.49392,-0.16038,-0.00015512,0.00016453);
+			break;
+		case 16:
+			if(type == "SH")
+				returnMe[i] = lcpo(1.90,0.7722,-0.26393,0.0010629,0.0002179);
+			else
+				returnMe[i] = lcpo(1.90,0.54581,-0.19477,-0.0012873,0.00029247);
+			break;
+		case 15:
+			if(bonds <= 3)
+				returnMe[i] = lcpo(1.90,0.3865,-0.18249,-0.0036598,0.0004264);
+			else
+				returnMe[i] = lcpo(1.90,0.03873,-0.0089339,0.0000083582,0.0000030381);
+			break;
+		default://Amber's default LCPO parameters
+			returnMe[i] = lcpo(1.70,0.51245,-0.15966,-0.00019781,0.00016392);
+			break;
+		}
+	}
+	return returnMe;
+}
+
+/*
+ * Area of the sphere of radius r_i that is buried by the sphere of radius r_j,
+ * whose center is a distance d away.
+ */
+static mmpbsa_t lcpo_overlap(const mmpbsa_t& r_i, const mmpbsa_t& r_j, const mmpbsa_t& d)
+{
+	return MMPBSA_PI*r_i*(2*r_i - d - (r_i*r_i - r_j*r_j)/d);
+}
+
+mmpbsa_t mmpbsa::lcpo_area(const std::valarray<mmpbsa::Vector>& crds, const std::vector<mmpbsa::lcpo_params_t>& params,
+		std::vector<mmpbsa_t>* atom_areas, const std::vector<size_t>* selection) throw (mmpbsa::MMPBSAException)
+{
+	size_t num_atoms = crds.size();
+	if(params.size() != num_atoms)
+	{
+		std::ostringstream error;
+		error << "mmpbsa::lcpo_area: Number of LCPO parameters (" << params.size()
+				<< ") does not match the number of atoms (" << num_atoms << ")";
+		throw mmpbsa::MMPBSAException(error,mmpbsa::DATA_FORMAT_ERROR);
+	}
+	std::vector<size_t> todo = area_todo("mmpbsa::lcpo_area",num_atoms,atom_areas,selection);
+	std::vector<mmpbsa_t> areas;
+	if(selection != 0)
+		areas = *atom_areas;
+	else
+		areas.assign(num_atoms,0);
+
+	std::vector<mmpbsa_t> radii(num_atoms,0);
+	mmpbsa_t max_radius = 0;
+	for(size_t i = 0;i<num_atoms;i++)
+		if(params[i].radius > 0)
+		{
+			radii[i] = params[i].radius + MMPBSA_LCPO_PROBE;
+			max_radius = std::max(max_radius,radii[i]);
+		}
+	mmpbsa::NeighborGrid grid(crds,(max_radius > 0) ? 2*max_radius : 1);
+
+	std::vector<size_t> n_i,candidates;//overlapping neighbors of an atom
+	std::vector<mmpbsa_t> d_i;//and their distances
+	for(size_t t = 0;t<todo.size();t++)
+	{
+		size_t i = todo[t];
+		areas[i] = 0;
+		if(radii[i] == 0)
+			continue;
+		n_i.clear();
+		d_i.clear();
+		candidates.clear();
+		grid.candidates(crds[i],candidates);
+		for(size_t c = 0;c<candidates.size();c++)
+		{
+			size_t j = candidates[c];
+			if(j == i || radii[j] == 0)
+				continue;
+			mmpbsa_t d = (crds[i] - crds[j]).modulus();
+			if(d < radii[i] + radii[j] && d > 0)
+			{
+				n_i.push_back(j);
+				d_i.push_back(d);
+			}
+		}
+
+		mmpbsa_t sum_ij = 0,sum_jk = 0,sum_ij_jk = 0;
+		for(size_t a = 0;a<n_i.size();a++)
+		{
+			size_t j = n_i[a];
+			mmpbsa_t a_ij = lcpo_overlap(radii[i],radii[j],d_i[a]);
+			mmpbsa_t sum_k = 0;//overlaps of j with the other neighbors of i
+			for(size_t b = 0;b<n_i.size();b++)
+			{
+				size_t k = n_i[b];
+				if(k == j)
+					continue;
+				mmpbsa_t d_jk = (crds[j] - crds[k]).modulus();
+				if(d_jk < radii[j] + radii[k] && d_jk > 0)
+					sum_k += lcpo_overlap(radii[j],radii[k],d_jk);
+			}
+			sum_ij += a_ij;
+			sum_jk += sum_k;
+			sum_ij_jk += a_ij*sum_k;
+		}
+		const mmpbsa::lcpo_params_t& p = params[i];
+		areas[i] = p.p1*MMPBSA_4_PI*radii[i]*radii[i] + p.p2*sum_ij + p.p3*sum_jk + p.p4*sum_ij_jk;
+	}
+
+	mmpbsa_t returnMe = 0;
+	for(size_t i = 0;i<num_atoms;i++)
+		returnMe += areas[i];
+	if(atom_areas != 0)
+		atom_areas->swap(areas);
+	return returnMe;
+}
+
+std::vector<size_t> mmpbsa::interface_atoms(const std::valarray<mmpbsa::Vector>& crds, const std::vector<mmpbsa_t>& radii,
+		const std::vector<bool>& in_ligand) throw (mmpbsa::MMPBSAException)
+{
+	size_t num_atoms = crds.size();
+	if(radii.size() != num_atoms || in_ligand.size() != num_atoms)
+	{
+		std::ostringstream error;
+		error << "mmpbsa::interface_atoms: Number of radii (" << radii.size() << ") or molecule flags ("
+				<< in_ligand.size() << ") does not match the number of atoms (" << num_atoms << ")";
+		throw mmpbsa::MMPBSAException(error,mmpbsa::DATA_FORMAT_ERROR);
+	}
+	std::vector<size_t> returnMe;
+	mmpbsa_t max_radius = 0;
+	for(size_t i = 0;i<num_atoms;i++)
+		max_radius = std::max(max_radius,radii[i]);
+	if(max_radius == 0)
+		return returnMe;
+
+	//Only the ligand, which is usually the smaller molecule, is placed on the grid.
+	std::vector<size_t> ligand;
+	for(size_t i = 0;i<num_atoms;i++)
+		if(in_ligand[i])
+			ligand.push_back(i);
+	std::valarray<mmpbsa::Vector> ligand_crds(ligand.size());
+	for(size_t l = 0;l<ligand.size();l++)
+		ligand_crds[l] = crds[ligand[l]];
+	mmpbsa::NeighborGrid grid(ligand_crds,2*max_radius);
+
+	std::vector<bool> selected(num_atoms,false);
+	std::vector<size_t> candidates;
+	for(size_t i = 0;i<num_atoms;i++)
+	{
+		if(in_ligand[i] || radii[i] == 0)
+			continue;
+		candidates.clear();
+		grid.candidates(crds[i],candidates);
+		for(size_t c = 0;c<candidates.size();c++)
+		{
+			size_t j = ligand[candidates[c]];
+			mmpbsa_t cutoff = radii[i] + radii[j];
+			if(radii[j] == 0 || (crds[i] - crds[j]).modulus() >= cutoff)
+				continue;
+			selected[i] = selected[j] = true;
+		}
+	}
+	for(size_t i = 0;i<num_atoms;i++)
+		if(selected[i])
+			returnMe.push_back(i);
+	return returnMe;
+}
@@ -0,0 +1,128 @@
+/**
+ * @file SurfaceArea.h
+ * @brief Solvent accessible surface area engines other than molsurf
+ *
+ * Two approximations of the solvent accessible surface area are provided, for use
+ * in place of molsurf (cf MeadInterface::sa_method):
+ *
+ * Shrake-Rupley places a fixed number of points, evenly spread on a unit sphere, on the
+ * expanded sphere (radius plus probe) of each atom. A point is accessible if it is not
+ * inside the expanded sphere of any other atom. The area of an atom is the fraction of
+ * its points that are accessible times the area of its sphere. The error decreases as
+ * the number of points increases.
+ *
+ * LCPO (Weiser, Shenkin and Still, J. Comput. Chem. 20, 217 (1999)) approximates the
+ * area of each atom from the pairwise overlaps of the spheres of its neighbors, using
+ * four parameters that depend on the element, hybridization and number of bonded heavy
+ * atoms of the atom (cf lcpo_parameters). Hydrogens are included in the radii of
+ * the heavy atoms to which they are bonded and have no area of their own.
+ *
+ * Both engines find the neighbors of an atom with a NeighborGrid.
+ */
+
+#ifndef SURFACEAREA_H
+#define SURFACEAREA_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <vector>
+#include <valarray>
+
+#include "globals.h"
+#include "structs.h"
+#include "mmpbsa_exceptions.h"
+#include "Vector.h"
+
+#define MMPBSA_LCPO_PROBE 1.4//Angstroms. The LCPO parameters were fitted with this probe radius.
+
+namespace mmpbsa{
+
+/**
+ * Cell list of a set of coordinates. Cells are cubes whose edge is at least the
+ * cutoff, so that every atom within the cutoff of a position lies in one of
+ * the 27 cells surrounding the position.
+ */
+class NeighborGrid {
+public:
+	NeighborGrid(const std::valarray<mmpbsa::Vector>& crds, const mmpbsa_t& cutoff) throw (mmpbsa::MMPBSAException);
+
+	/**
+	 * Appends the indices of the atoms in the cells surrounding the position to
+	 * candidates. These include every atom within the cutoff of the position.
+	 */
+	void candidates(const mmpbsa::Vector& r, std::vector<size_t>& candidates) const;
+
+private:
+	int cell(const mmpbsa_t& coord, const size_t& axis) const;
+
+	mmpbsa_t origin[3];
+	mmpbsa_t cell_size;
+	int dim[3];
+	std::vector<size_t> cell_start;///<Atoms of cell c are cell_atoms[cell_start[c]] to cell_atoms[cell_start[c+1]-1]
+	std::vector<size_t> cell_atoms;
+};
+
+/**
+ * Parameters of an atom for LCPO.
+ */
+typedef struct {
+	mmpbsa_t radius;///<Angstroms, without the probe
+	mmpbsa_t p1,p2,p3,p4;
+}lcpo_params_t;
+
+/**
+ * Directions, nearly evenly spaced, of num_points points on the unit sphere
+ * (golden section spiral).
+ */
+std::vector<mmpbsa::Vector> sphere_points(const size_t& num_points);
+
+/**
+ * Shrake-Rupley surface area of spheres with the provided radii, which should
+ * already include the probe radius. If atom_areas is not null, it is replaced
+ * by the area of each atom. Atoms are divided among nthreads threads when
+ * compiled with pthreads.
+ *
+ * If selection is not null, only the areas of the listed atoms are calculated.
+ * The areas of the other atoms are taken from atom_areas, which must then have
+ * one value per atom, e.g. from a previous calculation (cf interface_atoms).
+ */
+mmpbsa_t shrake_rupley_area(const std::valarray<mmpbsa::Vector>& crds, const std::vector<mmpbsa_t>& radii,
+		const size_t& num_points, const int& nthreads = 1,
+		std::vector<mmpbsa_t>* atom_areas = 0,
+		const std::vector<size_t>* selection = 0) throw (mmpbsa::MMPBSAException);
+
+/**
+ * LCPO parameters of each atom, based upon its Amber atom type (cf atom_t::type_name)
+ * or, if the type is unknown, its atomic number, and the number of heavy atoms bonded
+ * to it in the force field. Elements other than H, C, N, O, S and P are given
+ * Amber's default parameters, which are those of an sp2 carbon.
+ */
+std::vector<mmpbsa::lcpo_params_t> lcpo_parameters(const std::vector<mmpbsa::atom_t>& atoms,
+		const mmpbsa::forcefield_t& ff);
+
+/**
+ * LCPO surface area, using a probe radius of MMPBSA_LCPO_PROBE. If atom_areas is
+ * not null, it is replaced by the area of each atom. selection is as in
+ * shrake_rupley_area.
+ */
+mmpbsa_t lcpo_area(const std::valarray<mmpbsa::Vector>& crds, const std::vector<mmpbsa::lcpo_params_t>& params,
+		std::vector<mmpbsa_t>* atom_areas = 0,
+		const std::vector<size_t>* selection = 0) throw (mmpbsa::MMPBSAException);
+
+/**
+ * Atoms of a complex whose spheres overlap the sphere of an atom of the other
+ * molecule; in_ligand[i] is true if atom i belongs to the ligand. The area of an
+ * atom, with either engine, depends only on the atoms whose spheres overlap its own,
+ * so these are the only atoms whose areas differ between the complex and the separated
+ * receptor and ligand. Atoms with zero radius are never selected.
+ *
+ * For LCPO, radii are the LCPO radii plus MMPBSA_LCPO_PROBE.
+ */
+std::vector<size_t> interface_atoms(const std::valarray<mmpbsa::Vector>& crds, const std::vector<mmpbsa_t>& radii,
+		const std::vector<bool>& in_ligand) throw (mmpbsa::MMPBSAException);
+
+}//end namespace mmpbsa
+
+#endif//SURFACEAREA_H
@@ -0,0 +1,602 @@
+#include "TprReader.h"
+
+#include <fstream>
+#include <map>
+
+static const char* tpr_error_prefix = "mmpbsa_io::read_tpr: ";
+
+static void tpr_error(const std::string& what) throw (mmpbsa::MMPBSAException)
+{
+	throw mmpbsa::MMPBSAException(tpr_error_prefix + what,mmpbsa::BROKEN_PRMTOP_FILE);
+}
+
+//XDR stores all values big endian, in multiples of four bytes. These decode the raw
+//bytes regardless of host byte order.
+static void read_tpr_bytes(std::istream& tprFile, unsigned char* buf, const size_t& size)
+{
+	tprFile.read((char*)buf,size);
+	if(tprFile.gcount() != std::streamsize(size))
+		tpr_error("Unexpected end of file.");
+}
+
+static int read_tpr_int(std::istream& tprFile)
+{
+	unsigned char buf[4];
+	read_tpr_bytes(tprFile,buf,4);
+	unsigned int val = ((unsigned int)buf[0] << 24) | ((unsigned int)buf[1] << 16)
+			| ((unsigned int)buf[2] << 8) | (unsigned int)buf[3];
+	return (int) val;
+}
+
+static double read_tpr_double(std::istream& tprFile)
+{
+	unsigned char buf[8];
+	read_tpr_bytes(tprFile,buf,8);
+	union{unsigned long long i; double d;} val;
+	val.i = 0;
+	for(size_t i = 0;i<8;i++)
+		val.i = (val.i << 8) | (unsigned long long)buf[i];
+	return val.d;
+}
+
+static double read_tpr_real(std::istream& tprFile, const size_t& real_size)
+{
+	if(real_size == sizeof(double))
+		return read_tpr_double(tprFile);
+	union{int i; float f;} val;
+	val.i = read_tpr_int(tprFile);
+	return (double) val.f;
+}
+
+/**
+ * Reads a count of items that are at least min_size bytes each, which must fit in
+ * the rest of the file. A misread count therefore fails here, rather than with an
+ * allocation of arbitrary size.
+ */
+static size_t read_tpr_count(std::istream& tprFile, const std::streamoff& file_size, const size_t& min_size, const char* what)
+{
+	int count = read_tpr_int(tprFile);
+	std::streamoff remaining = file_size - std::streamoff(tprFile.tellg());
+	if(count < 0 || (min_size && std::streamoff(count)*std::streamoff(min_size) > remaining))
+	{
+		std::ostringstream error;
+		error << "Invalid number of " << what << " (" << count << ").";
+		tpr_error(error.str());
+	}
+	return size_t(count);
+}
+
+/**
+ * Gromacs strings are stored as their length, including the null terminator,
+ * followed by an XDR string (length, then characters padded to four bytes).
+ */
+static std::string read_tpr_string(std::istream& tprFile)
+{
+	int slen = read_tpr_int(tprFile);
+	int str_size = read_tpr_int(tprFile);
+	if(str_size < 0 || str_size > slen || str_size > 4096)
+		tpr_error("Invalid string.");
+	std::vector<char> buf((str_size + 3) & ~3);
+	if(buf.size())
+		read_tpr_bytes(tprFile,(unsigned char*)&buf[0],buf.size());
+	return std::string(buf.begin(),buf.begin() + str_size);
+}
+
+static std::string read_tpr_symbol(std::istream& tprFile, const std::vector<std::string>& symtab)
+{
+	int idx = read_tpr_int(tprFile);
+	if(idx < 0 || size_t(idx) >= symtab.size())
+		tpr_error("Symbol index outside of the symbol table.");
+	return symtab[idx];
+}
+
+/**
+ * Layout of the parameters of each function type, as written by do_iparams
+ * for tpx version 73: 'r' for a real and 'i' for an integer.
+ */
+static const char* tpr_iparams_layout(const int& functype)
+{
+	using namespace mmpbsa_io;
+	switch(functype)
+	{
+	case TPR_BONDS: case TPR_G96BONDS: case TPR_HARMONIC: case TPR_ANGLES: case TPR_G96ANGLES: case TPR_IDIHS:
+		return "rrrr";//rA, krA, rB, krB
+	case TPR_PDIHS: case TPR_PIDIHS: case TPR_ANGRES: case TPR_ANGRESZ:
+		return "rrrri";//phiA, cpA, phiB, cpB, mult
+	case TPR_LJ:
+		return "rr";//c6, c12
+	case TPR_LJ14:
+		return "rrrr";//c6A, c12A, c6B, c12B
+	case TPR_RBDIHS: case TPR_FOURDIHS: case TPR_POSRES:
+		return "rrrrrrrrrrrr";
+	case TPR_FENEBONDS: case TPR_CONSTR: case TPR_CONSTRNC: case TPR_SETTLE:
+	case TPR_VSITE3: case TPR_VSITE3FD: case TPR_VSITE3FAD:
+		return "rr";
+	case TPR_RESTRBONDS:
+		return "rrrrrrrr";
+	case TPR_TABBONDS: case TPR_TABBONDSNC: case TPR_TABANGLES: case TPR_TABDIHS:
+		return "rir";
+	case TPR_MORSE: case TPR_CUBICBONDS: case TPR_CROSS_BOND_BONDS: case TPR_BHAM:
+	case TPR_VSITE3OUT: case TPR_VSITE4FD: case TPR_VSITE4FDN:
+		return "rrr";
+	case TPR_CROSS_BOND_ANGLES: case TPR_UREY_BRADLEY: case TPR_THOLE_POL: case TPR_LJC_PAIRS_NB:
+		return "rrrr";
+	case TPR_QUARTIC_ANGLES: case TPR_WATER_POL:
+		return "rrrrrr";
+	case TPR_LJC14_Q: case TPR_GB12: case TPR_GB13: case TPR_GB14:
+		return "rrrrr";
+	case TPR_POLARIZATION: case TPR_VSITE2:
+		return "r";
+	case TPR_CONNBONDS:
+		return "";
+	case TPR_DISRES:
+		return "iirrrr";
+	case TPR_ORIRES:
+		return "iiirrr";
+	case TPR_DIHRES:
+		return "iirrr";
+	case TPR_VSITEN:
+		return "ir";
+	case TPR_CMAP:
+		return "ii";
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Number of atoms of each interaction of the function types used by MMPBSA, or
+ * zero for the others.
+ */
+static size_t tpr_interaction_atoms(const int& functype)
+{
+	using namespace mmpbsa_io;
+	switch(functype)
+	{
+	case TPR_BONDS: case TPR_LJ14:
+		return 2;
+	case TPR_ANGLES:
+		return 3;
+	case TPR_PDIHS: case TPR_PIDIHS:
+		return 4;
+	default:
+		return 0;
+	}
+}
+
+void mmpbsa_io::read_tpr_header(std::istream& tprFile, mmpbsa_io::tpr_header_t& header) throw (mmpbsa::MMPBSAException)
+{
+	std::string tag = read_tpr_string(tprFile);
+	if(tag.compare(0,7,"VERSION") != 0)
+		tpr_error("Not a Gromacs run input file.");
+
+	int precision = read_tpr_int(tprFile);
+	if(precision != sizeof(float) && precision != sizeof(double))
+	{
+		std::ostringstream error;
+		error << "Unknown precision (" << precision << " byte reals).";
+		tpr_error(error.str());
+	}
+	header.real_size = size_t(precision);
+
+	header.version = read_tpr_int(tprFile);
+	header.generation = read_tpr_int(tprFile);
+	if(header.version != MMPBSA_TPX_VERSION || header.generation > MMPBSA_TPX_GENERATION)
+	{
+		std::ostringstream error;
+		error << "Unsupported tpx version " << header.version << " (generation " << header.generation << ", "
+				<< tag << "). Only version " << MMPBSA_TPX_VERSION << " (Gromacs 4.5) is read natively. "
+				<< "Other versions require mmpbsa to be built with --with-gromacs.";
+		throw mmpbsa::MMPBSAException(tpr_error_prefix + error.str(),mmpbsa::DATA_FORMAT_ERROR);
+	}
+
+	header.natoms = read_tpr_int(tprFile);
+	header.ngtc = read_tpr_int(tprFile);
+	header.lambda = read_tpr_real(tprFile,header.real_size);
+	bool* flags[] = {&header.has_ir, &header.has_top, &header.has_x, &header.has_v, &header.has_f, &header.has_box};
+	for(size_t i = 0;i<sizeof(flags)/sizeof(bool*);i++)
+		*flags[i] = (read_tpr_int(tprFile) != 0);
+	if(header.natoms < 0 || header.ngtc < 0)
+		tpr_error("Invalid header.");
+}
+
+static void read_tpr_moltype(std::istream& tprFile, const std::streamoff& file_size, const mmpbsa_io::tpr_header_t& header,
+		const std::vector<std::string>& symtab, mmpbsa_io::tpr_moltype_t& mol)
+{
+	using namespace mmpbsa_io;
+	const size_t& real_size = header.real_size;
+	mol.name = read_tpr_symbol(tprFile,symtab);
+
+	//atoms
+	size_t natoms = read_tpr_count(tprFile,file_size,4*real_size + 20,"atoms");
+	size_t nres = read_tpr_count(tprFile,file_size,12,"residues");
+	mol.atoms.resize(natoms);
+	for(size_t i = 0;i<natoms;i++)
+	{
+		tpr_atom_t& atom = mol.atoms[i];
+		atom.m = read_tpr_real(tprFile,real_size);
+		atom.q = read_tpr_real(tprFile,real_size);
+		atom.mB = read_tpr_real(tprFile,real_size);
+		atom.qB = read_tpr_real(tprFile,real_size);
+		atom.type = read_tpr_int(tprFile);//unsigned shorts take four bytes in XDR
+		atom.typeB = read_tpr_int(tprFile);
+		atom.ptype = read_tpr_int(tprFile);
+		atom.resind = read_tpr_int(tprFile);
+		atom.atomnumber = read_tpr_int(tprFile);
+		if(atom.resind < 0 || size_t(atom.resind) >= nres)
+			tpr_error("Residue index of atom in " + mol.name + " is outside of its residues.");
+	}
+	std::vector<std::string>* names[] = {&mol.atom_names, &mol.atom_types, 0};
+	for(size_t i = 0;i<3;i++)//names, types and B state types, which are not used.
+		for(size_t j = 0;j<natoms;j++)
+		{
+			std::string symbol = read_tpr_symbol(tprFile,symtab);
+			if(names[i] != 0)
+				names[i]->push_back(symbol);
+		}
+	for(size_t i = 0;i<nres;i++)
+	{
+		mol.residue_names.push_back(read_tpr_symbol(tprFile,symtab));
+		read_tpr_int(tprFile);//residue number
+		read_tpr_int(tprFile);//insertion code, an unsigned char in four bytes
+	}
+
+	//interaction lists
+	mol.ilists.resize(TPR_NRE);
+	for(size_t ftype = 0;ftype<TPR_NRE;ftype++)
+	{
+		size_t nr = read_tpr_count(tprFile,file_size,4,"interaction list entries");
+		mol.ilists[ftype].resize(nr);
+		for(size_t i = 0;i<nr;i++)
+			mol.ilists[ftype][i] = read_tpr_int(tprFile);
+	}
+
+	//charge groups, which are not used
+	size_t ncgs = read_tpr_count(tprFile,file_size,4,"charge groups");
+	for(size_t i = 0;i<=ncgs;i++)
+		read_tpr_int(tprFile);
+
+	//exclusions
+	size_t nexcl = read_tpr_count(tprFile,file_size,4,"exclusion lists");
+	size_t nexcl_atoms = read_tpr_count(tprFile,file_size,4,"excluded atoms");
+	if(nexcl != natoms)
+		tpr_error("Exclusions of " + mol.name + " do not match its atoms. The file may not be tpx version 73.");
+	mol.excl_index.resize(nexcl + 1);
+	for(size_t i = 0;i<=nexcl;i++)
+	{
+		mol.excl_index[i] = read_tpr_int(tprFile);
+		if(mol.excl_index[i] < 0 || size_t(mol.excl_index[i]) > nexcl_atoms || (i && mol.excl_index[i] < mol.excl_index[i-1]))
+			tpr_error("Invalid exclusion index in " + mol.name + ".");
+	}
+	mol.excl_atoms.resize(nexcl_atoms);
+	for(size_t i = 0;i<nexcl_atoms;i++)
+		mol.excl_atoms[i] = read_tpr_int(tprFile);
+}
+
+void mmpbsa_io::read_tpr_topology(std::istream& tprFile, const mmpbsa_io::tpr_header_t& header, mmpbsa_io::tpr_topology_t& top) throw (mmpbsa::MMPBSAException)
+{
+	const size_t& real_size = header.real_size;
+	if(!header.has_top)
+		tpr_error("The run input file has no topology.");
+
+	std::streampos start = tprFile.tellg();
+	tprFile.seekg(0,std::ios::end);
+	std::streamoff file_size = tprFile.tellg();
+	tprFile.seekg(start);
+
+	//box, relative box and box velocities, then the temperature coupling data
+	size_t num_reals = (header.has_box) ? 27 : 0;
+	num_reals += header.ngtc;
+	for(size_t i = 0;i<num_reals;i++)
+		read_tpr_real(tprFile,real_size);
+
+	std::vector<std::string> symtab(read_tpr_count(tprFile,file_size,8,"symbols"));
+	for(size_t i = 0;i<symtab.size();i++)
+		symtab[i] = read_tpr_string(tprFile);
+	top.name = read_tpr_symbol(tprFile,symtab);
+
+	//force field parameters
+	top.atnr = read_tpr_int(tprFile);
+	size_t ntypes = read_tpr_count(tprFile,file_size,4,"parameter sets");
+	if(top.atnr < 0 || size_t(top.atnr)*top.atnr > ntypes)
+		tpr_error("Invalid number of atom types.");
+	top.functypes.resize(ntypes);
+	for(size_t i = 0;i<ntypes;i++)
+		top.functypes[i] = read_tpr_int(tprFile);
+	read_tpr_double(tprFile);//repulsion power of LJ
+	top.fudgeQQ = read_tpr_real(tprFile,real_size);
+	top.iparams.resize(ntypes);
+	for(size_t i = 0;i<ntypes;i++)
+	{
+		const char* layout = tpr_iparams_layout(top.functypes[i]);
+		if(layout == 0)
+		{
+			std::ostringstream error;
+			error << "Unsupported interaction function type " << top.functypes[i] << ".";
+			tpr_error(error.str());
+		}
+		for(;*layout;layout++)
+			top.iparams[i].push_back((*layout == 'i') ? double(read_tpr_int(tprFile)) : read_tpr_real(tprFile,real_size));
+	}
+
+	//molecule types
+	top.moltypes.resize(read_tpr_count(tprFile,file_size,4,"molecule types"));
+	for(size_t i = 0;i<top.moltypes.size();i++)
+		read_tpr_moltype(tprFile,file_size,header,symtab,top.moltypes[i]);
+
+	//molecule blocks. Position restraint coordinates are skipped.
+	top.molblocks.resize(read_tpr_count(tprFile,file_size,20,"molecule blocks"));
+	size_t natoms = 0;
+	for(size_t i = 0;i<top.molblocks.size();i++)
+	{
+		tpr_molblock_t& block = top.molblocks[i];
+		block.type = read_tpr_int(tprFile);
+		block.nmol = read_tpr_int(tprFile);
+		block.natoms_mol = read_tpr_int(tprFile);
+		if(block.type < 0 || size_t(block.type) >= top.moltypes.size() || block.nmol < 0
+				|| size_t(block.natoms_mol) != top.moltypes[block.type].atoms.size())
+			tpr_error("Invalid molecule block.");
+		for(size_t state = 0;state<2;state++)
+		{
+			size_t nposres = read_tpr_count(tprFile,file_size,3*real_size,"position restraints");
+			for(size_t j = 0;j<3*nposres;j++)
+				read_tpr_real(tprFile,real_size);
+		}
+		natoms += size_t(block.nmol)*block.natoms_mol;
+	}
+	top.natoms = read_tpr_int(tprFile);
+	if(top.natoms != header.natoms || natoms != size_t(header.natoms))
+	{
+		std::ostringstream error;
+		error << "The molecule blocks hold " << natoms << " atoms, but the header lists " << header.natoms << ".";
+		tpr_error(error.str());
+	}
+
+	//Interactions that are used store parameter set and atom indices, which are checked
+	//here so that they may be used directly.
+	for(size_t i = 0;i<top.moltypes.size();i++)
+		for(size_t ftype = 0;ftype<TPR_NRE;ftype++)
+		{
+			const std::vector<int>& ilist = top.moltypes[i].ilists[ftype];
+			size_t stride = 1 + tpr_interaction_atoms(ftype);
+			if(stride == 1)
+				continue;
+			if(ilist.size() % stride != 0)
+				tpr_error("Incomplete interaction list in " + top.moltypes[i].name + ".");
+			for(size_t j = 0;j<ilist.size();j++)
+				if((j % stride == 0 && (ilist[j] < 0 || size_t(ilist[j]) >= ntypes || top.functypes[ilist[j]] != int(ftype)))
+						|| (j % stride != 0 && (ilist[j] < 0 || size_t(ilist[j]) >= top.moltypes[i].atoms.size())))
+					tpr_error("Interaction of " + top.moltypes[i].name + " refers to an invalid parameter set or atom.");
+		}
+}
+
+void mmpbsa_io::read_tpr(const std::string& filename, mmpbsa_io::tpr_header_t& header, mmpbsa_io::tpr_topology_t& top) throw (mmpbsa::MMPBSAException)
+{
+	std::fstream tprFile(filename.c_str(),std::ios::in | std::ios::binary);
+	if(!tprFile.good())
+		throw mmpbsa::MMPBSAException("mmpbsa_io::read_tpr: Could not open " + filename,mmpbsa::FILE_IO_ERROR);
+	try
+	{
+		read_tpr_header(tprFile,header);
+		read_tpr_topology(tprFile,header,top);
+	}
+	catch(const mmpbsa::MMPBSAException& e)
+	{
+		throw mmpbsa::MMPBSAException(std::string(e.what()) + " (" + filename + ")",e.getErrType());
+	}
+	tprFile.close();
+}
+
+void mmpbsa_io::get_tpr_forcefield(const std::string& filename,mmpbsa::forcefield_t** split_ff,std::vector<mmpbsa::atom_t>** atom_lists,
+		std::valarray<mmpbsa::MMPBSAState::MOLECULE>& mol_list,const std::set<size_t>* receptor_pos,
+		const std::set<size_t>* ligand_pos) throw (mmpbsa::MMPBSAException)
+{
+	using namespace mmpbsa;
+
+	//Gromacs to Amber units, as in get_gromacs_forcefield
+	static const mmpbsa_t joules2cal = 0.23889;
+	static const mmpbsa_t angst2nm_sqrd = 0.01;
+	static const mmpbsa_t nm2angst_6 = 1e+6;
+	static const mmpbsa_t nm2angst_12 = 1e+12;
+	static const mmpbsa_t nm2angst = 10;
+	static const mmpbsa_t charge_units = 18.2182634799;
+
+	if(split_ff == 0 || atom_lists == 0)
+		throw mmpbsa::MMPBSAException("mmpbsa_io::get_tpr_forcefield: Null pointer supplied for atom list and/or force field.",mmpbsa::NULL_POINTER);
+
+	tpr_header_t header;
+	tpr_topology_t top;
+	read_tpr(filename,header,top);
+
+	*split_ff = new mmpbsa::forcefield_t[MMPBSAState::END_OF_MOLECULES];
+	*atom_lists = new std::vector<mmpbsa::atom_t>[MMPBSAState::END_OF_MOLECULES];
+	for(size_t i = 0;i<MMPBSAState::END_OF_MOLECULES;i++)
+		init(&split_ff[0][i]);
+	forcefield_t& complex = split_ff[0][MMPBSAState::COMPLEX];
+	std::vector<atom_t>& complex_atoms = atom_lists[0][MMPBSAState::COMPLEX];
+
+	//Bonded parameters are stored in the complex's arrays, which the receptor and ligand
+	//interactions point to as well. param_index maps parameter sets to their place in those arrays.
+	std::map<size_t,size_t> param_index;
+	size_t num_bonds = 0, num_angles = 0, num_dihedrals = 0;
+	for(size_t i = 0;i<top.functypes.size();i++)
+		switch(top.functypes[i])
+		{
+		case TPR_BONDS:
+			param_index[i] = num_bonds++;
+			break;
+		case TPR_ANGLES:
+			param_index[i] = num_angles++;
+			break;
+		case TPR_PDIHS: case TPR_PIDIHS:
+			param_index[i] = num_dihedrals++;
+			break;
+		}
+	complex.bond_energy_data = new bond_energy_t[num_bonds];
+	complex.angle_energy_data = new bond_energy_t[num_angles];
+	complex.dihedral_energy_data = new dihedral_energy_t[num_dihedrals];
+	for(size_t i = 0;i<top.functypes.size();i++)
+	{
+		const std::vector<double>& params = top.iparams[i];
+		switch(top.functypes[i])
+		{
+		case TPR_BONDS:
+		{
+			bond_energy_t& energy = complex.bond_energy_data[param_index[i]];
+			energy.energy_const = 0.5*params[1]*joules2cal*angst2nm_sqrd;
+			energy.eq_distance = params[0]*nm2angst;
+			break;
+		}
+		case TPR_ANGLES:
+		{
+			bond_energy_t& energy = complex.angle_energy_data[param_index[i]];
+			energy.energy_const = 0.5*params[1]*joules2cal;
+			energy.eq_distance = MMPBSA_DEG_TO_RAD*params[0];
+			break;
+		}
+		case TPR_PDIHS: case TPR_PIDIHS:
+		{
+			dihedral_energy_t& energy = complex.dihedral_energy_data[param_index[i]];
+			energy.energy_const = joules2cal*params[1];
+			energy.periodicity = params[4];
+			energy.phase = MMPBSA_DEG_TO_RAD*params[0];
+			break;
+		}
+		case TPR_LJ:
+		{
+			//The first atnr*atnr parameter sets are the LJ matrix, indexed by atom type.
+			lj_params_t lj;
+			lj.c6 = nm2angst_6*joules2cal*params[0];
+			lj.c12 = nm2angst_12*joules2cal*params[1];
+			complex.lj_params.push_back(lj);
+			break;
+		}
+		}
+	}
+
+	std::set<int> ignored_types;
+	size_t atom_offset = 0, residue_offset = 0;
+	size_t part_offsets[MMPBSAState::END_OF_MOLECULES] = {0,0,0};
+	for(size_t mol_block = 0;mol_block<top.molblocks.size();mol_block++)
+	{
+		const tpr_moltype_t& mol = top.moltypes[top.molblocks[mol_block].type];
+		if(mol.name == "SOL")// NO SOLVENTS!!!
+			continue;
+		size_t part;
+		if((receptor_pos != 0 && receptor_pos->size() != 0 && receptor_pos->find(mol_block) != receptor_pos->end()) || ((receptor_pos == 0 || receptor_pos->size() == 0) && mol_block == 0))
+			part = MMPBSAState::RECEPTOR;
+		else if((ligand_pos != 0 && ligand_pos->size() != 0 && ligand_pos->find(mol_block) != ligand_pos->end()) || ((ligand_pos == 0 || ligand_pos->size() == 0) && mol_block > 0))
+			part = MMPBSAState::LIGAND;
+		else
+			continue;
+		forcefield_t* fields[] = {&complex, &split_ff[0][part]};
+		std::vector<atom_t>* atoms[] = {&complex_atoms, &atom_lists[0][part]};
+		size_t& part_offset = part_offsets[part];
+
+		for(int copy = 0;copy<top.molblocks[mol_block].nmol;copy++)
+		{
+			//Indices are offset by the atoms before the molecule, in the complex and in the receptor or ligand.
+			size_t offsets[] = {atom_offset, part_offset};
+			for(size_t atom_idx = 0;atom_idx<mol.atoms.size();atom_idx++)
+			{
+				const tpr_atom_t& atom = mol.atoms[atom_idx];
+				atom_t new_atom;
+				new_atom.atom_type = atom.typeB;
+				new_atom.atomic_number = atom.atomnumber;
+				new_atom.charge = charge_units*atom.qB;
+				new_atom.name = mol.atom_names[atom_idx];
+				new_atom.type_name = mol.atom_types[atom_idx];
+				new_atom.residue = residue_offset + atom.resind;
+				new_atom.residue_name = mol.residue_names[atom.resind];
+				for(size_t i = 0;i<2;i++)
+				{
+					new_atom.exclusion_list.clear();
+					for(int ex_idx = mol.excl_index[atom_idx];ex_idx < mol.excl_index[atom_idx+1];ex_idx++)
+						new_atom.exclusion_list.insert(mol.excl_atoms[ex_idx] + offsets[i]);
+					atoms[i]->push_back(new_atom);
+				}
+			}
+
+			for(size_t ftype = 0;ftype<TPR_NRE;ftype++)
+			{
+				const std::vector<int>& ilist = mol.ilists[ftype];
+				size_t stride = 1 + tpr_interaction_atoms(ftype);
+				if(stride == 1)
+				{
+					if(ilist.size() != 0 && ftype != TPR_LJ)
+						ignored_types.insert(ftype);
+					continue;
+				}
+				for(size_t idx = 0;idx<ilist.size();idx += stride)
+					for(size_t i = 0;i<2;i++)
+					{
+						const int* iatoms = &ilist[idx];
+						const size_t& offset = offsets[i];
+						switch(ftype)
+						{
+						case TPR_BONDS:
+						{
+							bond_t new_bond;
+							new_bond.atom_i = iatoms[1] + offset;
+							new_bond.atom_j = iatoms[2] + offset;
+							new_bond.bond_energy = &complex.bond_energy_data[param_index[iatoms[0]]];
+							fields[i]->bonds_with_H.push_back(new_bond);
+							break;
+						}
+						case TPR_ANGLES:
+						{
+							angle_t new_angle;
+							new_angle.atom_i = iatoms[1] + offset;
+							new_angle.atom_j = iatoms[2] + offset;
+							new_angle.atom_k = iatoms[3] + offset;
+							new_angle.angle_energy = &complex.angle_energy_data[param_index[iatoms[0]]];
+							fields[i]->angles_with_H.push_back(new_angle);
+							break;
+						}
+						case TPR_PDIHS: case TPR_PIDIHS:
+						{
+							//1-4 pairs are listed separately (LJ14), so dihedrals are masked from 1-4 terms.
+							dihedral_t new_dihedral;
+							new_dihedral.atom_i = iatoms[1] + offset;
+							new_dihedral.atom_j = iatoms[2] + offset;
+							new_dihedral.atom_k = iatoms[3] + offset;
+							new_dihedral.atom_l = iatoms[4] + offset;
+							new_dihedral.lj.c12 = new_dihedral.lj.c6 = 0;
+							new_dihedral.dihedral_energy = &complex.dihedral_energy_data[param_index[iatoms[0]]];
+							new_dihedral.nonbonded_masks.should_ignore_end_grp = false;
+							new_dihedral.nonbonded_masks.is_improper = true;
+							fields[i]->dihedrals_with_H.push_back(new_dihedral);
+							break;
+						}
+						case TPR_LJ14:
+						{
+							const std::vector<double>& params = top.iparams[iatoms[0]];
+							dihedral_t new_dihedral;
+							new_dihedral.atom_i = iatoms[1] + offset;
+							new_dihedral.atom_l = iatoms[2] + offset;
+							new_dihedral.atom_j = new_dihedral.atom_k = -1;
+							new_dihedral.lj.c6 = nm2angst_6*joules2cal*params[0];
+							new_dihedral.lj.c12 = nm2angst_12*joules2cal*params[1];
+							new_dihedral.nonbonded_masks.is_improper = new_dihedral.nonbonded_masks.should_ignore_end_grp = false;
+							new_dihedral.dihedral_energy = 0;
+							fields[i]->dihedrals_with_H.push_back(new_dihedral);
+							break;
+						}
+						}
+					}
+			}
+			atom_offset += mol.atoms.size();
+			part_offset += mol.atoms.size();
+			residue_offset += mol.residue_names.size();
+		}
+	}
+	for(std::set<int>::const_iterator ftype = ignored_types.begin();ftype != ignored_types.end();ftype++)
+		std::cerr << "get_tpr_forcefield: Warning: Non supported gromacs interaction type: " << *ftype << std::endl;
+
+	//create mol_list
+	mol_list.resize(complex_atoms.size(),MMPBSAState::LIGAND);
+	mol_list[std::slice(0,atom_lists[0][MMPBSAState::RECEPTOR].size(),1)] = MMPBSAState::RECEPTOR;
+
+	//All molecules must share the LJ paramters
+	split_ff[0][MMPBSAState::RECEPTOR].lj_params = split_ff[0][MMPBSAState::LIGAND].lj_params = complex.lj_params;
+}
@@ -0,0 +1,160 @@
+/**
+ * @namespace mmpbsa_io
+ * @brief Native reader for Gromacs run input files (.tpr)
+ *
+ * Run input files are XDR encoded (big endian) and are read directly,
+ * without libgmx, so that .tpr topologies may be used on hosts where
+ * Gromacs is not installed. Only the subset of the file needed for MMPBSA
+ * is decoded: the force field parameters, the molecule types (atoms,
+ * interaction lists and exclusions) and the molecule blocks. Reading stops
+ * before the atom types, groups, coordinates and input record.
+ *
+ * The layout of the topology depends on the tpx file version. Only the
+ * version written by Gromacs 4.5 (the version of libgmx used with
+ * --with-gromacs) is supported; files of other versions are rejected.
+ * With --with-gromacs, libgmx reads .tpr files instead (see FormatConverter).
+ */
+
+#ifndef TPRREADER_H
+#define TPRREADER_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string>
+#include <valarray>
+#include <vector>
+#include <set>
+#include <iostream>
+#include <sstream>
+
+#include "globals.h"
+#include "mmpbsa_exceptions.h"
+#include "structs.h"
+#include "MMPBSAState.h"
+
+//tpx file version and generation written by Gromacs 4.5
+#define MMPBSA_TPX_VERSION 73
+#define MMPBSA_TPX_GENERATION 23
+
+namespace mmpbsa_io{
+
+/**
+ * Interaction function types, numbered as in tpx version 73 files
+ * (F_* in gromacs/types/idef.h of Gromacs 4.5).
+ */
+enum tpr_functype {TPR_BONDS = 0, TPR_G96BONDS, TPR_MORSE, TPR_CUBICBONDS, TPR_CONNBONDS, TPR_HARMONIC,
+	TPR_FENEBONDS, TPR_TABBONDS, TPR_TABBONDSNC, TPR_RESTRBONDS,
+	TPR_ANGLES, TPR_G96ANGLES, TPR_CROSS_BOND_BONDS, TPR_CROSS_BOND_ANGLES, TPR_UREY_BRADLEY,
+	TPR_QUARTIC_ANGLES, TPR_TABANGLES,
+	TPR_PDIHS, TPR_RBDIHS, TPR_FOURDIHS, TPR_IDIHS, TPR_PIDIHS, TPR_TABDIHS, TPR_CMAP,
+	TPR_GB12, TPR_GB13, TPR_GB14, TPR_GBPOL, TPR_NPSOLVATION,
+	TPR_LJ14, TPR_COUL14, TPR_LJC14_Q, TPR_LJC_PAIRS_NB,
+	TPR_LJ, TPR_BHAM, TPR_LJ_LR, TPR_BHAM_LR, TPR_DISPCORR, TPR_COUL_SR, TPR_COUL_LR,
+	TPR_RF_EXCL, TPR_COUL_RECIP, TPR_DPD,
+	TPR_POLARIZATION, TPR_WATER_POL, TPR_THOLE_POL,
+	TPR_POSRES, TPR_DISRES, TPR_DISRESVIOL, TPR_ORIRES, TPR_ORIRESDEV,
+	TPR_ANGRES, TPR_ANGRESZ, TPR_DIHRES, TPR_DIHRESVIOL,
+	TPR_CONSTR, TPR_CONSTRNC, TPR_SETTLE,
+	TPR_VSITE2, TPR_VSITE3, TPR_VSITE3FD, TPR_VSITE3FAD, TPR_VSITE3OUT, TPR_VSITE4FD, TPR_VSITE4FDN, TPR_VSITEN,
+	TPR_COM_PULL, TPR_EQM, TPR_EPOT, TPR_EKIN, TPR_ETOT, TPR_ECONSERVED, TPR_TEMP, TPR_VTEMP,
+	TPR_PDISPCORR, TPR_PRES, TPR_DHDL_CON, TPR_DVDL, TPR_DKDL,
+	TPR_NRE///<Number of function types, i.e. of interaction lists per molecule type
+};
+
+/**
+ * Header of a run input file.
+ */
+typedef struct {
+	int version, generation;///<tpx file version and generation
+	size_t real_size;///<4 for single precision, 8 for double precision.
+	int natoms, ngtc;///<Number of atoms and of temperature coupling groups
+	double lambda;
+	bool has_ir, has_top, has_x, has_v, has_f, has_box;///<Which parts of the run input are stored
+}tpr_header_t;
+
+/**
+ * Atom of a molecule type. Charges are in electron charges.
+ */
+typedef struct {
+	double m, q, mB, qB;
+	int type, typeB, ptype;
+	int resind;///<Residue of the atom within its molecule type
+	int atomnumber;
+}tpr_atom_t;
+
+/**
+ * Molecule type. Names are resolved from the symbol table.
+ */
+typedef struct {
+	std::string name;
+	std::vector<tpr_atom_t> atoms;
+	std::vector<std::string> atom_names, atom_types, residue_names;
+	/**
+	 * Interaction lists, indexed by tpr_functype. Each interaction is stored as
+	 * the index of its parameters in tpr_topology_t::iparams followed by its atoms.
+	 */
+	std::vector<std::vector<int> > ilists;
+	std::vector<int> excl_index, excl_atoms;///<Exclusions of atom i are excl_atoms[excl_index[i]] to excl_atoms[excl_index[i+1]-1]
+}tpr_moltype_t;
+
+/**
+ * Molecule block, i.e. nmol consecutive copies of a molecule type.
+ */
+typedef struct {
+	int type, nmol, natoms_mol;
+}tpr_molblock_t;
+
+/**
+ * Topology of a run input file. Units are those of Gromacs (nm, kJ/mol, degrees).
+ */
+typedef struct {
+	std::string name;
+	int atnr;///<Number of atom types. The first atnr*atnr parameter sets are the LJ matrix.
+	std::vector<int> functypes;///<tpr_functype of each parameter set
+	std::vector<std::vector<double> > iparams;///<Parameters of each set, in the order they are stored (e.g. rA, krA, rB, krB for harmonic bonds)
+	double fudgeQQ;
+	std::vector<tpr_moltype_t> moltypes;
+	std::vector<tpr_molblock_t> molblocks;
+	int natoms;
+}tpr_topology_t;
+
+/**
+ * Reads the header at the beginning of the run input file.
+ *
+ * Throws an MMPBSAException if the data is not a run input file or if its
+ * tpx version is not MMPBSA_TPX_VERSION.
+ */
+void read_tpr_header(std::istream& tprFile, tpr_header_t& header) throw (mmpbsa::MMPBSAException);
+
+/**
+ * Reads the topology, which follows the box and temperature coupling
+ * data after the header.
+ */
+void read_tpr_topology(std::istream& tprFile, const tpr_header_t& header, tpr_topology_t& top) throw (mmpbsa::MMPBSAException);
+
+/**
+ * Opens the run input file and reads its header and topology.
+ */
+void read_tpr(const std::string& filename, tpr_header_t& header, tpr_topology_t& top) throw (mmpbsa::MMPBSAException);
+
+/**
+ * Sets up the forcefield data from a run input file, as get_gromacs_forcefield
+ * does with libgmx. Charges, Lennard Jones parameters, harmonic bonds and angles,
+ * proper and improper (periodic) dihedrals, 1-4 pairs and exclusions are used.
+ * Other interaction types are ignored with a warning.
+ *
+ * split_ff and atom_lists are allocated with MMPBSAState::END_OF_MOLECULES
+ * elements, for the complex, receptor and ligand. Molecule blocks named "SOL"
+ * are skipped. Unless receptor_pos or ligand_pos list the molecule blocks
+ * (zero-indexed) of the receptor and ligand, the first block is the receptor
+ * and the others are the ligand.
+ */
+void get_tpr_forcefield(const std::string& filename,mmpbsa::forcefield_t** split_ff,std::vector<mmpbsa::atom_t>** atom_lists,
+		std::valarray<mmpbsa::MMPBSAState::MOLECULE>& mol_list,const std::set<size_t>* receptor_pos = 0,
+		const std::set<size_t>* ligand_pos = 0) throw (mmpbsa::MMPBSAException);
+
+}//end namespace mmpbsa_io
+
+#endif//TPRREADER_H
@@ -0,0 +1,189 @@
+#include "TrrReader.h"
+
+#include <fstream>
+
+//XDR stores all values big endian. These decode the raw bytes regardless of host byte order.
+static int xdr_int(const unsigned char* buf)
+{
+	unsigned int val = ((unsigned int)buf[0] << 24) | ((unsigned int)buf[1] << 16)
+			| ((unsigned int)buf[2] << 8) | (unsigned int)buf[3];
+	return (int) val;
+}
+
+static float xdr_float(const unsigned char* buf)
+{
+	union{unsigned int i; float f;} val;
+	val.i = ((unsigned int)buf[0] << 24) | ((unsigned int)buf[1] << 16)
+			| ((unsigned int)buf[2] << 8) | (unsigned int)buf[3];
+	return val.f;
+}
+
+static double xdr_double(const unsigned char* buf)
+{
+	union{unsigned long long i; double d;} val;
+	val.i = 0;
+	for(size_t i = 0;i<8;i++)
+		val.i = (val.i << 8) | (unsigned long long)buf[i];
+	return val.d;
+}
+
+static double xdr_real(const unsigned char* buf, const size_t& real_size)
+{
+	return (real_size == sizeof(double)) ? xdr_double(buf) : (double) xdr_float(buf);
+}
+
+static bool read_xdr_int(std::istream& trrFile, int& val)
+{
+	unsigned char buf[4];
+	trrFile.read((char*)buf,4);
+	if(trrFile.gcount() != 4)
+		return false;
+	val = xdr_int(buf);
+	return true;
+}
+
+bool mmpbsa_io::read_trr_header(std::istream& trrFile, mmpbsa_io::trr_header_t& header) throw (mmpbsa::MMPBSAException)
+{
+	int magic, slen, str_size;
+	if(!read_xdr_int(trrFile,magic))
+		return false;//end of file
+	if(magic != MMPBSA_TRR_MAGIC)
+	{
+		std::ostringstream error;
+		error << "mmpbsa_io::read_trr_header: Not a trr frame (magic number " << magic << ")";
+		throw mmpbsa::MMPBSAException(error,mmpbsa::BROKEN_TRAJECTORY_FILE);
+	}
+
+	//Version string, "GMX_trn_file", stored as its length (with null terminator) followed
+	//by an XDR string (length then characters, padded to a multiple of four bytes).
+	if(!read_xdr_int(trrFile,slen) || !read_xdr_int(trrFile,str_size) || str_size < 0 || str_size > slen)
+		throw mmpbsa::MMPBSAException("mmpbsa_io::read_trr_header: Incomplete frame header.",mmpbsa::BROKEN_TRAJECTORY_FILE);
+	trrFile.seekg((str_size + 3) & ~3,std::ios::cur);
+
+	int* fields[] = {&header.ir_size, &header.e_size, &header.box_size, &header.vir_size, &header.pres_size,
+			&header.top_size, &header.sym_size, &header.x_size, &header.v_size, &header.f_size,
+			&header.natoms, &header.step, &header.nre};
+	size_t num_fields = sizeof(fields)/sizeof(int*);
+	for(size_t i = 0;i<num_fields;i++)
+		if(!read_xdr_int(trrFile,*fields[i]))
+			throw mmpbsa::MMPBSAException("mmpbsa_io::read_trr_header: Incomplete frame header.",mmpbsa::BROKEN_TRAJECTORY_FILE);
+	for(size_t i = 0;i<10;i++)//block sizes
+		if(*fields[i] < 0)
+		{
+			std::ostringstream error;
+			error << "mmpbsa_io::read_trr_header: Negative block size in trr frame at step " << header.step;
+			throw mmpbsa::MMPBSAException(error,mmpbsa::BROKEN_TRAJECTORY_FILE);
+		}
+
+	//Precision is not stored explicitly. Gromacs determines it from the size of the data blocks.
+	header.real_size = 0;
+	if(header.box_size)
+		header.real_size = header.box_size/9;
+	else if(header.natoms > 0 && header.x_size)
+		header.real_size = header.x_size/(header.natoms*3);
+	else if(header.natoms > 0 && header.v_size)
+		header.real_size = header.v_size/(header.natoms*3);
+	else if(header.natoms > 0 && header.f_size)
+		header.real_size = header.f_size/(header.natoms*3);
+	if(header.real_size != sizeof(float) && header.real_size != sizeof(double))
+	{
+		std::ostringstream error;
+		error << "mmpbsa_io::read_trr_header: Cannot determine precision of trr frame at step " << header.step;
+		throw mmpbsa::MMPBSAException(error,mmpbsa::BROKEN_TRAJECTORY_FILE);
+	}
+
+	unsigned char buf[16];
+	trrFile.read((char*)buf,2*header.real_size);
+	if(trrFile.gcount() != std::streamsize(2*header.real_size))
+		throw mmpbsa::MMPBSAException("mmpbsa_io::read_trr_header: Incomplete frame header.",mmpbsa::BROKEN_TRAJECTORY_FILE);
+	header.t = xdr_real(buf,header.real_size);
+	header.lambda = xdr_real(buf + header.real_size,header.real_size);
+	return true;
+}
+
+std::streamoff mmpbsa_io::trr_bytes_before_x(const mmpbsa_io::trr_header_t& header)
+{
+	return std::streamoff(header.ir_size) + header.e_size + header.box_size + header.vir_size
+			+ header.pres_size + header.top_size + header.sym_size;
+}
+
+std::streamoff mmpbsa_io::trr_data_bytes(const mmpbsa_io::trr_header_t& header)
+{
+	return trr_bytes_before_x(header) + header.x_size + header.v_size + header.f_size;
+}
+
+bool mmpbsa_io::read_trr_frame(std::istream& trrFile, std::valarray<mmpbsa::Vector>& crds, mmpbsa_io::trr_header_t* header) throw (mmpbsa::MMPBSAException)
+{
+	trr_header_t local_header;
+	if(header == 0)
+		header = &local_header;
+	if(!read_trr_header(trrFile,*header))
+		return false;
+
+	trrFile.seekg(trr_bytes_before_x(*header),std::ios::cur);
+	if(header->x_size == 0)
+	{
+		std::ostringstream error;
+		error << "mmpbsa_io::read_trr_frame: No coordinates in trr frame at step " << header->step;
+		throw mmpbsa::MMPBSAException(error,mmpbsa::BROKEN_TRAJECTORY_FILE);
+	}
+
+	if(header->natoms <= 0 || size_t(header->x_size) != 3*size_t(header->natoms)*header->real_size)
+	{
+		std::ostringstream error;
+		error << "mmpbsa_io::read_trr_frame: Coordinate block of " << header->x_size << " bytes does not match "
+				<< header->natoms << " atoms in trr frame at step " << header->step;
+		throw mmpbsa::MMPBSAException(error,mmpbsa::BROKEN_TRAJECTORY_FILE);
+	}
+
+	static const mmpbsa_t nm2angst = 10;
+	std::vector<unsigned char> buffer(header->x_size);
+	trrFile.read((char*)&buffer[0],header->x_size);
+	if(trrFile.gcount() != header->x_size)
+	{
+		std::ostringstream error;
+		error << "mmpbsa_io::read_trr_frame: Incomplete frame at step " << header->step;
+		throw mmpbsa::MMPBSAException(error,mmpbsa::UNEXPECTED_EOF);
+	}
+
+	size_t natoms = header->natoms;
+	const unsigned char* curr_val = &buffer[0];
+	if(crds.size() != natoms)
+		crds.resize(natoms);
+	for(size_t i = 0;i<natoms;i++)
+		for(size_t j = 0;j<3;j++,curr_val += header->real_size)
+			crds[i].at(j) = xdr_real(curr_val,header->real_size)*nm2angst;
+
+	trrFile.seekg(header->v_size + header->f_size,std::ios::cur);
+	return true;
+}
+
+size_t mmpbsa_io::index_trr_frames(std::istream& trrFile, std::vector<std::streampos>& offsets) throw (mmpbsa::MMPBSAException)
+{
+	trr_header_t header;
+	std::streampos curr_pos = trrFile.tellg();
+	offsets.clear();
+	while(read_trr_header(trrFile,header))
+	{
+		offsets.push_back(curr_pos);
+		trrFile.seekg(trr_data_bytes(header),std::ios::cur);
+		curr_pos = trrFile.tellg();
+		if(curr_pos < 0)
+			break;
+	}
+	return offsets.size();
+}
+
+void mmpbsa_io::load_trr_frame(const std::string& filename, const std::streampos& offset, std::valarray<mmpbsa::Vector>& crds) throw (mmpbsa::MMPBSAException)
+{
+	std::fstream trrFile(filename.c_str(),std::ios::in | std::ios::binary);
+	if(!trrFile.good())
+		throw mmpbsa::MMPBSAException("mmpbsa_io::load_trr_frame: Could not open " + filename,mmpbsa::FILE_IO_ERROR);
+	trrFile.seekg(offset,std::ios::beg);
+	if(!read_trr_frame(trrFile,crds))
+	{
+		std::ostringstream error;
+		error << "mmpbsa_io::load_trr_frame: No frame at offset " << offset << " in " << filename;
+		throw mmpbsa::MMPBSAException(error,mmpbsa::UNEXPECTED_EOF);
+	}
+}
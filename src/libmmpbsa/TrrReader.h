@@ -0,0 +1,93 @@
+/**
+ * @namespace mmpbsa_io
+ * @brief Native reader for Gromacs full precision trajectory files (.trr)
+ *
+ * Trajectory files are XDR encoded (big endian) and are read directly,
+ * without libgmx. Therefore, .trr trajectories may be used on hosts
+ * where Gromacs is not installed. Both single and double precision
+ * files are supported; the precision is determined from the frame header.
+ *
+ * Frames are indexed once, when the trajectory is opened, so that seeking
+ * to a snapshot does not require reading every preceding frame.
+ */
+
+#ifndef TRRREADER_H
+#define TRRREADER_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string>
+#include <valarray>
+#include <vector>
+#include <iostream>
+#include <sstream>
+
+#include "globals.h"
+#include "mmpbsa_exceptions.h"
+#include "Vector.h"
+
+//Magic number at the start of each trr frame.
+#define MMPBSA_TRR_MAGIC 1993
+
+namespace mmpbsa_io{
+
+/**
+ * Header of a single trr frame. Sizes are in bytes.
+ */
+typedef struct {
+	int ir_size, e_size, box_size, vir_size, pres_size, top_size, sym_size;///<Sizes of the data blocks, in the order they are stored
+	int x_size, v_size, f_size;
+	int natoms, step, nre;
+	double t, lambda;
+	size_t real_size;///<4 for single precision, 8 for double precision.
+}trr_header_t;
+
+/**
+ * Reads the header of the trr frame at the current position of the stream.
+ *
+ * Returns false if the end of the stream has been reached before a header could
+ * be read. Throws an MMPBSAException if the data is not a trr frame.
+ */
+bool read_trr_header(std::istream& trrFile, trr_header_t& header) throw (mmpbsa::MMPBSAException);
+
+/**
+ * Number of bytes of frame data that precede the coordinates. Blocks are stored
+ * in the order of their sizes in the header: ir, e, box, vir, pres, top, sym, x, v, f.
+ * Only box, vir and pres are written by current versions of Gromacs, but every
+ * block is skipped by its size.
+ */
+std::streamoff trr_bytes_before_x(const trr_header_t& header);
+
+/**
+ * Number of bytes of frame data that follow the header.
+ */
+std::streamoff trr_data_bytes(const trr_header_t& header);
+
+/**
+ * Reads the frame (header and data) at the current position of the stream.
+ * Coordinates are converted from nanometers to Angstroms. Velocities and
+ * forces are skipped.
+ *
+ * Returns false if the end of the stream has been reached.
+ */
+bool read_trr_frame(std::istream& trrFile, std::valarray<mmpbsa::Vector>& crds, trr_header_t* header = 0) throw (mmpbsa::MMPBSAException);
+
+/**
+ * Scans the trajectory file and stores the stream offset of each frame in offsets.
+ * Only frame headers are read.
+ *
+ * @return Number of frames in the file.
+ */
+size_t index_trr_frames(std::istream& trrFile, std::vector<std::streampos>& offsets) throw (mmpbsa::MMPBSAException);
+
+/**
+ * Loads coordinates of the frame beginning at the provided offset. The file is opened
+ * and closed for each call.
+ */
+void load_trr_frame(const std::string& filename, const std::streampos& offset, std::valarray<mmpbsa::Vector>& crds) throw (mmpbsa::MMPBSAException);
+
+}//end namespace mmpbsa_io
+
+#endif//TRRREADER_H
@@ -26,6 +26,8 @@
 #define SANDER_INPCRD_TYPE "inpcrd"
 #define MMPBSA_TRAJECTORY_TYPE "traj"
 #define CHECKPOINT_FILE_TYPE "checkpoint"
+#define POTENTIAL_GRID_TYPE "potential_grid"
+#define POSE_SCORE_TYPE "pose_scores"
 
 //These tags are used to indicate the current state of the mdmmpbsa program
 #define MMPBSASTATE_TAG "mmpbsa_state"
@@ -794,14 +794,19 @@ std::ostream& streamPDB(std::ostream& theStream, const std::vector<mmpbsa::atom_
 bool mmpbsa_io::get_next_snap(mmpbsa_io::trajectory_t& traj, std::valarray<mmpbsa::Vector>& snapshot, mmpbsa_t *box_crds)
 {
 
-#ifdef USE_GROMACS
 	if(traj.gromacs_filename != 0)
 	{
-		mmpbsa_io::load_gmx_trr(*traj.gromacs_filename,snapshot,traj.curr_snap - 1);
+		if(traj.gmx_frame_offsets == 0 || traj.curr_snap == 0 || traj.curr_snap > traj.gmx_frame_offsets->size())
+		{
+			std::ostringstream error;
+			error << "mmpbsa_io::get_next_snap: No such snap shot in " << *traj.gromacs_filename << " Snap shot# " << traj.curr_snap
+					<< " Max snap shot: " << traj.num_gmx_frames;
+			throw mmpbsa::MMPBSAException(error,mmpbsa::UNEXPECTED_EOF);
+		}
+		mmpbsa_io::load_trr_frame(*traj.gromacs_filename,traj.gmx_frame_offsets->at(traj.curr_snap - 1),snapshot);
 		traj.curr_snap++;
 		return snapshot.size() != 0;
 	}
-#endif
 	using std::iostream;using std::fstream;
 	iostream* sander_file = traj.sander_crd_stream;
 	bool returnMe;
@@ -863,13 +868,11 @@ void mmpbsa_io::seek(std::iostream& stream, size_t natoms, int ifbox, size_t sna
 
 void mmpbsa_io::seek(mmpbsa_io::trajectory_t& traj,size_t snap_pos)
 {
-#ifdef USE_GROMACS
 	if(traj.gromacs_filename != 0)
 	{
 		traj.curr_snap = snap_pos;
 		return;
 	}
-#endif
 	using std::fstream;using std::iostream;
 	iostream* sander_file = traj.sander_crd_stream;
 	if(sander_file == 0)
@@ -910,6 +913,7 @@ void mmpbsa_io::default_trajectory(mmpbsa_io::trajectory_t& traj)
 
 	traj.gromacs_filename = 0;
 	traj.num_gmx_frames = 0;
+	traj.gmx_frame_offsets = 0;
 	traj.curr_snap = 0;
 }
 
@@ -918,6 +922,7 @@ void mmpbsa_io::destroy_trajectory(mmpbsa_io::trajectory_t& traj)
 	delete traj.sander_crd_stream;
 	delete traj.sander_filename;
 	delete traj.gromacs_filename;
+	delete traj.gmx_frame_offsets;
 }
 
 mmpbsa_io::trajectory_t mmpbsa_io::open_trajectory(const std::string& filename,const bool& should_remain_in_memory)
@@ -926,14 +931,17 @@ mmpbsa_io::trajectory_t mmpbsa_io::open_trajectory(const std::string& filename,c
 	trajectory_t returnMe;
 	mmpbsa_io::default_trajectory(returnMe);
 
-#ifdef USE_GROMACS
 	if(filename.find(".trr") != std::string::npos)
 	{
+		fstream trrFile(filename.c_str(),std::ios::in | std::ios::binary);
+		if(!trrFile.good())
+			throw mmpbsa::MMPBSAException("mmpbsa_io::open_trajectory: Unable to read from trajectory file",mmpbsa::BROKEN_TRAJECTORY_FILE);
 		returnMe.gromacs_filename = new std::string(filename);
-		returnMe.num_gmx_frames = mmpbsa_io::total_gmx_trr_frames(filename);
+		returnMe.gmx_frame_offsets = new std::vector<std::streampos>;
+		returnMe.num_gmx_frames = mmpbsa_io::index_trr_frames(trrFile,*returnMe.gmx_frame_offsets);
+		returnMe.curr_snap = 1;
 		return returnMe;
 	}
-#endif
 	//Test whether the file can be opened. If so, setup trajectory. Otherwise, throw exception.
 	fstream* trajDiskFile = new fstream(filename.c_str(),std::ios::in | std::ios::binary);
 	if(!trajDiskFile->good())
@@ -962,10 +970,8 @@ bool mmpbsa_io::eof(trajectory_t& traj)
 
 	if(traj.sander_crd_stream == 0)
 	{
-#ifdef USE_GROMACS
 		if(traj.gromacs_filename != 0)
-			return traj.curr_snap >= traj.num_gmx_frames;
-#endif
+			return traj.curr_snap > traj.num_gmx_frames;
 		if(traj.sander_filename == 0)
 			throw mmpbsa::MMPBSAException("mmpbsa_io::eof: No trajectory file provided.",mmpbsa::NULL_POINTER);
 		ifstream sander_file(traj.sander_filename->c_str());
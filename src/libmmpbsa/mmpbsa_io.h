@@ -24,6 +24,8 @@
 #include "SanderParm.h"
 #include "Vector.h"
 
+#include "TrrReader.h"
+
 #ifdef USE_GROMACS
 #include "GromacsReader.h"
 #endif
@@ -157,6 +159,13 @@ void destroy_trajectory(mmpbsa_io::trajectory_t& traj);
 /**
  * Determines whether or not the program has reached the end of
  * the trajectory.
+ *
+ * For Gromacs .trr trajectories, which are read by TrrReader, curr_snap is
+ * the one-indexed frame that get_next_snap will read next, as for sander
+ * trajectories. The end is reached once every frame has been read, i.e.
+ * when curr_snap is greater than the number of frames. (Before .trr files
+ * were read natively, the end was reported one frame early, when curr_snap
+ * equaled the number of frames.)
  */
 bool eof(trajectory_t& traj);
 
@@ -79,6 +79,27 @@ int mmpbsa_utils::loadListArg(const std::string& values,std::set<size_t>& array,
     return 0;
 }
 
+int mmpbsa_utils::loadListArg(const std::string& values,std::vector<mmpbsa_t>& array)
+{
+    using mmpbsa_utils::StringTokenizer;
+    StringTokenizer valTokens(values,",");
+    mmpbsa_t currValue = 0;
+    while(valTokens.hasMoreTokens())
+    {
+        std::string curr_token = valTokens.nextToken();
+        std::istringstream curr(curr_token);
+        curr >> currValue;
+        if(curr.fail())
+        {
+            std::ostringstream error;
+            error << "mmpbsa_utils::loadListArg: Invalid floating point value\nValue:" << curr_token;
+            throw mmpbsa::MMPBSAException(error,mmpbsa::COMMAND_LINE_ERROR);
+        }
+        array.push_back(currValue);
+    }
+    return 0;
+}
+
 std::string mmpbsa_utils::toUpperCase(const std::string& bean)
 {
     std::string returnMe = bean;
@@ -110,34 +131,104 @@ std::string mmpbsa_utils::trimString(const std::string& theString)
     return bean;
 }
 
+/**
+ * Flags the atoms of A that are within cutoff of an atom of B, and vice versa.
+ *
+ * The atoms of A are binned into cubic cells, at least cutoff on a side, so that each
+ * atom of B is only compared with the atoms of A in its own and the 26 neighboring cells.
+ */
+static void flag_interactors(const std::valarray<mmpbsa_t>& acrds, const std::valarray<mmpbsa_t>& bcrds,
+        const mmpbsa_t& cutoff, std::valarray<bool>& aflags, std::valarray<bool>& bflags)
+{
+    size_t num_a = aflags.size();
+    if(num_a == 0 || bflags.size() == 0)
+        return;
+
+    //Cells span the atoms of A. Their number is limited to a few per atom, for sparse coordinate sets.
+    mmpbsa_t amin[3],amax[3];
+    for(size_t j = 0;j<3;j++)
+        amin[j] = amax[j] = acrds[j];
+    for(size_t i = 1;i<num_a;i++)
+        for(size_t j = 0;j<3;j++)
+        {
+            amin[j] = std::min(amin[j],acrds[3*i+j]);
+            amax[j] = std::max(amax[j],acrds[3*i+j]);
+        }
+    mmpbsa_t cell_size = (cutoff > 0) ? cutoff : 1;
+    size_t dims[3];
+    for(;;)
+    {
+        for(size_t j = 0;j<3;j++)
+            dims[j] = size_t((amax[j] - amin[j])/cell_size) + 1;
+        if(dims[0]*dims[1]*dims[2] <= 8*num_a)
+            break;
+        cell_size *= 2;
+    }
+
+    //Atoms of A, sorted by cell. cell_start[c] is the first in cell c.
+    std::vector<size_t> cell_of(num_a), cell_start(dims[0]*dims[1]*dims[2] + 1,0), cell_atoms(num_a);
+    for(size_t i = 0;i<num_a;i++)
+    {
+        size_t idx[3];
+        for(size_t j = 0;j<3;j++)
+            idx[j] = std::min(size_t((acrds[3*i+j] - amin[j])/cell_size),dims[j]-1);
+        cell_of[i] = (idx[2]*dims[1] + idx[1])*dims[0] + idx[0];
+        cell_start[cell_of[i]+1]++;
+    }
+    for(size_t c = 1;c<cell_start.size();c++)
+        cell_start[c] += cell_start[c-1];
+    std::vector<size_t> fill(cell_start.begin(),cell_start.end()-1);
+    for(size_t i = 0;i<num_a;i++)
+        cell_atoms[fill[cell_of[i]]++] = i;
+
+    mmpbsa_t cutsqrd = cutoff*cutoff;
+    for(size_t i = 0;i<bflags.size();i++)
+    {
+        const mmpbsa_t* b = &bcrds[3*i];
+        long lo[3],hi[3];
+        bool outside = false;
+        for(size_t j = 0;j<3 && !outside;j++)
+        {
+            mmpbsa_t cell = floor((b[j] - amin[j])/cell_size);
+            outside = (cell < -1 || cell > mmpbsa_t(dims[j]));
+            if(outside)
+                break;
+            lo[j] = std::max(long(cell) - 1,0L);
+            hi[j] = std::min(long(cell) + 1,long(dims[j]) - 1);
+        }
+        if(outside)
+            continue;
+        for(long z = lo[2];z<=hi[2];z++)
+            for(long y = lo[1];y<=hi[1];y++)
+                for(long x = lo[0];x<=hi[0];x++)
+                {
+                    size_t c = (size_t(z)*dims[1] + y)*dims[0] + x;
+                    for(size_t k = cell_start[c];k<cell_start[c+1];k++)
+                    {
+                        const mmpbsa_t* a = &acrds[3*cell_atoms[k]];
+                        mmpbsa_t dx = b[0] - a[0], dy = b[1] - a[1], dz = b[2] - a[2];
+                        if(dx*dx + dy*dy + dz*dz < cutsqrd)
+                        {
+                            bflags[i] = true;
+                            aflags[cell_atoms[k]] = true;
+                        }
+                    }
+                }
+    }
+}
+
 mead_data_t * mmpbsa_utils::interaction_minmax(const std::valarray<mmpbsa_t>& acrds,
         const std::valarray<mmpbsa_t>& bcrds, const mmpbsa_t& cutoff)
 {
     using std::valarray;
-    using std::slice;
     using std::max;
     using std::min;
     
-    mmpbsa_t cutsqrd = cutoff*cutoff;
     valarray<bool> aflags(false,size_t(acrds.size()/3));
     valarray<bool> bflags(false,size_t(bcrds.size()/3));
+    flag_interactors(acrds,bcrds,cutoff,aflags,bflags);
 
-    mmpbsa_t rsqrd = 0;//valarray<mmpbsa_t> rsqrd(0.0,numCoords);
-    for(size_t i = 0;i<bflags.size();i++)
-    {
-        for(size_t j = 0;j<aflags.size();j++)
-        {
-            rsqrd = pow(bcrds[3*i]-acrds[3*j],2) + pow(bcrds[3*i+1]-acrds[3*j+1],2)
-                    + pow(bcrds[3*i+2]-acrds[3*j+2],2);
-            if(rsqrd < cutsqrd)
-            {
-                bflags[i] = true;
-                aflags[j] = true;
-            }
-        }
-
-    }
-    mead_data_t max_corner[3],min_corner[3];
+    mead_data_t max_corner[3] = {0,0,0},min_corner[3] = {0,0,0};
     bool seenFirstInteractor = false;
     for(size_t i = 0;i<aflags.size();i++)
     {
@@ -153,14 +244,14 @@ mead_data_t * mmpbsa_utils::interaction_minmax(const std::valarray<mmpbsa_t>& ac
             {
                 for(size_t j = 0;j<3;j++)
                 {
-                    max_corner[j] = max(acrds[3*i+j],mmpbsa_t(max_corner[j]));
+                    max_corner[j] = max(acrds[3*i+j],mmpbsa_t(max_corner[j]));//mead_data_type is not necessarily the same as mmpbsa_t, unfortunately. :-( Indeed, Coord is single precision.
                     min_corner[j] = min(acrds[3*i+j],mmpbsa_t(min_corner[j]));
                 }
             }
         }
     }
 
-    for(size_t i = 0;i<bflags.size();i+=3)
+    for(size_t i = 0;i<bflags.size();i++)
     {
         if(bflags[i])
         {
@@ -172,7 +263,7 @@ mead_data_t * mmpbsa_utils::interaction_minmax(const std::valarray<mmpbsa_t>& ac
         }
     }
 
-    mead_data_t * returnMe = new float[6];//x,y,z for min and max respectively
+    mead_data_t * returnMe = new mead_data_t[6];//x,y,z for min and max respectively
     for(size_t i = 0;i<3;i++)
     {
         returnMe[i] = min_corner[i];
@@ -184,78 +275,134 @@ mead_data_t * mmpbsa_utils::interaction_minmax(const std::valarray<mmpbsa_t>& ac
 mead_data_t * mmpbsa_utils::interaction_minmax(const std::valarray<mmpbsa::Vector>& acrds,
                 const std::valarray<mmpbsa::Vector>& bcrds, const mmpbsa_t& cutoff)
 {
-    using std::valarray;
-    using std::slice;
-    using std::max;
-    using std::min;
-
-    valarray<bool> aflags(false,acrds.size());
-    valarray<bool> bflags(false,bcrds.size());
-
-    mmpbsa_t r = 0;
-    for(size_t i = 0;i<bflags.size();i++)
-    {
-        for(size_t j = 0;j<aflags.size();j++)
-        {
-            r = (bcrds[i]-acrds[j]).modulus();
-            if(r < cutoff)
-            {
-                bflags[i] = true;
-                aflags[j] = true;
-            }
-        }
+    std::valarray<mmpbsa_t> aflat(3*acrds.size()),bflat(3*bcrds.size());
+    for(size_t i = 0;i<acrds.size();i++)
+        for(size_t j = 0;j<3;j++)
+            aflat[3*i+j] = acrds[i].at(j);
+    for(size_t i = 0;i<bcrds.size();i++)
+        for(size_t j = 0;j<3;j++)
+            bflat[3*i+j] = bcrds[i].at(j);
+    return interaction_minmax(aflat,bflat,cutoff);
+}
 
-    }
-    mead_data_t max_corner[3],min_corner[3];
-    bool seenFirstInteractor = false;
-    for(size_t i = 0;i<aflags.size();i++)
+/**
+ * Eigenvector of the largest eigenvalue of a symmetric 4x4 matrix, by cyclic Jacobi
+ * rotations. The matrix is overwritten.
+ */
+static void largest_eigenvector(mmpbsa_t a[4][4], mmpbsa_t eigenvector[4])
+{
+    mmpbsa_t v[4][4] = {{1,0,0,0},{0,1,0,0},{0,0,1,0},{0,0,0,1}};
+    for(size_t sweep = 0;sweep<50;sweep++)
     {
-        if(aflags[i])
-        {
-            if(!seenFirstInteractor)
+        mmpbsa_t off = 0;
+        for(size_t p = 0;p<4;p++)
+            for(size_t q = p+1;q<4;q++)
+                off += a[p][q]*a[p][q];
+        if(off < 1e-20)
+            break;
+        for(size_t p = 0;p<4;p++)
+            for(size_t q = p+1;q<4;q++)
             {
-                for(size_t j = 0;j<3;j++)
-                    min_corner[j] = max_corner[j] = acrds[i].at(j);
-                seenFirstInteractor = true;
-            }
-            else
-            {
-                for(size_t j = 0;j<3;j++)
+                if(a[p][q] == 0)
+                    continue;
+                mmpbsa_t theta = (a[q][q] - a[p][p])/(2*a[p][q]);
+                mmpbsa_t t = ((theta < 0) ? -1 : 1)/(fabs(theta) + sqrt(theta*theta + 1));
+                mmpbsa_t c = 1/sqrt(t*t + 1), s = t*c;
+                for(size_t k = 0;k<4;k++)
                 {
-                    max_corner[j] = max(acrds[i].at(j),mmpbsa_t(max_corner[j]));//mead_data_type is not necessarily the same as mmpbsa_t, unfortunately. :-( Indeed, Coord is single precision.
-                    min_corner[j] = min(acrds[i].at(j),mmpbsa_t(min_corner[j]));
+                    mmpbsa_t akp = a[k][p], akq = a[k][q];
+                    a[k][p] = c*akp - s*akq;
+                    a[k][q] = s*akp + c*akq;
+                    mmpbsa_t vkp = v[k][p], vkq = v[k][q];
+                    v[k][p] = c*vkp - s*vkq;
+                    v[k][q] = s*vkp + c*vkq;
+                }
+                for(size_t k = 0;k<4;k++)
+                {
+                    mmpbsa_t apk = a[p][k], aqk = a[q][k];
+                    a[p][k] = c*apk - s*aqk;
+                    a[q][k] = s*apk + c*aqk;
                 }
             }
-        }
     }
+    size_t largest = 0;
+    for(size_t i = 1;i<4;i++)
+        if(a[i][i] > a[largest][largest])
+            largest = i;
+    for(size_t i = 0;i<4;i++)
+        eigenvector[i] = v[i][largest];
+}
 
-    for(size_t i = 0;i<bflags.size();i+=3)
-    {
-        if(bflags[i])
+mmpbsa_t mmpbsa_utils::superposed_rmsd(const std::valarray<mmpbsa::Vector>& acrds,
+        const std::valarray<mmpbsa::Vector>& bcrds, const size_t& num_fit) throw (mmpbsa::MMPBSAException)
+{
+    const size_t num_atoms = acrds.size();
+    const size_t fit = (num_fit == 0 || num_fit > num_atoms) ? num_atoms : num_fit;
+    if(bcrds.size() != num_atoms)
+        throw mmpbsa::MMPBSAException("mmpbsa_utils::superposed_rmsd: The coordinate sets have different numbers of atoms.",
+                mmpbsa::DATA_FORMAT_ERROR);
+    if(num_atoms == 0)
+        return 0;
+
+    mmpbsa_t acenter[3] = {0,0,0},bcenter[3] = {0,0,0};
+    for(size_t i = 0;i<fit;i++)
+        for(size_t j = 0;j<3;j++)
         {
-            for(size_t j = 0;j<3;j++)
-            {
-                max_corner[j] = max(bcrds[i].at(j),mmpbsa_t(max_corner[j]));
-                min_corner[j] = min(bcrds[i].at(j),mmpbsa_t(min_corner[j]));
-            }
+            acenter[j] += acrds[i][j];
+            bcenter[j] += bcrds[i][j];
         }
+    for(size_t j = 0;j<3;j++)
+    {
+        acenter[j] /= fit;
+        bcenter[j] /= fit;
     }
 
-    mead_data_t * returnMe = new mead_data_t[6];//x,y,z for min and max respectively
-    for(size_t i = 0;i<3;i++)
+    //Correlation matrix S[j][k] = sum a_j b_k of the centered coordinates of the fit atoms.
+    mmpbsa_t S[3][3] = {{0,0,0},{0,0,0},{0,0,0}};
+    for(size_t i = 0;i<fit;i++)
+        for(size_t j = 0;j<3;j++)
+            for(size_t k = 0;k<3;k++)
+                S[j][k] += (acrds[i][j] - acenter[j])*(bcrds[i][k] - bcenter[k]);
+
+    //The unit quaternion of the rotation of A onto B is the eigenvector of the largest eigenvalue of N.
+    mmpbsa_t N[4][4] = {
+        {S[0][0]+S[1][1]+S[2][2], S[1][2]-S[2][1], S[2][0]-S[0][2], S[0][1]-S[1][0]},
+        {S[1][2]-S[2][1], S[0][0]-S[1][1]-S[2][2], S[0][1]+S[1][0], S[2][0]+S[0][2]},
+        {S[2][0]-S[0][2], S[0][1]+S[1][0], -S[0][0]+S[1][1]-S[2][2], S[1][2]+S[2][1]},
+        {S[0][1]-S[1][0], S[2][0]+S[0][2], S[1][2]+S[2][1], -S[0][0]-S[1][1]+S[2][2]}
+    };
+    mmpbsa_t q[4];
+    largest_eigenvector(N,q);
+    const mmpbsa_t R[3][3] = {
+        {q[0]*q[0]+q[1]*q[1]-q[2]*q[2]-q[3]*q[3], 2*(q[1]*q[2]-q[0]*q[3]), 2*(q[1]*q[3]+q[0]*q[2])},
+        {2*(q[1]*q[2]+q[0]*q[3]), q[0]*q[0]-q[1]*q[1]+q[2]*q[2]-q[3]*q[3], 2*(q[2]*q[3]-q[0]*q[1])},
+        {2*(q[1]*q[3]-q[0]*q[2]), 2*(q[2]*q[3]+q[0]*q[1]), q[0]*q[0]-q[1]*q[1]-q[2]*q[2]+q[3]*q[3]}
+    };
+
+    //Rotate A onto B, so that R(a - acenter) is compared with b - bcenter.
+    mmpbsa_t msd = 0;
+    for(size_t i = 0;i<num_atoms;i++)
     {
-        returnMe[i] = min_corner[i];
-        returnMe[i+3] = max_corner[i];
+        mmpbsa_t a[3];
+        for(size_t j = 0;j<3;j++)
+            a[j] = acrds[i][j] - acenter[j];
+        for(size_t j = 0;j<3;j++)
+        {
+            mmpbsa_t diff = R[j][0]*a[0] + R[j][1]*a[1] + R[j][2]*a[2] - (bcrds[i][j] - bcenter[j]);
+            msd += diff*diff;
+        }
     }
-    return returnMe;
+    return sqrt(msd/num_atoms);
 }
 
-float mmpbsa_utils::lookup_radius(const std::string& atomName,
-       const std::map<std::string,float>& radiusMap)
+/**
+ * Radius lookup shared by the radius map and the radius hash table.
+ */
+template <class radius_container> static float find_radius(const std::string& atomName,
+       const radius_container& radiusMap)
             throw (mmpbsa::MMPBSAException)
 {
     using std::string;
-    using std::map;
     using mmpbsa_utils::trimString;
 
 
@@ -269,42 +416,44 @@ float mmpbsa_utils::lookup_radius(const std::string& atomName,
         return -1;
 
     //A direct name match is preferred. Otherwise test for untrimmed keys and/or ambiguities.
-    if(radiusMap.find(atomName) != radiusMap.end())
-    {
-    	return radiusMap.find(atomName)->second;
-    }
+    typename radius_container::const_iterator match = radiusMap.find(atomName);
+    if(match != radiusMap.end())
+        return match->second;
 
-    //Not found by atomName. Check atom name only entries
-    std::vector<mmpbsa_t> possibleMatches;
+    //Not found by atomName. Check the trimmed name, which is also a keyed lookup.
     string theAtom = trimString(atomName);
-    for(map<std::string,float>::const_iterator it = radiusMap.begin();it != radiusMap.end();it++)
-    {
-        if(it->first == theAtom)//direct match
-        {
-            possibleMatches.push_back(it->second);
-        }
-    }
-    //see what we found.
-    if(possibleMatches.size() == 0)//see above note on shared radii
-    {
-        float deeperSearch = lookup_radius(theAtom.erase(theAtom.size()-1),radiusMap);
-        if(deeperSearch == -1)
-        {
-            std::ostringstream error;
-            error << "No radius found for '" << atomName << "' in Radii Map";
-            throw mmpbsa::MMPBSAException(error,mmpbsa::DATA_FORMAT_ERROR);
-        }
-        return deeperSearch;
-    }
-    if(possibleMatches.size() > 1)
+    match = radiusMap.find(theAtom);
+    if(match != radiusMap.end())
+        return match->second;
+
+    //see above note on shared radii
+    float deeperSearch = (theAtom.size() > 1) ? find_radius(theAtom.erase(theAtom.size()-1),radiusMap) : -1;
+    if(deeperSearch == -1)
     {
         std::ostringstream error;
-        error << possibleMatches.size() << " matches for '" << atomName << "' in Radii Map";
+        error << "No radius found for '" << atomName << "' in Radii Map";
         throw mmpbsa::MMPBSAException(error,mmpbsa::DATA_FORMAT_ERROR);
     }
-    
-    //iff there is one match.
-    return float(possibleMatches[0]);
+    return deeperSearch;
+}
+
+float mmpbsa_utils::lookup_radius(const std::string& atomName,
+       const std::map<std::string,float>& radiusMap)
+            throw (mmpbsa::MMPBSAException)
+{
+    return find_radius(atomName,radiusMap);
+}
+
+mmpbsa_utils::radius_table_t mmpbsa_utils::make_radius_table(const std::map<std::string,float>& radiusMap)
+{
+    return radius_table_t(radiusMap.begin(),radiusMap.end());
+}
+
+float mmpbsa_utils::lookup_radius(const std::string& atomName,
+       const radius_table_t& radiusTable)
+            throw (mmpbsa::MMPBSAException)
+{
+    return find_radius(atomName,radiusTable);
 }
 
 mmpbsa_t mmpbsa_utils::dihedral_angle(const mmpbsa::Vector& x, const mmpbsa::Vector& y)
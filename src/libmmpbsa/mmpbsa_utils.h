@@ -20,6 +20,11 @@
 #include <map>
 #include <set>
 #include <valarray>
+#ifdef _MSC_VER
+#include <unordered_map>
+#else
+#include <tr1/unordered_map>
+#endif
 
 #include "globals.h"
 #include "mmpbsa_exceptions.h"
@@ -48,12 +53,24 @@ namespace mmpbsa_utils {
      */
     int loadListArg(const std::string& values,std::set<size_t>& array, const size_t& offset);
 
+    /**
+     * Loads a comma separated list of floating point values into the array,
+     * in left to right order. Ranges are not allowed.
+     *
+     * @param values
+     * @param array
+     */
+    int loadListArg(const std::string& values,std::vector<mmpbsa_t>& array);
+
     /**
      * Return center of interaction beetween two atom coordinate sets.
      * It is defined as the center of the union of the atoms of A that
      * are within CUTOFF of any atoms of B with the atoms of B within
      * CUTOFF of A's atoms.
      * 
+     * Atoms are binned into cells, so that only atoms in neighboring cells are
+     * compared. If no atoms interact, all six values are zero.
+     *
      * @param acrds
      * @param bcrds
      * @param cutoff
@@ -65,6 +82,22 @@ namespace mmpbsa_utils {
     mead_data_t * interaction_minmax(const std::valarray<mmpbsa::Vector>& acrds,
                 const std::valarray<mmpbsa::Vector>& bcrds, const mmpbsa_t& cutoff = 4.0);
 
+    /**
+     * Root mean square deviation of two sets of coordinates of the same atoms,
+     * in the same order, after they have been superposed by least squares over
+     * their first num_fit atoms, e.g. to compare ligand poses in the frame of
+     * the receptor.
+     *
+     * The rotation is found by Horn's quaternion method.
+     *
+     * @param acrds
+     * @param bcrds
+     * @param num_fit Number of atoms that are superposed. Zero means all.
+     * @return RMSD over all atoms, in the units of the coordinates
+     */
+    mmpbsa_t superposed_rmsd(const std::valarray<mmpbsa::Vector>& acrds,
+            const std::valarray<mmpbsa::Vector>& bcrds, const size_t& num_fit = 0) throw (mmpbsa::MMPBSAException);
+
     /**
      * Performs a lookup of a radius of the given atom. The lookup is not as
      * simple as using the atom name as the key for the provided map, because
@@ -83,6 +116,26 @@ namespace mmpbsa_utils {
             const std::map<std::string,float>& radiusMap)
             throw (mmpbsa::MMPBSAException);
 
+    /**
+     * Radii keyed by atom name in a hash table, for repeated lookups.
+     *
+     * @see make_radius_table
+     */
+    typedef std::tr1::unordered_map<std::string,float> radius_table_t;
+
+    /**
+     * Copies a radius map into a hash table.
+     */
+    radius_table_t make_radius_table(const std::map<std::string,float>& radiusMap);
+
+    /**
+     * Same as lookup_radius with a radius map, with hashed lookups of each name
+     * that is tried.
+     */
+    float lookup_radius(const std::string& atomName,
+            const radius_table_t& radiusTable)
+            throw (mmpbsa::MMPBSAException);
+
     std::string toUpperCase(const std::string& bean);
     std::string toLowerCase(const std::string& bean);
     /**
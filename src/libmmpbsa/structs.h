@@ -26,6 +26,9 @@ typedef struct {
 	mmpbsa_t charge;
 	size_t atom_type;///<For Lennard Jones Parameters, etc
 	std::set<size_t> exclusion_list;
+	size_t residue;///<Zero-indexed residue of the atom in the whole topology
+	std::string residue_name;
+	std::string type_name;///<Force field atom type, e.g. Amber's CT. Empty if unknown.
 }atom_t;
 
 /**
@@ -114,6 +117,7 @@ typedef struct {
 	//for gromacs trajectories
 	std::string* gromacs_filename;
 	size_t num_gmx_frames;
+	std::vector<std::streampos>* gmx_frame_offsets;///<Stream position of each trr frame
 }trajectory_t;
 
 }//mmpbsa_io namespace
@@ -0,0 +1,161 @@
+/**
+ * Tests of the interaction box of a receptor and a ligand (mmpbsa_utils::interaction_minmax).
+ *
+ * The box is compared with a brute force scan of every pair of atoms on 200 random
+ * receptor/ligand sets. The sets differ in size, spread and cutoff: some are sparse
+ * enough that the cells grow, some do not interact, in which case the box is zero.
+ * Every interacting atom of both molecules must be within the box, including the
+ * ligand atoms that were once skipped by a stride of three atoms.
+ * Returns the number of failed checks.
+ */
+
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "mmpbsa_utils.h"
+#include "Vector.h"
+
+#define NUM_SETS 200
+
+static int failures = 0;
+
+static void check(const bool& passed, const std::string& what)
+{
+	if(!passed)
+	{
+		std::cerr << "FAILED: " << what << std::endl;
+		failures++;
+	}
+}
+
+/**
+ * Linear congruential generator, so that the sets are the same on every platform.
+ */
+static mmpbsa_t next_random(unsigned long& seed)
+{
+	seed = (seed*1103515245UL + 12345UL) & 0x7fffffffUL;
+	return seed/2147483648.0;
+}
+
+static std::valarray<mmpbsa_t> random_crds(const size_t& num_atoms, const mmpbsa_t& offset, const mmpbsa_t& spread, unsigned long& seed)
+{
+	std::valarray<mmpbsa_t> returnMe(3*num_atoms);
+	for(size_t i = 0;i<returnMe.size();i++)
+		returnMe[i] = offset + spread*next_random(seed);
+	return returnMe;
+}
+
+/**
+ * Box spanned by the atoms of A within cutoff of an atom of B and vice versa, from
+ * every pair of atoms, in the order {min,max}. Zero if no atoms interact.
+ */
+static std::vector<mead_data_t> brute_force_minmax(const std::valarray<mmpbsa_t>& acrds,
+		const std::valarray<mmpbsa_t>& bcrds, const mmpbsa_t& cutoff)
+{
+	std::vector<mead_data_t> returnMe(6,0);
+	size_t num_a = acrds.size()/3, num_b = bcrds.size()/3;
+	std::vector<bool> aflags(num_a,false), bflags(num_b,false);
+	for(size_t i = 0;i<num_b;i++)
+		for(size_t k = 0;k<num_a;k++)
+		{
+			mmpbsa_t dx = bcrds[3*i] - acrds[3*k], dy = bcrds[3*i+1] - acrds[3*k+1], dz = bcrds[3*i+2] - acrds[3*k+2];
+			if(dx*dx + dy*dy + dz*dz < cutoff*cutoff)
+				aflags[k] = bflags[i] = true;
+		}
+
+	bool seenFirstInteractor = false;
+	const std::valarray<mmpbsa_t>* crds[2] = {&acrds,&bcrds};
+	const std::vector<bool>* flags[2] = {&aflags,&bflags};
+	for(size_t mol = 0;mol<2;mol++)
+		for(size_t i = 0;i<flags[mol]->size();i++)
+		{
+			if(!(*flags[mol])[i])
+				continue;
+			for(size_t j = 0;j<3;j++)
+			{
+				mmpbsa_t coord = (*crds[mol])[3*i+j];
+				if(!seenFirstInteractor || coord < returnMe[j])
+					returnMe[j] = coord;
+				if(!seenFirstInteractor || coord > returnMe[j+3])
+					returnMe[j+3] = coord;
+			}
+			seenFirstInteractor = true;
+		}
+	return returnMe;
+}
+
+static void test_random_sets()
+{
+	unsigned long seed = 2718;
+	size_t num_interacting = 0;
+	for(size_t set = 0;set<NUM_SETS;set++)
+	{
+		size_t num_receptor = 1 + size_t(80*next_random(seed));
+		size_t num_ligand = 1 + size_t(30*next_random(seed));
+		//Every fourth set is sparse, so that the cells grow beyond the cutoff.
+		mmpbsa_t spread = (set % 4 == 3) ? 200 : 5 + 25*next_random(seed);
+		mmpbsa_t ligand_offset = spread*(next_random(seed) - 0.25);
+		mmpbsa_t cutoff = (set % 2) ? 4.0 : 1 + 6*next_random(seed);
+		std::valarray<mmpbsa_t> receptor = random_crds(num_receptor,0,spread,seed);
+		std::valarray<mmpbsa_t> ligand = random_crds(num_ligand,ligand_offset,0.5*spread,seed);
+
+		mead_data_t* minmax = mmpbsa_utils::interaction_minmax(receptor,ligand,cutoff);
+		std::vector<mead_data_t> expected = brute_force_minmax(receptor,ligand,cutoff);
+		bool same = true, interacting = false;
+		for(size_t j = 0;j<6;j++)
+		{
+			same &= (minmax[j] == expected[j]);
+			interacting |= (expected[j] != 0);
+		}
+		if(interacting)
+			num_interacting++;
+		if(!same)
+		{
+			std::ostringstream what;
+			what << "set " << set << " (" << num_receptor << " receptor and " << num_ligand << " ligand atoms, cutoff "
+					<< cutoff << "): box {" << minmax[0] << "," << minmax[1] << "," << minmax[2] << "," << minmax[3]
+					<< "," << minmax[4] << "," << minmax[5] << "} is the brute force box {" << expected[0] << ","
+					<< expected[1] << "," << expected[2] << "," << expected[3] << "," << expected[4] << ","
+					<< expected[5] << "}";
+			check(false,what.str());
+		}
+		delete [] minmax;
+	}
+	std::ostringstream what;
+	what << num_interacting << " of " << NUM_SETS << " sets interact, which should be most but not all of them";
+	check(num_interacting > NUM_SETS/2 && num_interacting < NUM_SETS,what.str());
+}
+
+/**
+ * The Vector overload flattens its coordinates and must give the same box.
+ */
+static void test_vector_overload()
+{
+	unsigned long seed = 31415;
+	std::valarray<mmpbsa_t> receptor = random_crds(50,0,20,seed);
+	std::valarray<mmpbsa_t> ligand = random_crds(20,5,10,seed);
+	std::valarray<mmpbsa::Vector> receptor_vectors(50), ligand_vectors(20);
+	for(size_t i = 0;i<50;i++)
+		receptor_vectors[i] = mmpbsa::Vector(receptor[3*i],receptor[3*i+1],receptor[3*i+2]);
+	for(size_t i = 0;i<20;i++)
+		ligand_vectors[i] = mmpbsa::Vector(ligand[3*i],ligand[3*i+1],ligand[3*i+2]);
+
+	mead_data_t* minmax = mmpbsa_utils::interaction_minmax(receptor_vectors,ligand_vectors);
+	std::vector<mead_data_t> expected = brute_force_minmax(receptor,ligand,4.0);
+	bool same = true;
+	for(size_t j = 0;j<6;j++)
+		same &= (minmax[j] == expected[j]);
+	check(same && expected[3] > expected[0],"the Vector overload gives the brute force box");
+	delete [] minmax;
+}
+
+int main(int argc, char** argv)
+{
+	test_random_sets();
+	test_vector_overload();
+	if(failures == 0)
+		std::cout << "All interaction_minmax tests passed" << std::endl;
+	return failures;
+}
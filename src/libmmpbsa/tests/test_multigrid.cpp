@@ -0,0 +1,134 @@
+/**
+ * Tests of the multigrid Poisson-Boltzmann solver (PBMultigrid).
+ *
+ *   Born ion: a unit charge of radius 2 Angstroms, on 1, 0.5 and 0.25 Angstrom
+ *             focusing levels, against the analytic solvation energy
+ *             -332.06/(2*2)*(1 - 1/80) = -81.98 kcal/mol.
+ *   Warm start: a solve that starts from the potentials of the previous call
+ *               must give the energy of a solve from zero, in fewer iterations.
+ *
+ * The comparison with MEAD is in test_multigrid_mead.cpp.
+ * Returns the number of failed checks.
+ */
+
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "PBMultigrid.h"
+
+//Amber charge units, i.e. electron charge times sqrt(332.06)
+#define AMBER_UNIT_CHARGE 18.2223
+
+static int failures = 0;
+
+static void check(const bool& passed, const std::string& what)
+{
+	if(!passed)
+	{
+		std::cerr << "FAILED: " << what << std::endl;
+		failures++;
+	}
+}
+
+static mmpbsa::grid_level_t level(const int& dim, const mmpbsa_t& spacing)
+{
+	mmpbsa::grid_level_t returnMe;
+	returnMe.dim = dim;
+	returnMe.spacing = spacing;
+	returnMe.center[0] = returnMe.center[1] = returnMe.center[2] = 0;
+	returnMe.on_interaction = false;
+	return returnMe;
+}
+
+/**
+ * Three atoms with charges -0.5, +1 and -0.5, about 1.5 Angstroms apart.
+ */
+static std::vector<mmpbsa::atom_t> small_molecule(std::valarray<mmpbsa::Vector>& crds)
+{
+	std::vector<mmpbsa::atom_t> atoms(3);
+	mmpbsa_t charges[] = {-0.5,1.0,-0.5};
+	crds.resize(3);
+	for(size_t i = 0;i<3;i++)
+	{
+		atoms[i].name = (i == 1) ? "C" : "O";
+		atoms[i].charge = charges[i]*AMBER_UNIT_CHARGE;
+		crds[i] = mmpbsa::Vector(1.5*i - 1.4,0.3*i,-0.2*i);
+	}
+	return atoms;
+}
+
+static void test_born_ion()
+{
+	std::vector<mmpbsa::atom_t> atoms(1);
+	atoms[0].name = "X";
+	atoms[0].charge = AMBER_UNIT_CHARGE;
+	std::map<std::string,mead_data_t> radii;
+	radii["X"] = 2.0;
+	std::valarray<mmpbsa::Vector> crds(1);
+	crds[0] = mmpbsa::Vector(0.1,0.05,-0.07);
+
+	std::vector<mmpbsa::grid_level_t> levels;
+	levels.push_back(level(41,1.0));
+	levels.push_back(level(41,0.5));
+	levels.push_back(level(161,0.25));
+
+	mmpbsa::PBMultigrid solver(atoms,radii);
+	mmpbsa_t energy = solver.pb_solvation(crds,levels);
+	const mmpbsa_t born = -332.06/(2*2.0)*(1 - 1/80.0);
+	std::ostringstream what;
+	what << "Born ion energy " << energy << " is within 1.5% of " << born;
+	check(fabs(energy - born) < 0.015*fabs(born),what.str());
+}
+
+static void test_warm_start()
+{
+	std::valarray<mmpbsa::Vector> crds;
+	std::vector<mmpbsa::atom_t> atoms = small_molecule(crds);
+	std::map<std::string,mead_data_t> radii;
+	radii["C"] = 1.7;
+	radii["O"] = 1.5;
+
+	std::vector<mmpbsa::grid_level_t> levels;
+	levels.push_back(level(41,1.0));
+	levels.push_back(level(41,0.5));
+
+	mmpbsa::PBMultigrid warm(atoms,radii,0.15);
+	mmpbsa_t first = warm.pb_solvation(crds,levels);
+	size_t cold_iterations = warm.last_iterations;
+
+	//The same snapshot again starts from its own solution.
+	mmpbsa_t again = warm.pb_solvation(crds,levels);
+	check(fabs(again - first) < 1e-4*fabs(first),"warm start of an unchanged snapshot gives its energy");
+	check(warm.last_iterations < cold_iterations,"warm start of an unchanged snapshot takes fewer iterations");
+
+	//A moved snapshot starts from the previous one's solution.
+	std::valarray<mmpbsa::Vector> moved = crds;
+	moved[0] += mmpbsa::Vector(0.1,-0.05,0.0);
+	moved[2] += mmpbsa::Vector(-0.05,0.1,0.05);
+	mmpbsa_t warm_energy = warm.pb_solvation(moved,levels);
+
+	mmpbsa::PBMultigrid cold(atoms,radii,0.15);
+	mmpbsa_t cold_energy = cold.pb_solvation(moved,levels);
+	std::ostringstream what;
+	what << "warm started energy " << warm_energy << " matches cold energy " << cold_energy;
+	check(fabs(warm_energy - cold_energy) < 1e-4*fabs(cold_energy),what.str());
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		test_born_ion();
+		test_warm_start();
+	}
+	catch(const mmpbsa::MMPBSAException& e)
+	{
+		std::cerr << "FAILED: " << e.what() << std::endl;
+		failures++;
+	}
+	if(failures == 0)
+		std::cout << "All multigrid tests passed" << std::endl;
+	return failures;
+}
@@ -0,0 +1,101 @@
+/**
+ * Comparison of the multigrid Poisson-Boltzmann solver (PBMultigrid) with MEAD
+ * (MeadInterface::pb_solvation), which solve the same model on the same focusing
+ * levels.
+ *
+ * The molecule has three atoms with charges -0.5, +1 and -0.5, about 1.5 Angstroms
+ * apart. It is solved on the focusing levels of MeadInterface::grid_levels, with a
+ * 0.5 Angstrom fine spacing, without salt and with 0.15 M salt and an interior
+ * dielectric of 2. The solvers differ in how they discretize the dielectric
+ * boundary, so their energies are compared within 3%.
+ * Returns the number of failed checks.
+ */
+
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "MEAD/FinDiffMethod.h"
+
+#include "MeadInterface.h"
+#include "PBMultigrid.h"
+
+//Amber charge units, i.e. electron charge times sqrt(332.06)
+#define AMBER_UNIT_CHARGE 18.2223
+
+static int failures = 0;
+
+static void check(const bool& passed, const std::string& what)
+{
+	if(!passed)
+	{
+		std::cerr << "FAILED: " << what << std::endl;
+		failures++;
+	}
+}
+
+static mmpbsa::pb_condition_t condition(const mmpbsa_t& istrength, const mmpbsa_t& interior_dielectric)
+{
+	mmpbsa::pb_condition_t returnMe;
+	returnMe.istrength = istrength;
+	returnMe.interior_dielectric = interior_dielectric;
+	return returnMe;
+}
+
+int main(int argc, char** argv)
+{
+	using mmpbsa::MeadInterface;
+	try
+	{
+		std::vector<mmpbsa::atom_t> atoms(3);
+		std::valarray<mmpbsa::Vector> crds(3);
+		mmpbsa_t charges[] = {-0.5,1.0,-0.5};
+		for(size_t i = 0;i<3;i++)
+		{
+			atoms[i].name = (i == 1) ? "C" : "O";
+			atoms[i].charge = charges[i]*AMBER_UNIT_CHARGE;
+			crds[i] = mmpbsa::Vector(1.5*i - 1.4,0.3*i,-0.2*i);
+		}
+		std::map<std::string,mead_data_t> radii;
+		radii["C"] = 1.7;
+		radii["O"] = 1.5;
+
+		//The first two atoms are the receptor and the third the ligand, which places the
+		//finer levels on their interaction region, as for a snapshot.
+		std::valarray<mmpbsa::Vector> receptor = crds[std::slice(0,2,1)];
+		std::valarray<mmpbsa::Vector> ligand = crds[std::slice(2,1,1)];
+		mmpbsa::grid_plan_t plan;
+		MeadInterface::clear_grid_plan(plan);
+		MeadInterface::extend_grid_plan(plan,crds,receptor,ligand);
+		std::vector<mmpbsa::grid_level_t> levels = MeadInterface::grid_levels(plan,41,0.5);
+		std::vector<mmpbsa::pb_condition_t> conditions;
+		conditions.push_back(condition(0.0,1.0));
+		conditions.push_back(condition(0.15,2.0));
+
+		mmpbsa::mead_atom_set_t atom_set = MeadInterface::create_atom_set(atoms,radii);
+		MeadInterface::update_atom_set(atom_set,crds);
+		FinDiffMethod fdm = MeadInterface::createFDM(levels);
+		std::vector<mmpbsa_t> mead = MeadInterface::pb_solvation(*atom_set.atoms,fdm,conditions);
+		MeadInterface::destroy_atom_set(atom_set);
+
+		mmpbsa::PBMultigrid solver(atoms,radii);
+		std::vector<mmpbsa_t> multigrid = solver.pb_solvation(crds,levels,conditions);
+
+		check(mead.size() == conditions.size() && multigrid.size() == conditions.size(),"one energy per condition");
+		for(size_t i = 0;i<mead.size() && i<multigrid.size();i++)
+		{
+			std::ostringstream what;
+			what << "condition " << i << ": multigrid energy " << multigrid[i] << " is within 3% of MEAD energy " << mead[i];
+			check(mead[i] < 0 && fabs(multigrid[i] - mead[i]) < 0.03*fabs(mead[i]),what.str());
+		}
+	}
+	catch(const mmpbsa::MMPBSAException& e)
+	{
+		std::cerr << "FAILED: " << e.what() << std::endl;
+		failures++;
+	}
+	if(failures == 0)
+		std::cout << "Multigrid matches MEAD" << std::endl;
+	return failures;
+}
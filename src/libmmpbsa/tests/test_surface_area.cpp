@@ -0,0 +1,333 @@
+/**
+ * Tests of the surface area engines (SurfaceArea).
+ *
+ *   Interface recalculation: a 300 atom receptor and a 30 atom ligand, placed at
+ *                            random so that the ligand overlaps one side of the
+ *                            receptor. The atom areas of the complex, obtained by
+ *                            recalculating only the interface atoms (interface_atoms)
+ *                            from the atom areas of the separated molecules, must
+ *                            equal those of a full calculation of the complex, with
+ *                            Shrake-Rupley and with LCPO.
+ *   molsurf comparison: the Shrake-Rupley area of the 400 atom cluster of the molsurf
+ *                       tests (../molsurf/tests/atoms400.xyzr) at the default number
+ *                       of points, 960, must be within 0.1% of the molsurf area,
+ *                       2132.000138. It was -0.05% when Shrake-Rupley was added,
+ *                       while 240 points gave +0.13% and 60 points -1.7%.
+ *   LCPO parameters: lcpo_parameters of a small molecule, whose atoms are
+ *                    identified by Amber and GAFF atom types or, without a type,
+ *                    by their atomic number, and whose parameters depend on the
+ *                    number of bonded heavy atoms.
+ *
+ * Fixtures are read relative to $srcdir, as set by "make check", or the current directory.
+ * Returns the number of failed checks.
+ */
+
+#include <cstdlib>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "molsurf/molsurf.h"
+
+#include "SurfaceArea.h"
+
+#define RECEPTOR_ATOMS 300
+#define LIGAND_ATOMS 30
+#define DEFAULT_SA_POINTS 960//MeadInterface::sa_points
+
+static int failures = 0;
+
+static void check(const bool& passed, const std::string& what)
+{
+	if(!passed)
+	{
+		std::cerr << "FAILED: " << what << std::endl;
+		failures++;
+	}
+}
+
+static bool close(const mmpbsa_t& a, const mmpbsa_t& b)
+{
+	return fabs(a - b) <= 1e-6*fabs(b);
+}
+
+static std::string fixture(const std::string& name)
+{
+	const char* srcdir = getenv("srcdir");
+	return std::string((srcdir != 0) ? srcdir : ".") + "/" + name;
+}
+
+/**
+ * Linear congruential generator, so that the molecules are the same on every platform.
+ */
+static mmpbsa_t next_random(unsigned long& seed)
+{
+	seed = (seed*1103515245UL + 12345UL) & 0x7fffffffUL;
+	return seed/2147483648.0;
+}
+
+/**
+ * Complex of a receptor, in an 18 Angstrom cube, and a ligand, in an 8 Angstrom
+ * cube that straddles one face of the receptor's. The receptor atoms come first.
+ * Radii are between 1.5 and 2 Angstroms.
+ */
+static void make_complex(std::valarray<mmpbsa::Vector>& crds, std::vector<mmpbsa_t>& radii, std::vector<bool>& in_ligand)
+{
+	unsigned long seed = 4321;
+	size_t num_atoms = RECEPTOR_ATOMS + LIGAND_ATOMS;
+	crds.resize(num_atoms);
+	radii.resize(num_atoms);
+	in_ligand.resize(num_atoms);
+	for(size_t i = 0;i<num_atoms;i++)
+	{
+		in_ligand[i] = (i >= RECEPTOR_ATOMS);
+		mmpbsa_t x = next_random(seed), y = next_random(seed), z = next_random(seed);
+		if(in_ligand[i])
+			crds[i] = mmpbsa::Vector(14 + 8*x,5 + 8*y,5 + 8*z);
+		else
+			crds[i] = mmpbsa::Vector(18*x,18*y,18*z);
+		radii[i] = 1.5 + 0.5*next_random(seed);
+	}
+}
+
+/**
+ * Splits the complex coordinates (or any per atom values) into those of the
+ * receptor and of the ligand.
+ */
+template <class T> static void split(const std::valarray<T>& complex, std::valarray<T>& receptor, std::valarray<T>& ligand)
+{
+	receptor.resize(RECEPTOR_ATOMS);
+	ligand.resize(LIGAND_ATOMS);
+	for(size_t i = 0;i<RECEPTOR_ATOMS;i++)
+		receptor[i] = complex[i];
+	for(size_t i = 0;i<LIGAND_ATOMS;i++)
+		ligand[i] = complex[RECEPTOR_ATOMS + i];
+}
+
+template <class T> static void split(const std::vector<T>& complex, std::vector<T>& receptor, std::vector<T>& ligand)
+{
+	receptor.assign(complex.begin(),complex.begin() + RECEPTOR_ATOMS);
+	ligand.assign(complex.begin() + RECEPTOR_ATOMS,complex.end());
+}
+
+/**
+ * Atom areas of the complex before the interface atoms are recalculated, i.e.
+ * those of the separated receptor and ligand.
+ */
+static std::vector<mmpbsa_t> join(const std::vector<mmpbsa_t>& receptor, const std::vector<mmpbsa_t>& ligand)
+{
+	std::vector<mmpbsa_t> returnMe(receptor);
+	returnMe.insert(returnMe.end(),ligand.begin(),ligand.end());
+	return returnMe;
+}
+
+/**
+ * Compares the atom areas and total area of the interface recalculation with
+ * those of the full calculation.
+ */
+static void compare(const std::string& engine, const std::vector<size_t>& selection,
+		const std::vector<mmpbsa_t>& interface_areas, const mmpbsa_t& interface_area,
+		const std::vector<mmpbsa_t>& full_areas, const mmpbsa_t& full_area)
+{
+	size_t num_atoms = RECEPTOR_ATOMS + LIGAND_ATOMS;
+	std::ostringstream what;
+	what << engine << ": " << selection.size() << " interface atoms";
+	check(selection.size() > 0 && selection.size() < num_atoms/2,what.str());
+
+	check(interface_areas.size() == num_atoms && full_areas.size() == num_atoms,engine + ": one area per atom");
+	size_t mismatches = 0;
+	for(size_t i = 0;i<interface_areas.size() && i<full_areas.size();i++)
+		if(fabs(interface_areas[i] - full_areas[i]) > 1e-9*(1 + fabs(full_areas[i])))
+			mismatches++;
+	what.str("");
+	what << engine << ": " << mismatches << " atom areas differ from the full calculation";
+	check(mismatches == 0,what.str());
+
+	what.str("");
+	what << engine << ": interface area " << interface_area << " equals the full area " << full_area;
+	check(fabs(interface_area - full_area) < 1e-9*full_area,what.str());
+}
+
+static void test_shrake_rupley_interface()
+{
+	std::valarray<mmpbsa::Vector> crds, receptor_crds, ligand_crds;
+	std::vector<mmpbsa_t> radii, receptor_radii, ligand_radii;
+	std::vector<bool> in_ligand;
+	make_complex(crds,radii,in_ligand);
+	for(size_t i = 0;i<radii.size();i++)
+		radii[i] += MMPBSA_LCPO_PROBE;
+	split(crds,receptor_crds,ligand_crds);
+	split(radii,receptor_radii,ligand_radii);
+
+	std::vector<mmpbsa_t> full_areas, receptor_areas, ligand_areas;
+	mmpbsa_t full_area = mmpbsa::shrake_rupley_area(crds,radii,240,1,&full_areas);
+	mmpbsa::shrake_rupley_area(receptor_crds,receptor_radii,240,1,&receptor_areas);
+	mmpbsa::shrake_rupley_area(ligand_crds,ligand_radii,240,1,&ligand_areas);
+
+	std::vector<mmpbsa_t> interface_areas = join(receptor_areas,ligand_areas);
+	std::vector<size_t> selection = mmpbsa::interface_atoms(crds,radii,in_ligand);
+	mmpbsa_t interface_area = mmpbsa::shrake_rupley_area(crds,radii,240,1,&interface_areas,&selection);
+	compare("Shrake-Rupley",selection,interface_areas,interface_area,full_areas,full_area);
+}
+
+static void test_lcpo_interface()
+{
+	std::valarray<mmpbsa::Vector> crds, receptor_crds, ligand_crds;
+	std::vector<mmpbsa_t> radii;
+	std::vector<bool> in_ligand;
+	make_complex(crds,radii,in_ligand);
+	split(crds,receptor_crds,ligand_crds);
+
+	//sp3 carbon parameters, with the radii of the complex
+	std::vector<mmpbsa::lcpo_params_t> params(radii.size()), receptor_params, ligand_params;
+	for(size_t i = 0;i<radii.size();i++)
+	{
+		params[i].radius = radii[i];
+		params[i].p1 = 0.77887;
+		params[i].p2 = -0.28063;
+		params[i].p3 = -0.0012968;
+		params[i].p4 = 0.00039328;
+		radii[i] += MMPBSA_LCPO_PROBE;
+	}
+	split(params,receptor_params,ligand_params);
+
+	std::vector<mmpbsa_t> full_areas, receptor_areas, ligand_areas;
+	mmpbsa_t full_area = mmpbsa::lcpo_area(crds,params,&full_areas);
+	mmpbsa::lcpo_area(receptor_crds,receptor_params,&receptor_areas);
+	mmpbsa::lcpo_area(ligand_crds,ligand_params,&ligand_areas);
+
+	std::vector<mmpbsa_t> interface_areas = join(receptor_areas,ligand_areas);
+	std::vector<size_t> selection = mmpbsa::interface_atoms(crds,radii,in_ligand);
+	mmpbsa_t interface_area = mmpbsa::lcpo_area(crds,params,&interface_areas,&selection);
+	compare("LCPO",selection,interface_areas,interface_area,full_areas,full_area);
+}
+
+static void test_molsurf_comparison()
+{
+	std::fstream xyzrFile(fixture("../molsurf/tests/atoms400.xyzr").c_str(),std::ios::in);
+	check(xyzrFile.good(),"open ../molsurf/tests/atoms400.xyzr");
+	std::vector<mmpbsa::Vector> positions;
+	std::vector<mmpbsa_t> radii;
+	mmpbsa_t x,y,z,radius;
+	while(xyzrFile >> x >> y >> z >> radius)
+	{
+		positions.push_back(mmpbsa::Vector(x,y,z));
+		radii.push_back(radius + MMPBSA_LCPO_PROBE);
+	}
+	check(positions.size() == 400,"read the 400 atoms of atoms400.xyzr");
+	if(positions.size() != 400)
+		return;
+
+	std::vector<REAL_T> xs(400),ys(400),zs(400);
+	std::valarray<mmpbsa::Vector> crds(400);
+	for(size_t i = 0;i<400;i++)
+	{
+		crds[i] = positions[i];
+		xs[i] = positions[i].x();
+		ys[i] = positions[i].y();
+		zs[i] = positions[i].z();
+	}
+	REAL_T molsurf_area = 0;
+	int retval = molsurf_calc(&xs[0],&ys[0],&zs[0],&radii[0],400,0,NULL,&molsurf_area);
+	check(retval == MOLSURF_OK && fabs(molsurf_area - 2132.000138) < 1e-5,"molsurf area of atoms400.xyzr");
+
+	mmpbsa_t area = mmpbsa::shrake_rupley_area(crds,radii,DEFAULT_SA_POINTS);
+	std::ostringstream what;
+	what << "Shrake-Rupley area " << area << " at " << DEFAULT_SA_POINTS
+			<< " points is within 0.1% of the molsurf area " << molsurf_area;
+	check(fabs(area - molsurf_area) < 1e-3*molsurf_area,what.str());
+}
+
+static mmpbsa::atom_t lcpo_atom(const std::string& type_name, const int& atomic_number = 0)
+{
+	mmpbsa::atom_t returnMe;
+	returnMe.type_name = type_name;
+	returnMe.atomic_number = atomic_number;
+	return returnMe;
+}
+
+static void add_bond(std::vector<mmpbsa::bond_t>& bonds, const size_t& atom_i, const size_t& atom_j)
+{
+	mmpbsa::bond_t bond;
+	bond.atom_i = atom_i;
+	bond.atom_j = atom_j;
+	bond.bond_energy = 0;
+	bonds.push_back(bond);
+}
+
+static void check_lcpo(const std::vector<mmpbsa::lcpo_params_t>& params, const size_t& atom,
+		const mmpbsa_t& radius, const mmpbsa_t& p1, const mmpbsa_t& p4, const std::string& what)
+{
+	if(atom >= params.size())
+		return;
+	check(params[atom].radius == radius && close(params[atom].p1,p1) && close(params[atom].p4,p4),what);
+}
+
+static void test_lcpo_parameters()
+{
+	//Atoms have no atomic number unless noted, so elements come from the types.
+	std::vector<mmpbsa::atom_t> atoms;
+	atoms.push_back(lcpo_atom("CT"));//0: methyl
+	atoms.push_back(lcpo_atom("CT"));//1: methylene
+	atoms.push_back(lcpo_atom("c3"));//2: GAFF methine
+	atoms.push_back(lcpo_atom("C"));//3: carboxyl carbon
+	atoms.push_back(lcpo_atom("O"));//4: carbonyl oxygen
+	atoms.push_back(lcpo_atom("OH"));//5: hydroxyl oxygen
+	atoms.push_back(lcpo_atom("N3"));//6: secondary amine
+	atoms.push_back(lcpo_atom("",7));//7: untyped nitrogen
+	atoms.push_back(lcpo_atom("HC"));//8 to 10: hydrogens of the methyl
+	atoms.push_back(lcpo_atom("HC"));
+	atoms.push_back(lcpo_atom("HC"));
+	atoms.push_back(lcpo_atom("HO"));//11
+	atoms.push_back(lcpo_atom("H"));//12
+	atoms.push_back(lcpo_atom("ZN",30));//13: an ion, with Amber's default parameters
+
+	mmpbsa::forcefield_t ff;
+	add_bond(ff.bonds_without_H,0,1);
+	add_bond(ff.bonds_without_H,1,2);
+	add_bond(ff.bonds_without_H,2,3);
+	add_bond(ff.bonds_without_H,2,6);
+	add_bond(ff.bonds_without_H,3,4);
+	add_bond(ff.bonds_without_H,3,5);
+	add_bond(ff.bonds_without_H,6,7);
+	add_bond(ff.bonds_with_H,0,8);
+	add_bond(ff.bonds_with_H,9,0);
+	add_bond(ff.bonds_with_H,0,10);
+	add_bond(ff.bonds_with_H,5,11);
+	add_bond(ff.bonds_with_H,6,12);
+
+	std::vector<mmpbsa::lcpo_params_t> params = mmpbsa::lcpo_parameters(atoms,ff);
+	check(params.size() == atoms.size(),"one set of LCPO parameters per atom");
+	check_lcpo(params,0,1.70,0.77887,0.00039328,"sp3 carbon with one heavy atom; hydrogens are not counted");
+	check_lcpo(params,1,1.70,0.56482,0.0002658,"sp3 carbon with two heavy atoms");
+	check_lcpo(params,2,1.70,0.23348,0.00007967,"lower case GAFF sp3 carbon with three heavy atoms");
+	check_lcpo(params,3,1.70,0.070344,0.000016875,"sp2 carbon with three heavy atoms");
+	check_lcpo(params,4,1.60,0.68563,0.00023743,"carbonyl oxygen");
+	check_lcpo(params,5,1.60,0.77914,0.00035071,"hydroxyl oxygen with one heavy atom");
+	check_lcpo(params,6,1.65,0.22599,0.000080038,"sp3 nitrogen with two heavy atoms");
+	check_lcpo(params,7,1.65,0.73511,0.0002523,"untyped nitrogen, from its atomic number, with one heavy atom");
+	for(size_t i = 8;i<13 && i<params.size();i++)
+		check(params[i].radius == 0 && params[i].p1 == 0,"hydrogens have no area of their own");
+	check_lcpo(params,13,1.70,0.51245,0.00016392,"other elements have Amber's default parameters");
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		test_shrake_rupley_interface();
+		test_lcpo_interface();
+		test_molsurf_comparison();
+		test_lcpo_parameters();
+	}
+	catch(const mmpbsa::MMPBSAException& e)
+	{
+		std::cerr << "FAILED: " << e.what() << std::endl;
+		failures++;
+	}
+	if(failures == 0)
+		std::cout << "All surface area tests passed" << std::endl;
+	return failures;
+}
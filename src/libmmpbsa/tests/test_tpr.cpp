@@ -0,0 +1,205 @@
+/**
+ * Tests of the native Gromacs run input reader (TprReader).
+ *
+ * fixture.tpr is a single precision, tpx version 73 (Gromacs 4.5) file, which
+ * ends after the molecule blocks, as the reader does. It has two atom types and
+ * three molecule types:
+ *   REC: atoms N, CA, C, O (charges -0.3, 0.1, 0.25, -0.05; types 0, 1, 1, 0) in
+ *        residues ALA and GLY, with three bonds, two angles, a proper dihedral
+ *        (180 degrees, 4.6 kJ/mol, multiplicity 3), an improper dihedral and a
+ *        1-4 pair between N and O.
+ *   LIG: atoms C1, O1 (charges 0.4, -0.4; types 1, 0) with one bond.
+ *   SOL: a water, with settles.
+ * The molecule blocks are one REC, two LIG and two SOL, i.e. 14 atoms.
+ *
+ * Fixtures are read from $srcdir/tests, as set by "make check", or ./tests.
+ * Returns the number of failed checks.
+ */
+
+#include <cstdlib>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+
+#include "TprReader.h"
+
+static int failures = 0;
+
+static void check(const bool& passed, const std::string& what)
+{
+	if(!passed)
+	{
+		std::cerr << "FAILED: " << what << std::endl;
+		failures++;
+	}
+}
+
+static bool close(const mmpbsa_t& a, const mmpbsa_t& b)
+{
+	return fabs(a - b) <= 1e-5*fabs(b);
+}
+
+static std::string fixture(const std::string& name)
+{
+	const char* srcdir = getenv("srcdir");
+	return std::string((srcdir != 0) ? srcdir : ".") + "/tests/" + name;
+}
+
+static void test_topology()
+{
+	using namespace mmpbsa_io;
+	tpr_header_t header;
+	tpr_topology_t top;
+	read_tpr(fixture("fixture.tpr"),header,top);
+	check(header.version == MMPBSA_TPX_VERSION && header.real_size == sizeof(float),"header version and precision");
+	check(header.natoms == 14 && top.natoms == 14,"number of atoms");
+	check(top.atnr == 2 && top.functypes.size() == 11,"number of atom types and parameter sets");
+	check(top.moltypes.size() == 3 && top.moltypes[0].name == "REC" && top.moltypes[2].name == "SOL","molecule types");
+	check(top.molblocks.size() == 3 && top.molblocks[1].nmol == 2,"molecule blocks");
+	if(top.moltypes.size() != 3)
+		return;
+	const tpr_moltype_t& rec = top.moltypes[0];
+	check(rec.atoms.size() == 4 && rec.atom_names[1] == "CA" && rec.atom_types[1] == "CT","REC atoms");
+	check(rec.residue_names.size() == 2 && rec.atoms[2].resind == 1,"REC residues");
+	check(rec.ilists[TPR_BONDS].size() == 9 && rec.ilists[TPR_LJ14].size() == 3,"REC interaction lists");
+	check(rec.excl_index.size() == 5 && rec.excl_index[4] == 16,"REC exclusions");
+}
+
+static void test_forcefield()
+{
+	using mmpbsa::MMPBSAState;
+	mmpbsa::forcefield_t* ff = 0;
+	std::vector<mmpbsa::atom_t>* atoms = 0;
+	std::valarray<MMPBSAState::MOLECULE> mol_list;
+	mmpbsa_io::get_tpr_forcefield(fixture("fixture.tpr"),&ff,&atoms,mol_list);
+	static const mmpbsa_t charge_units = 18.2182634799;
+	static const mmpbsa_t joules2cal = 0.23889;
+
+	const std::vector<mmpbsa::atom_t>& complex = atoms[MMPBSAState::COMPLEX];
+	const std::vector<mmpbsa::atom_t>& ligand = atoms[MMPBSAState::LIGAND];
+	check(complex.size() == 8 && atoms[MMPBSAState::RECEPTOR].size() == 4 && ligand.size() == 4,"solvent is skipped and the ligand has both LIG molecules");
+	check(mol_list.size() == 8 && mol_list[3] == MMPBSAState::RECEPTOR && mol_list[4] == MMPBSAState::LIGAND,"molecule list");
+	if(complex.size() != 8 || ligand.size() != 4)
+		return;
+
+	//charges, atom types and residues
+	check(close(complex[0].charge,-0.3*charge_units) && close(complex[6].charge,0.4*charge_units),"charges");
+	check(complex[1].atom_type == 1 && complex[3].atom_type == 0 && complex[7].atom_type == 0,"atom types");
+	check(complex[1].name == "CA" && complex[1].type_name == "CT" && complex[6].name == "C1","atom names");
+	check(complex[2].residue == 1 && complex[2].residue_name == "GLY" && complex[6].residue == 3,"residues");
+
+	//LJ matrix, shared by all molecules
+	const std::vector<mmpbsa::lj_params_t>& lj = ff[MMPBSAState::COMPLEX].lj_params;
+	check(lj.size() == 4 && ff[MMPBSAState::LIGAND].lj_params.size() == 4,"LJ matrix size");
+	if(lj.size() == 4)
+		check(close(lj[3].c6,4e-3*1e6*joules2cal) && close(lj[1].c12,3e-6*1e12*joules2cal),"LJ parameters");
+
+	//bonded terms
+	const mmpbsa::forcefield_t& cff = ff[MMPBSAState::COMPLEX];
+	check(cff.bonds_with_H.size() == 5 && cff.angles_with_H.size() == 2 && cff.dihedrals_with_H.size() == 3,"complex bonded terms");
+	if(cff.bonds_with_H.size() == 5)
+	{
+		check(cff.bonds_with_H[4].atom_i == 6 && cff.bonds_with_H[4].atom_j == 7,"bond of the second ligand is offset in the complex");
+		check(close(cff.bonds_with_H[0].bond_energy->energy_const,0.5*250000*joules2cal*0.01)
+				&& close(cff.bonds_with_H[0].bond_energy->eq_distance,1.5),"bond parameters");
+		check(close(cff.bonds_with_H[4].bond_energy->eq_distance,1.0),"ligand bond parameters");
+	}
+	const mmpbsa::forcefield_t& lff = ff[MMPBSAState::LIGAND];
+	check(lff.bonds_with_H.size() == 2 && lff.bonds_with_H[1].atom_i == 2 && lff.bonds_with_H[1].atom_j == 3,"bond of the second ligand is offset in the ligand");
+	if(cff.angles_with_H.size() == 2)
+		check(close(cff.angles_with_H[0].angle_energy->eq_distance,109.5*MMPBSA_DEG_TO_RAD)
+				&& close(cff.angles_with_H[0].angle_energy->energy_const,0.5*400*joules2cal),"angle parameters");
+	size_t num_dihedrals = 0, num_pairs = 0;
+	for(size_t i = 0;i<cff.dihedrals_with_H.size();i++)
+	{
+		const mmpbsa::dihedral_t& dihedral = cff.dihedrals_with_H[i];
+		if(dihedral.dihedral_energy == 0)
+		{
+			num_pairs++;
+			check(dihedral.atom_i == 0 && dihedral.atom_l == 3 && close(dihedral.lj.c6,5e-4*1e6*joules2cal),"1-4 pair");
+		}
+		else if(dihedral.atom_i == 0)
+		{
+			num_dihedrals++;
+			check(dihedral.dihedral_energy->periodicity == 3 && close(dihedral.dihedral_energy->phase,M_PI)
+					&& close(dihedral.dihedral_energy->energy_const,4.6*joules2cal),"proper dihedral parameters");
+		}
+		else
+		{
+			num_dihedrals++;
+			check(dihedral.atom_i == 3 && dihedral.dihedral_energy->periodicity == 2,"improper dihedral");
+		}
+	}
+	check(num_dihedrals == 2 && num_pairs == 1,"dihedrals and 1-4 pairs");
+
+	//exclusions, including the atom itself as Gromacs lists them
+	check(complex[0].exclusion_list.size() == 4 && complex[0].exclusion_list.count(3),"receptor exclusions");
+	check(complex[6].exclusion_list.size() == 2 && complex[6].exclusion_list.count(7) && !complex[6].exclusion_list.count(1),"complex exclusions are offset");
+	check(ligand[2].exclusion_list.size() == 2 && ligand[2].exclusion_list.count(3),"ligand exclusions are offset");
+
+	for(size_t i = 0;i<MMPBSAState::END_OF_MOLECULES;i++)
+		destroy(&ff[i]);
+	delete [] ff;
+	delete [] atoms;
+}
+
+/**
+ * Run input files of other tpx versions have a different layout and must be rejected.
+ */
+static void test_version_check()
+{
+	std::fstream tprFile(fixture("fixture.tpr").c_str(),std::ios::in | std::ios::binary);
+	std::string data((std::istreambuf_iterator<char>(tprFile)),std::istreambuf_iterator<char>());
+	check(data.size() > 32,"read fixture.tpr");
+	if(data.size() <= 32)
+		return;
+
+	//The version follows the 24 byte "VERSION 4.5.3" string and the precision.
+	data[31] = 58;//Gromacs 4.0
+	std::istringstream old_file(data,std::ios::in | std::ios::binary);
+	mmpbsa_io::tpr_header_t header;
+	bool rejected = false;
+	try
+	{
+		mmpbsa_io::read_tpr_header(old_file,header);
+	}
+	catch(const mmpbsa::MMPBSAException& e)
+	{
+		rejected = (e.getErrType() == mmpbsa::DATA_FORMAT_ERROR);
+	}
+	check(rejected,"tpx version 58 is rejected");
+
+	data[8] = 'X';//not a run input file
+	std::istringstream not_tpr(data,std::ios::in | std::ios::binary);
+	rejected = false;
+	try
+	{
+		mmpbsa_io::read_tpr_header(not_tpr,header);
+	}
+	catch(const mmpbsa::MMPBSAException& e)
+	{
+		rejected = true;
+	}
+	check(rejected,"a file without the VERSION tag is rejected");
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		test_topology();
+		test_forcefield();
+		test_version_check();
+	}
+	catch(const mmpbsa::MMPBSAException& e)
+	{
+		std::cerr << "FAILED: " << e.what() << std::endl;
+		failures++;
+	}
+	if(failures == 0)
+		std::cout << "All tpr tests passed" << std::endl;
+	return failures;
+}
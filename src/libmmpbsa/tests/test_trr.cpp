@@ -0,0 +1,157 @@
+/**
+ * Tests of the native Gromacs trajectory reader (TrrReader) and of how
+ * .trr trajectories are read through mmpbsa_io.
+ *
+ * The fixtures hold three atoms. Atom i of frame k (zero-indexed) is at
+ * (0.1i + 0.5k, 0.2i - 0.25k, 0.3i + 0.125k) nm.
+ *   single.trr: three single precision frames. The first has a box, the
+ *               second velocities and no box, and the third a box, forces and
+ *               8 and 12 byte ir and e blocks before the box.
+ *   double.trr: two double precision frames, with boxes. The second also has
+ *               velocities.
+ *
+ * Fixtures are read from $srcdir/tests, as set by "make check", or ./tests.
+ * Returns the number of failed checks.
+ */
+
+#include <cstdlib>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "TrrReader.h"
+#include "mmpbsa_io.h"
+
+static int failures = 0;
+
+static void check(const bool& passed, const std::string& what)
+{
+	if(!passed)
+	{
+		std::cerr << "FAILED: " << what << std::endl;
+		failures++;
+	}
+}
+
+static std::string fixture(const std::string& name)
+{
+	const char* srcdir = getenv("srcdir");
+	return std::string((srcdir != 0) ? srcdir : ".") + "/tests/" + name;
+}
+
+static bool frame_matches(const std::valarray<mmpbsa::Vector>& crds, const size_t& frame)
+{
+	if(crds.size() != 3)
+		return false;
+	for(size_t i = 0;i<3;i++)
+	{
+		mmpbsa_t expected[3] = {10*(0.1*i + 0.5*frame), 10*(0.2*i - 0.25*frame), 10*(0.3*i + 0.125*frame)};
+		for(size_t j = 0;j<3;j++)
+			if(fabs(crds[i][j] - expected[j]) > 1e-4)
+				return false;
+	}
+	return true;
+}
+
+static void test_frames(const std::string& name, const size_t& num_frames, const size_t& real_size)
+{
+	std::fstream trrFile(fixture(name).c_str(),std::ios::in | std::ios::binary);
+	check(trrFile.good(),"open " + name);
+
+	std::valarray<mmpbsa::Vector> crds;
+	mmpbsa_io::trr_header_t header;
+	for(size_t frame = 0;frame<num_frames;frame++)
+	{
+		std::ostringstream what;
+		what << name << " frame " << frame;
+		check(mmpbsa_io::read_trr_frame(trrFile,crds,&header),"read " + what.str());
+		check(header.real_size == real_size,"precision of " + what.str());
+		check(header.step == int(10*frame),"step of " + what.str());
+		check(frame_matches(crds,frame),"coordinates of " + what.str());
+	}
+	check(!mmpbsa_io::read_trr_frame(trrFile,crds),name + " ends after its last frame");
+
+	trrFile.clear();
+	trrFile.seekg(0,std::ios::beg);
+	std::vector<std::streampos> offsets;
+	check(mmpbsa_io::index_trr_frames(trrFile,offsets) == num_frames,"index " + name);
+	if(offsets.size() == num_frames)
+	{
+		mmpbsa_io::load_trr_frame(fixture(name),offsets.back(),crds);
+		check(frame_matches(crds,num_frames - 1),"load last frame of " + name + " by offset");
+	}
+}
+
+static void test_trajectory(const std::string& name, const size_t& num_frames)
+{
+	mmpbsa_io::trajectory_t traj = mmpbsa_io::open_trajectory(fixture(name));
+	std::valarray<mmpbsa::Vector> crds;
+	check(traj.num_gmx_frames == num_frames,"number of frames of " + name);
+	check(traj.curr_snap == 1,name + " starts at snapshot 1");
+
+	//eof is only reached once every frame has been read.
+	for(size_t frame = 0;frame<num_frames;frame++)
+	{
+		std::ostringstream what;
+		what << name << " snapshot " << frame + 1;
+		check(!mmpbsa_io::eof(traj),"not eof before " + what.str());
+		check(mmpbsa_io::get_next_snap(traj,crds),"get " + what.str());
+		check(frame_matches(crds,frame),"coordinates of " + what.str());
+	}
+	check(mmpbsa_io::eof(traj),"eof after the last snapshot of " + name);
+
+	bool threw_eof = false;
+	try
+	{
+		mmpbsa_io::get_next_snap(traj,crds);
+	}
+	catch(const mmpbsa::MMPBSAException& e)
+	{
+		threw_eof = (e.getErrType() == mmpbsa::UNEXPECTED_EOF);
+	}
+	check(threw_eof,"reading past the end of " + name + " is UNEXPECTED_EOF");
+
+	//Seeking is one-indexed.
+	mmpbsa_io::seek(traj,2);
+	check(!mmpbsa_io::eof(traj),"not eof after seeking to snapshot 2 of " + name);
+	check(mmpbsa_io::get_next_snap(traj,crds) && frame_matches(crds,1),"seek to snapshot 2 of " + name);
+	mmpbsa_io::destroy_trajectory(traj);
+}
+
+static void test_not_trr()
+{
+	std::istringstream garbage(std::string("\x00\x00\x07\xca not a trr frame",20));
+	mmpbsa_io::trr_header_t header;
+	bool threw = false;
+	try
+	{
+		mmpbsa_io::read_trr_header(garbage,header);
+	}
+	catch(const mmpbsa::MMPBSAException& e)
+	{
+		threw = (e.getErrType() == mmpbsa::BROKEN_TRAJECTORY_FILE);
+	}
+	check(threw,"a bad magic number is BROKEN_TRAJECTORY_FILE");
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		test_frames("single.trr",3,sizeof(float));
+		test_frames("double.trr",2,sizeof(double));
+		test_trajectory("single.trr",3);
+		test_trajectory("double.trr",2);
+		test_not_trr();
+	}
+	catch(const mmpbsa::MMPBSAException& e)
+	{
+		std::cerr << "FAILED: " << e.what() << std::endl;
+		failures++;
+	}
+	if(failures == 0)
+		std::cout << "All trr tests passed" << std::endl;
+	return failures;
+}
@@ -16,7 +16,6 @@ int main(int argc, char** argv)
 #endif
 
 #ifdef USE_MPI
-  std::string mmpbsa_output_filename;
   mmpbsa_utils::mpi_init_hosts(&argc,&argv,mpi_rank,mpi_size);
   if(mpi_rank == 0)
     data_list = new mmpbsa_utils::XMLNode(MMPBSA_XML_TITLE);
@@ -53,63 +52,33 @@ int main(int argc, char** argv)
         }
       else
         {
-	  int queuePosition= 0;
-	  for(std::vector<MMPBSAState>::iterator job = processQueue.begin();
-	      job != processQueue.end();job++,queuePosition++)
-            {
-	      switch(job->currentProcess)
-                {
-		case MMPBSAState::SANDER:
-		  restart_sander(*job,job->currentSI);
-		  if(job->placeInQueue > queuePosition)
-		    {
-		      queuePosition++;
-		      continue;
-		    }
-		  else if(job->placeInQueue < queuePosition)
-		    {
-		      job->currentSI.completed = false;
-		      job->fractionDone = 0;
-		      job->placeInQueue = queuePosition;
-		    }
-		  retval = sander_run(*job,job->currentSI);
-		  break;
-		case MMPBSAState::MOLSURF:
-		  if(job->placeInQueue > queuePosition)
-		    {
-		      queuePosition++;
-		      continue;
-		    }
-		  else if(job->placeInQueue < queuePosition)
-		    {
-		      job->placeInQueue = queuePosition;
-		    }
-		  molsurf_run(*job);
-		  break;
-		case MMPBSAState::MMPBSA:
-		  restart_mmpbsa(*job);
-		  if(job->placeInQueue > queuePosition)
-		    {
-		      queuePosition++;
-		      continue;
-		    }
-		  else if(job->placeInQueue < queuePosition)
-		    {
-		      job->fractionDone = 0;
-		      job->placeInQueue = queuePosition;
-		    }
-		  retval = mmpbsa_run(*job,job->currentMI);
-#ifdef USE_MPI
-		  if(has_filename(MMPBSA_OUT_TYPE,*job))
-		    mmpbsa_output_filename = get_filename(MMPBSA_OUT_TYPE,*job);
-		  else if(has_filename(SANDER_MDOUT_TYPE,*job))
-		    mmpbsa_output_filename = get_filename(SANDER_MDOUT_TYPE,*job);
+	  //Jobs that share a topology read it once.
+	  cache_shared_topologies(processQueue);
+	  int queue_jobs = get_queue_jobs(argc,argv);
+	  size_t queue_memory = get_queue_memory(argc,argv);
+	  bool has_prereqs = false;
+	  for(size_t i = 0;i<processQueue.size();i++)
+	    has_prereqs |= (processQueue[i].prereqs.size() > 0);
+#ifdef USE_SNAPSHOT_PROCESSES
+	  if((queue_jobs > 1 || has_prereqs) && processQueue.size() > 1)
+	    retval = run_queue_graph(processQueue,queue_jobs,queue_memory);
+	  else
+#else
+	  if(queue_jobs > 1 || queue_memory || has_prereqs)
+	    std::cerr << "Warning: queue_jobs, queue_memory and prereq are not available in this build. "
+		      << "Jobs will be run one after another, in the order of the queue, until one fails." << std::endl;
 #endif
-		  break;
-                }
-	      if(retval)
-		break;
-            }
+	    {
+	      int queuePosition= 0;
+	      for(std::vector<MMPBSAState>::iterator job = processQueue.begin();
+		  job != processQueue.end();job++,queuePosition++)
+		{
+		  retval = run_queue_job(*job,queuePosition);
+		  if(retval)
+		    break;
+		}
+	    }
+	  free_topology_cache();
         }
 #ifdef USE_BOINC
       if(retval)
@@ -143,7 +112,7 @@ int main(int argc, char** argv)
 }
 
 void writePDB(const std::vector<mmpbsa::atom_t>& atoms,const mmpbsa::forcefield_t& ff,
-	      const std::valarray<mmpbsa::Vector>crds,const mmpbsa::MMPBSAState& currState,const std::string& molecule)
+	      const std::valarray<mmpbsa::Vector>& crds,const mmpbsa::MMPBSAState& currState,const std::string& molecule)
 {
   std::fstream pdbFile;
   std::string filename = "default";
@@ -238,11 +207,19 @@ void get_sander_forcefield(mmpbsa::MMPBSAState& currState,mmpbsa::forcefield_t**
   using std::valarray;
   using std::slice;
 
-  //load and check the parmtop file.
-  mmpbsa::SanderParm * sp = new mmpbsa::SanderParm;
+  //load and check the parmtop file. Topologies shared by several jobs of the queue were read once.
   if(!has_filename(MMPBSA_TOPOLOGY_TYPE,currState))
     throw mmpbsa::MMPBSAException("get_sander_forcefield: no parmtop file.",BROKEN_PRMTOP_FILE);
-  sp->raw_read_amber_parm(get_filename(MMPBSA_TOPOLOGY_TYPE,currState));
+  const std::string& topology_filename = get_filename(MMPBSA_TOPOLOGY_TYPE,currState);
+  mmpbsa::SanderParm * sp;
+  std::map<std::string,mmpbsa::SanderParm*>::const_iterator cached = topology_cache.find(topology_filename);
+  if(cached != topology_cache.end())
+    sp = new mmpbsa::SanderParm(*cached->second);
+  else
+    {
+      sp = new mmpbsa::SanderParm;
+      sp->raw_read_amber_parm(topology_filename);
+    }
   if(!currState.trustPrmtop)
     if(!sp->sanityCheck())
       throw MMPBSAException("get_sander_forcefield: Parmtop file, " + get_filename(SANDER_PRMTOP_TYPE,currState)
@@ -296,6 +273,24 @@ void get_sander_forcefield(mmpbsa::MMPBSAState& currState,mmpbsa::forcefield_t**
   ligandEFun.extract_force_field((*split_ff)[MMPBSAState::LIGAND]);
   ligandEFun.extract_atom_structs((*atom_lists)[MMPBSAState::LIGAND]);
 
+  //Number residues as in the whole topology, so that those of the complex, receptor and ligand match.
+  std::vector<size_t> atom_residues(sp->natom,0);
+  for(size_t r = 0;2*r+1 < entireEFun.res_ranges.size();r++)
+    for(size_t i = entireEFun.res_ranges[2*r];i < entireEFun.res_ranges[2*r+1] && i < sp->natom;i++)
+      atom_residues[i] = r;
+  const valarray<bool>* keepers[MMPBSAState::END_OF_MOLECULES];
+  keepers[MMPBSAState::COMPLEX] = &complexKeepers;
+  keepers[MMPBSAState::RECEPTOR] = &receptorKeepers;
+  keepers[MMPBSAState::LIGAND] = &ligandKeepers;
+  for(size_t mol = 0;mol < MMPBSAState::END_OF_MOLECULES;mol++)
+    {
+      std::vector<atom_t>& atoms = (*atom_lists)[mol];
+      size_t curr_atom = 0;
+      for(size_t i = 0;i < sp->natom && curr_atom < atoms.size();i++)
+	if((*keepers[mol])[i])
+	  atoms[curr_atom++].residue = atom_residues[i];
+    }
+
   mol_list.resize(sp->natom,MMPBSAState::END_OF_MOLECULES);//In this case, it is solvent
   mol_list[receptorKeepers] = MMPBSAState::RECEPTOR;
   mol_list[ligandKeepers] = MMPBSAState::LIGAND;
@@ -310,30 +305,6 @@ void get_sander_forcefield(mmpbsa::MMPBSAState& currState,mmpbsa::forcefield_t**
   delete sp;
 }
 
-bool should_calculate_snapshot(const size_t& currentSnap, const std::vector<size_t>& snapList)
-{
-#ifndef USE_MPI
-  return true;
-#else
-  if(snapList.size() == 0)
-    return (currentSnap-1) % mpi_size == mpi_rank;
-
-  for(size_t i = 0;i<snapList.size();i++)
-    {
-      //Is the requested snap shot in the list?
-      if(snapList.at(i) == currentSnap)
-	if(i % mpi_size == mpi_rank)//If so should this host do it?
-	  return true;
-	else
-	  return false;
-    }
-
-  return false;//If the snapshot is not in the list, don't do it.
-
-#endif
-
-}
-
 
 void get_forcefield(mmpbsa::MMPBSAState& currState,mmpbsa::forcefield_t** split_ff,std::vector<mmpbsa::atom_t>** atom_lists, std::valarray<mmpbsa::MMPBSAState::MOLECULE>& mol_list,mmpbsa_io::trajectory_t& trajfile)
 {
@@ -349,6 +320,16 @@ void get_forcefield(mmpbsa::MMPBSAState& currState,mmpbsa::forcefield_t** split_
       mmpbsa_io::get_gromacs_forcefield(filename.c_str(),split_ff,atom_lists,mol_list,receptor_start,ligand_start);
       return;
     }
+#else
+  //Without libgmx, run input files are read natively (Gromacs 4.5 tpx format only).
+  if(has_filename(MMPBSA_TOPOLOGY_TYPE,currState) && get_filename(MMPBSA_TOPOLOGY_TYPE,currState).find(".tpr") != std::string::npos)
+    {
+      std::set<size_t> *receptor_start,*ligand_start;
+      receptor_start = (currState.receptorStartPos.size()) ? &currState.receptorStartPos : 0;
+      ligand_start = (currState.ligandStartPos.size()) ? &currState.ligandStartPos : 0;
+      mmpbsa_io::get_tpr_forcefield(get_filename(MMPBSA_TOPOLOGY_TYPE,currState),split_ff,atom_lists,mol_list,receptor_start,ligand_start);
+      return;
+    }
 #endif
   get_sander_forcefield(currState,split_ff,atom_lists,mol_list,trajfile);
 }
@@ -364,6 +345,301 @@ void dump_crds(const std::vector<mmpbsa::atom_t>& atoms,
   std::cout << "# End Coordinates" << std::endl;
 }
 
+/**
+ * Reads every snapshot that will be calculated and plans one finite difference
+ * grid that covers all of them. The trajectory is returned to the first snapshot.
+ */
+mmpbsa::grid_plan_t create_job_grid_plan(mmpbsa_io::trajectory_t& trajFile, const mmpbsa::MMPBSAState& currState,
+			     const std::valarray<mmpbsa::MMPBSAState::MOLECULE>& mol_list,
+			     std::valarray<mmpbsa::Vector>& complexSnap, std::valarray<mmpbsa::Vector>& receptorSnap, std::valarray<mmpbsa::Vector>& ligandSnap)
+{
+  using mmpbsa::MeadInterface;
+  mmpbsa::grid_plan_t plan;
+  std::valarray<mmpbsa::Vector> snapshot(mol_list.size());
+  size_t snap_counter = 1,num_used = 0;
+
+  MeadInterface::clear_grid_plan(plan);
+  mmpbsa_io::seek(trajFile,1);
+  while(!mmpbsa_io::eof(trajFile))
+    {
+      try
+	{
+	  if(!mmpbsa_io::get_next_snap(trajFile,snapshot))
+	    break;
+	}
+      catch(mmpbsa::MMPBSAException e)
+	{
+	  if(e.getErrType() == mmpbsa::UNEXPECTED_EOF)
+	    break;
+	  throw e;
+	}
+      if(currState.snapList.size() == 0 || mmpbsa_utils::contains(currState.snapList,snap_counter))
+	{
+	  split_snapshot(snapshot,mol_list,complexSnap,receptorSnap,ligandSnap);
+	  MeadInterface::extend_grid_plan(plan,complexSnap,receptorSnap,ligandSnap);
+	  num_used++;
+	}
+      snap_counter++;
+    }
+  mmpbsa_io::seek(trajFile,1);
+
+  if(plan.empty)
+    throw mmpbsa::MMPBSAException("create_job_grid_plan: No snapshots were found with which to build the grid.",mmpbsa::BROKEN_TRAJECTORY_FILE);
+  std::cout << "Using one finite difference grid for " << num_used << " snapshots" << std::endl;
+  return plan;
+}
+
+bool lower_pose_score(const pose_score_t& a, const pose_score_t& b)
+{
+  return a.score < b.score;
+}
+
+/**
+ * Scores the ligand of every snapshot that will be calculated by its interaction
+ * with the electrostatic potential of the receptor of the first such snapshot.
+ * The potential is solved once, on a grid covering every ligand pose, or loaded
+ * from the potential grid file, if that file was made for the same receptor and
+ * covers every pose. A newly solved potential is written to the potential grid file,
+ * if one was given.
+ *
+ * Scores are returned lowest (most favorable) first. The trajectory is returned
+ * to the first snapshot.
+ */
+std::vector<pose_score_t> score_poses(mmpbsa_io::trajectory_t& trajFile, const mmpbsa::MMPBSAState& currState,
+				      const mmpbsa::MeadInterface& mi, const std::valarray<mmpbsa::MMPBSAState::MOLECULE>& mol_list,
+				      const std::vector<mmpbsa::atom_t>* atom_lists, mmpbsa::mead_atom_set_t& receptor_set,
+				      std::valarray<mmpbsa::Vector>& complexSnap, std::valarray<mmpbsa::Vector>& receptorSnap, std::valarray<mmpbsa::Vector>& ligandSnap)
+{
+  using mmpbsa::MeadInterface;
+  using mmpbsa::MMPBSAState;
+  std::vector<pose_score_t> returnMe;
+  std::valarray<mmpbsa::Vector> snapshot(mol_list.size());
+  size_t snap_counter = 0;
+
+  //First pass: region spanned by the poses, and the receptor.
+  mmpbsa::grid_plan_t plan;
+  MeadInterface::clear_grid_plan(plan);
+  mmpbsa_t ligand_min[3],ligand_max[3];
+  std::valarray<mmpbsa::Vector> receptor;
+  size_t receptor_snap = 0;
+  if(atom_lists[MMPBSAState::LIGAND].size() == 0)
+    throw mmpbsa::MMPBSAException("score_poses: The ligand has no atoms.",mmpbsa::DATA_FORMAT_ERROR);
+  mmpbsa_io::seek(trajFile,1);
+  while(next_job_snapshot(trajFile,currState,snapshot,snap_counter))
+    {
+      split_snapshot(snapshot,mol_list,complexSnap,receptorSnap,ligandSnap);
+      MeadInterface::extend_grid_plan(plan,complexSnap,receptorSnap,ligandSnap);
+      if(receptor_snap == 0)
+	{
+	  receptor.resize(receptorSnap.size());
+	  receptor = receptorSnap;
+	  receptor_snap = snap_counter;
+	  for(size_t axis = 0;axis<3;axis++)
+	    {
+	      ligand_min[axis] = ligandSnap[0][axis];
+	      ligand_max[axis] = ligandSnap[0][axis];
+	    }
+	}
+      for(size_t i = 0;i<ligandSnap.size();i++)
+	for(size_t axis = 0;axis<3;axis++)
+	  {
+	    ligand_min[axis] = std::min(ligand_min[axis],ligandSnap[i][axis]);
+	    ligand_max[axis] = std::max(ligand_max[axis],ligandSnap[i][axis]);
+	  }
+    }
+  if(receptor_snap == 0)
+    throw mmpbsa::MMPBSAException("score_poses: No ligand poses were found to score.",mmpbsa::BROKEN_TRAJECTORY_FILE);
+  for(size_t axis = 0;axis<3;axis++)
+    {
+      ligand_min[axis] -= MMPBSA_POSE_GRID_MARGIN;
+      ligand_max[axis] += MMPBSA_POSE_GRID_MARGIN;
+    }
+
+  //Receptor potential
+  std::vector<mmpbsa::grid_level_t> levels = mi.plan_grid(plan);
+  mmpbsa::PotentialGrid grid;
+  size_t signature = coordinate_hash(receptor);
+  bool have_grid = false;
+  if(has_filename(POTENTIAL_GRID_TYPE,currState))
+    {
+      const std::string& grid_filename = get_filename(POTENTIAL_GRID_TYPE,currState);
+      try
+	{
+	  grid.load(grid_filename);
+	  mmpbsa::Vector corners[2] = {mmpbsa::Vector(ligand_min[0],ligand_min[1],ligand_min[2]),
+				       mmpbsa::Vector(ligand_max[0],ligand_max[1],ligand_max[2])};
+	  have_grid = (grid.signature == signature && grid.covers(std::valarray<mmpbsa::Vector>(corners,2)));
+	  if(have_grid)
+	    std::cout << "Using the receptor potential in " << grid_filename << std::endl;
+	  else
+	    std::cerr << "Warning: " << grid_filename << " was made for a different receptor or region. "
+		      << "The receptor potential will be solved again." << std::endl;
+	}
+      catch(mmpbsa::MMPBSAException e)
+	{
+	  if(e.getErrType() != mmpbsa::FILE_IO_ERROR)
+	    std::cerr << "Warning: " << e.what() << " The receptor potential will be solved again." << std::endl;
+	}
+    }
+  if(!have_grid)
+    {
+      std::cout << "Solving the potential of the receptor of snapshot #" << receptor_snap << std::endl;
+      grid = mmpbsa::PotentialGrid(ligand_min,ligand_max,levels.back().spacing);
+      grid.signature = signature;
+      MeadInterface::update_atom_set(receptor_set,receptor);
+      MeadInterface::receptor_potential(*receptor_set.atoms,MeadInterface::createFDM(levels),mi.istrength,2.0,grid);
+      if(has_filename(POTENTIAL_GRID_TYPE,currState))
+	grid.save(get_filename(POTENTIAL_GRID_TYPE,currState));
+    }
+
+  //Second pass: score the poses.
+  bool receptor_moved = false;
+  snap_counter = 0;
+  mmpbsa_io::seek(trajFile,1);
+  while(next_job_snapshot(trajFile,currState,snapshot,snap_counter))
+    {
+      split_snapshot(snapshot,mol_list,complexSnap,receptorSnap,ligandSnap);
+      if(!receptor_moved && coordinate_hash(receptorSnap) != signature)
+	{
+	  std::cerr << "Warning: The receptor is not rigid. Poses are scored with the receptor of snapshot #"
+		    << receptor_snap << std::endl;
+	  receptor_moved = true;
+	}
+      pose_score_t pose;
+      pose.snapshot = snap_counter;
+      pose.score = grid.interaction_energy(ligandSnap,atom_lists[MMPBSAState::LIGAND]);
+      returnMe.push_back(pose);
+    }
+  mmpbsa_io::seek(trajFile,1);
+
+  std::stable_sort(returnMe.begin(),returnMe.end(),lower_pose_score);
+  return returnMe;
+}
+
+/**
+ * Writes the pose scores, one per line, as rank, snapshot and score (kcal/mol).
+ */
+void write_pose_scores(const std::vector<pose_score_t>& scores, std::ostream& out)
+{
+  out << "#rank snapshot score(kcal/mol)" << std::endl;
+  for(size_t i = 0;i<scores.size();i++)
+    out << i+1 << " " << scores[i].snapshot << " " << scores[i].score << std::endl;
+}
+
+/**
+ * Atoms of the binding site of a snapshot: the atoms of the receptor (its pocket) and of
+ * the ligand within the box spanned by the receptor and ligand atoms that interact
+ * (cf interaction_minmax), as indices into receptorSnap and ligandSnap. If they do not
+ * interact, every atom is used.
+ */
+void binding_site_atoms(const std::valarray<mmpbsa::Vector>& receptorSnap, const std::valarray<mmpbsa::Vector>& ligandSnap,
+			std::vector<size_t>& receptor_site, std::vector<size_t>& ligand_site)
+{
+  receptor_site.clear();
+  ligand_site.clear();
+  if(receptorSnap.size() && ligandSnap.size())
+    {
+      mead_data_t* minmax = mmpbsa_utils::interaction_minmax(receptorSnap,ligandSnap);
+      bool interact = false;
+      for(size_t i = 0;i<6;i++)
+	interact |= (minmax[i] != 0);
+      const std::valarray<mmpbsa::Vector>* molecules[2] = {&receptorSnap,&ligandSnap};
+      std::vector<size_t>* sites[2] = {&receptor_site,&ligand_site};
+      for(size_t mol = 0;interact && mol<2;mol++)
+	for(size_t i = 0;i<molecules[mol]->size();i++)
+	  {
+	    const mmpbsa::Vector& atom = (*molecules[mol])[i];
+	    bool inside = true;
+	    for(size_t axis = 0;axis<3;axis++)
+	      inside &= (atom[axis] >= minmax[axis] && atom[axis] <= minmax[axis+3]);
+	    if(inside)
+	      sites[mol]->push_back(i);
+	  }
+      delete [] minmax;
+    }
+  if(receptor_site.size() + ligand_site.size() < 3)
+    {
+      std::cerr << "Warning: The receptor and ligand do not interact. Snapshots are clustered by the whole complex." << std::endl;
+      receptor_site.clear();
+      ligand_site.clear();
+      for(size_t i = 0;i<receptorSnap.size();i++)
+	receptor_site.push_back(i);
+      for(size_t i = 0;i<ligandSnap.size();i++)
+	ligand_site.push_back(i);
+    }
+}
+
+/**
+ * Clusters the snapshots that will be calculated by the RMSD of the binding site atoms
+ * of the first snapshot, after superposing the receptor's atoms of the site, so that
+ * both changes of the pocket and of the ligand's pose in it are measured. Clusters are
+ * made with the leader algorithm: in trajectory order, each snapshot joins the cluster
+ * of the nearest representative within currState.cluster_rmsd, or else represents a new
+ * cluster. The trajectory is read once and only the binding sites of the representatives
+ * are kept.
+ *
+ * The snapshots to be calculated are replaced by the representatives. The trajectory is
+ * returned to the first snapshot.
+ */
+void cluster_snapshots(mmpbsa::snapshot_clusters_t& clusters, mmpbsa_io::trajectory_t& trajFile, mmpbsa::MMPBSAState& currState,
+		       const std::valarray<mmpbsa::MMPBSAState::MOLECULE>& mol_list,
+		       std::valarray<mmpbsa::Vector>& complexSnap, std::valarray<mmpbsa::Vector>& receptorSnap, std::valarray<mmpbsa::Vector>& ligandSnap)
+{
+  clusters.active = false;
+  clusters.weights.clear();
+  clusters.num_site_atoms = 0;
+  if(currState.cluster_rmsd <= 0)
+    return;
+
+  std::valarray<mmpbsa::Vector> snapshot(mol_list.size());
+  std::vector<size_t> receptor_site,ligand_site,representatives;
+  std::vector<std::valarray<mmpbsa::Vector> > sites;//binding site of each representative
+  size_t snap_counter = 0,num_snaps = 0,num_fit = 0;
+  mmpbsa_io::seek(trajFile,1);
+  while(next_job_snapshot(trajFile,currState,snapshot,snap_counter))
+    {
+      split_snapshot(snapshot,mol_list,complexSnap,receptorSnap,ligandSnap);
+      if(num_snaps++ == 0)
+	{
+	  binding_site_atoms(receptorSnap,ligandSnap,receptor_site,ligand_site);
+	  num_fit = (receptor_site.size() >= 3) ? receptor_site.size() : 0;//zero = superpose the whole site
+	}
+      std::valarray<mmpbsa::Vector> site_crds(receptor_site.size() + ligand_site.size());
+      for(size_t i = 0;i<receptor_site.size();i++)
+	site_crds[i] = receptorSnap[receptor_site[i]];
+      for(size_t i = 0;i<ligand_site.size();i++)
+	site_crds[receptor_site.size() + i] = ligandSnap[ligand_site[i]];
+
+      size_t nearest = sites.size();
+      mmpbsa_t nearest_rmsd = currState.cluster_rmsd;
+      for(size_t i = 0;i<sites.size();i++)
+	{
+	  mmpbsa_t rmsd = mmpbsa_utils::superposed_rmsd(sites[i],site_crds,num_fit);
+	  if(rmsd <= nearest_rmsd)
+	    {
+	      nearest = i;
+	      nearest_rmsd = rmsd;
+	    }
+	}
+      if(nearest == sites.size())
+	{
+	  sites.push_back(site_crds);
+	  representatives.push_back(snap_counter);
+	  clusters.weights[snap_counter] = 1;
+	}
+      else
+	clusters.weights[representatives[nearest]]++;
+    }
+  mmpbsa_io::seek(trajFile,1);
+  if(num_snaps == 0)
+    throw mmpbsa::MMPBSAException("cluster_snapshots: No snapshots were found to cluster.",mmpbsa::BROKEN_TRAJECTORY_FILE);
+
+  clusters.active = true;
+  clusters.num_site_atoms = receptor_site.size() + ligand_site.size();
+  currState.snapList = representatives;
+  std::cout << "Clustered " << num_snaps << " snapshots into " << representatives.size() << " by the RMSD of "
+	    << clusters.num_site_atoms << " binding site atoms, within " << currState.cluster_rmsd << " Angstroms" << std::endl;
+}
 
 int molsurf_run(mmpbsa::MMPBSAState& currState)
 {
@@ -554,7 +830,6 @@ int mmpbsa_run(mmpbsa::MMPBSAState& currState, mmpbsa::MeadInterface& mi)
 
   //setup trajectory storage
   get_traj_title(trajFile);//Don't need title, but this ensure we are at the top of the file. If the title is needed later, hook this.
-  valarray<mmpbsa::Vector> snapshot(mol_list.size());
   size_t complexSize,receptorSize,ligandSize;
   receptorSize = ligandSize = 0;
   for(size_t i = 0;i<mol_list.size();i++)
@@ -569,13 +844,183 @@ int mmpbsa_run(mmpbsa::MMPBSAState& currState, mmpbsa::MeadInterface& mi)
   valarray<mmpbsa::Vector> receptorSnap(receptorSize);
   valarray<mmpbsa::Vector> ligandSnap(ligandSize);
 
+  //Optionally, score the ligand poses with the receptor's potential. Full MMPBSA is
+  //then only performed on the best scored fraction of the poses, if any.
+  if(currState.pose_scoring)
+    {
+      mmpbsa::mead_atom_set_t receptor_set = MeadInterface::create_atom_set(atom_lists[MMPBSAState::RECEPTOR],radii);
+      std::vector<pose_score_t> scores = score_poses(trajFile,currState,mi,mol_list,atom_lists,
+						     receptor_set,complexSnap,receptorSnap,ligandSnap);
+      MeadInterface::destroy_atom_set(receptor_set);
+      std::cout << "Scored " << scores.size() << " ligand poses" << std::endl;
+#ifdef USE_MPI
+      if(mpi_rank == MMPBSA_MASTER)
+#endif
+	{
+	  if(has_filename(POSE_SCORE_TYPE,currState))
+	    {
+	      std::fstream scoreFile(get_filename(POSE_SCORE_TYPE,currState).c_str(),std::ios::out);
+	      if(!scoreFile.good())
+		throw mmpbsa::MMPBSAException("mmpbsa_run: Could not open " + get_filename(POSE_SCORE_TYPE,currState),mmpbsa::FILE_IO_ERROR);
+	      write_pose_scores(scores,scoreFile);
+	      scoreFile.close();
+	    }
+	  else
+	    write_pose_scores(scores,std::cout);
+	}
+
+      size_t num_refined = size_t(ceil(currState.refine_fraction * scores.size()));
+      if(num_refined == 0)
+	{
+	  for(size_t i = 0;i<MMPBSAState::END_OF_MOLECULES;i++)
+	    destroy(&split_ff[i]);
+	  delete [] split_ff;
+	  delete [] atom_lists;
+	  currState.fractionDone = 1.0;
+	  checkpoint_mmpbsa(currState);
+	  return 0;
+	}
+      currState.snapList.clear();
+      for(size_t i = 0;i<num_refined && i<scores.size();i++)
+	currState.snapList.push_back(scores[i].snapshot);
+      std::sort(currState.snapList.begin(),currState.snapList.end());
+      std::cout << "Refining the " << currState.snapList.size() << " best scored poses" << std::endl;
+    }
+
+  //Which snapshots are calculated, in which order and until when is kept for this job only.
+  snapshot_run_t run;
+#ifdef USE_MPI
+  init_snapshot_run(run,mpi_rank,mpi_size);
+#else
+  init_snapshot_run(run,0,1);
+#endif
+
+  //Optionally, cluster the snapshots by the structure of their binding site. MMPBSA is
+  //then only performed on one representative of each cluster.
+  cluster_snapshots(run.clusters,trajFile,currState,mol_list,complexSnap,receptorSnap,ligandSnap);
+
+  //Optionally, build one grid spanning every snapshot, so that all energies
+  //are calculated on an identical grid.
+  mmpbsa::grid_plan_t job_plan;
+  std::vector<mmpbsa::grid_level_t> job_levels;
+  FinDiffMethod* job_fdm = 0;
+  if(mi.fixed_grid)
+    {
+      job_plan = create_job_grid_plan(trajFile,currState,mol_list,complexSnap,receptorSnap,ligandSnap);
+      job_levels = mi.plan_grid(job_plan);
+      if(mi.pb_solver == MeadInterface::PB_MEAD)
+	job_fdm = new FinDiffMethod(MeadInterface::createFDM(job_levels));
+    }
+  const std::vector<pb_condition_t> pb_conditions = mi.pb_conditions();
+  if(mi.pb_sweep())
+    std::cout << "Calculating PB energies for " << pb_conditions.size() << " conditions. "
+	      << "ELSTAT_SOLV is that of the first." << std::endl;
+
+  if(mi.pb_solver == MeadInterface::PB_MULTIGRID && mi.pb_reference != MeadInterface::REFERENCE_SOLVE)
+    std::cerr << "Warning: pb_reference is only used with the MEAD solver. Reference energies will be solved." << std::endl;
+
+  //Decomposition needs the atom energies of each solve, which are neither cached nor returned by concurrent solves.
+  if(currState.decompose && (currState.reuse_components || mi.concurrent_pb))
+    {
+      std::cerr << "Warning: reuse_components and concurrent_pb are not used with decompose." << std::endl;
+      currState.reuse_components = false;
+      mi.concurrent_pb = false;
+    }
+
+  //Interface SA keeps the atom areas of the separated receptor and ligand.
+  if(mi.sa_interface && mi.sa_method == MeadInterface::SA_MOLSURF)
+    {
+      std::cerr << "Warning: sa_interface needs sa_method=shrake_rupley or lcpo. Surface areas will be calculated in full." << std::endl;
+      mi.sa_interface = false;
+    }
+
+  //Snapshots may be calculated by several threads, each with its own worker.
+  //A pipeline has a worker for each of its PB and SA threads.
+  size_t num_workers = 1;
+  bool use_pipeline = false,use_processes = false;
+  if(currState.snapshot_processes > 1)
+    {
+#ifdef USE_SNAPSHOT_PROCESSES
+      use_processes = true;
+      num_workers = currState.snapshot_processes;
+      if(currState.pipeline_workers.size() || currState.snapshot_threads > 1)
+	std::cerr << "Warning: pipeline and snapshot_threads are not used with snapshot_processes." << std::endl;
+#else
+      std::cerr << "Warning: worker processes are not available in this build. Snapshots will be calculated by this process." << std::endl;
+#endif
+    }
+  else if(currState.pipeline_workers.size())
+    {
+#ifdef USE_PTHREADS
+      use_pipeline = true;
+      num_workers = currState.pipeline_workers.at(PIPELINE_PB) + currState.pipeline_workers.at(PIPELINE_SA);
+      if(currState.reuse_components || mi.concurrent_pb)
+	{
+	  std::cerr << "Warning: reuse_components and concurrent_pb are not used with pipeline." << std::endl;
+	  currState.reuse_components = false;
+	  mi.concurrent_pb = false;
+	}
+      if(currState.snapshot_threads > 1)
+	std::cerr << "Warning: snapshot_threads is not used with pipeline." << std::endl;
+#else
+      std::cerr << "Warning: not compiled with threads. Snapshots will be calculated one at a time." << std::endl;
+#endif
+    }
+  else if(currState.snapshot_threads > 1)
+    {
+#ifdef USE_PTHREADS
+      num_workers = currState.snapshot_threads;
+      if(mi.concurrent_pb && mi.pb_solver == MeadInterface::PB_MEAD)
+	{
+	  std::cerr << "Warning: concurrent_pb is not used with MEAD when snapshot_threads is greater than one." << std::endl;
+	  mi.concurrent_pb = false;
+	}
+#else
+      std::cerr << "Warning: not compiled with threads. Snapshots will be calculated one at a time." << std::endl;
+#endif
+    }
+  snapshot_job_t job;
+  job.mi = &mi;
+  job.split_ff = split_ff;
+  job.atom_lists = atom_lists;
+  job.mol_list = &mol_list;
+  job.radii = &radii;
+  job.job_plan = &job_plan;
+  job.job_levels = &job_levels;
+  job.job_fdm = job_fdm;
+  job.pb_conditions = &pb_conditions;
+  job.complex_size = complexSize;
+  job.receptor_size = receptorSize;
+  job.ligand_size = ligandSize;
+  job.mead_mutex = 0;
+  job.run = &run;
+  job.hooks.progress = updateMMPBSAProgress;
+  job.hooks.checkpoint = checkpoint_mmpbsa;
+  job.hooks.checkpoint_molecule = thread_safe_checkpoint;
+#ifdef USE_MPI
+  job.hooks.write_data = 0;//The master writes the data of every node (cf mpi_dump_data).
+#else
+  job.hooks.write_data = write_mmpbsa_data;
+#endif
+  job.hooks.write_pdb = writePDB;
+#ifdef USE_PTHREADS
+  pthread_mutex_t mead_mutex;
+  pthread_mutex_init(&mead_mutex,NULL);
+  if((num_workers > 1 || use_pipeline) && !use_processes)
+    job.mead_mutex = (void*)&mead_mutex;
+#endif
+  std::vector<snapshot_worker_t> workers(num_workers);
+  for(size_t i = 0;i<num_workers;i++)
+    init_snapshot_worker(workers[i],job);
 
   //if the program is resuming a previously started calculation, advance to the
   //last snapshot.
-  if(currState.currentSnap)//zero = one = start from beginning.
+  if(currState.currentSnap > 1)
     {
       mmpbsa_io::seek(trajFile,currState.currentSnap-1);
     }
+  else if(currState.currentSnap == 1)//e.g. snapshots taken out of order, which are resumed from processedSnaps
+    mmpbsa_io::seek(trajFile,1);
   else
     {
       trajFile.curr_snap = currState.currentSnap = 1;//start from beginning if currentSnap was originally zero.
@@ -594,194 +1039,42 @@ int mmpbsa_run(mmpbsa::MMPBSAState& currState, mmpbsa::MeadInterface& mi)
   fflush(stdout);
 #endif
 
-  mmpbsa_utils::XMLNode* outputXML = previousEnergyData.getHead();
+  start_convergence(run,currState,previousEnergyData);
+  start_snapshot_order(run.order,trajFile,currState,workers[0].snapshot);
 
-  //Walk through the snapshots. This is where MMPBSA is actually done.
-  while(!mmpbsa_io::eof(trajFile))
+#ifdef USE_MPI
+  //Nodes claim snapshots as they finish others, rather than calculating every mpi_size-th.
+  if(currState.dynamic_schedule && mpi_size > 1)
     {
-      try{
-	//if a list of snaps to be run is provided, check to see if this snapshot
-	//should be used. Remember: snapcounter is 1-indexed.
-	//
-	//Additionally, check to see if the snapshot should be run by this node
-	//if multiple nodes are used, e.g. MPI
-	if(currState.snapList.size())//check if the current snapshot should be skipped
-	  {
-	    if(!mmpbsa_utils::contains(currState.snapList,currState.currentSnap) || !should_calculate_snapshot(currState.currentSnap, currState.snapList))
-	      {
-		try
-		  {
-		    mmpbsa_io::seek(trajFile,trajFile.curr_snap+1);
-		    std::cout << "Skipping Snapshot #" << currState.currentSnap << std::endl;
-		    currState.currentSnap += 1;
-		    currState.currentMolecule = MMPBSAState::COMPLEX;
-		    continue;
-		  }
-		catch(mmpbsa::MMPBSAException mmpbsae)
-		  {
-		    if(mmpbsae.getErrType() == mmpbsa::FILE_IO_ERROR && mmpbsa_io::eof(trajFile))
-		      break;// Done with snapshots.
-		    printf("Throwing exception type: %d as opposed to %d  EOF = %d Message: %s\n",mmpbsae.getErrType(),mmpbsa::FILE_IO_ERROR,((mmpbsa_io::eof(trajFile))?1:0),mmpbsae.what());fflush(stdout);
-		    
-		    throw mmpbsae;
-		  }
-	      }
-	  }
-        
-	//Can the snapshot be loaded, and if so, should it be run by this node, if multiple
-	//nodes are used.
-	if(get_next_snap(trajFile, snapshot) && should_calculate_snapshot(currState.currentSnap, currState.snapList))
-	  std::cout << "Running Snapshot #" << currState.currentSnap << std::endl;
-	else if(!should_calculate_snapshot(currState.currentSnap,currState.snapList))
-	  {
-	    std::cout << "Skipping snapshot #" << currState.currentSnap++ << std::endl;
-	    continue;
-	  }
-	else
-	  {
-	    std::ostringstream error;
-	    error << "mmpbsa_run: Error in loading snapshot #"  << ++(currState.currentSnap) << std::endl;
-	    throw MMPBSAException(error,BROKEN_TRAJECTORY_FILE);
-	  }
-      }
-      catch(MMPBSAException e)
-        {
-	  if(e.getErrType() == UNEXPECTED_EOF)
-	    break;//return 0;
-	  throw e;
-        }
-
-      study_cpu_time();
-
-      //retrieve snapshot ID and start a snapshot XML dataset.
-      std::ostringstream strSnapNumber;
-      strSnapNumber << currState.currentSnap;//Node used to output energy data
-      mmpbsa_utils::XMLNode* snapshotXML = new mmpbsa_utils::XMLNode("snapshot");
-      snapshotXML->insertChild("ID",strSnapNumber.str());
-      if(mi.snap_list_offset != 0)
-        {
-	  strSnapNumber.str("");
-	  strSnapNumber << mi.snap_list_offset;
-	  snapshotXML->insertChild("snap_list_offset",strSnapNumber.str());
-        }
-
-      //separate coordinates
-      size_t complexCoordIndex = 0;
-      size_t receptorCoordIndex = 0;
-      size_t ligandCoordIndex = 0;
-      for(size_t i = 0;i<mol_list.size();i++)
-        {
-	  Vector& currCoord = snapshot[i];
-	  if(mol_list[i] == MMPBSAState::RECEPTOR)
-            {
-	      complexSnap[complexCoordIndex++] = currCoord;
-	      receptorSnap[receptorCoordIndex++] = currCoord;
-            }
-	  else if(mol_list[i] == MMPBSAState::LIGAND)
-            {
-	      complexSnap[complexCoordIndex++] = currCoord;
-	      ligandSnap[ligandCoordIndex++] = currCoord;
-            }
-        }
-
-      //write PDB information, if requested.
-      if(currState.savePDB)
-        {
-	  writePDB(atom_lists[MMPBSAState::COMPLEX],split_ff[MMPBSAState::COMPLEX],complexSnap,currState,"complex");
-	  writePDB(atom_lists[MMPBSAState::RECEPTOR],split_ff[MMPBSAState::RECEPTOR],receptorSnap,currState,"receptor");
-	  writePDB(atom_lists[MMPBSAState::LIGAND],split_ff[MMPBSAState::LIGAND],ligandSnap,currState,"ligand");
-        }
-
-      //Check to see if we just ended one snap shot and need to start the
-      //next snap shot at the beginning (which is the whole COMPLEX. If
-      //so, reset the current Molecule to Complex and increment the snap count.
-      if(currState.currentMolecule == MMPBSAState::END_OF_MOLECULES)
-        {
-	  currState.currentMolecule = MMPBSAState::COMPLEX;
-	  ::updateMMPBSAProgress(currState,1);
-	  currState.currentSnap += 1;
-	  report_boinc_progress();
-	  continue;//Restarted program at the end of a snapshot. So, move on.
-        }
-        
-      // Iterate through the three parts of the complex and calculate energies
-      for(;currState.currentMolecule < MMPBSAState::END_OF_MOLECULES;++currState.currentMolecule)
-        {
-	  FinDiffMethod fdm = MeadInterface::createFDM(complexSnap,receptorSnap,ligandSnap);
-	  const std::valarray<Vector> *curr_crds;
-	  mmpbsa_t energy;
-	  std::string mol_name;
-	  int molsurf_error_flag = 0;
-
-	  switch(currState.currentMolecule)
-	    {
-	    case MMPBSAState::COMPLEX:
-	      curr_crds = &complexSnap;
-	      mol_name = "COMPLEX";
-	      break;
-	    case MMPBSAState::RECEPTOR:
-	      curr_crds = &receptorSnap;
-	      mol_name = "RECEPTOR";
-	      break;
-	    case MMPBSAState::LIGAND:
-	      curr_crds = &ligandSnap;
-	      mol_name = "LIGAND";
-	      break;
-	    default:
-	      throw MMPBSAException("mmpbsa_run: invalid molecule in switch.",mmpbsa::DATA_FORMAT_ERROR);
-	    }
-
-	  std::cout << "Calculating " << mol_name << std::endl;
-	  // Constructor performs MM
-	  EMap results(atom_lists[currState.currentMolecule],split_ff[currState.currentMolecule],*curr_crds);
-
-	  // PB
-	  energy = MeadInterface::pb_solvation(atom_lists[currState.currentMolecule],*curr_crds,fdm,radii,residues,mi.istrength);
-	  results.set_elstat_solv(energy);
-
-	  // SA
-#ifdef _WIN32
-	  energy = MeadInterface::molsurf_windows32(atom_lists[currState.currentMolecule],*curr_crds,radii,&molsurf_error_flag);
-#else //posix
-	  energy = MeadInterface::molsurf_posix(atom_lists[currState.currentMolecule],*curr_crds,radii,&molsurf_error_flag);
+#if MPI_VERSION >= 3
+      start_snapshot_schedule(run,job,workers[0],trajFile,currState);
+#else
+      std::cerr << "Warning: mpi_schedule=dynamic needs MPI 3. Snapshots will be divided among nodes in turn." << std::endl;
 #endif
-	  if(molsurf_error_flag != 0)
-	    {
-	      results.molsurf_failed = true;
-	      results.set_area(0.0);
-	      results.set_sasol(0.0);
-	    }
-	  else
-	    {
-	      results.molsurf_failed = false;
-	      results.set_area(energy);
-	      results.set_sasol(energy*mi.surf_tension+mi.surf_offset);
-	    }
-
-	  // Current molecule calculation has finished. Checkpoint.
-	  thread_safe_checkpoint(mol_name.c_str(),results, currState,snapshotXML, NULL);
-
-        }
-
-      //MMPBSA is complete. Save the state and update the process on the
-      //status, if monitoring is being done, e.g. BOINC.
-      checkpoint_mmpbsa(currState);
-      outputXML->insertChild(snapshotXML);
-      currState.currentMolecule = MMPBSAState::COMPLEX;//Reset current molecule
-      currState.currentSnap += 1;
-
-#ifndef USE_MPI
-      write_mmpbsa_data(previousEnergyData,currState);
+    }
 #endif
 
-      //If there was a snapshot list, has the list been completed?
-      if(currState.snapList.size())
-	if(*(currState.snapList.end()-1) == currState.currentSnap - 1)//decrement currentSnap because it was increment above.
-	  break;
-
+#ifdef USE_SNAPSHOT_PROCESSES
+  if(use_processes)
+    run_snapshot_processes(job,&workers[0],num_workers,trajFile,currState,previousEnergyData);
+#endif
+#ifdef USE_PTHREADS
+  if(use_pipeline)
+    run_snapshot_pipeline(job,&workers[0],currState.pipeline_workers,currState.pipeline_queue,trajFile,currState,previousEnergyData);
+  else if(num_workers > 1 && !use_processes)
+    run_snapshot_threads(job,&workers[0],num_workers,trajFile,currState,previousEnergyData);
+#endif
 
-    }//end of snapshot loop
+  //Walk through the snapshots. This is where MMPBSA is actually done.
+  if(num_workers == 1 && !use_pipeline)
+    run_snapshot_loop(job,workers[0],trajFile,currState,previousEnergyData);
   study_cpu_time();
+#ifdef USE_MPI
+  finish_snapshot_schedule(run);
+#endif
+  report_convergence(run.convergence);
+
+  report_snapshot_workers(job,&workers[0],num_workers,currState);
 
   currState.fractionDone = 1.0;
   checkpoint_mmpbsa(currState);
@@ -790,6 +1083,12 @@ int mmpbsa_run(mmpbsa::MMPBSAState& currState, mmpbsa::MeadInterface& mi)
     destroy(&split_ff[i]);
   delete [] split_ff;
   delete [] atom_lists;
+  for(size_t i = 0;i<num_workers;i++)
+    destroy_snapshot_worker(workers[i]);
+  delete job_fdm;
+#ifdef USE_PTHREADS
+  pthread_mutex_destroy(&mead_mutex);
+#endif
 
 #ifdef USE_MPI
   mpi_processes_running--;
@@ -1013,12 +1312,32 @@ int parseParameter(std::map<std::string,std::string> args, mmpbsa::MMPBSAState&
 	  std::istringstream buff(it->second);
 	  buff >> currState.weight;
     	}
-      else if(it->first == "id" || it->first == "prereq")//this is used by the queue system only. Not needed for calculations.
-	continue;
+      else if(it->first == "id")//these are used by the queue system only (cf run_queue_graph). Not needed for calculations.
+	currState.queue_id = mmpbsa_utils::trimString(it->second);
+      else if(it->first == "prereq")
+	{
+	  std::string prereq;
+	  while(std::getline(buff,prereq,','))
+	    {
+	      prereq = mmpbsa_utils::trimString(prereq);
+	      if(prereq.size() && std::find(currState.prereqs.begin(),currState.prereqs.end(),prereq) == currState.prereqs.end())
+		currState.prereqs.push_back(prereq);
+	    }
+	}
       else if (it->first == "istrength")
     	{
 	  buff >> MMPBSA_FORMAT >> mi.istrength;
     	}
+      else if (it->first == "istrength_list" || it->first == "dielectric_list")
+    	{
+	  std::vector<mmpbsa_t>& sweep = (it->first == "istrength_list") ? mi.istrength_list : mi.dielectric_list;
+	  sweep.clear();
+	  mmpbsa_utils::loadListArg(it->second,sweep);
+	  for(size_t i = 0;i<sweep.size();i++)
+	    if(sweep[i] < 0 || (it->first == "dielectric_list" && sweep[i] == 0))
+	      throw mmpbsa::MMPBSAException("parse_parameters: \"" + it->second + "\" is an invalid " + it->first + ".",
+					    mmpbsa::COMMAND_LINE_ERROR);
+    	}
       else if (it->first == "surf_offset")
     	{
 	  buff >> MMPBSA_FORMAT >> mi.surf_offset;
@@ -1065,6 +1384,201 @@ int parseParameter(std::map<std::string,std::string> args, mmpbsa::MMPBSAState&
 	    throw mmpbsa::MMPBSAException("parse_parameters: \"" + it->second + "\" is an invalid verbosity level.",
 					  mmpbsa::COMMAND_LINE_ERROR);
     	}
+      else if(it->first == "fixed_grid")
+    	{
+	  mi.fixed_grid = (it->second != "0");
+    	}
+      else if(it->first == "pb_reference")
+    	{
+	  if(it->second == "solve")
+	    mi.pb_reference = MeadInterface::REFERENCE_SOLVE;
+	  else if(it->second == "cache")
+	    mi.pb_reference = MeadInterface::REFERENCE_CACHE;
+	  else if(it->second == "check")
+	    mi.pb_reference = MeadInterface::REFERENCE_CHECK;
+	  else
+	    throw mmpbsa::MMPBSAException("parse_parameters: \"" + it->second + "\" is an invalid pb_reference method. Use solve, cache or check.",
+					  mmpbsa::COMMAND_LINE_ERROR);
+	  //Cached reference energies are only valid on an unchanging grid.
+	  if(mi.pb_reference != MeadInterface::REFERENCE_SOLVE)
+	    mi.fixed_grid = true;
+    	}
+      else if(it->first == "reference_tolerance")
+    	{
+	  buff >> MMPBSA_FORMAT >> mi.reference_tolerance;
+	  if(buff.fail() || mi.reference_tolerance < 0)
+	    throw mmpbsa::MMPBSAException("parse_parameters: \"" + it->second + "\" is an invalid reference tolerance.",
+					  mmpbsa::COMMAND_LINE_ERROR);
+    	}
+      else if(it->first == "concurrent_pb")
+    	{
+	  mi.concurrent_pb = (it->second != "0");
+    	}
+      else if(it->first == "reuse_components")
+    	{
+	  currState.reuse_components = (it->second != "0");
+    	}
+      else if(it->first == "component_tolerance")
+    	{
+	  buff >> MMPBSA_FORMAT >> currState.component_tolerance;
+	  if(buff.fail() || currState.component_tolerance < 0)
+	    throw mmpbsa::MMPBSAException("parse_parameters: \"" + it->second + "\" is an invalid component tolerance.",
+					  mmpbsa::COMMAND_LINE_ERROR);
+    	}
+      else if(it->first == "pose_scoring")
+    	{
+	  currState.pose_scoring = (it->second != "0");
+    	}
+      else if(it->first == "refine_fraction")
+    	{
+	  buff >> MMPBSA_FORMAT >> currState.refine_fraction;
+	  if(buff.fail() || currState.refine_fraction < 0 || currState.refine_fraction > 1)
+	    throw mmpbsa::MMPBSAException("parse_parameters: \"" + it->second + "\" is an invalid refine fraction. It must be between 0 and 1.",
+					  mmpbsa::COMMAND_LINE_ERROR);
+    	}
+      else if(it->first == "cluster_rmsd")
+    	{
+	  buff >> MMPBSA_FORMAT >> currState.cluster_rmsd;
+	  if(buff.fail() || currState.cluster_rmsd < 0)
+	    throw mmpbsa::MMPBSAException("parse_parameters: \"" + it->second + "\" is an invalid cluster RMSD.",
+					  mmpbsa::COMMAND_LINE_ERROR);
+    	}
+      else if(it->first == "decompose")
+    	{
+	  currState.decompose = (it->second != "0");
+    	}
+      else if(it->first == "snapshot_threads")
+    	{
+#ifndef USE_PTHREADS
+	  std::cerr << "Warning: not compiled with threads. Ignoring snapshot_threads tag." << std::endl;
+	  continue;
+#endif
+	  buff >> currState.snapshot_threads;
+	  if(buff.fail() || currState.snapshot_threads < 1)
+	    {
+	      std::cerr << "Warning: '" << it->second << "' is not a valid value for the 'snapshot_threads' flag. Using one thread." << std::endl;
+	      currState.snapshot_threads = 1;
+	    }
+    	}
+      else if(it->first == "mpi_schedule")
+    	{
+	  if(it->second == "static")
+	    currState.dynamic_schedule = false;
+	  else if(it->second == "dynamic")
+	    currState.dynamic_schedule = true;
+	  else
+	    throw mmpbsa::MMPBSAException("parse_parameters: \"" + it->second + "\" is an invalid mpi_schedule. Use static or dynamic.",
+					  mmpbsa::COMMAND_LINE_ERROR);
+    	}
+      else if(it->first == "snapshot_processes")
+    	{
+	  buff >> currState.snapshot_processes;
+	  if(buff.fail() || currState.snapshot_processes < 1)
+	    {
+	      std::cerr << "Warning: '" << it->second << "' is not a valid value for the 'snapshot_processes' flag. Using one process." << std::endl;
+	      currState.snapshot_processes = 1;
+	    }
+    	}
+      else if(it->first == "pipeline")
+    	{
+#ifndef USE_PTHREADS
+	  std::cerr << "Warning: not compiled with threads. Ignoring pipeline tag." << std::endl;
+	  continue;
+#else
+	  std::vector<size_t> stage_workers;
+	  loadListArg(it->second,stage_workers);
+	  if(stage_workers.size() != PIPELINE_WRITE || mmpbsa_utils::contains(stage_workers,size_t(0)))
+	    {
+	      std::cerr << "Warning: '" << it->second << "' is not a valid value for the 'pipeline' flag. "
+			<< "It needs the number of read, MM, PB and SA threads, each at least one. Not using a pipeline." << std::endl;
+	      continue;
+	    }
+	  currState.pipeline_workers = stage_workers;
+#endif
+    	}
+      else if(it->first == "pipeline_queue")
+    	{
+	  buff >> currState.pipeline_queue;
+	  if(buff.fail() || currState.pipeline_queue < 1)
+	    throw mmpbsa::MMPBSAException("parse_parameters: \"" + it->second + "\" is an invalid pipeline queue size.",
+					  mmpbsa::COMMAND_LINE_ERROR);
+    	}
+      else if(it->first == "snap_order")
+    	{
+	  if(it->second == "trajectory")
+	    currState.progressive_order = false;
+	  else if(it->second == "progressive")
+	    currState.progressive_order = true;
+	  else
+	    throw mmpbsa::MMPBSAException("parse_parameters: \"" + it->second + "\" is an invalid snap_order. Use trajectory or progressive.",
+					  mmpbsa::COMMAND_LINE_ERROR);
+    	}
+      else if(it->first == "convergence")
+    	{
+	  buff >> MMPBSA_FORMAT >> currState.convergence;
+	  if(buff.fail() || currState.convergence < 0)
+	    throw mmpbsa::MMPBSAException("parse_parameters: \"" + it->second + "\" is an invalid standard error of convergence.",
+					  mmpbsa::COMMAND_LINE_ERROR);
+    	}
+      else if(it->first == "convergence_min" || it->first == "convergence_stall")
+    	{
+	  size_t& snapshots = (it->first == "convergence_min") ? currState.convergence_min : currState.convergence_stall;
+	  buff >> snapshots;
+	  if(buff.fail())
+	    throw mmpbsa::MMPBSAException("parse_parameters: \"" + it->second + "\" is an invalid number of snapshots for " + it->first + ".",
+					  mmpbsa::COMMAND_LINE_ERROR);
+    	}
+      else if(it->first == "grid_spacing")
+    	{
+	  buff >> MMPBSA_FORMAT >> mi.grid_spacing;
+	  if(buff.fail() || mi.grid_spacing <= 0)
+	    throw mmpbsa::MMPBSAException("parse_parameters: \"" + it->second + "\" is an invalid grid spacing.",
+					  mmpbsa::COMMAND_LINE_ERROR);
+    	}
+      else if(it->first == "grid_memory")
+    	{
+	  buff >> mi.grid_memory;
+	  if(buff.fail())
+	    throw mmpbsa::MMPBSAException("parse_parameters: \"" + it->second + "\" is an invalid grid memory size.",
+					  mmpbsa::COMMAND_LINE_ERROR);
+    	}
+      else if(it->first == "pb_solver")
+    	{
+	  if(it->second == "mead")
+	    mi.pb_solver = MeadInterface::PB_MEAD;
+	  else if(it->second == "multigrid")
+	    mi.pb_solver = MeadInterface::PB_MULTIGRID;
+	  else
+	    throw mmpbsa::MMPBSAException("parse_parameters: \"" + it->second + "\" is an invalid pb_solver. Use mead or multigrid.",
+					  mmpbsa::COMMAND_LINE_ERROR);
+    	}
+      else if(it->first == "sa_method")
+    	{
+	  if(it->second == "molsurf")
+	    mi.sa_method = MeadInterface::SA_MOLSURF;
+	  else if(it->second == "shrake_rupley")
+	    mi.sa_method = MeadInterface::SA_SHRAKE_RUPLEY;
+	  else if(it->second == "lcpo")
+	    mi.sa_method = MeadInterface::SA_LCPO;
+	  else
+	    throw mmpbsa::MMPBSAException("parse_parameters: \"" + it->second + "\" is an invalid sa_method. Use molsurf, shrake_rupley or lcpo.",
+					  mmpbsa::COMMAND_LINE_ERROR);
+    	}
+      else if(it->first == "sa_points")
+    	{
+	  buff >> mi.sa_points;
+	  if(buff.fail() || mi.sa_points == 0)
+	    throw mmpbsa::MMPBSAException("parse_parameters: \"" + it->second + "\" is an invalid number of sphere points.",
+					  mmpbsa::COMMAND_LINE_ERROR);
+    	}
+      else if(it->first == "sa_check")
+    	{
+	  mi.sa_check = (it->second != "0");
+    	}
+      else if(it->first == "sa_interface")
+    	{
+	  mi.sa_interface = (it->second != "0");
+    	}
 	else if(it->first == "overwrite")
 	  {
 	    if(it->second.size() > 0)
@@ -1084,6 +1598,17 @@ int parseParameter(std::map<std::string,std::string> args, mmpbsa::MMPBSAState&
     	}
 
     }
+  if(currState.cluster_rmsd > 0 && (currState.convergence > 0 || currState.convergence_stall > 0))
+    throw mmpbsa::MMPBSAException("parse_parameters: convergence cannot be used with cluster_rmsd, whose snapshots are weighted by cluster.",
+				  mmpbsa::COMMAND_LINE_ERROR);
+#ifdef USE_MPI
+  if(currState.convergence > 0 || currState.convergence_stall > 0)
+    throw mmpbsa::MMPBSAException("parse_parameters: convergence cannot be used with MPI, whose nodes each calculate part of the snapshots.",
+				  mmpbsa::COMMAND_LINE_ERROR);
+  if(currState.progressive_order)
+    throw mmpbsa::MMPBSAException("parse_parameters: progressive snap_order cannot be used with MPI, whose nodes divide the snapshots among themselves.",
+				  mmpbsa::COMMAND_LINE_ERROR);
+#endif
   return returnMe;
 }
 
@@ -1104,6 +1629,14 @@ std::string helpString()
     "\n\tfrom a lookup table built into mmpbsa"
     "\nistrength=<strength value>"
     "\n\t(default = 0)"
+    "\nistrength_list=<comma separated list>"
+    "\n\tIonic strengths of a PB sweep. Every combination"
+    "\n\twith dielectric_list is calculated on the same"
+    "\n\tgrid and recorded in the pb_sweep element of each"
+    "\n\tsnapshot. ELSTAT_SOLV is that of the first."
+    "\ndielectric_list=<comma separated list>"
+    "\n\tInterior dielectric constants of a PB sweep"
+    "\n\t(default = 1)"
     "\nsurf_offset=<surface offset>"
     "\n\t(default = 0.92 kcal/mol)"
     "\nsurf_tension=<surface tension value>"
@@ -1122,9 +1655,140 @@ std::string helpString()
     "\n\t1-indexed list of snapshots to be included."
     "\n\tIf this option is not used, all snapshots"
     "\n\tare calculated."
+    "\nfixed_grid=<0 or 1>"
+    "\n\tUse one finite difference grid, covering every"
+    "\n\tsnapshot, for the whole job. By default, a grid"
+    "\n\tis built for each snapshot."
+    "\npb_reference=<solve, cache or check>"
+    "\n\tHow the reference (vacuum) energy is obtained."
+    "\n\tsolve (default) solves it for every molecule."
+    "\n\tcache reuses the previous solution of a molecule"
+    "\n\twhose atoms have not moved beyond reference_tolerance."
+    "\n\tcheck solves it and reports the error the cache"
+    "\n\twould have made. cache and check imply fixed_grid=1."
+    "\nreference_tolerance=<Angstroms>"
+    "\n\t(default = 0.01)"
+    "\npb_solver=<mead or multigrid>"
+    "\n\tmead (default) solves the Poisson-Boltzmann"
+    "\n\tequation with MEAD. multigrid uses the built in"
+    "\n\tmultigrid solver, on the same grids, which is"
+    "\n\tmultithreaded with the multithread flag."
+    "\n\tpb_reference only applies to mead."
+    "\nreuse_components=<0 or 1>"
+    "\n\tReuse the energies of the complex, receptor or"
+    "\n\tligand if its coordinates and PB grid are the same"
+    "\n\tas in its last calculation, e.g. a rigid receptor."
+    "\n\tUse with fixed_grid=1. Reused energies are noted"
+    "\n\tin the snapshot's output."
+    "\ncomponent_tolerance=<Angstroms>"
+    "\n\tLargest atom displacement for which energies are"
+    "\n\treused (default = 0, i.e. identical coordinates)"
+    "\npose_scoring=<0 or 1>"
+    "\n\tScore each ligand pose by its interaction with the"
+    "\n\tpotential of the receptor, which is solved once."
+    "\n\tScores are written to the pose_scores file, if"
+    "\n\tgiven, or STDOUT. The potential is saved to and"
+    "\n\treused from the potential_grid file, if given."
+    "\nrefine_fraction=<fraction>"
+    "\n\tWith pose_scoring, perform MMPBSA on this fraction"
+    "\n\tof the best scored poses (default = 0, i.e. none)"
+    "\ncluster_rmsd=<Angstroms>"
+    "\n\tCluster snapshots whose binding sites are within"
+    "\n\tthis RMSD and perform MMPBSA only on the first"
+    "\n\tsnapshot of each cluster, whose output is weighted"
+    "\n\tby the cluster's population (default = 0, i.e. no"
+    "\n\tclustering). Not available with convergence."
+    "\ndecompose=<0 or 1>"
+    "\n\tAlso decompose the energies of each snapshot by"
+    "\n\tresidue. A table of the internal, van der Waals,"
+    "\n\telectrostatic, PB and SA energies of each residue"
+    "\n\tof each molecule is added to the snapshot's output."
+    "\nsnapshot_threads=<number>"
+    "\n\tNumber of snapshots calculated at the same time,"
+    "\n\teach by its own thread (default = 1). Output is"
+    "\n\twritten in snapshot order. MEAD solves are done one"
+    "\n\tat a time; use pb_solver=multigrid to run PB in"
+    "\n\tparallel."
+    "\nmpi_schedule=<static or dynamic>"
+    "\n\tWith MPI, how nodes divide the snapshots. static"
+    "\n\t(default): each node calculates every n-th snapshot."
+    "\n\tdynamic: nodes claim the most expensive snapshot"
+    "\n\tleft, estimated by grid size, whenever they are"
+    "\n\tready for another."
+    "\nsnapshot_processes=<number>"
+    "\n\tNumber of worker processes that calculate snapshots"
+    "\n\tat the same time (default = 1, i.e. none). Unlike"
+    "\n\tthreads, processes also run MEAD in parallel. Output"
+    "\n\tis written in snapshot order. Overrides pipeline and"
+    "\n\tsnapshot_threads. Not available with MPI."
+    "\npipeline=<read>,<MM>,<PB>,<SA>"
+    "\n\tCalculate snapshots in a pipeline of stages, with"
+    "\n\tthe given number of threads for reading, MM, PB and"
+    "\n\tSA, so that the stages of different snapshots"
+    "\n\toverlap. Occupancy and waiting time of each stage"
+    "\n\tare printed at the end. Overrides snapshot_threads."
+    "\npipeline_queue=<number>"
+    "\n\tMaximum number of snapshots waiting between two"
+    "\n\tstages of the pipeline (default = 4)"
+    "\nsnap_order=<trajectory or progressive>"
+    "\n\tOrder in which snapshots are calculated. With"
+    "\n\tprogressive, the snapshots calculated at any time"
+    "\n\tare spread over the trajectory (bit reversal)."
+    "\n\tprogressive is not available with MPI."
+    "\n\t(default = trajectory)"
+    "\nconvergence=<kcal/mol>"
+    "\n\tStop calculating snapshots once the standard error"
+    "\n\tof DELTA G, estimated with block averages, is below"
+    "\n\tthis value (default = 0, i.e. never). The estimate"
+    "\n\tis recorded in each snapshot's output."
+    "\n\tNot available with MPI."
+    "\nconvergence_min=<number>"
+    "\n\tSnapshots calculated before a job may stop for"
+    "\n\tconvergence (default = 20)"
+    "\nconvergence_stall=<number>"
+    "\n\tAlso stop once the standard error has not reached"
+    "\n\ta new minimum for this many snapshots"
+    "\n\t(default = 0, i.e. never)"
+    "\ngrid_spacing=<Angstroms>"
+    "\n\tSpacing of the finest PB grid (default = 0.25)"
+    "\ngrid_memory=<megabytes>"
+    "\n\tMemory available to the PB grids. If given, focusing"
+    "\n\tlevels are chosen for the size of the complex and"
+    "\n\tthe fine spacing is increased, if necessary, to fit."
+    "\n\tThe grid used is recorded with each snapshot."
+    "\n\t(default = 0, i.e. the usual three levels)"
+    "\nconcurrent_pb=<0 or 1>"
+    "\n\tSolve PB for the complex, receptor and ligand"
+    "\n\tof a snapshot at the same time. MEAD solves run"
+    "\n\tin separate processes, multigrid solves in threads."
+    "\nsa_method=<molsurf, shrake_rupley or lcpo>"
+    "\n\tSurface area engine. molsurf (default) is analytical."
+    "\n\tshrake_rupley samples sa_points points per atom"
+    "\n\tand is multithreaded with the multithread flag."
+    "\n\tlcpo approximates the area from Amber atom types."
+    "\nsa_points=<number>"
+    "\n\tSphere points per atom (default = 960)"
+    "\nsa_check=<0 or 1>"
+    "\n\tAlso calculate the area with molsurf and report"
+    "\n\tthe deviation of sa_method from it."
+    "\nsa_interface=<0 or 1>"
+    "\n\tCalculate the atom areas of the receptor and"
+    "\n\tligand, reusing those of a molecule that has not"
+    "\n\tmoved, and recalculate only the interface atoms"
+    "\n\tof the complex. Needs shrake_rupley or lcpo."
     "\ntrust_prmtop"
     "\n\tOverride the Parmtop sanity check."
     "\n\tUse with caution!"
+    "\nqueue_jobs=<number>"
+    "\n\tNumber of slots in which jobs of the queue run at"
+    "\n\tthe same time (default = 1, i.e. in turn). A job"
+    "\n\ttakes one slot per snapshot worker and starts once"
+    "\n\tthe jobs whose id are in its prereq list succeed."
+    "\nqueue_memory=<megabytes>"
+    "\n\tMemory of the PB grids of the jobs of the queue that"
+    "\n\trun at the same time. A job takes its grid_memory"
+    "\n\tfor each snapshot it solves at the same time"
+    "\n\t(default = 0, i.e. only queue_jobs is used)."
     "\nsample_queue=<filename>"
     "\n\tCreates a sample queue XML file.";
 }
@@ -1266,6 +1930,12 @@ bool restart_mmpbsa(mmpbsa::MMPBSAState& restartState)
         {
 	  buff >> restartState.placeInQueue;
         }
+      else if(tag == "processed_snaps")
+        {
+	  std::vector<size_t> processed;
+	  mmpbsa_utils::loadListArg(it->second,processed);
+	  restartState.processedSnaps.insert(processed.begin(),processed.end());
+        }
       else if(tag == "save_pdb" && it->second != "0")
         {
 	  restartState.savePDB == true;
@@ -1311,6 +1981,27 @@ void checkpoint_sander(mmpbsa::MMPBSAState& saveState, mmpbsa::SanderInterface&
 
 }
 
+/**
+ * Writes a set of snapshots as a list of ranges, e.g. "1-4,9", as read by loadListArg.
+ */
+std::string snapshot_ranges(const std::set<size_t>& snaps)
+{
+  std::ostringstream returnMe;
+  std::set<size_t>::const_iterator it = snaps.begin();
+  while(it != snaps.end())
+    {
+      size_t first = *it,last = *it;
+      while(++it != snaps.end() && *it == last + 1)
+	last++;
+      if(returnMe.tellp() > 0)
+	returnMe << ",";
+      returnMe << first;
+      if(last != first)
+	returnMe << "-" << last;
+    }
+  return returnMe.str();
+}
+
 void checkpoint_mmpbsa(mmpbsa::MMPBSAState& saveState)
 {
     
@@ -1324,6 +2015,8 @@ void checkpoint_mmpbsa(mmpbsa::MMPBSAState& saveState)
   checkMap["checkpoint_counter"] = buff.str();
   buff.str("");buff << saveState.placeInQueue;
   checkMap["queue_position"] = buff.str();
+  if(saveState.processedSnaps.size())
+    checkMap["processed_snaps"] = snapshot_ranges(saveState.processedSnaps);
 
   if(saveState.savePDB)
     checkMap["save_pdb"] = "1";
@@ -1475,6 +2168,379 @@ std::vector<mmpbsa::MMPBSAState>& getQueueFile(std::vector<mmpbsa::MMPBSAState>&
   return returnMe;
 }
 
+int get_queue_jobs(int argc, char** argv)
+{
+  int returnMe = 1;
+  std::string arg;
+  for(int i = 1;i<argc;i++)
+    {
+      arg = argv[i];
+      if(arg.substr(0,2) == "--")
+	arg.erase(0,2);
+      if(arg.substr(0,arg.find("=")) != "queue_jobs")
+	continue;
+      std::istringstream buff(arg.substr(arg.find("=")+1));
+      buff >> returnMe;
+      if(buff.fail() || returnMe < 1)
+	{
+	  std::cerr << "Warning: '" << arg << "' is not a valid number of queue jobs. Running jobs one after another." << std::endl;
+	  returnMe = 1;
+	}
+    }
+  return returnMe;
+}
+
+size_t get_queue_memory(int argc, char** argv)
+{
+  size_t returnMe = 0;
+  std::string arg;
+  for(int i = 1;i<argc;i++)
+    {
+      arg = argv[i];
+      if(arg.substr(0,2) == "--")
+	arg.erase(0,2);
+      if(arg.substr(0,arg.find("=")) != "queue_memory")
+	continue;
+      std::istringstream buff(arg.substr(arg.find("=")+1));
+      buff >> returnMe;
+      if(buff.fail())
+	{
+	  std::cerr << "Warning: '" << arg << "' is not a valid queue memory size. Not limiting the memory of the queue." << std::endl;
+	  returnMe = 0;
+	}
+    }
+  return returnMe;
+}
+
+int run_queue_job(mmpbsa::MMPBSAState& job, int& queuePosition)
+{
+  using mmpbsa::MMPBSAState;
+  int retval = 0;
+  switch(job.currentProcess)
+    {
+    case MMPBSAState::SANDER:
+      restart_sander(job,job.currentSI);
+      if(job.placeInQueue > queuePosition)
+	{
+	  queuePosition++;
+	  return 0;
+	}
+      else if(job.placeInQueue < queuePosition)
+	{
+	  job.currentSI.completed = false;
+	  job.fractionDone = 0;
+	  job.placeInQueue = queuePosition;
+	}
+      retval = sander_run(job,job.currentSI);
+      break;
+    case MMPBSAState::MOLSURF:
+      if(job.placeInQueue > queuePosition)
+	{
+	  queuePosition++;
+	  return 0;
+	}
+      else if(job.placeInQueue < queuePosition)
+	{
+	  job.placeInQueue = queuePosition;
+	}
+      molsurf_run(job);
+      break;
+    case MMPBSAState::MMPBSA:
+      restart_mmpbsa(job);
+      if(job.placeInQueue > queuePosition)
+	{
+	  queuePosition++;
+	  return 0;
+	}
+      else if(job.placeInQueue < queuePosition)
+	{
+	  job.fractionDone = 0;
+	  job.placeInQueue = queuePosition;
+	}
+      retval = mmpbsa_run(job,job.currentMI);
+#ifdef USE_MPI
+      if(has_filename(MMPBSA_OUT_TYPE,job))
+	mmpbsa_output_filename = get_filename(MMPBSA_OUT_TYPE,job);
+      else if(has_filename(SANDER_MDOUT_TYPE,job))
+	mmpbsa_output_filename = get_filename(SANDER_MDOUT_TYPE,job);
+#endif
+      break;
+    }
+  return retval;
+}
+
+void cache_shared_topologies(const std::vector<mmpbsa::MMPBSAState>& queue)
+{
+  std::map<std::string,size_t> users;
+  for(std::vector<mmpbsa::MMPBSAState>::const_iterator job = queue.begin();job != queue.end();job++)
+    if(job->currentProcess == mmpbsa::MMPBSAState::MMPBSA && has_filename(MMPBSA_TOPOLOGY_TYPE,*job))
+      users[get_filename(MMPBSA_TOPOLOGY_TYPE,*job)]++;
+
+  for(std::map<std::string,size_t>::const_iterator it = users.begin();it != users.end();it++)
+    {
+      if(it->second < 2 || topology_cache.find(it->first) != topology_cache.end())
+	continue;
+      mmpbsa::SanderParm* sp = new mmpbsa::SanderParm;
+      try
+	{
+	  sp->raw_read_amber_parm(it->first);
+	}
+      catch(mmpbsa::MMPBSAException e)
+	{
+	  delete sp;
+	  continue;
+	}
+      topology_cache[it->first] = sp;
+      std::cout << "Topology " << it->first << " is shared by " << it->second << " jobs and was read once." << std::endl;
+    }
+}
+
+void free_topology_cache()
+{
+  for(std::map<std::string,mmpbsa::SanderParm*>::iterator it = topology_cache.begin();it != topology_cache.end();it++)
+    delete it->second;
+  topology_cache.clear();
+}
+
+#ifdef USE_SNAPSHOT_PROCESSES
+/**
+ * Name of a job of the queue in messages: its id or, if it has none, its place in the queue.
+ */
+std::string queue_job_name(const std::vector<mmpbsa::MMPBSAState>& queue, const size_t& job)
+{
+  if(queue[job].queue_id.size())
+    return "\"" + queue[job].queue_id + "\"";
+  std::ostringstream name;
+  name << "#" << job + 1;
+  return name.str();
+}
+
+/**
+ * Number of the queue_jobs slots taken by a job: the number of snapshots
+ * it calculates at the same time.
+ */
+int queue_job_slots(const mmpbsa::MMPBSAState& job)
+{
+  int returnMe = 1;
+  if(job.currentProcess != mmpbsa::MMPBSAState::MMPBSA)
+    return returnMe;
+  if(job.snapshot_processes > 1)
+    return job.snapshot_processes;
+  if(job.pipeline_workers.size())
+    {
+      returnMe = 0;
+      for(size_t i = 0;i<job.pipeline_workers.size();i++)
+	returnMe += job.pipeline_workers[i];
+      return returnMe;
+    }
+  if(job.snapshot_threads > 1)
+    returnMe = job.snapshot_threads;
+  return returnMe;
+}
+
+/**
+ * Megabytes of PB grids held at once by a job: the grid_memory ceiling within which
+ * each snapshot's grids are planned (cf MeadInterface::plan_grid), for each snapshot
+ * it solves at the same time. Zero if the job has no grid_memory, as its grids are
+ * then not planned within a ceiling.
+ */
+size_t queue_job_memory(const mmpbsa::MMPBSAState& job)
+{
+  if(job.currentProcess != mmpbsa::MMPBSAState::MMPBSA)
+    return 0;
+  size_t solves = 1;
+  if(job.snapshot_processes > 1)
+    solves = job.snapshot_processes;
+#ifdef USE_PTHREADS
+  else if(job.pipeline_workers.size())
+    solves = job.pipeline_workers.at(mmpbsa::PIPELINE_PB);
+#endif
+  else if(job.snapshot_threads > 1)
+    solves = job.snapshot_threads;
+  return solves*job.currentMI.grid_memory;
+}
+
+int run_queue_graph(std::vector<mmpbsa::MMPBSAState>& queue, const int& max_slots, const size_t& max_memory) throw (mmpbsa::MMPBSAException)
+{
+  using mmpbsa::MMPBSAException;
+  enum {JOB_WAITING = 0, JOB_RUNNING, JOB_SUCCEEDED, JOB_FAILED, JOB_SKIPPED};
+
+  //Find the jobs on which each job depends.
+  std::map<std::string,size_t> ids;
+  std::map<std::string,size_t> checkpoints;
+  for(size_t i = 0;i<queue.size();i++)
+    {
+      if(queue[i].queue_id.size())
+	{
+	  if(ids.find(queue[i].queue_id) != ids.end())
+	    throw MMPBSAException("run_queue_graph: More than one job has the id \"" + queue[i].queue_id + "\".",mmpbsa::BAD_XML_TAG);
+	  ids[queue[i].queue_id] = i;
+	}
+      //Jobs that run at the same time cannot share a checkpoint file.
+      if(has_filename(CHECKPOINT_FILE_TYPE,queue[i]))
+	{
+	  const std::string& checkpoint = get_filename(CHECKPOINT_FILE_TYPE,queue[i]);
+	  if(checkpoints.find(checkpoint) != checkpoints.end())
+	    throw MMPBSAException("run_queue_graph: Jobs " + queue_job_name(queue,checkpoints[checkpoint]) + " and "
+				  + queue_job_name(queue,i) + " share the checkpoint file " + checkpoint
+				  + ". Give each job its own to run them at the same time.",mmpbsa::COMMAND_LINE_ERROR);
+	  checkpoints[checkpoint] = i;
+	}
+    }
+  std::vector<std::vector<size_t> > prereqs(queue.size());
+  for(size_t i = 0;i<queue.size();i++)
+    for(size_t j = 0;j<queue[i].prereqs.size();j++)
+      {
+	std::map<std::string,size_t>::const_iterator prereq = ids.find(queue[i].prereqs[j]);
+	if(prereq == ids.end())
+	  throw MMPBSAException("run_queue_graph: Job " + queue_job_name(queue,i) + " needs the job \""
+				+ queue[i].prereqs[j] + "\", which is not in the queue.",mmpbsa::BAD_XML_TAG);
+	prereqs[i].push_back(prereq->second);
+      }
+
+  //Every job must be reachable, i.e. the dependencies have no cycle.
+  std::vector<bool> ordered(queue.size(),false);
+  size_t num_ordered = 0;
+  for(bool progress = true;progress;)
+    {
+      progress = false;
+      for(size_t i = 0;i<queue.size();i++)
+	{
+	  if(ordered[i])
+	    continue;
+	  size_t j = 0;
+	  while(j < prereqs[i].size() && ordered[prereqs[i][j]])
+	    j++;
+	  if(j < prereqs[i].size())
+	    continue;
+	  ordered[i] = progress = true;
+	  num_ordered++;
+	}
+    }
+  if(num_ordered < queue.size())
+    {
+      std::string cycle;
+      for(size_t i = 0;i<queue.size();i++)
+	if(!ordered[i])
+	  cycle += " " + queue_job_name(queue,i);
+      throw MMPBSAException("run_queue_graph: The prerequisites of these jobs form a cycle:" + cycle,mmpbsa::BAD_XML_TAG);
+    }
+
+  //Memory taken by each job from the queue_memory budget.
+  std::vector<size_t> memory(queue.size(),0);
+  for(size_t i = 0;max_memory && i<queue.size();i++)
+    {
+      memory[i] = queue_job_memory(queue[i]);
+      if(queue[i].currentProcess == mmpbsa::MMPBSAState::MMPBSA && memory[i] == 0)
+	std::cerr << "Warning: job " << queue_job_name(queue,i) << " has no grid_memory, so the memory of its PB grids "
+		  << "is not known and is not counted against queue_memory." << std::endl;
+      else if(memory[i] > max_memory)
+	std::cerr << "Warning: job " << queue_job_name(queue,i) << " may use " << memory[i] << " MB of PB grids, more than "
+		  << "queue_memory. It will run alone." << std::endl;
+    }
+
+  //Buffered output would otherwise be written by each process.
+  std::cout.flush();
+  std::cerr.flush();
+  fflush(stdout);
+  fflush(stderr);
+
+  std::vector<int> status(queue.size(),JOB_WAITING);
+  std::map<pid_t,size_t> running;
+  int used_slots = 0;
+  size_t used_memory = 0;
+  int returnMe = 0;
+  while(true)
+    {
+      //Skip the jobs whose prerequisites did not succeed.
+      for(bool skipped = true;skipped;)
+	{
+	  skipped = false;
+	  for(size_t i = 0;i<queue.size();i++)
+	    for(size_t j = 0;status[i] == JOB_WAITING && j<prereqs[i].size();j++)
+	      if(status[prereqs[i][j]] == JOB_FAILED || status[prereqs[i][j]] == JOB_SKIPPED)
+		{
+		  std::cerr << "Skipping job " << queue_job_name(queue,i) << " because job "
+			    << queue_job_name(queue,prereqs[i][j]) << " did not succeed." << std::endl;
+		  status[i] = JOB_SKIPPED;
+		  skipped = true;
+		}
+	}
+
+      //Start the jobs that are ready, in queue order, while their slots fit.
+      bool fork_failed = false;
+      for(size_t i = 0;i<queue.size() && !fork_failed;i++)
+	{
+	  if(status[i] != JOB_WAITING)
+	    continue;
+	  bool ready = true;
+	  for(size_t j = 0;j<prereqs[i].size();j++)
+	    ready &= (status[prereqs[i][j]] == JOB_SUCCEEDED);
+	  if(!ready)
+	    continue;
+	  int slots = queue_job_slots(queue[i]);
+	  if(running.size() && (used_slots + slots > max_slots || (max_memory && used_memory + memory[i] > max_memory)))
+	    continue;
+
+	  pid_t pid = fork();
+	  if(pid == 0)
+	    {
+	      int retval;
+	      int queuePosition = i;
+	      try
+		{
+		  retval = run_queue_job(queue[i],queuePosition);
+		}
+	      catch(MMPBSAException e)
+		{
+		  std::cerr << e.identifier() << ": " << e.what() << std::endl;
+		  retval = e.getErrType();
+		}
+	      std::cout.flush();
+	      std::cerr.flush();
+	      _exit((retval & 0xff) == retval ? retval : EXIT_CHILD_FAILED);
+	    }
+	  if(pid < 0)
+	    {
+	      if(running.size() == 0)
+		throw MMPBSAException("run_queue_graph: Could not start a process for job " + queue_job_name(queue,i) + ".",mmpbsa::SYSTEM_ERROR);
+	      fork_failed = true;//retry once a job has finished.
+	      continue;
+	    }
+	  std::cout << "Started job " << queue_job_name(queue,i) << " (" << pid << ")" << std::endl;
+	  status[i] = JOB_RUNNING;
+	  running[pid] = i;
+	  used_slots += slots;
+	  used_memory += memory[i];
+	}
+      if(running.size() == 0)
+	break;
+
+      int child_status;
+      pid_t pid = waitpid(-1,&child_status,0);
+      if(pid < 0)
+	{
+	  if(errno == EINTR)
+	    continue;
+	  throw MMPBSAException("run_queue_graph: Could not wait for the jobs of the queue.",mmpbsa::SYSTEM_ERROR);
+	}
+      std::map<pid_t,size_t>::iterator finished = running.find(pid);
+      if(finished == running.end())
+	continue;
+      size_t job = finished->second;
+      running.erase(finished);
+      used_slots -= queue_job_slots(queue[job]);
+      used_memory -= memory[job];
+      int retval = (WIFEXITED(child_status)) ? WEXITSTATUS(child_status) : EXIT_CHILD_FAILED;
+      status[job] = (retval == 0) ? JOB_SUCCEEDED : JOB_FAILED;
+      std::cout << "Job " << queue_job_name(queue,job) << " finished (" << retval << ")" << std::endl;
+      if(retval && returnMe == 0)
+	returnMe = retval;
+    }
+  return returnMe;
+}
+#endif
+
 void sampleQueue(const std::string& filename)
 {
   using std::map;
@@ -1566,61 +2632,6 @@ void update_gshmem()
 #endif
 }
 
-#if 0//why use threads if it's not supported in mead or molsurf
-void *do_mmpbsa_calculation_thread(void* args)
-{
-  struct mmpbsa_thread_arg * thread_args = (mmpbsa_thread_arg*) args;
-  if(thread_args == 0)
-    throw mmpbsa::MMPBSAException("do_mmpbsa_calculation_thread: given null pointer for argument structure");
-  mmpbsa::EMap theEMap = mmpbsa::MeadInterface::full_EMap(*thread_args->atoms,*thread_args->ff,*thread_args->snap,
-							  *thread_args->fdm,
-							  *thread_args->pradii,*thread_args->residues,thread_args->mi->istrength,
-							  thread_args->mi->surf_tension,thread_args->mi->surf_offset);
-  thread_safe_checkpoint(thread_args->next_mole,thread_args->mole_name,
-			 theEMap,*thread_args->currState,thread_args->snapshotXML,thread_args->mmpbsa_mutex);
-#ifdef USE_PTHREADS
-  std::cout << "Finished " << thread_args->mole_name << std::endl;
-  delete thread_args;
-#endif
-}
-
-int do_mmpbsa_calculation(void* thread_object,int useMultithread,
-			  const std::vector<mmpbsa::atom_t>& atoms, const mmpbsa::forcefield_t& ff,
-			  const std::valarray<mmpbsa::Vector>& Snap,
-			  const FinDiffMethod& fdm,const std::map<std::string,float>& radii,
-			  const std::map<std::string,std::string>& residues,
-			  const mmpbsa::MeadInterface& mi,
-			  mmpbsa::MMPBSAState& currState,mmpbsa_utils::XMLNode* snapshotXML,
-			  mmpbsa::MMPBSAState::MOLECULE next_mole, const char* mole_name, void * mmpbsa_mutex)
-{
-  struct mmpbsa_thread_arg * pass_these = new struct mmpbsa_thread_arg;
-  pass_these->atoms = &atoms;
-  pass_these->ff = &ff;
-  pass_these->snap = &Snap;
-  pass_these->fdm = &fdm;
-  pass_these->pradii = &radii;
-  pass_these->residues = &residues;
-  pass_these->mi = &mi;
-  pass_these->currState = &currState;
-  pass_these->snapshotXML = snapshotXML;
-  pass_these->next_mole = next_mole;
-  pass_these->mmpbsa_mutex = mmpbsa_mutex;
-  pass_these->mole_name = mole_name;
-
-
-#ifdef USE_PTHREADS
-  if(useMultithread)
-    {
-      std::cout << "Running thread " << mole_name << "(" << &pass_these << ", " << pass_these->snap <<  ")" << std::endl;
-      return pthread_create((pthread_t*)thread_object,&attr,do_mmpbsa_calculation_thread,(void*) pass_these);
-    }
-#endif
-  std::cout << "Calculating " << mole_name << std::endl;
-  (*do_mmpbsa_calculation_thread)((void*) pass_these);
-  return 0;
-}
-#endif
-
 void thread_safe_checkpoint(const char* mole_name,
 			    const mmpbsa::EMap& EMap, mmpbsa::MMPBSAState& currState,
 			    mmpbsa_utils::XMLNode* snapshotXML, void * mmpbsa_mutex)
@@ -4,6 +4,10 @@
 #include <cstdlib>
 #include <iostream>
 #include <valarray>
+#include <set>
+#include <map>
+#include <deque>
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 #include <time.h>
@@ -21,11 +25,20 @@
 #include "libmmpbsa/EmpEnerFun.h"
 #include "libmmpbsa/EMap.h"
 #include "libmmpbsa/MeadInterface.h"
+#include "libmmpbsa/PBMultigrid.h"
+#include "libmmpbsa/PotentialGrid.h"
+#include "libmmpbsa/Decomposition.h"
 #include "libmmpbsa/XMLParser.h"
 #include "libmmpbsa/XMLNode.h"
 #include "libmmpbsa/SanderParm.h"
 #include "libmmpbsa/SanderInterface.h"
 #include "libmmpbsa/MMPBSAState.h"
+#include "libmmpbsa/SnapshotJob.h"
+#include "libmmpbsa/SnapshotSerial.h"
+#include "libmmpbsa/SnapshotThreads.h"
+#include "libmmpbsa/SnapshotPipeline.h"
+#include "libmmpbsa/SnapshotProcesses.h"
+#include "libmmpbsa/TprReader.h"
 
 #if USE_GZIP
 #include "libmmpbsa/Zipper.h"
@@ -38,6 +51,7 @@
 
 
 #include "MEAD/FinDiffMethod.h"
+#include "MEAD/AtomSet.h"
 
 #ifdef USE_BOINC
 #include "boinc/boinc_api.h"
@@ -60,21 +74,36 @@ double netCPUTime;
 static int mmpbsa_verbosity;
 
 #ifdef USE_PTHREADS
+#include <pthread.h>
+#include <sys/time.h>
 pthread_mutex_t mmpbsa_mutex;
 pthread_attr_t attr;
 #else
 unsigned short mmpbsa_mutex;
 #endif
 
+#ifdef USE_SNAPSHOT_PROCESSES
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#endif
+
 #ifdef USE_MPI
+#include <mpi.h>
 #include "mmpbsa_mpi.h"
 int mpi_rank,mpi_size;
 size_t mpi_processes_running;
 mmpbsa_utils::XMLNode* data_list;
 std::map<int,std::string> data_fragments;///<Storage container for fragment data send via MPI_Send from child nodes.
+std::string mmpbsa_output_filename;///<File to which the master writes the data of the nodes (cf mpi_dump_data)
 #endif
 
 std::vector<mmpbsa::MMPBSAState> processQueue;///<Array of calculations to be run by the program.
+std::map<std::string,mmpbsa::SanderParm*> topology_cache;///<Topologies used by several jobs of the queue, by filename (cf cache_shared_topologies)
 
 /**
  * Pulls everything together to perform the MMPBSA calculations.
@@ -157,6 +186,48 @@ const std::string& get_filename(const std::string& filetype, const mmpbsa::MMPBS
 
 std::vector<mmpbsa::MMPBSAState>& getQueueFile(std::vector<mmpbsa::MMPBSAState>& queue_vector, int argc,char** argv);
 
+/**
+ * Reads the number of job slots of the queue (queue_jobs flag) from the command line.
+ * Default: 1, i.e. jobs are run one after another.
+ */
+int get_queue_jobs(int argc, char** argv);
+
+/**
+ * Reads the memory budget, in megabytes, of the jobs of the queue that run at the same
+ * time (queue_memory flag) from the command line. Default: 0, i.e. no budget.
+ */
+size_t get_queue_memory(int argc, char** argv);
+
+/**
+ * Runs a job of the queue at the given place in it. If its checkpoint shows
+ * that the queue has already passed it, the job is skipped and queuePosition
+ * is advanced.
+ *
+ * @return error code of the job, zero if it succeeded.
+ */
+int run_queue_job(mmpbsa::MMPBSAState& job, int& queuePosition);
+
+/**
+ * Reads each topology used by more than one MMPBSA job of the queue once and
+ * stores it in topology_cache, from which get_sander_forcefield copies it.
+ * A topology that cannot be read is left to the jobs, which report the error.
+ */
+void cache_shared_topologies(const std::vector<mmpbsa::MMPBSAState>& queue);
+void free_topology_cache();
+
+#ifdef USE_SNAPSHOT_PROCESSES
+/**
+ * Runs the jobs of the queue as a graph of dependencies (cf id and prereq), each
+ * in a forked process. A job starts once the jobs named in its prereq list have
+ * succeeded, and jobs run at the same time as long as their slots (cf queue_job_slots)
+ * fit in max_slots and, if max_memory is not zero, the megabytes of their PB grids
+ * (cf queue_job_memory) fit in max_memory. Jobs depending on one that failed are skipped.
+ *
+ * @return error code of the first job that failed, zero if all succeeded.
+ */
+int run_queue_graph(std::vector<mmpbsa::MMPBSAState>& queue, const int& max_slots, const size_t& max_memory) throw (mmpbsa::MMPBSAException);
+#endif
+
 /**
  * Creates a string about the usage of the program, listing the parameters and
  * flags. This string should be sent to STDOUT, if "--help" is provided as a flag.
@@ -233,35 +304,21 @@ double overallFractionDone();
 void send_status_message(mmpbsa::SanderInterface& si, double frac_done,
         double checkpoint_cpu_time);
 
-int do_mmpbsa_calculation(void* thread_object,int useMultithread,const std::vector<mmpbsa::atom_t>& atoms,
-		const mmpbsa::forcefield_t& ff, const std::valarray<mmpbsa::Vector>& Snap,
-		const FinDiffMethod& fdm,const std::map<std::string,float>& radii,
-		const std::map<std::string,std::string>& residues,
-		const mmpbsa::MeadInterface& mi,
-		mmpbsa::MMPBSAState& currState,mmpbsa_utils::XMLNode* snapshotXML,
-		mmpbsa::MMPBSAState::MOLECULE next_mole, const char* mole_name, void * mmpbsa_mutex);
-
 void thread_safe_checkpoint(const char* mole_name,
 		const mmpbsa::EMap& EMap, mmpbsa::MMPBSAState& currState,
 		mmpbsa_utils::XMLNode* snapshotXML, void * mmpbsa_mutex);
 
-struct mmpbsa_thread_arg
-{
-	const std::vector<mmpbsa::atom_t>* atoms;
-	const mmpbsa::forcefield_t* ff;
-	const std::valarray<mmpbsa::Vector>* snap;
-	const FinDiffMethod* fdm;
-	const std::map<std::string,float>* pradii;
-	const std::map<std::string,std::string>* residues;
-	const mmpbsa::MeadInterface* mi;
-	mmpbsa::MMPBSAState* currState;
-	mmpbsa_utils::XMLNode* snapshotXML;
-	mmpbsa::MMPBSAState::MOLECULE next_mole;
-	const char* mole_name;
-	void * mmpbsa_mutex;
-};
-
+/**
+ * Electrostatic interaction energy (kcal/mol) of the ligand of a snapshot with the
+ * precomputed receptor potential.
+ */
+typedef struct {
+	size_t snapshot;
+	mmpbsa_t score;
+}pose_score_t;
 
+//Distance (Angstroms) by which the receptor potential grid extends beyond the ligand poses.
+#define MMPBSA_POSE_GRID_MARGIN 2.0
 
 #endif	/* MMPBSA_H */
 
@@ -58,8 +58,20 @@ typedef struct{
 typedef struct{
   size_t molsurf_dependent[NUM_MOLECULES], molsurf_independent[NUM_MOLECULES];
   mmpbsa_analyzer_data averages[NUM_MOLECULES],stddev[NUM_MOLECULES];
+  size_t representatives;///<Number of snapshots in the data, regardless of weight, i.e. of independent samples
 }mmpbsa_analyzer_average;
 
+/**
+ * Sums of the change in PB energy for each condition of a PB sweep
+ * (cf istrength_list and dielectric_list of mmpbsa).
+ */
+typedef struct{
+  std::vector<std::string> conditions;///<"ionic_strength interior_dielectric"
+  std::vector<mmpbsa_t> sum, sumsq;
+  size_t count;///<Number of snapshots represented (cf snapshot_weight)
+  size_t representatives;///<Number of snapshots in the data, regardless of weight
+}mmpbsa_analyzer_sweep;
+
 
 /**
  * Possible options provided to the command line.
@@ -181,7 +193,12 @@ void finalize_average(mmpbsa_analyzer_average& avg)
   
 }
 
-void average_data(const mmpbsa::EMap& new_emap, mmpbsa_analyzer_average& avg, mmpbsa::EMap& curr_delta,int molecule)
+/**
+ * Adds the energies of a molecule of a snapshot to the averages, as many times as the
+ * snapshot's weight (cf snapshot_weight), and to the snapshot's change in energy.
+ */
+void average_data(const mmpbsa::EMap& new_emap, mmpbsa_analyzer_average& avg, mmpbsa::EMap& curr_delta,int molecule,
+		  const size_t& weight = 1)
 {
   mmpbsa_t curr_data;
   size_t i;//index into arrays 0 <= i < NUM_MOLECULES
@@ -190,37 +207,37 @@ void average_data(const mmpbsa::EMap& new_emap, mmpbsa_analyzer_average& avg, mm
 
   i = (size_t) molecule;
   curr_data = new_emap.total_elec_energy();
-  avg.averages[i].ele += curr_data;
-  avg.stddev[i].ele += curr_data*curr_data;
+  avg.averages[i].ele += weight*curr_data;
+  avg.stddev[i].ele += weight*curr_data*curr_data;
   
   curr_data = new_emap.total_vdw_energy();
-  avg.averages[i].vdw += curr_data; 
-  avg.stddev[i].vdw += curr_data*curr_data; 
+  avg.averages[i].vdw += weight*curr_data; 
+  avg.stddev[i].vdw += weight*curr_data*curr_data; 
   
   curr_data = new_emap.total_internal_energy();
-  avg.averages[i].internal += curr_data;
-  avg.stddev[i].internal += curr_data*curr_data;
+  avg.averages[i].internal += weight*curr_data;
+  avg.stddev[i].internal += weight*curr_data*curr_data;
   
   curr_data = new_emap.total_gas_energy();
-  avg.averages[i].gas += curr_data;
-  avg.stddev[i].gas += curr_data*curr_data;
+  avg.averages[i].gas += weight*curr_data;
+  avg.stddev[i].gas += weight*curr_data*curr_data;
   
   curr_data = new_emap.elstat_solv;
-  avg.averages[i].pbsolv += curr_data;
-  avg.stddev[i].pbsolv += curr_data*curr_data;
+  avg.averages[i].pbsolv += weight*curr_data;
+  avg.stddev[i].pbsolv += weight*curr_data*curr_data;
 
-  avg.molsurf_independent[i]++;
+  avg.molsurf_independent[i] += weight;
 
   if(!new_emap.molsurf_failed)
     {
       curr_data = new_emap.sasol;
-      avg.averages[i].pbsur += curr_data;
-      avg.stddev[i].pbsur += curr_data*curr_data;
+      avg.averages[i].pbsur += weight*curr_data;
+      avg.stddev[i].pbsur += weight*curr_data*curr_data;
       
       curr_data = new_emap.area;
-      avg.averages[i].area += curr_data;
-      avg.stddev[i].area += curr_data*curr_data;
-      avg.molsurf_dependent[i]++;
+      avg.averages[i].area += weight*curr_data;
+      avg.stddev[i].area += weight*curr_data*curr_data;
+      avg.molsurf_dependent[i] += weight;
     }
 
   if(molecule == COMPLEX)
@@ -263,6 +280,7 @@ int sanity_check_average(mmpbsa_analyzer_average& avg)
 
 void init_average(mmpbsa_analyzer_average& avg)
 {
+  avg.representatives = 0;
   for(size_t i = 0;i<NUM_MOLECULES;i++)
     {
       avg.molsurf_dependent[i] = avg.molsurf_independent[i] = 0;
@@ -277,6 +295,112 @@ void init_average(mmpbsa_analyzer_average& avg)
     }
 }
 
+/**
+ * Adds the change in PB energy (complex - receptor - ligand) of each condition
+ * in the snapshot's pb_sweep element to the sweep sums, as many times as the
+ * snapshot's weight.
+ */
+void average_pb_sweep(const mmpbsa_utils::XMLNode* sweep, mmpbsa_analyzer_sweep& sweep_avg, const size_t& weight = 1)
+{
+  std::vector<std::string> conditions;
+  std::vector<mmpbsa_t> delta;
+  size_t num_molecules = 0;
+  const mmpbsa_utils::XMLNode* child;
+  for(child = sweep->children;child != 0;child = child->siblings)
+    if(child->getName() == "condition")
+      conditions.push_back(child->getText());
+  delta.assign(conditions.size(),0);
+  for(child = sweep->children;child != 0;child = child->siblings)
+    {
+      mmpbsa_t sign;
+      if(child->getName() == "COMPLEX")
+	sign = 1;
+      else if(child->getName() == "RECEPTOR" || child->getName() == "LIGAND")
+	sign = -1;
+      else
+	continue;
+      std::istringstream energies(child->getText());
+      mmpbsa_t energy;
+      for(size_t i = 0;i<conditions.size();i++)
+	{
+	  energies >> energy;
+	  if(energies.fail())
+	    throw mmpbsa::MMPBSAException("average_pb_sweep: " + child->getName() + " does not have an energy for each condition.",mmpbsa::DATA_FORMAT_ERROR);
+	  delta[i] += sign*energy;
+	}
+      num_molecules++;
+    }
+  if(num_molecules != 3)
+    throw mmpbsa::MMPBSAException("average_pb_sweep: A snapshot's pb_sweep does not have a complex, receptor and ligand.",mmpbsa::DATA_FORMAT_ERROR);
+
+  if(sweep_avg.count == 0)
+    {
+      sweep_avg.conditions = conditions;
+      sweep_avg.sum.assign(conditions.size(),0);
+      sweep_avg.sumsq.assign(conditions.size(),0);
+    }
+  else if(sweep_avg.conditions != conditions)
+    throw mmpbsa::MMPBSAException("average_pb_sweep: Snapshots have different PB sweep conditions.",mmpbsa::DATA_FORMAT_ERROR);
+  for(size_t i = 0;i<delta.size();i++)
+    {
+      sweep_avg.sum[i] += weight*delta[i];
+      sweep_avg.sumsq[i] += weight*delta[i]*delta[i];
+    }
+  sweep_avg.count += weight;
+  sweep_avg.representatives++;
+}
+
+/**
+ * Standard error of an average, estimated from its standard deviation and the number
+ * of independent samples, i.e. of snapshots in the data rather than those they represent.
+ */
+mmpbsa_t standard_error(const mmpbsa_t& stddev, const size_t& samples)
+{
+	if(samples == 0)
+		return 0;
+	return stddev/sqrt((mmpbsa_t)samples);
+}
+
+/**
+ * Writes the average, standard deviation and standard error of the change in PB energy
+ * for each condition of the PB sweep, if there was one. Standard errors are estimated
+ * from the number of snapshots in the data, as the copies of a clustered snapshot
+ * (cf snapshot_weight) are not independent samples.
+ */
+void summarize_pb_sweep(std::ostream* output, const mmpbsa_analyzer_sweep& sweep_avg)
+{
+	using std::ios;
+	if(output == 0 || sweep_avg.count == 0)
+		return;
+
+	*output << "PB sweep of " << sweep_avg.representatives << " snapshots";
+	if(sweep_avg.count != sweep_avg.representatives)
+		*output << " (cluster representatives), weighted to represent " << sweep_avg.count;
+	*output << "." << std::endl;
+	output->flags(ios::left|ios::fixed);output->width(12);
+	*output << "ISTRENGTH";output->width(12);
+	*output << "EPS_IN";output->flags(ios::right|ios::fixed);output->width(12);
+	*output << "PBSOLV";output->width(12);
+	*output << "STD";output->width(12);
+	*output << "SEM" << std::endl;
+	for(size_t i = 0;i<sweep_avg.conditions.size();i++)
+	{
+		std::istringstream condition(sweep_avg.conditions[i]);
+		std::string strength,dielectric;
+		condition >> strength >> dielectric;
+		mmpbsa_t average = sweep_avg.sum[i]/sweep_avg.count;
+		mmpbsa_t variance = sweep_avg.sumsq[i]/sweep_avg.count - average*average;
+		output->precision(2);
+		output->flags(ios::left|ios::fixed);output->width(12);
+		*output << strength;output->width(12);
+		*output << dielectric;output->flags(ios::right|ios::fixed);output->width(12);
+		*output << average;output->width(12);
+		mmpbsa_t stddev = sqrt((variance > 0) ? variance : 0);
+		*output << stddev;output->width(12);
+		*output << standard_error(stddev,sweep_avg.representatives) << std::endl;
+	}
+}
+
 void summarize_delta(std::ostream* output, mmpbsa_analyzer_average& avg)
 {
 	using std::ios;
@@ -287,56 +411,64 @@ void summarize_delta(std::ostream* output, mmpbsa_analyzer_average& avg)
 	output->flags(ios::left|ios::fixed);output->width(12);
 	*output << " ";output->flags(ios::internal|ios::fixed);
 	output->width(18);
-	*output << mole2str(DELTA) << std::endl;
+	*output << mole2str(DELTA);output->width(18);
+	*output << "SEM" << std::endl;
 
 	//ELE = vacele + ele14
 	output->flags(ios::left|ios::fixed);output->width(12);
 	*output << "ELE";output->flags(ios::right|ios::fixed);
 	output->width(12);
 	*output << avg.averages[DELTA].ele;output->width(12);
-	*output << avg.stddev[DELTA].ele;*output << std::endl;
+	*output << avg.stddev[DELTA].ele;output->width(12);
+	*output << standard_error(avg.stddev[DELTA].ele,avg.representatives);*output << std::endl;
 
 	//VDW = vdwaals + vdw14
 	output->flags(ios::left|ios::fixed);output->width(12);
 	*output << "VDW";output->flags(ios::right|ios::fixed);
 	output->width(12);
 	*output << avg.averages[DELTA].vdw;output->width(12);
-	*output << avg.stddev[DELTA].vdw;*output << std::endl;
+	*output << avg.stddev[DELTA].vdw;output->width(12);
+	*output << standard_error(avg.stddev[DELTA].vdw,avg.representatives);*output << std::endl;
 
 	//INT = vdwaals + vdw14
 	output->flags(ios::left|ios::fixed);output->width(12);
 	*output << "INT";output->flags(ios::right|ios::fixed);
 	output->width(12);
 	*output << avg.averages[DELTA].internal;output->width(12);
-	*output << avg.stddev[DELTA].internal;*output << std::endl;
+	*output << avg.stddev[DELTA].internal;output->width(12);
+	*output << standard_error(avg.stddev[DELTA].internal,avg.representatives);*output << std::endl;
 
 	//Gas energy
 	output->flags(ios::left|ios::fixed);output->width(12);
 	*output << "GAS";output->flags(ios::right|ios::fixed);
 	output->width(12);
 	*output << avg.averages[DELTA].gas;output->width(12);
-	*output << avg.stddev[DELTA].gas;*output << std::endl;
+	*output << avg.stddev[DELTA].gas;output->width(12);
+	*output << standard_error(avg.stddev[DELTA].gas,avg.representatives);*output << std::endl;
 
 	//Surface Area Solvation energy
 	output->flags(ios::left|ios::fixed);output->width(12);
 	*output << "PBSUR";output->flags(ios::right|ios::fixed);
 	output->width(12);
 	*output << avg.averages[DELTA].pbsur;output->width(12);
-	*output << avg.stddev[DELTA].pbsur;*output << std::endl;
+	*output << avg.stddev[DELTA].pbsur;output->width(12);
+	*output << standard_error(avg.stddev[DELTA].pbsur,avg.representatives);*output << std::endl;
 
 	//Poisson-Boltzmann Solvation energy
 	output->flags(ios::left|ios::fixed);output->width(12);
 	*output << "PBSOLV";output->flags(ios::right|ios::fixed);
 	output->width(12);
 	*output << avg.averages[DELTA].pbsolv;output->width(12);
-	*output << avg.stddev[DELTA].pbsolv;*output << std::endl;
+	*output << avg.stddev[DELTA].pbsolv;output->width(12);
+	*output << standard_error(avg.stddev[DELTA].pbsolv,avg.representatives);*output << std::endl;
 
 	//Surface Area
 	output->flags(ios::left|ios::fixed);output->width(12);
 	*output << "AREA";output->flags(ios::right|ios::fixed);
 	output->width(12);
 	*output << avg.averages[DELTA].area;output->width(12);
-	*output << avg.stddev[DELTA].area;*output << std::endl;
+	*output << avg.stddev[DELTA].area;output->width(12);
+	*output << standard_error(avg.stddev[DELTA].area,avg.representatives);*output << std::endl;
 
 
 }
@@ -438,6 +570,26 @@ void summarize_molecules(std::ostream* output,mmpbsa_analyzer_average& avg)
 }
 
 
+/**
+ * Number of snapshots that a snapshot of the data represents: the population of its
+ * cluster, if mmpbsa clustered the snapshots (cf cluster_rmsd), or else one.
+ */
+size_t snapshot_weight(const mmpbsa_utils::XMLNode* snap)
+{
+	for(const mmpbsa_utils::XMLNode* child = snap->children;child != 0;child = child->siblings)
+	{
+		if(child->getName() != "weight")
+			continue;
+		std::istringstream buff(child->getText());
+		size_t weight = 0;
+		buff >> weight;
+		if(buff.fail() || weight == 0)
+			throw mmpbsa::MMPBSAException("snapshot_weight: \"" + child->getText() + "\" is an invalid snapshot weight.",mmpbsa::DATA_FORMAT_ERROR);
+		return weight;
+	}
+	return 1;
+}
+
 void summarize(mmpbsa_analyzer_arguments& args)
 {
 	using namespace std;
@@ -450,9 +602,11 @@ void summarize(mmpbsa_analyzer_arguments& args)
 	//some data does depend on molsurf results; others do not. Therefore the averaging is different if molsurf fails.
 	mmpbsa_analyzer_average avg;
 	size_t bad_area_com, bad_area_rec, bad_area_lig;
-	size_t snapshot_counter = 0;
+	size_t snapshot_counter = 0, represented_counter = 0;
 	
 	EMap curr,curr_delta;//place holder for calculating energy for a given snapshot.
+	mmpbsa_analyzer_sweep sweep_avg;
+	sweep_avg.count = sweep_avg.representatives = 0;
 
 	if(args.input == NULL)
 		throw mmpbsa::MMPBSAException("summarize: No input stream provided.",mmpbsa::FILE_IO_ERROR);
@@ -474,35 +628,46 @@ void summarize(mmpbsa_analyzer_arguments& args)
 		{
 			curr_delta.clear();
 			snapshot_counter++;
+			avg.representatives++;
+			size_t weight = snapshot_weight(snap);
+			represented_counter += weight;
 			for(molecule = snap->children;molecule != 0;molecule = molecule->siblings)
 			{
 				if(molecule->getName() == "COMPLEX")
 				{
 					curr = EMap::loadXML(molecule);
-					average_data(curr,avg,curr_delta,COMPLEX);
+					average_data(curr,avg,curr_delta,COMPLEX,weight);
 					if(curr.molsurf_failed)
 					  bad_area_com++;
 				}
 				else if(molecule->getName() == "RECEPTOR")
 				{
 					curr = EMap::loadXML(molecule);
-					average_data(curr,avg,curr_delta,RECEPTOR);
+					average_data(curr,avg,curr_delta,RECEPTOR,weight);
 					if(curr.molsurf_failed)
 					  bad_area_rec++;
 				}
 				else if(molecule->getName() == "LIGAND")
 				{
 					curr = EMap::loadXML(molecule);
-					average_data(curr,avg,curr_delta,LIGAND);
+					average_data(curr,avg,curr_delta,LIGAND,weight);
 					if(curr.molsurf_failed)
 						bad_area_lig++;
 				}
+				else if(molecule->getName() == "pb_sweep")
+				{
+					average_pb_sweep(molecule,sweep_avg,weight);
+				}
+				else if(molecule->getName() == "weight")
+				{
+					//used by snapshot_weight
+				}
 				else if(args.verbosity > 1)
 				  {
 				    *args.output << "Ignoring tag: " << molecule->getName() << std::endl;				
 				  }
 			}
-			average_data(curr_delta,avg,curr_delta,DELTA);
+			average_data(curr_delta,avg,curr_delta,DELTA,weight);
 		}
 	}
 
@@ -531,10 +696,15 @@ void summarize(mmpbsa_analyzer_arguments& args)
 	}
 
 	// Output results
-	*args.output << "Summary of " << snapshot_counter << " snapshots." << std::endl;
+	*args.output << "Summary of " << snapshot_counter << " snapshots";
+	if(represented_counter != snapshot_counter)
+		*args.output << " (cluster representatives), weighted to represent " << represented_counter
+			     << ". Standard errors are estimated from the " << snapshot_counter << " representatives";
+	*args.output << "." << std::endl;
 
 	summarize_molecules(args.output,avg);
 	summarize_delta(args.output,avg);
+	summarize_pb_sweep(args.output,sweep_avg);
 
 	delete data;
 
@@ -2,11 +2,19 @@
 
 #include <mpi.h>
 #include <cstring>
+#include <iostream>
 
 void mmpbsa_utils::mpi_init_hosts(int* argc, char*** argv, int& mpi_rank,int& mpi_size)
 {
-	//Initialize
+	//Initialize. Snapshot threads may claim snapshots (cf claim_snapshot), one at a time.
+#ifdef USE_PTHREADS
+	int provided;
+	MPI_Init_thread(argc,argv,MPI_THREAD_SERIALIZED,&provided);
+	if(provided < MPI_THREAD_SERIALIZED)
+		std::cerr << "Warning: MPI does not support calls from several threads. Use one snapshot thread per node." << std::endl;
+#else
 	MPI_Init(argc,argv);
+#endif
 	MPI_Comm_rank(MPI_COMM_WORLD,&mpi_rank);
 	MPI_Comm_size(MPI_COMM_WORLD,&mpi_size);
 }
@@ -21,7 +21,7 @@ enum MMPBSA_MPI_TAG {DATA = 0,STATUS,NUM_OF_TAGS};
 /**
  * Initializes hosts.
  *
- * Calls MPI_Init.
+ * Calls MPI_Init, or, with threads, MPI_Init_thread, so that threads may make MPI calls one at a time.
  */
 void mpi_init_hosts(int* argc, char*** argv, int& mpi_rank,int& mpi_size);
 
@@ -24,17 +24,17 @@
 #include <stdlib.h>
 #include <math.h>
 #include <assert.h>
+#include <setjmp.h>
 
 //#include "nab.h" // dc: moved to molsurf.h because molsurf.h ITSELF has a dependency on nab.h (or files referenced therein). This is glossed over in nab
 #include "molsurf.h"
 
-REAL_T __dx__, __dy__, __dz__;
+/* All of the state of one surface calculation. Every array is carved out of a
+   single allocation (arena), sized by the number of atoms, so that a calculation
+   costs one malloc and one free. Contexts are not shared, which allows molsurf to
+   be run concurrently in several threads.
 
-static int natm_sel;
-static molsurf_ATOM *atom;
-static RES *res;
-
-/* neighbor arrays:  these are big so amount of data stored must be small
+   neighbor arrays:  these are big so amount of data stored must be small
    upper_neighbors is of the NEIGHBOR_TORUS type, which contains 2
    small ints, one for the index of the neighbor the other for the
    torus.  This last index is key.  The torus associated with
@@ -45,32 +45,72 @@ static RES *res;
    Any other index corresponds to an index in the torus array that has
    already been instantiated.
  */
+/* neighbor of an atom, ordered by distance (then index) in getneighbors() */
+typedef struct neighbor_sort {
+   REAL_T d;
+   int iatom;
+} NEIGHBOR_SORT;
+
+typedef struct molsurf_context {
+   int natm_sel;
+   molsurf_ATOM *atom;
+   RES *res;
+
+   NEIGHBOR_TORUS *upper_neighbors; /* contains atoms and torus indices */
+   NEIGHBOR *neighbors;     /* contains atom indices for all neighbors */
+   int n_upper_neighbors_max, n_neighbors_max;  /* allocated sizes of the
+                                                   neighbor arrays, which grow
+                                                   outside of the arena */
+   TORUS *toruslist;
+   PROBE *probelist;
+
+   CONCAVE_FACE *concave_face;
+   SADDLE_FACE *saddle_face;
+   CONVEX_FACE *convex_face;
+   CONE_FACE *cone_face;
+   BROKEN_CONCAVE_FACE *broken_concave_face;
+   CONCAVE_CYCLE *concave_cycle;
+
+   VERTEX *vertexlist;
+   EDGE *concave_edge_list;
+   EDGE *convex_edge_list;
+   CIRCLE *convex_circle_list;
+   CIRCLE *concave_circle_list;
+
+   CYCLE *cyclelist;
+   LOW_TORUS *low_torus;
+   CUSP_EDGE *cusp_edge;
+   CUSP_PAIR *cusp_pair;
+
+   int *edge_used;              /* scratch space of split_cycle() */
+   int *cell_start;             /* scratch space of getneighbors() */
+   int *cell_atoms;
+   int *neighbor_candidates;
+   NEIGHBOR_SORT *neighbor_sort;
+   CUSP_GROUP *cusp_group;      /* scratch space of non_axial_trim() */
+
+   char *arena;
+   jmp_buf on_error;            /* return point of molsurf_calc() */
+} MOLSURF_CONTEXT;
+
+/* Calculation being run by this thread, used by the capacity checks of the
+   routines below and to abandon the calculation when an error is found. */
+#if defined(_MSC_VER)
+#define MOLSURF_THREAD_LOCAL __declspec(thread)
+#else
+#define MOLSURF_THREAD_LOCAL __thread
+#endif
+static MOLSURF_THREAD_LOCAL MOLSURF_CONTEXT *active_context = NULL;
 
-static NEIGHBOR_TORUS *upper_neighbors; /* contains atoms and torus indices */
-static NEIGHBOR *neighbors;     /* contains atom indices for all neighbors */
-static TORUS *toruslist;
-static PROBE *probelist;
-
-static CONCAVE_FACE *concave_face;
-static SADDLE_FACE *saddle_face;
-static CONVEX_FACE *convex_face;
-static CONE_FACE *cone_face;
-static BROKEN_CONCAVE_FACE *broken_concave_face;
-static CONCAVE_CYCLE *concave_cycle;
-
-static VERTEX *vertexlist;
-static EDGE *concave_edge_list;
-static EDGE *convex_edge_list;
-static CIRCLE *convex_circle_list;
-static CIRCLE *concave_circle_list;
-
-static CYCLE *cyclelist;
-static LOW_TORUS *low_torus;
-static CUSP_EDGE *cusp_edge;
-static CUSP_PAIR *cusp_pair;
+#if defined(__GNUC__)
+#define MOLSURF_NORETURN __attribute__((noreturn))
+#elif defined(_MSC_VER)
+#define MOLSURF_NORETURN __declspec(noreturn)
+#else
+#define MOLSURF_NORETURN
+#endif
 
 /*  size limitations: these are multiplied by the number of atoms */
-#define NUM_NEIGHBOR 100
 #define NUM_PROBE 100
 #define NUM_TORUS 10
 #define NUM_CIRCLE 30
@@ -80,6 +120,9 @@ static CUSP_PAIR *cusp_pair;
 #define NUM_EDGE 20
 #define NUM_CUSP 20
 
+/* The cell grid used by getneighbors() has at most this many cells per atom */
+#define MAX_CELLS_PER_ATOM 2
+
 int countmolatoms();
 
 static void check_broken_faces(int, BROKEN_CONCAVE_FACE[]);
@@ -95,7 +138,10 @@ static void memory_usage(void);
 #endif
 static void vnorm(REAL_T[], int);
 static void atom_vertex_match(VERTEX[], int, int);
-static int getneighbors(int, molsurf_ATOM[], NEIGHBOR[], NEIGHBOR_TORUS[], REAL_T);
+static int getneighbors(int, molsurf_ATOM[], REAL_T);
+static void reserve_neighbors(MOLSURF_CONTEXT *, int, int);
+static int compare_neighbor_sort(const void *, const void *);
+static int compare_int(const void *, const void *);
 static int get_probes(molsurf_ATOM[], int *, NEIGHBOR[], NEIGHBOR_TORUS[],
                       PROBE[], REAL_T);
 static int probe_pos(molsurf_ATOM *, molsurf_ATOM *, molsurf_ATOM *,
@@ -109,7 +155,6 @@ static int is_buried(molsurf_ATOM *, molsurf_ATOM *, molsurf_ATOM *, REAL_T, REA
 static int get_torus(molsurf_ATOM[], int *, NEIGHBOR[], NEIGHBOR_TORUS[],
                      REAL_T, TORUS[]);
 static void torus_data(TORUS[], int, molsurf_ATOM[], int, int, REAL_T);
-static void sort_neighbors(int, REAL_T[], int, NEIGHBOR[]);
 static int convex_circles(molsurf_ATOM[], int, TORUS[], int, CIRCLE[], REAL_T);
 static int concave_circles(molsurf_ATOM[], int, PROBE[], TORUS[], CIRCLE[],
                            REAL_T);
@@ -249,8 +294,10 @@ static REAL_T conc_cycle_piece(int, CONCAVE_CYCLE[], CIRCLE[], EDGE[],
                                VERTEX[], int, PROBE[], REAL_T);
 static REAL_T interior_angle(int, int, int, int, EDGE[], CIRCLE[],
                              VERTEX[]);
-static void allocate_memory(void);
-static void free_memory(void);
+static size_t layout_memory(MOLSURF_CONTEXT *);
+MOLSURF_NORETURN static void molsurf_fail(int);
+static REAL_T molsurf_surface(MOLSURF_CONTEXT *, REAL_T *, REAL_T *, REAL_T *,
+                              REAL_T *, REAL_T, REAL_T *);
 
 
 #if 0 //dc: changed definition for its use in mmpbsa
@@ -259,8 +306,106 @@ REAL_T molsurf(MOLECULE_T ** m, char **aex, REAL_T * probe_rad_in)
 REAL_T molsurf(REAL_T *xcrds, REAL_T *ycrds, REAL_T *zcrds,
 		REAL_T *radii,
 		size_t num_atoms, REAL_T probe_rad)
+{
+   return molsurf_atom_areas(xcrds, ycrds, zcrds, radii, num_atoms, probe_rad, NULL);
+}
+
+REAL_T molsurf_atom_areas(REAL_T *xcrds, REAL_T *ycrds, REAL_T *zcrds,
+		REAL_T *radii,
+		size_t num_atoms, REAL_T probe_rad, REAL_T *atom_areas)
+{
+   REAL_T area;
+   if (molsurf_calc(xcrds, ycrds, zcrds, radii, num_atoms, probe_rad,
+                    atom_areas, &area) != MOLSURF_OK)
+      return ERROR;
+   return area;
+}
+
+int molsurf_calc(REAL_T *xcrds, REAL_T *ycrds, REAL_T *zcrds,
+		REAL_T *radii,
+		size_t num_atoms, REAL_T probe_rad,
+		REAL_T *atom_areas, REAL_T *area)
+{
+   MOLSURF_CONTEXT *ctx;
+   MOLSURF_CONTEXT *previous = active_context;
+   int error;
+
+   *area = 0.0;
+   if (num_atoms == 0)
+      return MOLSURF_OK;
+   if ((ctx = (MOLSURF_CONTEXT *) calloc(1, sizeof(MOLSURF_CONTEXT))) == NULL)
+      return MOLSURF_ERROR_MEMORY;
+   ctx->natm_sel = num_atoms;
+   if ((ctx->arena = (char *) malloc(layout_memory(ctx))) == NULL) {
+      free(ctx);
+      return MOLSURF_ERROR_MEMORY;
+   }
+   layout_memory(ctx);
+
+   active_context = ctx;
+   error = setjmp(ctx->on_error);
+   if (error == MOLSURF_OK)
+      *area = molsurf_surface(ctx, xcrds, ycrds, zcrds, radii, probe_rad,
+                              atom_areas);
+   active_context = previous;
+
+   free(ctx->neighbors);
+   free(ctx->upper_neighbors);
+   free(ctx->arena);
+   free(ctx);
+   return error;
+}
+
+const char *molsurf_strerror(int error)
+{
+   switch (error) {
+   case MOLSURF_OK:
+      return "no error";
+   case MOLSURF_ERROR_MEMORY:
+      return "could not allocate memory";
+   case MOLSURF_ERROR_LIMIT:
+      return "an array size limit was exceeded";
+   case MOLSURF_ERROR_SURFACE:
+      return "the surface could not be constructed";
+   default:
+      return "unknown error";
+   }
+}
+
+/* Abandons the calculation of this thread, returning the error code from molsurf_calc(). */
+static void molsurf_fail(int error)
+{
+   assert(active_context != NULL);
+   longjmp(active_context->on_error, error);
+}
+
+static REAL_T molsurf_surface(MOLSURF_CONTEXT *ctx,
+		REAL_T *xcrds, REAL_T *ycrds, REAL_T *zcrds,
+		REAL_T *radii, REAL_T probe_rad, REAL_T *atom_areas)
 #endif
 {
+   const int natm_sel = ctx->natm_sel;
+   molsurf_ATOM *atom = ctx->atom;
+   RES *res = ctx->res;
+   NEIGHBOR_TORUS *upper_neighbors;
+   NEIGHBOR *neighbors;
+   TORUS *toruslist = ctx->toruslist;
+   PROBE *probelist = ctx->probelist;
+   CONCAVE_FACE *concave_face = ctx->concave_face;
+   SADDLE_FACE *saddle_face = ctx->saddle_face;
+   CONVEX_FACE *convex_face = ctx->convex_face;
+   CONE_FACE *cone_face = ctx->cone_face;
+   BROKEN_CONCAVE_FACE *broken_concave_face = ctx->broken_concave_face;
+   CONCAVE_CYCLE *concave_cycle = ctx->concave_cycle;
+   VERTEX *vertexlist = ctx->vertexlist;
+   EDGE *concave_edge_list = ctx->concave_edge_list;
+   EDGE *convex_edge_list = ctx->convex_edge_list;
+   CIRCLE *convex_circle_list = ctx->convex_circle_list;
+   CIRCLE *concave_circle_list = ctx->concave_circle_list;
+   CYCLE *cyclelist = ctx->cyclelist;
+   LOW_TORUS *low_torus = ctx->low_torus;
+   CUSP_EDGE *cusp_edge = ctx->cusp_edge;
+   CUSP_PAIR *cusp_pair = ctx->cusp_pair;
 
    int nat = 0, nres = 0, n_torus = 0, n_probes = 0, n_vertex = 0;
 
@@ -284,8 +429,6 @@ REAL_T molsurf(REAL_T *xcrds, REAL_T *ycrds, REAL_T *zcrds,
 /*  Take info from NAB molecule and put into Paul's data structure,
    (only for atoms matching aex).                                    */
 
-   natm_sel = num_atoms;
-   allocate_memory();
 #ifdef DEBUG
    memory_usage();
 #endif
@@ -335,11 +478,9 @@ REAL_T molsurf(REAL_T *xcrds, REAL_T *ycrds, REAL_T *zcrds,
 
 
    nat = n;
-   if ((res = (RES *) malloc(10 * natm_sel * sizeof(RES))) == NULL) {
-      fprintf(stderr, "Unable to allocate space for res\n");
-      exit(1);
-   }
-   i = getneighbors(nat, atom, neighbors, upper_neighbors, probe_rad);
+   i = getneighbors(nat, atom, probe_rad);
+   neighbors = ctx->neighbors;
+   upper_neighbors = ctx->upper_neighbors;
 
 /* determine valid probe positions */
    n_probes = get_probes(atom, &nat, neighbors, upper_neighbors,
@@ -544,9 +685,12 @@ REAL_T molsurf(REAL_T *xcrds, REAL_T *ycrds, REAL_T *zcrds,
          }
       }
    }
+#else
+   if (atom_areas != NULL)
+      for (n = 0; n < natm_sel; n++)
+         atom_areas[n] = atom[n].area;
 #endif
 
-   free_memory();
    return (broken_conc_area + conv_area + conc_area + sad_area +
            cone_area);
 
@@ -582,7 +726,7 @@ static void add_edge(int *n_edges, EDGE edge[],
    }
    if ((fabs(d1 - r2) > 0.1) || (fabs(d2 - r2) > 0.1)) {
       printf("add_edge(): edge vertex not on circle\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_SURFACE);
    }
    /*
       printf("adding edge: v1 %8.3f%8.3f%8.3f\n", vertex[v1].pos[0], vertex[v1].pos[1], vertex[v1].pos[2]);
@@ -595,9 +739,9 @@ static void add_edge(int *n_edges, EDGE edge[],
    edge[*n_edges].alive = 1;
 
    (*n_edges)++;
-   if (*n_edges >= NUM_EDGE * natm_sel) {
+   if (*n_edges >= NUM_EDGE * active_context->natm_sel) {
       printf("MAX_EDGE exceeded\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_LIMIT);
    }
 }
 static void add_free_edge(int *n_edges, EDGE edge[], int icircle)
@@ -607,9 +751,9 @@ static void add_free_edge(int *n_edges, EDGE edge[], int icircle)
    edge[*n_edges].circle = icircle;
    edge[*n_edges].alive = 1;
    (*n_edges)++;
-   if (*n_edges >= NUM_EDGE * natm_sel) {
+   if (*n_edges >= NUM_EDGE * active_context->natm_sel) {
       printf("MAX_EDGE exceeded\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_LIMIT);
    }
 }
 static void add_probe(int *np, PROBE probelist[], molsurf_POINT px, REAL_T height,
@@ -651,9 +795,9 @@ static void add_probe(int *np, PROBE probelist[], molsurf_POINT px, REAL_T heigh
    } else {
       probelist[*np].low = 0;
    }
-   if (*np > NUM_PROBE * natm_sel) {
+   if (*np > NUM_PROBE * active_context->natm_sel) {
       fprintf(stderr, "MAXPROBE exceeded: %d %d %d\n", ia, ja, ka);
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_LIMIT);
    }
    ++upper_neighbors[ij].nprobes;
    ++upper_neighbors[jk].nprobes;
@@ -670,9 +814,9 @@ static void add_saddle_face(SADDLE_FACE saddle_face[], int *nface,
    saddle_face[*nface].e2_convex = e2_convex;
    saddle_face[*nface].e4_convex = e4_convex;
    ++(*nface);
-   if (*nface >= NUM_FACE * natm_sel) {
+   if (*nface >= NUM_FACE * active_context->natm_sel) {
       printf("convex_edges() MAX_FACE exceeded\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_LIMIT);
    }
 }
 
@@ -696,51 +840,51 @@ static void memory_usage(void)
    printf("size requirements in bytes\n");
 
    printf("one atom              %ld\n", sizeof(molsurf_ATOM));
-   printf("atom            total %ld\n", natm_sel * sizeof(molsurf_ATOM));
-   total += natm_sel * sizeof(molsurf_ATOM);
+   printf("atom            total %ld\n", active_context->natm_sel * sizeof(molsurf_ATOM));
+   total += active_context->natm_sel * sizeof(molsurf_ATOM);
 
    printf("one NEIGHBOR_TORUS    %ld\n", sizeof(NEIGHBOR_TORUS));
    printf("NEIGHBOR_TORUS  total %ld\n",
-          60 * natm_sel * sizeof(NEIGHBOR_TORUS));
-   total += 60 * natm_sel * sizeof(NEIGHBOR_TORUS);
+          60 * active_context->natm_sel * sizeof(NEIGHBOR_TORUS));
+   total += 60 * active_context->natm_sel * sizeof(NEIGHBOR_TORUS);
 
    printf("one NEIGHBOR          %ld\n", sizeof(NEIGHBOR));
-   printf("NEIGHBOR        total %ld\n", 60 * natm_sel * sizeof(NEIGHBOR));
-   total += 60 * natm_sel * sizeof(NEIGHBOR);
+   printf("NEIGHBOR        total %ld\n", 60 * active_context->natm_sel * sizeof(NEIGHBOR));
+   total += 60 * active_context->natm_sel * sizeof(NEIGHBOR);
 
    printf("one TORUS             %ld\n", sizeof(TORUS));
-   printf("TORUS           total %ld\n", 5 * natm_sel * sizeof(TORUS));
-   total += 5 * natm_sel * sizeof(TORUS);
+   printf("TORUS           total %ld\n", 5 * active_context->natm_sel * sizeof(TORUS));
+   total += 5 * active_context->natm_sel * sizeof(TORUS);
 
    printf("one PROBE             %ld\n", sizeof(PROBE));
-   printf("PROBE           total %ld\n", 5 * natm_sel * sizeof(PROBE));
-   total += 5 * natm_sel * sizeof(PROBE);
+   printf("PROBE           total %ld\n", 5 * active_context->natm_sel * sizeof(PROBE));
+   total += 5 * active_context->natm_sel * sizeof(PROBE);
 
    printf("one VERTEX            %ld\n", sizeof(VERTEX));
-   printf("VERTEX          total %ld\n", 10 * natm_sel * sizeof(VERTEX));
-   total += 10 * natm_sel * sizeof(VERTEX);
+   printf("VERTEX          total %ld\n", 10 * active_context->natm_sel * sizeof(VERTEX));
+   total += 10 * active_context->natm_sel * sizeof(VERTEX);
 
    printf("one EDGE      %ld\n", sizeof(EDGE));
-   printf("EDGE    total %ld\n", 10 * natm_sel * sizeof(EDGE));
-   total += 10 * natm_sel * sizeof(EDGE);
+   printf("EDGE    total %ld\n", 10 * active_context->natm_sel * sizeof(EDGE));
+   total += 10 * active_context->natm_sel * sizeof(EDGE);
 
    printf("one CIRCLE            %ld\n", sizeof(CIRCLE));
-   printf("CIRCLE          total %ld\n", 5 * natm_sel * sizeof(CIRCLE));
-   total += 5 * natm_sel * sizeof(CIRCLE);
+   printf("CIRCLE          total %ld\n", 5 * active_context->natm_sel * sizeof(CIRCLE));
+   total += 5 * active_context->natm_sel * sizeof(CIRCLE);
 
    printf("one CONCAVE_FACE      %ld\n", sizeof(CONCAVE_FACE));
    printf("CONCAVE_FACE    total %ld\n",
-          10 * natm_sel * sizeof(CONCAVE_FACE));
-   total += 10 * natm_sel * sizeof(CONCAVE_FACE);
+          10 * active_context->natm_sel * sizeof(CONCAVE_FACE));
+   total += 10 * active_context->natm_sel * sizeof(CONCAVE_FACE);
 
    printf("one SADDLE_FACE       %ld\n", sizeof(SADDLE_FACE));
    printf("SADDLE_FACE     total %ld\n",
-          10 * natm_sel * sizeof(SADDLE_FACE));
-   total += 10 * natm_sel * sizeof(SADDLE_FACE);
+          10 * active_context->natm_sel * sizeof(SADDLE_FACE));
+   total += 10 * active_context->natm_sel * sizeof(SADDLE_FACE);
 
    printf("one CYCLE             %ld\n", sizeof(CYCLE));
-   printf("CYCLE           total %ld\n", 10 * natm_sel * sizeof(CYCLE));
-   total += 10 * natm_sel * sizeof(CYCLE);
+   printf("CYCLE           total %ld\n", 10 * active_context->natm_sel * sizeof(CYCLE));
+   total += 10 * active_context->natm_sel * sizeof(CYCLE);
 
    printf("Sum total             %d\n\n", total);
 
@@ -769,30 +913,78 @@ static void atom_vertex_match(VERTEX vertex[], int iv, int iatom)
       fprintf(stderr, "vertex atom mismatch\n");
       fprintf(stderr, "       atom: %d\n", iatom);
       fprintf(stderr, "vertex atom: %d\n", vertex[iv].iatom);
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_SURFACE);
    }
 }
 
 
-#define MAX_NSORT 500
-
-static int getneighbors(int nat, molsurf_ATOM a[], NEIGHBOR neighbors[],
-                        NEIGHBOR_TORUS upper_neighbors[], REAL_T probe_rad)
+/* Finds the neighbors of each atom, i.e. the atoms whose probe-expanded spheres
+   overlap its own. The atoms are binned into a uniform grid of cubic cells,
+   no smaller than the largest possible neighbor distance, so that only the
+   27 cells around an atom need to be searched. The neighbors of an atom are
+   ordered by distance; its upper neighbors by index.                      */
+static int getneighbors(int nat, molsurf_ATOM a[], REAL_T probe_rad)
 {
+   MOLSURF_CONTEXT *ctx = active_context;
+   int *cell_start = ctx->cell_start;
+   int *cell_atoms = ctx->cell_atoms;
+   int *candidates = ctx->neighbor_candidates;
+   NEIGHBOR_SORT *dsort = ctx->neighbor_sort;
    REAL_T probe_diam, maxrad = 0.0, d, cutoff, d_ext;
+   REAL_T lo[3], hi[3], cell_size;
+   int dim[3], c[3], c0[3], c1[3];
    int n_tot = 0, n_upper_tot = 0;
-   int i, j;
+   int i, j, k, n, ncells, ncand;
    int nsort, istart;
-   REAL_T dsort[MAX_NSORT];
 
+   if (nat == 0)
+      return 0;
 
    probe_diam = 2 * probe_rad;
 
-   for (i = 0; i < nat; ++i)
+   for (k = 0; k < 3; ++k)
+      lo[k] = hi[k] = a[0].pos[k];
+   for (i = 0; i < nat; ++i) {
       if (a[i].rad > maxrad)
          maxrad = a[i].rad;
+      for (k = 0; k < 3; ++k) {
+         if (a[i].pos[k] < lo[k])
+            lo[k] = a[i].pos[k];
+         if (a[i].pos[k] > hi[k])
+            hi[k] = a[i].pos[k];
+      }
+   }
    cutoff = (2 * maxrad + probe_diam);
 
+/* sparse systems get larger cells, which bounds the memory of the grid */
+   cell_size = (cutoff > 0.0) ? cutoff : 1.0;
+   for (;;) {
+      for (k = 0; k < 3; ++k)
+         dim[k] = (int) ((hi[k] - lo[k]) / cell_size) + 1;
+      if ((double) dim[0] * dim[1] * dim[2] <= (double) MAX_CELLS_PER_ATOM * nat)
+         break;
+      cell_size *= 2;
+   }
+   ncells = dim[0] * dim[1] * dim[2];
+
+#define CELL_OF(pos, k) \
+   ((int) (((pos)[k] - lo[k]) / cell_size) < dim[k] ? \
+    (int) (((pos)[k] - lo[k]) / cell_size) : dim[k] - 1)
+
+/* counting sort of the atoms by cell: the atoms of cell n are
+   cell_atoms[cell_start[n]] ... cell_atoms[cell_start[n+1]-1]          */
+   for (n = 0; n <= ncells; ++n)
+      cell_start[n] = 0;
+   for (i = 0; i < nat; ++i)
+      ++cell_start[(CELL_OF(a[i].pos, 0) * dim[1] + CELL_OF(a[i].pos, 1)) * dim[2]
+                   + CELL_OF(a[i].pos, 2)];
+   for (n = 1; n <= ncells; ++n)
+      cell_start[n] += cell_start[n - 1];
+   for (i = nat - 1; i >= 0; --i)
+      cell_atoms[--cell_start[(CELL_OF(a[i].pos, 0) * dim[1] +
+                               CELL_OF(a[i].pos, 1)) * dim[2] +
+                              CELL_OF(a[i].pos, 2)]] = i;
+
    for (i = 0; i < nat; ++i) {
       a[i].buried = 0;
       d_ext = probe_diam + a[i].rad;
@@ -805,62 +997,62 @@ static int getneighbors(int nat, molsurf_ATOM a[], NEIGHBOR neighbors[],
       nsort = 0;
       istart = n_tot;           /* starting index for sort */
 
-      for (j = 0; j < nat; ++j) {
+      /* candidates from the surrounding cells, in the order of their index */
+      ncand = 0;
+      for (k = 0; k < 3; ++k) {
+         c[k] = CELL_OF(a[i].pos, k);
+         c0[k] = (c[k] > 0) ? c[k] - 1 : 0;
+         c1[k] = (c[k] < dim[k] - 1) ? c[k] + 1 : dim[k] - 1;
+      }
+      for (c[0] = c0[0]; c[0] <= c1[0]; ++c[0])
+         for (c[1] = c0[1]; c[1] <= c1[1]; ++c[1])
+            for (c[2] = c0[2]; c[2] <= c1[2]; ++c[2]) {
+               n = (c[0] * dim[1] + c[1]) * dim[2] + c[2];
+               for (j = cell_start[n]; j < cell_start[n + 1]; ++j)
+                  if (cell_atoms[j] != i)
+                     candidates[ncand++] = cell_atoms[j];
+            }
+      qsort(candidates, ncand, sizeof(int), compare_int);
 
-         if (fabs(a[i].pos[0] - a[j].pos[0]) > cutoff)
-            continue;
-         if (fabs(a[i].pos[1] - a[j].pos[1]) > cutoff)
-            continue;
-         if (fabs(a[i].pos[2] - a[j].pos[2]) > cutoff)
-            continue;
-         if (i == j)
-            continue;
+      for (n = 0; n < ncand; ++n) {
+         j = candidates[n];
 
          /* d = sqrt(dist2(a[i].pos,a[j].pos)); */
          d = DIST(a[i].pos, a[j].pos);
 
          if (d < (d_ext + a[j].rad)) {
-            if (n_tot >= NUM_NEIGHBOR * natm_sel) {
-               fprintf(stderr, "MAX_NEIGHBOR exceeded: %d %d %d\n", n_tot,
-                       i, j);
-               exit(ERROR);
-            }
+            reserve_neighbors(ctx, n_tot + 1, n_upper_tot + 1);
             if (a[i].rad + d < a[j].rad)
                a[i].buried = 1;
 
-            neighbors[n_tot].iatom = j;
+            ctx->neighbors[n_tot].iatom = j;
             ++a[i].n_neighbors;
             ++n_tot;
 
             if (j > i) {
 
                /* 2nd atom in torus */
-               upper_neighbors[n_upper_tot].iatom = j;
+               ctx->upper_neighbors[n_upper_tot].iatom = j;
 
                /* initial probe count for torus containing 
                   iatom and j to -1 (free) */
 
-               upper_neighbors[n_upper_tot].nprobes = FREE_TORUS;
+               ctx->upper_neighbors[n_upper_tot].nprobes = FREE_TORUS;
                ++a[i].n_upper;
                ++n_upper_tot;
-               if (n_upper_tot > NUM_NEIGHBOR * natm_sel) {
-                  fprintf(stderr, "MAX_NEIGHBOR exceeded\n");
-                  exit(ERROR);
-               }
             }
             /* set up sort */
-            if (nsort >= MAX_NSORT) {
-               fprintf(stderr, "MAX_NSORT exceeded: %d %d\n", nsort,
-                       MAX_NSORT);
-               exit(ERROR);
-            }
-            dsort[nsort] = d;
+            dsort[nsort].d = d;
+            dsort[nsort].iatom = j;
             ++nsort;
          }
       }
 /*    printf("atom %d has %d neighbors\n", i, a[i].n_neighbors);   */
-      sort_neighbors(nsort, dsort, istart, neighbors);
+      qsort(dsort, nsort, sizeof(NEIGHBOR_SORT), compare_neighbor_sort);
+      for (n = 0; n < nsort; ++n)
+         ctx->neighbors[istart + n].iatom = dsort[n].iatom;
    }
+#undef CELL_OF
 
 #ifdef DEBUG
    printf("number of temporary tori %d\n", n_upper_tot);
@@ -869,6 +1061,60 @@ static int getneighbors(int nat, molsurf_ATOM a[], NEIGHBOR neighbors[],
    return (n_tot);
 }
 
+/* Grows the neighbor arrays of the calculation to hold at least the given numbers
+   of neighbors and upper neighbors.                                               */
+static void reserve_neighbors(MOLSURF_CONTEXT * ctx, int n_neighbors,
+                              int n_upper)
+{
+   int size;
+   void *grown;
+
+   if (n_neighbors > ctx->n_neighbors_max) {
+      size = (ctx->n_neighbors_max > 0) ? 2 * ctx->n_neighbors_max
+          : 16 * ctx->natm_sel;
+      if (size < n_neighbors)
+         size = n_neighbors;
+      if ((grown = realloc(ctx->neighbors, size * sizeof(NEIGHBOR))) == NULL) {
+         fprintf(stderr, "Unable to allocate space for neighbors\n");
+         molsurf_fail(MOLSURF_ERROR_MEMORY);
+      }
+      ctx->neighbors = (NEIGHBOR *) grown;
+      ctx->n_neighbors_max = size;
+   }
+   if (n_upper > ctx->n_upper_neighbors_max) {
+      size = (ctx->n_upper_neighbors_max > 0) ? 2 * ctx->n_upper_neighbors_max
+          : 8 * ctx->natm_sel;
+      if (size < n_upper)
+         size = n_upper;
+      if ((grown = realloc(ctx->upper_neighbors,
+                           size * sizeof(NEIGHBOR_TORUS))) == NULL) {
+         fprintf(stderr, "Unable to allocate space for upper_neighbors\n");
+         molsurf_fail(MOLSURF_ERROR_MEMORY);
+      }
+      ctx->upper_neighbors = (NEIGHBOR_TORUS *) grown;
+      ctx->n_upper_neighbors_max = size;
+   }
+}
+
+/* Orders neighbors by distance. Ties keep the order of the atom indices, as
+   the bubble sort that this replaces did.                                 */
+static int compare_neighbor_sort(const void *a, const void *b)
+{
+   const NEIGHBOR_SORT *na = (const NEIGHBOR_SORT *) a;
+   const NEIGHBOR_SORT *nb = (const NEIGHBOR_SORT *) b;
+
+   if (na->d < nb->d)
+      return -1;
+   if (na->d > nb->d)
+      return 1;
+   return na->iatom - nb->iatom;
+}
+
+static int compare_int(const void *a, const void *b)
+{
+   return *(const int *) a - *(const int *) b;
+}
+
 
 static int get_probes(molsurf_ATOM atom[], int *nat,
                       NEIGHBOR neighbors[],
@@ -1332,9 +1578,9 @@ static int get_torus(molsurf_ATOM atom[], int *nat, NEIGHBOR neighbors[],
 
          }
          ++nt;
-         if (nt >= NUM_TORUS * natm_sel) {
+         if (nt >= NUM_TORUS * active_context->natm_sel) {
             fprintf(stderr, "MAX_TORUS exceeded\n");
-            exit(ERROR);
+            molsurf_fail(MOLSURF_ERROR_LIMIT);
          }
       }
    }
@@ -1385,38 +1631,6 @@ static void torus_data(TORUS tor[], int nt, molsurf_ATOM atom[],
 
 
 
-/* bubble sort, based on example in
-   Software Tools, Kernighan and Plauger */
-
-static void sort_neighbors(int n, REAL_T x[], int istart,
-                           NEIGHBOR neighbors[])
-{
-   int i, j, itmp;
-   REAL_T xtmp;
-
-   i = n - 1;                   /* index of last array element */
-
-   while (i > 0) {
-      j = 0;
-      while (j < i) {
-         if (x[j] > x[j + 1]) {
-
-            xtmp = x[j];
-            itmp = neighbors[istart + j].iatom;
-
-            x[j] = x[j + 1];
-            neighbors[istart + j].iatom = neighbors[istart + j + 1].iatom;
-
-            x[j + 1] = xtmp;
-            neighbors[istart + j + 1].iatom = itmp;
-         }
-         ++j;
-      }
-      i = i - 1;
-   }
-   return;
-}
-
 static int convex_circles(molsurf_ATOM atom[], int nat, TORUS toruslist[],
                           int n_torus, CIRCLE circlelist[],
                           REAL_T probe_rad)
@@ -1463,9 +1677,9 @@ static int convex_circles(molsurf_ATOM atom[], int nat, TORUS toruslist[],
 
       ++nc;
 
-      if (nc >= NUM_CIRCLE * natm_sel) {
+      if (nc >= NUM_CIRCLE * active_context->natm_sel) {
          fprintf(stderr, "MAX_CIRCLE exceeded\n");
-         exit(ERROR);
+         molsurf_fail(MOLSURF_ERROR_LIMIT);
       }
    }
    return nc;
@@ -1528,9 +1742,9 @@ static int concave_circles(molsurf_ATOM atom[], int n_probes,
             concave_circle_list[ic].axis[ii] = change_sign[jj] * vec[ii];
 
          ++ic;
-         if (ic >= NUM_CIRCLE * natm_sel) {
+         if (ic >= NUM_CIRCLE * active_context->natm_sel) {
             printf("concave_circles() MAX_CIRCLE exceeded\n");
-            exit(ERROR);
+            molsurf_fail(MOLSURF_ERROR_LIMIT);
          }
       }
    }
@@ -1613,24 +1827,24 @@ static void concave_edges(REAL_T probe_rad, molsurf_ATOM atom[],
       ++(torus[it2].n_concave_edges);
       ++(torus[it3].n_concave_edges);
 
-      if (torus[it1].n_concave_edges >= NUM_EDGE * natm_sel ||
-          torus[it2].n_concave_edges >= NUM_EDGE * natm_sel ||
-          torus[it3].n_concave_edges >= NUM_EDGE * natm_sel) {
+      if (torus[it1].n_concave_edges >= NUM_EDGE * active_context->natm_sel ||
+          torus[it2].n_concave_edges >= NUM_EDGE * active_context->natm_sel ||
+          torus[it3].n_concave_edges >= NUM_EDGE * active_context->natm_sel) {
          printf("MAXTOR_EDGE exceeded\n");
-         exit(ERROR);
+         molsurf_fail(MOLSURF_ERROR_LIMIT);
       }
-      if (*nedges >= NUM_EDGE * natm_sel) {
+      if (*nedges >= NUM_EDGE * active_context->natm_sel) {
          printf("MAX_EDGE exceeded\n");
-         exit(ERROR);
+         molsurf_fail(MOLSURF_ERROR_LIMIT);
       }
       /* define 3 new vertices */
 
       for (ii = 0; ii < 3; ++ii)
          addvert(probe_rad, probe_atom[ii], atom, i, probe, nverts, vert);
       ++iface;
-      if (iface >= NUM_FACE * natm_sel) {
+      if (iface >= NUM_FACE * active_context->natm_sel) {
          printf("MAX_FACE exceeded\n");
-         exit(ERROR);
+         molsurf_fail(MOLSURF_ERROR_LIMIT);
       }
    }
 
@@ -1639,7 +1853,7 @@ static void concave_edges(REAL_T probe_rad, molsurf_ATOM atom[],
    for (it = 0; it < ntorus; ++it) {
       if (torus[it].n_concave_edges % 2 != 0) {
          fprintf(stderr, "odd number of probe positions on torus!\n");
-         exit(ERROR);
+         molsurf_fail(MOLSURF_ERROR_SURFACE);
       }
       for (i = 0; i < torus[it].n_concave_edges; ++i) {
          ie = torus[it].concave_edges[i];
@@ -1654,7 +1868,7 @@ static void concave_edges(REAL_T probe_rad, molsurf_ATOM atom[],
                    torus[it].a2);
             printf("edge %d vert1.atom %d vert2.atom %d\n", ie,
                    vert[iv1].iatom, vert[iv2].iatom);
-            exit(ERROR);
+            molsurf_fail(MOLSURF_ERROR_SURFACE);
          }
       }
    }
@@ -1678,9 +1892,9 @@ static void addvert(REAL_T probe_rad, int ia, molsurf_ATOM atom[],
            probe_rad * atom[ia].pos[ii]);
    }
    ++(*nverts);
-   if (*nverts >= NUM_VERTEX * natm_sel) {
+   if (*nverts >= NUM_VERTEX * active_context->natm_sel) {
       printf("MAX_VERTS exceeded\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_LIMIT);
    }
    return;
 }
@@ -1786,7 +2000,7 @@ static void convex_edges(REAL_T probe_rad, int nat, molsurf_ATOM atom[],
 
    if (ne - n_free_edges != n_concave_edges) {
       printf("convex_edges() convex and concave edges not paired\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_SURFACE);
    }
    check_data(n_torus, toruslist, nat, atom, vertexlist, convex_edge, ne);
 
@@ -1818,7 +2032,7 @@ static void check_data(int n_torus, TORUS toruslist[],
       printf("convex_edges(): number of convex edges from toruslist %d\n",
              ntmp);
       printf(" not equal to total number of convex edges %d\n", ne);
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_SURFACE);
    }
    ntmp = 0;
    for (ia = 0; ia < nat; ++ia) {
@@ -1837,7 +2051,7 @@ static void check_data(int n_torus, TORUS toruslist[],
                    vertexlist[convex_edge[ie].vert1].iatom);
             printf("edge v2.atom %d\n",
                    vertexlist[convex_edge[ie].vert2].iatom);
-            exit(ERROR);
+            molsurf_fail(MOLSURF_ERROR_SURFACE);
          }
          if (vertexlist[convex_edge[ie].vert2].iatom != ia &&
              convex_edge[ie].vert1 >= 0) {
@@ -1852,7 +2066,7 @@ static void check_data(int n_torus, TORUS toruslist[],
             printf("edge v2.atom %d\n",
                    vertexlist[convex_edge[ie].vert2].iatom);
             printf("convex vertex atom mismatch\n");
-            exit(ERROR);
+            molsurf_fail(MOLSURF_ERROR_SURFACE);
          }
       }
    }
@@ -1860,7 +2074,7 @@ static void check_data(int n_torus, TORUS toruslist[],
       printf("convex_edges(): number of convex edges from atomlist %d\n",
              ntmp);
       printf(" not equal to total number of convex edges %d\n", ne);
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_SURFACE);
    }
    return;
 }
@@ -1873,9 +2087,9 @@ static void add_convex_edge_to_torus(int it, TORUS toruslist[],
 {
    toruslist[it].convex_edges[iedge] = ne;
    ++toruslist[it].n_convex_edges;
-   if (toruslist[it].n_convex_edges > NUM_EDGE * natm_sel) {
+   if (toruslist[it].n_convex_edges > NUM_EDGE * active_context->natm_sel) {
       printf("convex_edges() MAXTOR_EDGE exceeded\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_LIMIT);
    }
    return;
 }
@@ -1884,9 +2098,9 @@ static void add_convex_edge_to_atom(int ia, molsurf_ATOM atom[], int ne)
 {
    atom[ia].convex_edges[atom[ia].n_convex_edges] = ne;
    ++atom[ia].n_convex_edges;
-   if (atom[ia].n_convex_edges >= NUM_EDGE * natm_sel) {
+   if (atom[ia].n_convex_edges >= NUM_EDGE * active_context->natm_sel) {
       printf("convex_edges() MAXAT_EDGE exceeded\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_LIMIT);
    }
    return;
 }
@@ -1919,6 +2133,10 @@ static void convex_faces(int nat, molsurf_ATOM atom[],
          ++iface;
       } else if (atom[ia].n_cycles > 1) {
          /* printf("atom %d has %d cycles\n", ia, atom[ia].n_cycles); */
+         if (atom[ia].n_cycles > MAXAT_CYCLES) {
+            fprintf(stderr, "convex_faces() MAXAT_CYCLES exceeded\n");
+            molsurf_fail(MOLSURF_ERROR_LIMIT);
+         }
 
          for (i = 0; i < atom[ia].n_cycles; ++i) {
             ic = atom[ia].cycle_start + i;
@@ -2048,7 +2266,7 @@ static void sort_edges(int n_concave_edges, EDGE concave_edge_list[],
 
       if (ntmp >= MAXTOR_EDGE) {
          fprintf(stderr, "sort_edges() MAXTOR_EDGE exceeded\n");
-         exit(ERROR);
+         molsurf_fail(MOLSURF_ERROR_LIMIT);
       }
 /****************************************************************/
       /* identify the vertices that we are using to sort the edges    */
@@ -2065,7 +2283,7 @@ static void sort_edges(int n_concave_edges, EDGE concave_edge_list[],
          iv = concave_edge_list[iedge].vert2;
       if (vertexlist[iv].iatom != iatom) {
          fprintf(stderr, "sort_edges(): iatom not found\n");
-         exit(ERROR);
+         molsurf_fail(MOLSURF_ERROR_SURFACE);
       }
       u[0] = vertexlist[iv].pos[0] - circlelist[icircle].center[0];
       u[1] = vertexlist[iv].pos[1] - circlelist[icircle].center[1];
@@ -2082,7 +2300,7 @@ static void sort_edges(int n_concave_edges, EDGE concave_edge_list[],
             iv = concave_edge_list[iedge].vert2;
          if (vertexlist[iv].iatom != iatom) {
             fprintf(stderr, "sort_edges(): iatom not found\n");
-            exit(ERROR);
+            molsurf_fail(MOLSURF_ERROR_SURFACE);
          }
          v[0] = vertexlist[iv].pos[0] - circlelist[icircle].center[0];
          v[1] = vertexlist[iv].pos[1] - circlelist[icircle].center[1];
@@ -2190,7 +2408,7 @@ static void cycles(int nat, molsurf_ATOM atom[], VERTEX vertexlist[],
       if(atom[ia].n_convex_edges > MAXAT_EDGE)
 	{
 	  fprintf(stderr,"Atom has more convex edges than is allowed by the fixed convex edge array size.\nNumber of edges: %d Max Edges: %d\n",atom[ia].n_convex_edges,MAXAT_EDGE);
-	  exit(1);
+	  molsurf_fail(MOLSURF_ERROR_LIMIT);
 	}
       for (i = 0; i < atom[ia].n_convex_edges; ++i)
          atom_edge_cycle[i] = -1;
@@ -2218,9 +2436,9 @@ static void cycles(int nat, molsurf_ATOM atom[], VERTEX vertexlist[],
          ++ice;
          if (convex_edge_list[ie].vert1 == -1) {        /* a free edge */
             ++nc;               /* finsihed with the cycle already */
-            if (nc >= NUM_CYCLE * natm_sel) {
+            if (nc >= NUM_CYCLE * active_context->natm_sel) {
                fprintf(stderr, "MAX_CYCLES exceeded\n");
-               exit(ERROR);
+               molsurf_fail(MOLSURF_ERROR_LIMIT);
             }
             atom[ia].n_cycles++;        /* increment atom cycle count */
             continue;           /* move on to next new_edge   */
@@ -2241,9 +2459,9 @@ static void cycles(int nat, molsurf_ATOM atom[], VERTEX vertexlist[],
             second_vert = convex_edge_list[je].vert2;
          }
          ++nc;                  /* when second_vert = last_vert you've finished the cycle */
-         if (nc >= NUM_CYCLE * natm_sel) {
+         if (nc >= NUM_CYCLE * active_context->natm_sel) {
             fprintf(stderr, "MAX_CYCLES exceeded\n");
-            exit(ERROR);
+            molsurf_fail(MOLSURF_ERROR_LIMIT);
          }
          atom[ia].n_cycles++;   /* increment atom cycle count */
 
@@ -2290,7 +2508,7 @@ static int next_edge(int ivert, int ia, molsurf_ATOM atom[],
    printf("next_edge(): No edge found\n");
    dump_atom_edges(ivert, ia, atom, nae, convex_edges, atom_edge_cycle);
 
-   exit(ERROR);
+   molsurf_fail(MOLSURF_ERROR_SURFACE);
 }
 
 static void dump_atom_edges(int ivert, int ia, molsurf_ATOM atom[],
@@ -2473,7 +2691,7 @@ static int is_cycle_inside(int icycle, int jcycle, CYCLE cycle[],
 
    if (cycle[jcycle].nedges > MAXAT_EDGE) {
       printf("is_cycle_inside(): MAXAT_EDGE exceeded\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_LIMIT);
    }
    for (ii = 0; ii < 3; ++ii)
       u_pq[ii] = atom[ia].pos[ii] - p[ii];
@@ -2507,7 +2725,7 @@ static int is_cycle_inside(int icycle, int jcycle, CYCLE cycle[],
 
       if (sdist < 0) {
          printf("is_cycle_inside(): sdist < 0\n");
-         exit(ERROR);
+         molsurf_fail(MOLSURF_ERROR_SURFACE);
       }
       for (ii = 0; ii < 3; ++ii)
          pt[i][ii] = p[ii] + sdist * u_pr[ii];
@@ -2687,7 +2905,7 @@ static REAL_T cycle_piece(int ic, CYCLE cycle[], CIRCLE circle[],
       if (iv1 == -1) {
          if (cycle[ic].nedges != 1) {
             printf("cycle_area(): vert = -1 but n_edges > 1\n");
-            exit(ERROR);
+            molsurf_fail(MOLSURF_ERROR_SURFACE);
          }
          wrap_angle = 2.0 * PI;
       } else {
@@ -2814,7 +3032,7 @@ static int saddle_area(int n_faces, SADDLE_FACE saddle_face[],
       if (convex_circle_list[icircle].atom_or_probe_num != ia ||
           convex_circle_list[jcircle].atom_or_probe_num != ja) {
          printf("saddle_area() circle mismatch\n");
-         exit(ERROR);
+         molsurf_fail(MOLSURF_ERROR_SURFACE);
       }
       for (ii = 0; ii < 3; ++ii) {
 
@@ -2902,7 +3120,7 @@ static int saddle_area(int n_faces, SADDLE_FACE saddle_face[],
          printf("wrap angle %f \n", Rad2Deg * wrap_angle);
          printf("torus rad %f\n", torus[itorus].rad);
          printf("probe rad %f\n", probe_rad);
-         exit(ERROR);
+         molsurf_fail(MOLSURF_ERROR_SURFACE);
       }
       total_area += saddle_face[iface].area;
 #ifdef DEBUG
@@ -2940,7 +3158,7 @@ static int id_torus(int ia1, int ia2, molsurf_ATOM atom[], TORUS torus[])
    fprintf(stderr,
            "id_torus(): Could not find torus for atoms %d and %d\n", ia1,
            ia2);
-   exit(ERROR);
+   molsurf_fail(MOLSURF_ERROR_SURFACE);
    return -1;
 }
 
@@ -2982,9 +3200,9 @@ static void make_cones(int nat, molsurf_ATOM atom[], int n_torus, TORUS torus[],
           */
          low_torus[nlow].ncones = 0;
          ++nlow;
-         if (nlow >= NUM_TORUS * natm_sel) {
+         if (nlow >= NUM_TORUS * active_context->natm_sel) {
             printf("MAX_LOW_TORUS exceeded %d\n", nlow);
-            exit(ERROR);
+            molsurf_fail(MOLSURF_ERROR_LIMIT);
          }
       }
    }
@@ -3026,7 +3244,7 @@ static void make_cones(int nat, molsurf_ATOM atom[], int n_torus, TORUS torus[],
 
       if (low_torus[ilow].ncones >= MAXTOR_PROBE) {
          fprintf(stderr, "make_cones() MAXTOR_PROBE exceeded\n");
-         exit(ERROR);
+         molsurf_fail(MOLSURF_ERROR_LIMIT);
       }
       if (torus[it].n_concave_edges == 0) {
          ncones = ncones + 2;
@@ -3116,9 +3334,9 @@ static void add_2_verts(REAL_T prad, int i, TORUS torus[], int *n_vertex,
    vertex[nv + 1].iprobe = -1;
 
    nv = nv + 2;
-   if (nv >= NUM_VERTEX * natm_sel) {
+   if (nv >= NUM_VERTEX * active_context->natm_sel) {
       printf("MAX_VERTS exceeded %d\n", nv);
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_LIMIT);
    }
    *n_vertex = nv;
 
@@ -3136,7 +3354,7 @@ static int get_low_torus_index(int nlow, LOW_TORUS low_torus[], int it)
    }
 
    printf("get_low_torus_index() low torus not found!\n");
-   exit(ERROR);
+   molsurf_fail(MOLSURF_ERROR_SURFACE);
    return -1;
 }
 
@@ -3158,9 +3376,9 @@ static void cone_init(int ncones, CONE_FACE cone_face[], int it,
                       int iedge_convex, int ivertex)
 {
 
-   if (ncones >= NUM_FACE * natm_sel) {
+   if (ncones >= NUM_FACE * active_context->natm_sel) {
       printf("MAX_CONE_FACE exceeded\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_LIMIT);
    }
    cone_face[ncones].itorus = it;
    cone_face[ncones].e1_convex = iedge_convex;
@@ -3283,19 +3501,19 @@ static void make_broken_faces(int nat, molsurf_ATOM atom[], int n_torus,
             ++count;
             if (count >= MAXTOR_PROBE) {
                printf("trim_probes(): MAXTOR_PROBE exceeded\n");
-               exit(ERROR);
+               molsurf_fail(MOLSURF_ERROR_LIMIT);
             }
          }
       }
       low_torus[i].nfaces = count;
       if (low_torus[i].nfaces % 2 != 0) {
          printf("trim_probes(): n broken faces on low torus is odd\n");
-         exit(ERROR);
+         molsurf_fail(MOLSURF_ERROR_SURFACE);
       }
       if (low_torus[i].nfaces == 0 &&
           torus[low_torus[i].itorus].n_concave_edges > 0) {
          printf("trim_probes() low torus has no faces, but is not free\n");
-         exit(ERROR);
+         molsurf_fail(MOLSURF_ERROR_SURFACE);
       }
       /*
          printf("%d probes associated with low torus %d\n", 
@@ -3309,9 +3527,9 @@ static void add_concave_cycle(int i, CONCAVE_CYCLE concave_cycle[],
                               int e1, int e2, int e3, int iprobe,
                               int iface)
 {
-   if (i > NUM_CYCLE * natm_sel) {
+   if (i > NUM_CYCLE * active_context->natm_sel) {
       fprintf(stderr, "add_concave_cycle() MAX_CYCLES exceeded\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_LIMIT);
    }
    concave_cycle[i].nedges = 3;
    concave_cycle[i].edge[0] = e1;
@@ -3380,7 +3598,7 @@ static REAL_T get_cone_area(int n_faces, CONE_FACE cone_face[],
 
       if (theta1 < 0.0 || theta2 < 0.0 || theta2 < theta1) {
          printf("theta negative for cone face\n");
-         exit(ERROR);
+         molsurf_fail(MOLSURF_ERROR_SURFACE);
       }
       cone_face[iface].area = wrap_angle * probe_rad * probe_rad *
           (cos(theta1) * (theta2 - theta1) - (sin(theta2) - sin(theta1)));
@@ -3478,24 +3696,24 @@ static void axial_trim(int nat, molsurf_ATOM atom[], RES res[], int n_torus,
       itorus = low_torus[it].itorus;
       if (low_torus[it].nfaces >= MAXTOR_PROBE) {
          fprintf(stderr, "axial_trim(): MAXTOR_PROBE exceeded\n");
-         exit(ERROR);
+         molsurf_fail(MOLSURF_ERROR_LIMIT);
       }
       for (i = 0; i < low_torus[it].nfaces; ++i) {
          iface = low_torus[it].face[i];
          if (broken_concave_face[iface].n_cycles != 1) {
             fprintf(stderr, "axial_trim(): n_cycles != 1\n");
-            exit(ERROR);
+            molsurf_fail(MOLSURF_ERROR_SURFACE);
          }
          icycle = broken_concave_face[iface].concave_cycle[0];
          if (concave_cycle[icycle].nedges != 3) {
             fprintf(stderr, "axial_trim(): n_edges != 3\n");
-            exit(ERROR);
+            molsurf_fail(MOLSURF_ERROR_SURFACE);
          }
          for (j = 0; j < concave_cycle[icycle].nedges; ++j) {
             if (concave_cycle[icycle].edge_direction[j] != 1) {
                fprintf(stderr,
                        "axial_trim(): bad edge direction on cycle\n");
-               exit(ERROR);
+               molsurf_fail(MOLSURF_ERROR_SURFACE);
             }
          }
       }
@@ -3538,7 +3756,7 @@ static void axial_trim(int nat, molsurf_ATOM atom[], RES res[], int n_torus,
 
       if (low_torus[it].nfaces % 2 != 0) {
          fprintf(stderr, "odd number of faces on torus\n");
-         exit(ERROR);
+         molsurf_fail(MOLSURF_ERROR_SURFACE);
       }
       /* now for each pair of faces, you need to create a new edge on
          the circle of intersection of the probe positions for the pair
@@ -3556,7 +3774,7 @@ static void axial_trim(int nat, molsurf_ATOM atom[], RES res[], int n_torus,
          if (concave_edge[iedge].alive != 0 ||
              concave_edge[jedge].alive != 0) {
             printf("concave edge should already be dead\n");
-            exit(ERROR);
+            molsurf_fail(MOLSURF_ERROR_SURFACE);
          }
          /* 1. using previously found vertices create new circle and edge */
          iprobe = broken_concave_face[iface].probe;
@@ -3641,9 +3859,9 @@ static void axial_trim(int nat, molsurf_ATOM atom[], RES res[], int n_torus,
          add_edges_2_cycle(n_cusps, cusp_edge, concave_cycle, jcycle,
                            jedge, f2_edge1, f2_edge2, f2_edge3, 1);
          ++(*n_cusps);
-         if (*n_cusps >= NUM_CUSP * natm_sel) {
+         if (*n_cusps >= NUM_CUSP * active_context->natm_sel) {
             fprintf(stderr, "axial_trim(): MAX_CUSPS exceeded\n");
-            exit(ERROR);
+            molsurf_fail(MOLSURF_ERROR_LIMIT);
          }
       }
    }
@@ -3679,7 +3897,7 @@ static int get_cycle_edge(int itorus, CONCAVE_CYCLE concave_cycle[],
    for (i = 0; i < concave_cycle[icycle].nedges; ++i)
       fprintf(stderr, " %d", concave_cycle[icycle].edge[i]);
    fprintf(stderr, "\n");
-   exit(ERROR);
+   molsurf_fail(MOLSURF_ERROR_SURFACE);
    return -1;
 }
 
@@ -3742,7 +3960,7 @@ static void sort_faces(int it, LOW_TORUS low_torus[], REAL_T face_angle[],
                     concave_edge[ie].vert2,
                     vertexlist[concave_edge[ie].vert2].iatom);
          }
-         exit(ERROR);
+         molsurf_fail(MOLSURF_ERROR_SURFACE);
       }
       itmp = low_torus[it].face[0];
       jtmp = face_edge[0];
@@ -3787,9 +4005,9 @@ static void add_circle(PROBE probelist[], int iprobe, int jprobe,
       concave_circle[*n_concave_circles].axis[ii] = axis[ii];
    }
    ++(*n_concave_circles);
-   if (*n_concave_circles >= NUM_CIRCLE * natm_sel) {
+   if (*n_concave_circles >= NUM_CIRCLE * active_context->natm_sel) {
       fprintf(stderr, "axial_trim(): MAX_CIRCLE exceeded\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_LIMIT);
    }
 }
 
@@ -3845,7 +4063,7 @@ static int cone_edge(int v1, int v2, LOW_TORUS low_torus[], int it,
    }
 
 
-   exit(ERROR);
+   molsurf_fail(MOLSURF_ERROR_SURFACE);
    return -1;
 }
 
@@ -3868,9 +4086,9 @@ static void add_edges_2_cycle(int *n_cusps, CUSP_EDGE cusp_edge[],
       fprintf(stderr,
               "add_edges_2_cycle(): could not find edge to replace\n");
    n = concave_cycle[icycle].nedges + 2;
-   if (n >= NUM_FACE * natm_sel) {
+   if (n >= NUM_FACE * active_context->natm_sel) {
       fprintf(stderr, "add_edges_2_cycle(): MAX_FACE_EDGE exceeded\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_LIMIT);
    }
    /* shift edges that are to the right of itmp by 2 places */
    for (j = 0; j < 2; ++j) {
@@ -3922,7 +4140,7 @@ static void check_cycle(int iface,
    if (iprobe != concave_cycle[icycle].iprobe) {
       fprintf(stderr,
               "check_cycle(): face and cycle have different probes\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_SURFACE);
    }
    printf("vertices: ");
    for (i = 0; i < concave_cycle[icycle].nedges; ++i) {
@@ -3975,7 +4193,7 @@ static void concentric_axial_cusps(int *n_concave_edges,
                  cusp_edge[jcusp].cycle2 != jcycle)) {
 
                printf("concentric_axial_cusps(): cycle mismatch\n");
-               exit(ERROR);
+               molsurf_fail(MOLSURF_ERROR_SURFACE);
             }
 #ifdef DEBUG
             printf("rerouting cycles %d and %d\n", icycle, jcycle);
@@ -4048,7 +4266,7 @@ static void reroute(int icycle, int jcycle, int cusp1, int cusp2,
                 concave_cycle[icycle].edge[iedge2];
          } else {
             printf("reroute(): cusp edge mismatch\n");
-            exit(ERROR);
+            molsurf_fail(MOLSURF_ERROR_SURFACE);
          }
       }
    }
@@ -4076,11 +4294,7 @@ static void split_cycle(int *n_broken_concave_faces,
    int vertex2, iface, ntot, i, first_vert, next_vert, ne, iedge;
    int ncycle, istart, no_start, icusp;
 
-   if ((edge_used =
-        (int *) malloc(NUM_EDGE * natm_sel * sizeof(int))) == NULL) {
-      fprintf(stderr, "Unable to allocate space for edge_used\n");
-      exit(1);
-   }
+   edge_used = active_context->edge_used;
    vertex2 = -1;
    iface = concave_cycle[icycle].iface;
    ntot = concave_cycle[icycle].nedges;
@@ -4141,7 +4355,7 @@ static void split_cycle(int *n_broken_concave_faces,
       if (ne > ntot) {
          printf
              ("split_cycle(): could not find a starting edge for 2nd cycle\n");
-         exit(ERROR);
+         molsurf_fail(MOLSURF_ERROR_SURFACE);
       }
    }
 
@@ -4198,12 +4412,12 @@ static void split_cycle(int *n_broken_concave_faces,
    for (i = 0; i < ntot; ++i) {
       if (!edge_used[i]) {
          printf("edge %d not used\n", i);
-         exit(ERROR);
+         molsurf_fail(MOLSURF_ERROR_SURFACE);
       }
    }
    if (broken_concave_face[iface].n_cycles != 1) {
       printf("concentric_axial_cusps(): n_cycles != 1\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_SURFACE);
    }
    i = broken_concave_face[iface].n_cycles;
    i = *n_broken_concave_faces;
@@ -4221,7 +4435,6 @@ static void split_cycle(int *n_broken_concave_faces,
       dump_cycle(&concave_cycle[ncycle], concave_edge);
     */
 
-   free(edge_used);
    return;
 }
 
@@ -4241,7 +4454,7 @@ static int next_cycle_edge(CONCAVE_CYCLE cycle, EDGE concave_edge[],
    }
    printf("next_cycle_edge(): could not find next edge with vertex %d\n",
           next_vert);
-   exit(ERROR);
+   molsurf_fail(MOLSURF_ERROR_SURFACE);
    return -1;
 }
 
@@ -4276,12 +4489,7 @@ static void non_axial_trim(int nat, molsurf_ATOM atom[], RES res[], int n_torus,
    printf("non axial trim\n");
    printf("There are %d cusp edges\n", *n_cusps);
 #endif
-   if ((group =
-        (CUSP_GROUP *) malloc(NUM_CUSP * natm_sel * sizeof(CUSP_GROUP))) ==
-       NULL) {
-      fprintf(stderr, "Unable to allocate space for group\n");
-      exit(1);
-   }
+   group = active_context->cusp_group;
    ng = 0;
    *n_cusp_pairs = 0;
    for (icusp = 0; icusp < *n_cusps; ++icusp) {
@@ -4438,7 +4646,7 @@ static void non_axial_trim(int nat, molsurf_ATOM atom[], RES res[], int n_torus,
           */
       } else {
          printf("two many interesecting cusps %d\n", n);
-         exit(ERROR);
+         molsurf_fail(MOLSURF_ERROR_LIMIT);
       }
    }
 
@@ -4474,7 +4682,6 @@ static void non_axial_trim(int nat, molsurf_ATOM atom[], RES res[], int n_torus,
       }
     */
 
-   free(group);
    return;
 }
 
@@ -4562,7 +4769,7 @@ static void cusp_intersect(CUSP_EDGE cusp_edge[], int icusp, int jcusp,
 
    if (alpha < 0.0) {
       printf("alpha < 0 should not happen\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_SURFACE);
    } else if (alpha > asin(concave_circle[c1].rad / probe_rad) +
               asin(concave_circle[c2].rad / probe_rad)) {
       if (flag)
@@ -4700,7 +4907,7 @@ static void cusp_intersect(CUSP_EDGE cusp_edge[], int icusp, int jcusp,
    if ((fabs(v1_angle) < angle_range && fabs(v2_angle) > angle_range) ||
        (fabs(v1_angle) > angle_range && fabs(v2_angle) < angle_range)) {
       printf("cusp straddles vertex, no bueno\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_SURFACE);
    }
    if (flag)
       printf("angle1: %8.1f\n", Rad2Deg * v1_angle);
@@ -4781,7 +4988,7 @@ static int get_cycle_id(CUSP_EDGE cusp_edge[], int icusp, int jcusp,
              cusp_edge[icusp].cycle1, cusp_edge[icusp].cycle2);
       printf("jcusp %d cycles %d %d\n", jcusp,
              cusp_edge[jcusp].cycle1, cusp_edge[jcusp].cycle2);
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_SURFACE);
    }
    if (cusp_edge[icusp].cycle1 == cusp_edge[jcusp].cycle1 ||
        cusp_edge[icusp].cycle1 == cusp_edge[jcusp].cycle2) {
@@ -4791,7 +4998,7 @@ static int get_cycle_id(CUSP_EDGE cusp_edge[], int icusp, int jcusp,
       return cusp_edge[icusp].cycle2;
    } else {
       printf("no cycles found\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_SURFACE);
       return -1;
    }
 }
@@ -4815,7 +5022,7 @@ static void get_probe_id(CUSP_EDGE cusp_edge[], int icusp, int jcusp,
       *probe2 = concave_cycle[cusp_edge[jcusp].cycle1].iprobe;
    } else {
       printf("get_probeid(): no cycles match\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_SURFACE);
    }
 }
 
@@ -4917,9 +5124,9 @@ static void add_new_cusp(CUSP_EDGE cusp_edge[], int icusp, int jcusp,
 
 
    ++(*n);
-   if (*n >= NUM_CUSP * natm_sel) {
+   if (*n >= NUM_CUSP * active_context->natm_sel) {
       printf("add_new_cusp(): MAX_CUSP_PAIRS exceeded\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_LIMIT);
    }
    return;
 }
@@ -4936,7 +5143,7 @@ static int center_cycle(CUSP_EDGE cusp[], int icusp, int jcusp)
       return cusp[icusp].cycle2;
    } else {
       printf("center_cycle():no cusp match\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_SURFACE);
       return -1;
    }
 }
@@ -5047,7 +5254,7 @@ static void trim_2_cusps(PROBE probe[],
    n_list = cusp_stop - cusp_start;
    if (n_list > MAXTMP) {
       printf("MAXTMP exceeded\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_LIMIT);
    }
    for (i = 0; i < n_list; ++i)
       cusp_list[i] = cusp_start + i;
@@ -5056,7 +5263,7 @@ static void trim_2_cusps(PROBE probe[],
       iface = trim_face[i];
       if (broken_concave_face[iface].n_cycles != 1) {
          printf("broken concave face num of cycles != 1\n");
-         exit(ERROR);
+         molsurf_fail(MOLSURF_ERROR_SURFACE);
       }
       split_face(iface, n_broken_concave_faces, broken_concave_face,
                  n_concave_cycles, concave_cycle,
@@ -5122,14 +5329,14 @@ static void split_old_cusps(int cusp_list[], int nlist,
             ncut = ncut + 1;
             if (ncut >= MAXTMP) {
                printf("MAXTMP exceeded\n");
-               exit(ERROR);
+               molsurf_fail(MOLSURF_ERROR_LIMIT);
             }
          }
       }
       if (ncut != 2) {
          printf("split_old_cusps: not cutting with 2 verts\n");
          printf("ncut %d\n", ncut);
-         exit(ERROR);
+         molsurf_fail(MOLSURF_ERROR_SURFACE);
       }
       iva = concave_edge[iedge].vert1;
       for (ii = 0; ii < 3; ++ii)
@@ -5168,7 +5375,7 @@ static void make_new_cusp(int *nc, CUSP_EDGE cusp_edge[], int iold,
 {
    if (cusp_edge[iold].alive) {
       printf("new_cusp(): old cusp not dead\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_SURFACE);
    }
    cusp_edge[*nc].cycle1 = cusp_edge[iold].cycle1;
    cusp_edge[*nc].cycle2 = cusp_edge[iold].cycle2;
@@ -5180,9 +5387,9 @@ static void make_new_cusp(int *nc, CUSP_EDGE cusp_edge[], int iold,
 
    ++(*nc);
 
-   if (*nc > NUM_CUSP * natm_sel) {
+   if (*nc > NUM_CUSP * active_context->natm_sel) {
       printf("MAX_CUSPS exceeded\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_LIMIT);
    }
    return;
 }
@@ -5207,7 +5414,7 @@ static void get_faces(int face_list[], int *nfaces, int cusp_list[],
             printf("broken concave face has more than one cycle\n");
             printf("face %d number of cycles %d\n", face[j],
                    broken_concave_face[face[j]].n_cycles);
-            exit(ERROR);
+            molsurf_fail(MOLSURF_ERROR_SURFACE);
          }
          if (broken_concave_face[face[j]].concave_cycle[0] != cycle[j]) {
             printf("face cycle mismatch\n");
@@ -5215,14 +5422,14 @@ static void get_faces(int face_list[], int *nfaces, int cusp_list[],
                    face[j],
                    broken_concave_face[face[j]].concave_cycle[0],
                    cycle[j]);
-            exit(ERROR);
+            molsurf_fail(MOLSURF_ERROR_SURFACE);
          }
          if (is_new_face(face[j], face_list, nf)) {
             face_list[nf] = face[j];
             ++nf;
             if (nf > MAXTMP) {
                printf("MAXTMP exceeded\n");
-               exit(ERROR);
+               molsurf_fail(MOLSURF_ERROR_LIMIT);
             }
          }
       }
@@ -5268,7 +5475,7 @@ static void split_face(int iface,
 
    if (n_list >= MAXTMP) {
       printf("split_face(): MAXTMP exceeded\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_LIMIT);
    }
    narc = 0;
    npt = 0;
@@ -5292,7 +5499,7 @@ static void split_face(int iface,
     */
    if (tmp_cycle.nedges > MAXTMP) {
       printf("MAXTMP exceeded\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_LIMIT);
    }
    for (i = 0; i < tmp_cycle.nedges; ++i)
       edge_used[i] = 0;
@@ -5364,18 +5571,18 @@ static void split_face(int iface,
       broken_concave_face[iface].n_cycles = 1;
 
       ++(*n_concave_cycles);
-      if (*n_concave_cycles > NUM_CYCLE * natm_sel) {
+      if (*n_concave_cycles > NUM_CYCLE * active_context->natm_sel) {
          printf("MAX_CYCLES exceeded\n");
-         exit(ERROR);
+         molsurf_fail(MOLSURF_ERROR_LIMIT);
       }
       ++(*n_broken_faces);
-      if (*n_broken_faces > NUM_FACE * natm_sel) {
+      if (*n_broken_faces > NUM_FACE * active_context->natm_sel) {
          printf("MAX_FACE exceeded\n");
-         exit(ERROR);
+         molsurf_fail(MOLSURF_ERROR_LIMIT);
       }
    } else if (ns > 2) {
       printf("split_face(): face has more than 2 cycles\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_SURFACE);
    }
    /*
       printf(" remade icycle %d\n", icycle);
@@ -5406,13 +5613,13 @@ static void get_starters(int start[], int *ns,
          ++(*ns);
          if (*ns > MAXTMP) {
             printf("too many starting edges\n");
-            exit(ERROR);
+            molsurf_fail(MOLSURF_ERROR_LIMIT);
          }
       }
    }
    if (*ns > 2) {
       printf("split_face(): num starting edges  > 2  (%d)\n", *ns);
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_SURFACE);
    }
 }
 
@@ -5462,7 +5669,7 @@ static int cusp_match(int lastvert, int ncusps, int cusp_index[],
    }
 
    printf("cusp_match(): could not find match for vertex %d\n", lastvert);
-   exit(ERROR);
+   molsurf_fail(MOLSURF_ERROR_SURFACE);
    return -1;
 }
 
@@ -5500,9 +5707,9 @@ static void add_non_axial_cusp(int *nc, CUSP_EDGE cusp_edge[],
    cusp_edge[*nc].alive = 1;
    cusp_edge[*nc].concentric_pair = 0;
    ++(*nc);
-   if (*nc > NUM_CUSP * natm_sel) {
+   if (*nc > NUM_CUSP * active_context->natm_sel) {
       printf("MAX_CUSPS exceeded\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_LIMIT);
    }
    return;
 }
@@ -5515,9 +5722,9 @@ static void add_1_vert(int *nv, VERTEX vertex[], molsurf_POINT v)
    for (ii = 0; ii < 3; ++ii)
       vertex[*nv].pos[ii] = v[ii];
    ++(*nv);
-   if (*nv > NUM_VERTEX * natm_sel) {
+   if (*nv > NUM_VERTEX * active_context->natm_sel) {
       printf("MAX_VERTS exceeded\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_LIMIT);
    }
    return;
 }
@@ -5605,9 +5812,9 @@ static void add_cusp_circle(int *nc, CIRCLE circle[], PROBE probe[],
    circle[*nc].torus = -1;
    circle[*nc].atom_or_probe_num = -1;
    ++(*nc);
-   if (*nc >= NUM_CIRCLE * natm_sel) {
+   if (*nc >= NUM_CIRCLE * active_context->natm_sel) {
       printf("MAX_CIRCLE exceeded\n");
-      exit(ERROR);
+      molsurf_fail(MOLSURF_ERROR_LIMIT);
    }
    return;
 }
@@ -5724,7 +5931,7 @@ static REAL_T conc_cycle_piece(int ic, CONCAVE_CYCLE concave_cycle[],
       if (iv1 == -1) {
          if (concave_cycle[ic].nedges != 1) {
             printf("concave_cycle(): vert = -1 but n_edges > 1\n");
-            exit(ERROR);
+            molsurf_fail(MOLSURF_ERROR_SURFACE);
          }
          wrap_angle = 2.0 * PI;
       } else {
@@ -5821,147 +6028,46 @@ static REAL_T interior_angle(int e1, int dir1, int e2, int dir2,
 
 }
 
-static void allocate_memory(void)
-{
-   if ((atom = (molsurf_ATOM *) malloc(natm_sel * sizeof(molsurf_ATOM))) == NULL) {
-      fprintf(stderr, "Unable to allocate space for atom: %d\n", natm_sel);
-      exit(1);
-   }
-   if ((upper_neighbors =
-        (NEIGHBOR_TORUS *) malloc(NUM_NEIGHBOR * natm_sel *
-                                  sizeof(NEIGHBOR_TORUS))) == NULL) {
-      fprintf(stderr, "Unable to allocate space for upper_neighbors\n");
-      exit(1);
-   }
-   if ((neighbors =
-        (NEIGHBOR *) malloc(NUM_NEIGHBOR * natm_sel * sizeof(NEIGHBOR))) ==
-       NULL) {
-      fprintf(stderr, "Unable to allocate space for neighbors\n");
-      exit(1);
-   }
-   if ((probelist =
-        (PROBE *) malloc(NUM_PROBE * natm_sel * sizeof(PROBE))) == NULL) {
-      fprintf(stderr, "Unable to allocate space for probelist\n");
-      exit(1);
-   }
-   if ((toruslist =
-        (TORUS *) malloc(NUM_TORUS * natm_sel * sizeof(TORUS))) == NULL) {
-      fprintf(stderr, "Unable to allocate space for toruslist\n");
-      exit(1);
-   }
-   if ((convex_circle_list =
-        (CIRCLE *) malloc(NUM_CIRCLE * natm_sel * sizeof(CIRCLE))) ==
-       NULL) {
-      fprintf(stderr, "Unable to allocate space for convex_circle_list\n");
-      exit(1);
-   }
-   if ((concave_circle_list =
-        (CIRCLE *) malloc(NUM_CIRCLE * natm_sel * sizeof(CIRCLE))) ==
-       NULL) {
-      fprintf(stderr,
-              "Unable to allocate space for concave_circle_list\n");
-      exit(1);
-   }
-   if ((concave_face =
-        (CONCAVE_FACE *) malloc(NUM_FACE * natm_sel *
-                                sizeof(CONCAVE_FACE))) == NULL) {
-      fprintf(stderr, "Unable to allocate space for concave_face\n");
-      exit(1);
-   }
-   if ((convex_face =
-        (CONVEX_FACE *) malloc(NUM_FACE * natm_sel *
-                               sizeof(CONVEX_FACE))) == NULL) {
-      fprintf(stderr, "Unable to allocate space for convex_face\n");
-      exit(1);
-   }
-   if ((saddle_face =
-        (SADDLE_FACE *) malloc(NUM_FACE * natm_sel *
-                               sizeof(SADDLE_FACE))) == NULL) {
-      fprintf(stderr, "Unable to allocate space for saddle_face\n");
-      exit(1);
-   }
-   if ((cone_face =
-        (CONE_FACE *) malloc(NUM_FACE * natm_sel * sizeof(CONE_FACE))) ==
-       NULL) {
-      fprintf(stderr, "Unable to allocate space for cone_face\n");
-      exit(1);
-   }
-   if ((broken_concave_face =
-        (BROKEN_CONCAVE_FACE *) malloc(NUM_FACE * natm_sel *
-                                       sizeof(BROKEN_CONCAVE_FACE))) ==
-       NULL) {
-      fprintf(stderr,
-              "Unable to allocate space for broken_concave_face\n");
-      exit(1);
-   }
-   if ((concave_cycle =
-        (CONCAVE_CYCLE *) malloc(NUM_CYCLE * natm_sel *
-                                 sizeof(CONCAVE_CYCLE))) == NULL) {
-      fprintf(stderr, "Unable to allocate space for concave_cycle\n");
-      exit(1);
-   }
-   if ((cyclelist =
-        (CYCLE *) malloc(NUM_CYCLE * natm_sel * sizeof(CYCLE))) == NULL) {
-      fprintf(stderr, "Unable to allocate space for cyclelist\n");
-      exit(1);
-   }
-   if ((vertexlist =
-        (VERTEX *) malloc(NUM_VERTEX * natm_sel * sizeof(VERTEX))) ==
-       NULL) {
-      fprintf(stderr, "Unable to allocate space for vertexlist\n");
-      exit(1);
-   }
-   if ((concave_edge_list =
-        (EDGE *) malloc(NUM_EDGE * natm_sel * sizeof(EDGE))) == NULL) {
-      fprintf(stderr, "Unable to allocate space for concave_edge_list\n");
-      exit(1);
-   }
-   if ((convex_edge_list =
-        (EDGE *) malloc(NUM_EDGE * natm_sel * sizeof(EDGE))) == NULL) {
-      fprintf(stderr, "Unable to allocate space for convex_edge_list\n");
-      exit(1);
-   }
-   if ((low_torus =
-        (LOW_TORUS *) malloc(NUM_TORUS * natm_sel * sizeof(LOW_TORUS))) ==
-       NULL) {
-      fprintf(stderr, "Unable to allocate space for low_torus\n");
-      exit(1);
-   }
-   if ((cusp_edge =
-        (CUSP_EDGE *) malloc(NUM_EDGE * natm_sel * sizeof(CUSP_EDGE))) ==
-       NULL) {
-      fprintf(stderr, "Unable to allocate space for cusp_edge\n");
-      exit(1);
-   }
-   if ((cusp_pair =
-        (CUSP_PAIR *) malloc(NUM_CUSP * natm_sel * sizeof(CUSP_PAIR))) ==
-       NULL) {
-      fprintf(stderr, "Unable to allocate space for cusp_pair\n");
-      exit(1);
-   }
-}
-
-static void free_memory(void)
+/* Carves the arrays of the calculation out of ctx->arena, returning the number of
+   bytes used. With a NULL arena, only the size is calculated.                   */
+static size_t layout_memory(MOLSURF_CONTEXT * ctx)
 {
-   free(atom);
-   free(upper_neighbors);
-   free(neighbors);
-   free(probelist);
-   free(toruslist);
-   free(convex_circle_list);
-   free(concave_circle_list);
-   free(concave_face);
-   free(convex_face);
-   free(saddle_face);
-   free(cone_face);
-   free(broken_concave_face);
-   free(concave_cycle);
-   free(cyclelist);
-   free(vertexlist);
-   free(concave_edge_list);
-   free(convex_edge_list);
-   free(low_torus);
-   free(cusp_edge);
-   free(cusp_pair);
-   free(res);
+   size_t used = 0;
+   size_t natm = ctx->natm_sel;
+
+#define MOLSURF_CARVE(field, type, count) \
+   do { \
+      used = (used + sizeof(REAL_T) - 1) / sizeof(REAL_T) * sizeof(REAL_T); \
+      ctx->field = (ctx->arena == NULL) ? NULL : (type *) (ctx->arena + used); \
+      used += (count) * natm * sizeof(type); \
+   } while (0)
+
+   MOLSURF_CARVE(atom, molsurf_ATOM, 1);
+   MOLSURF_CARVE(res, RES, 10);
+   MOLSURF_CARVE(probelist, PROBE, NUM_PROBE);
+   MOLSURF_CARVE(toruslist, TORUS, NUM_TORUS);
+   MOLSURF_CARVE(convex_circle_list, CIRCLE, NUM_CIRCLE);
+   MOLSURF_CARVE(concave_circle_list, CIRCLE, NUM_CIRCLE);
+   MOLSURF_CARVE(concave_face, CONCAVE_FACE, NUM_FACE);
+   MOLSURF_CARVE(convex_face, CONVEX_FACE, NUM_FACE);
+   MOLSURF_CARVE(saddle_face, SADDLE_FACE, NUM_FACE);
+   MOLSURF_CARVE(cone_face, CONE_FACE, NUM_FACE);
+   MOLSURF_CARVE(broken_concave_face, BROKEN_CONCAVE_FACE, NUM_FACE);
+   MOLSURF_CARVE(concave_cycle, CONCAVE_CYCLE, NUM_CYCLE);
+   MOLSURF_CARVE(cyclelist, CYCLE, NUM_CYCLE);
+   MOLSURF_CARVE(vertexlist, VERTEX, NUM_VERTEX);
+   MOLSURF_CARVE(concave_edge_list, EDGE, NUM_EDGE);
+   MOLSURF_CARVE(convex_edge_list, EDGE, NUM_EDGE);
+   MOLSURF_CARVE(low_torus, LOW_TORUS, NUM_TORUS);
+   MOLSURF_CARVE(cusp_edge, CUSP_EDGE, NUM_EDGE);
+   MOLSURF_CARVE(cusp_pair, CUSP_PAIR, NUM_CUSP);
+   MOLSURF_CARVE(edge_used, int, NUM_EDGE);
+   MOLSURF_CARVE(cusp_group, CUSP_GROUP, NUM_CUSP);
+   MOLSURF_CARVE(cell_start, int, MAX_CELLS_PER_ATOM + 1);
+   MOLSURF_CARVE(cell_atoms, int, 1);
+   MOLSURF_CARVE(neighbor_candidates, int, 1);
+   MOLSURF_CARVE(neighbor_sort, NEIGHBOR_SORT, 1);
+
+#undef MOLSURF_CARVE
+   return used;
 }
@@ -143,7 +143,7 @@ typedef struct cycle {
 
 typedef struct convex_face {
       int n_cycles;           /* 0 or more cycles border a convex face */
-      int cycle[MAX_FACE_CYCLES];
+      int cycle[MAXAT_CYCLES];   /* the cycles of one atom */
       int atom;       /* atom associated with convex face */
       REAL_T area;
 } CONVEX_FACE;
@@ -225,10 +225,36 @@ typedef struct extreme_vertex {
   int vert_index;		/* index in vertex[] array */
 } EXTREME_VERTEX;
 
+/* Error codes of molsurf_calc() */
+#define MOLSURF_OK              0
+#define MOLSURF_ERROR_MEMORY    1 /* memory for the calculation could not be allocated */
+#define MOLSURF_ERROR_LIMIT     2 /* a fixed size limit (e.g. MAX_TORUS) was exceeded */
+#define MOLSURF_ERROR_SURFACE   3 /* inconsistent surface geometry */
+
+/* Calculates the molecular surface area, storing it in area. If atom_areas is not NULL,
+   the convex (contact) area of each atom is stored in it, which must hold num_atoms values.
+   With a zero probe radius, these sum to the total.
+
+   Returns MOLSURF_OK or one of the error codes above; molsurf never exits the program.
+   All of the state of a calculation is local to the call, so that molsurf_calc may be
+   called concurrently by several threads. */
+int molsurf_calc(REAL_T *xcrds, REAL_T *ycrds, REAL_T *zcrds,
+		REAL_T *radii,
+		size_t num_atoms, REAL_T probe_rad,
+		REAL_T *atom_areas, REAL_T *area);
+
+/* Description of a molsurf_calc() error code. */
+const char *molsurf_strerror(int error);
+
+/* As molsurf_calc, returning the area, or ERROR if the calculation failed. */
 REAL_T molsurf(REAL_T *xcrds, REAL_T *ycrds, REAL_T *zcrds,
 		REAL_T *radii,
 		size_t num_atoms, REAL_T probe_rad);//dc: forward declaration of routine used outside of molsurf.c
 
+REAL_T molsurf_atom_areas(REAL_T *xcrds, REAL_T *ycrds, REAL_T *zcrds,
+		REAL_T *radii,
+		size_t num_atoms, REAL_T probe_rad, REAL_T *atom_areas);
+
 #if 0
 /*  routine declarations   */
 
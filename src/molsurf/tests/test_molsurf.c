@@ -0,0 +1,153 @@
+/*
+ * Tests of the molecular surface area (molsurf_calc).
+ *
+ *   atoms400.xyzr: 400 atoms, whose area, with the 1.4 Angstrom probe added to
+ *                  the radii as xyzr2sas does, is 2132.000138.
+ *   dense cluster: 550 atoms of radius 2 to 3 Angstroms, placed at random in a
+ *                  5 Angstrom cube. Every atom neighbors nearly every other, i.e.
+ *                  more than the 500 neighbors per atom (MAX_NSORT) and 100 per
+ *                  atom on average (NUM_NEIGHBOR) to which molsurf was once limited.
+ *                  Its area is compared with a Shrake-Rupley estimate.
+ *
+ * Fixtures are read from $srcdir/tests, as set by "make check", or ./tests.
+ * Returns the number of failed checks.
+ */
+
+#include "molsurf.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#define PROBE_RADIUS 1.4
+#define DENSE_ATOMS 550
+
+static int failures = 0;
+
+static void check(int passed, const char *what)
+{
+  if(!passed)
+    {
+      fprintf(stderr,"FAILED: %s\n",what);
+      failures++;
+    }
+}
+
+static FILE *open_fixture(const char *name)
+{
+  const char *srcdir = getenv("srcdir");
+  char path[4096];
+  snprintf(path,sizeof(path),"%s/tests/%s",(srcdir != NULL) ? srcdir : ".",name);
+  return fopen(path,"r");
+}
+
+static void test_atoms400()
+{
+  REAL_T x[400], y[400], z[400], radii[400], atom_areas[400];
+  REAL_T area = 0, sum = 0;
+  char what[256];
+  int i, retval;
+  FILE *input = open_fixture("atoms400.xyzr");
+
+  check(input != NULL,"open atoms400.xyzr");
+  if(input == NULL)
+    return;
+  for(i = 0;i < 400;i++)
+    if(fscanf(input,"%lf %lf %lf %lf",&x[i],&y[i],&z[i],&radii[i]) != 4)
+      break;
+    else
+      radii[i] += PROBE_RADIUS;
+  fclose(input);
+  check(i == 400,"read the 400 atoms of atoms400.xyzr");
+
+  retval = molsurf_calc(x,y,z,radii,400,0,atom_areas,&area);
+  check(retval == MOLSURF_OK,"molsurf_calc of atoms400.xyzr");
+  snprintf(what,sizeof(what),"area of atoms400.xyzr %lf is 2132.000138",area);
+  check(fabs(area - 2132.000138) < 1e-5,what);
+  for(i = 0;i < 400;i++)
+    sum += atom_areas[i];
+  check(fabs(sum - area) < 1e-6*area,"atom areas of atoms400.xyzr sum to its area");
+}
+
+/* Linear congruential generator, so that the cluster is the same on every platform. */
+static REAL_T next_random(unsigned long *seed)
+{
+  *seed = (*seed*1103515245UL + 12345UL) & 0x7fffffffUL;
+  return *seed/2147483648.0;
+}
+
+/*
+ * Area of the union of the spheres, from the exposed fraction of num_points
+ * points on each sphere. The points follow a golden angle spiral.
+ */
+static REAL_T shrake_rupley(REAL_T *x, REAL_T *y, REAL_T *z, REAL_T *radii, size_t num_atoms, size_t num_points)
+{
+  REAL_T area = 0;
+  size_t i, j, k;
+  for(i = 0;i < num_atoms;i++)
+    {
+      size_t exposed = 0;
+      for(k = 0;k < num_points;k++)
+	{
+	  REAL_T cos_theta = 1 - (2*k + 1.0)/num_points, sin_theta = sqrt(1 - cos_theta*cos_theta);
+	  REAL_T phi = k*2.399963229728653;
+	  REAL_T px = x[i] + radii[i]*sin_theta*cos(phi), py = y[i] + radii[i]*sin_theta*sin(phi), pz = z[i] + radii[i]*cos_theta;
+	  for(j = 0;j < num_atoms;j++)
+	    if(j != i && (px - x[j])*(px - x[j]) + (py - y[j])*(py - y[j]) + (pz - z[j])*(pz - z[j]) < radii[j]*radii[j])
+	      break;
+	  if(j == num_atoms)
+	    exposed++;
+	}
+      area += 4*M_PI*radii[i]*radii[i]*exposed/num_points;
+    }
+  return area;
+}
+
+static void test_dense_cluster()
+{
+  REAL_T x[DENSE_ATOMS], y[DENSE_ATOMS], z[DENSE_ATOMS], radii[DENSE_ATOMS];
+  REAL_T area = 0, estimate;
+  unsigned long seed = 12345;
+  size_t i, j, max_neighbors = 0, total_neighbors = 0;
+  char what[256];
+  int retval;
+
+  for(i = 0;i < DENSE_ATOMS;i++)
+    {
+      x[i] = 5*next_random(&seed);
+      y[i] = 5*next_random(&seed);
+      z[i] = 5*next_random(&seed);
+      radii[i] = 2 + next_random(&seed);
+    }
+
+  /* neighbors, as molsurf finds them for a zero probe radius */
+  for(i = 0;i < DENSE_ATOMS;i++)
+    {
+      size_t neighbors = 0;
+      for(j = 0;j < DENSE_ATOMS;j++)
+	if(j != i && (x[i] - x[j])*(x[i] - x[j]) + (y[i] - y[j])*(y[i] - y[j]) + (z[i] - z[j])*(z[i] - z[j])
+	   < (radii[i] + radii[j])*(radii[i] + radii[j]))
+	  neighbors++;
+      total_neighbors += neighbors;
+      if(neighbors > max_neighbors)
+	max_neighbors = neighbors;
+    }
+  check(max_neighbors > 500 && total_neighbors > 100*DENSE_ATOMS,"the dense cluster exceeds the old neighbor limits");
+
+  retval = molsurf_calc(x,y,z,radii,DENSE_ATOMS,0,NULL,&area);
+  snprintf(what,sizeof(what),"molsurf_calc of the dense cluster: %s",molsurf_strerror(retval));
+  check(retval == MOLSURF_OK,what);
+  estimate = shrake_rupley(x,y,z,radii,DENSE_ATOMS,2000);
+  snprintf(what,sizeof(what),"area of the dense cluster %lf is within 1%% of the Shrake-Rupley estimate %lf",area,estimate);
+  check(fabs(area - estimate) < 0.01*estimate,what);
+}
+
+int main(int argc, char **argv)
+{
+  test_atoms400();
+  test_dense_cluster();
+  if(failures == 0)
+    printf("All molsurf tests passed\n");
+  return failures;
+}
@@ -0,0 +1,50 @@
+#!/bin/sh
+#
+# Multi-frame runs of xyzr2sas must give the areas of separate single-frame runs.
+#
+#   frames2.xyzr: two frames of the first 60 atoms of atoms400.xyzr. In the second,
+#                 the molecule is translated and every fifth atom is moved, so that
+#                 the frames have different areas.
+#   frames2.mdcrd, frames2.radii: the same frames as an Amber trajectory with box lines.
+#
+# Fixtures are read from $srcdir/tests, as set by "make check", or ./tests.
+# Returns the number of failed checks.
+
+srcdir=${srcdir:-.}
+fixtures=$srcdir/tests
+natoms=60
+failures=0
+tmp=${TMPDIR:-/tmp}/test_xyzr2sas.$$
+trap 'rm -f $tmp.*' 0
+
+check ()
+{
+    if ! cmp -s $1 $2
+    then
+	echo "FAILED: $3" >&2
+	echo "  got:" `cat $1` >&2
+	echo "  expected:" `cat $2` >&2
+	failures=`expr $failures + 1`
+    fi
+}
+
+# separate single-frame runs
+head -n $natoms $fixtures/frames2.xyzr | ./xyzr2sas $natoms > $tmp.single 2> /dev/null
+tail -n $natoms $fixtures/frames2.xyzr | ./xyzr2sas $natoms >> $tmp.single 2> /dev/null
+if test `wc -l < $tmp.single` -ne 2 || test `sed -n 1p $tmp.single` = `sed -n 2p $tmp.single`
+then
+    echo "FAILED: single-frame runs give two different areas:" `cat $tmp.single` >&2
+    failures=`expr $failures + 1`
+fi
+
+./xyzr2sas -i $fixtures/frames2.xyzr $natoms > $tmp.multi 2> /dev/null
+check $tmp.multi $tmp.single "concatenated xyzr frames"
+
+./xyzr2sas --trajectory $fixtures/frames2.mdcrd --radii $fixtures/frames2.radii --box $natoms > $tmp.traj 2> /dev/null
+check $tmp.traj $tmp.single "trajectory frames"
+
+if test $failures -eq 0
+then
+    echo "All xyzr2sas tests passed"
+fi
+exit $failures
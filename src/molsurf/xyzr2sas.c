@@ -1,148 +1,354 @@
-#include "molsurf.h"
-
-#include <getopt.h>
-#include <stdlib.h>
-#include <string.h>
-#include <ctype.h>
-#include <stdio.h>
-#include <errno.h>
-
-int load_coordinates(REAL_T **xcrds, REAL_T **ycrds, REAL_T **zcrds, REAL_T **radii, long natoms, FILE *input)
-{
-  char buffer[4096],*tok;
-  int test;
-  long linecount = 0;
-  if(natoms == 0)
-    return 0;
-  if(xcrds == NULL || ycrds == NULL || zcrds == NULL || radii == NULL || input == NULL)
-    {
-      fprintf(stderr,"load_coordinates was given a null pointer.\n");
-      return -1;
-    }
-
-  *xcrds = (REAL_T*)malloc(natoms*sizeof(REAL_T));
-  *ycrds = (REAL_T*)malloc(natoms*sizeof(REAL_T));
-  *zcrds = (REAL_T*)malloc(natoms*sizeof(REAL_T));
-  *radii = (REAL_T*)malloc(natoms*sizeof(REAL_T));
-
-  while(!feof(input) && !ferror(input))
-    {
-      if(fgets(buffer,4096,input) == NULL)
-	break;
-      if(strlen(buffer) == 0 || buffer[0] == '#')//comment with # character
-	continue;
-      if(!isdigit(buffer[0]) && buffer[0] != '+' && buffer[0] != '-')
-	continue;
-
-      test = sscanf(buffer,"%lf %lf %lf %lf",&(*xcrds)[linecount],&(*ycrds)[linecount],&(*zcrds)[linecount],&(*radii)[linecount]);
-      (*radii)[linecount] += 1.4;
-      linecount++;
-    }
-  if(ferror(input))
-    {
-      fprintf(stderr,"File error. Reason: %s\n",strerror(errno));
-      return -errno;
-    }
-
-  return linecount;
-}
-
-void print_help()
-{
-  printf("xyzr2sas -- Molecular Surface Area Calculator\n");
-  printf("Usage: ./xyzr2sas [options]\n\n");
-  printf("Options:\n");
-  printf("--input,   -i <FILE>\tAtomic coordinates and radii (Default: standard input)\n");
-  printf("--version, -v       \tDisplays the version\n");
-  printf("--help,    -h       \tThis help message\n");
-  printf("--usage             \tSame as \"--help\"\n");
-}
-
-const struct option long_opts[] = 
-  {
-    {"help",0,NULL,'h'},
-    {"usage",0,NULL,'h'},
-    {"version",0,NULL,'v'},
-    {"input",1,NULL,'i'},
-    {NULL,0,NULL,0}
-  };
-const char short_opts[] = "hi:v";
-
-int main(int argc, char **argv)
-{
-  FILE *input = stdin;
-  char num_atom_str[4096],curr_opt;
-  long natoms;
-  REAL_T *crds[3],*radii;
-  REAL_T area;
-  int retval;
-
-  natoms = 0;
-  for(;natoms < 3;natoms++)
-    crds[natoms] = NULL;
-  radii = NULL;
-
-  while((curr_opt = getopt_long(argc,argv,short_opts,long_opts,NULL)) != -1)
-    {
-      switch(curr_opt)
-	{
-	case 'i':
-	  {
-	    input = fopen(argv[1],"r");
-	    if(input == NULL)
-	      {
-		fprintf(stderr,"Could not open %s\nReason: %s\n",argv[1],strerror(errno));
-		exit(errno);
-	      }
-	    break;
-	  }
-	case 'h':
-	  print_help();
-	  exit(0);
-	  break;
-	case 'v':
-	  printf("xyz2sas %s\n",PACKAGE_VERSION);
-	  exit(0);
-	default:
-	  fprintf(stderr,"Unknown flag: %c\n",curr_opt);
-	  break;
-	}
-    }
-
-  if(optind >= argc)
-    {
-      fprintf(stderr,"At least the number of atoms is needed.\n");
-      return EINVAL;
-    }
-  else
-    strncpy(num_atom_str,argv[optind],4096);
-
-  natoms = atoi(num_atom_str);
-  if(natoms == 0)
-    {
-      fprintf(stderr,"No atoms provided: %s\n",num_atom_str);
-      return 0;
-    }
-  fprintf(stderr,"Loading %lu coordinates\n",natoms);
-  retval = load_coordinates(&crds[0],&crds[1],&crds[2],&radii,natoms,input);
-  if(retval != natoms)
-    {
-      fprintf(stderr,"Could not load all atoms (expected: %lu). Retval: %d\n",natoms,retval);
-      if(retval < 0)
-	return -retval;//errno
-      return 1;
-    }
-
-
-  area = molsurf(crds[0],crds[1],crds[2],radii,natoms,0);
-
-  natoms = 0;
-  for(;natoms < 3;natoms++)
-    free(crds[natoms]);
-  free(radii);
-
-  printf("%lf\n",area);
-
-  return 0;
-
-}
+#include "molsurf.h"
+
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <errno.h>
+#include <math.h>
+
+#define LINE_LENGTH 4096
+#define MDCRD_WIDTH 8 /* Amber ASCII trajectories are written as 10F8.3 */
+
+static const REAL_T powers_of_ten[] = {1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,1e11,1e12,1e13,1e14,1e15};
+
+/*
+ * Parses a decimal number, e.g. -12.345 or 1.5e-3, beginning at *str and ending
+ * before end, and advances *str past it. Leading white space is skipped.
+ * Returns 1 if a number was read and 0 otherwise. This avoids the cost of sscanf,
+ * which dominates the reading of long trajectories.
+ */
+static int parse_real(const char **str, const char *end, REAL_T *value)
+{
+  const char *curr = *str;
+  int negative = 0, digits = 0, frac_digits = 0, exponent = 0;
+  REAL_T mantissa = 0;
+
+  while(curr < end && isspace((unsigned char)*curr))
+    curr++;
+  if(curr < end && (*curr == '-' || *curr == '+'))
+    negative = (*curr++ == '-');
+  while(curr < end && isdigit((unsigned char)*curr))
+    {
+      mantissa = 10*mantissa + (*curr++ - '0');
+      digits++;
+    }
+  if(curr < end && *curr == '.')
+    {
+      curr++;
+      while(curr < end && isdigit((unsigned char)*curr))
+	{
+	  mantissa = 10*mantissa + (*curr++ - '0');
+	  digits++;
+	  frac_digits++;
+	}
+    }
+  if(digits == 0)
+    return 0;
+  if(curr < end && (*curr == 'e' || *curr == 'E'))
+    {
+      const char *exp_str = curr + 1;
+      int exp_negative = 0, exp_digits = 0, exp_value = 0;
+      if(exp_str < end && (*exp_str == '-' || *exp_str == '+'))
+	exp_negative = (*exp_str++ == '-');
+      while(exp_str < end && isdigit((unsigned char)*exp_str))
+	{
+	  exp_value = 10*exp_value + (*exp_str++ - '0');
+	  exp_digits++;
+	}
+      if(exp_digits)
+	{
+	  exponent = (exp_negative) ? -exp_value : exp_value;
+	  curr = exp_str;
+	}
+    }
+
+  /* the digits and the power of ten are exact, so one division rounds correctly */
+  exponent -= frac_digits;
+  if(exponent < 0 && -exponent < 16)
+    mantissa /= powers_of_ten[-exponent];
+  else if(exponent > 0 && exponent < 16)
+    mantissa *= powers_of_ten[exponent];
+  else if(exponent != 0)
+    mantissa *= pow(10.0,exponent);
+
+  *value = (negative) ? -mantissa : mantissa;
+  *str = curr;
+  return 1;
+}
+
+/*
+ * Reads the next data line, skipping comments (#) and lines that do not begin with a
+ * number. Returns the length of the line, without its newline, or -1 at the end of input.
+ */
+static int next_data_line(char *buffer, FILE *input)
+{
+  while(fgets(buffer,LINE_LENGTH,input) != NULL)
+    {
+      const char *first = buffer;
+      while(*first == ' ' || *first == '\t')
+	first++;
+      if(*first == '#')
+	continue;
+      if(!isdigit((unsigned char)*first) && *first != '+' && *first != '-' && *first != '.')
+	continue;
+      return (int)strcspn(buffer,"\r\n");
+    }
+  return -1;
+}
+
+/*
+ * Reads one frame of natoms lines of x, y, z and radius. The probe radius is
+ * added to the radii. Returns the number of atoms read, which is zero at the
+ * end of input, or -errno if the input could not be read.
+ */
+int load_coordinates(REAL_T *xcrds, REAL_T *ycrds, REAL_T *zcrds, REAL_T *radii, long natoms, FILE *input)
+{
+  char buffer[LINE_LENGTH];
+  long linecount = 0;
+  int length;
+
+  while(linecount < natoms && (length = next_data_line(buffer,input)) >= 0)
+    {
+      const char *curr = buffer, *end = buffer + length;
+      if(!parse_real(&curr,end,&xcrds[linecount]) || !parse_real(&curr,end,&ycrds[linecount])
+	 || !parse_real(&curr,end,&zcrds[linecount]) || !parse_real(&curr,end,&radii[linecount]))
+	{
+	  fprintf(stderr,"Could not read the coordinates and radius of atom %ld: %s\n",linecount + 1,buffer);
+	  return -EINVAL;
+	}
+      radii[linecount] += 1.4;
+      linecount++;
+    }
+  if(ferror(input))
+    {
+      fprintf(stderr,"File error. Reason: %s\n",strerror(errno));
+      return -errno;
+    }
+
+  return linecount;
+}
+
+/*
+ * Reads natoms radii, any number per line, and adds the probe radius.
+ * Returns the number of radii read or -errno.
+ */
+int load_radii(REAL_T *radii, long natoms, FILE *input)
+{
+  char buffer[LINE_LENGTH];
+  long count = 0;
+  int length;
+
+  while(count < natoms && (length = next_data_line(buffer,input)) >= 0)
+    {
+      const char *curr = buffer, *end = buffer + length;
+      while(count < natoms && parse_real(&curr,end,&radii[count]))
+	radii[count++] += 1.4;
+    }
+  if(ferror(input))
+    {
+      fprintf(stderr,"File error. Reason: %s\n",strerror(errno));
+      return -errno;
+    }
+  return count;
+}
+
+/*
+ * Reads one frame of an Amber ASCII trajectory, whose coordinates are in fixed
+ * width fields. If has_box is non-zero, the box line following the coordinates is
+ * skipped. Returns the number of atoms read, which is zero at the end of input,
+ * or -errno.
+ */
+int load_mdcrd_frame(REAL_T *xcrds, REAL_T *ycrds, REAL_T *zcrds, long natoms, int has_box, FILE *input)
+{
+  char buffer[LINE_LENGTH];
+  REAL_T *crds[3];
+  long count = 0, total = 3*natoms;
+  int length;
+
+  crds[0] = xcrds;
+  crds[1] = ycrds;
+  crds[2] = zcrds;
+  while(count < total && (length = next_data_line(buffer,input)) >= 0)
+    {
+      const char *field = buffer, *end = buffer + length;
+      for(;count < total && field < end;field += MDCRD_WIDTH)
+	{
+	  const char *curr = field, *field_end = (field + MDCRD_WIDTH < end) ? field + MDCRD_WIDTH : end;
+	  if(!parse_real(&curr,field_end,&crds[count % 3][count / 3]))
+	    {
+	      fprintf(stderr,"Could not read coordinate %ld of the trajectory frame: %s\n",count + 1,buffer);
+	      return -EINVAL;
+	    }
+	  count++;
+	}
+    }
+  if(count == total && has_box)
+    next_data_line(buffer,input);
+  if(ferror(input))
+    {
+      fprintf(stderr,"File error. Reason: %s\n",strerror(errno));
+      return -errno;
+    }
+  return count / 3;
+}
+
+void print_help()
+{
+  printf("xyzr2sas -- Molecular Surface Area Calculator\n");
+  printf("Usage: ./xyzr2sas [options] <number of atoms>\n\n");
+  printf("Options:\n");
+  printf("--input,      -i <FILE>\tAtomic coordinates and radii (Default: standard input)\n");
+  printf("              \tConcatenated blocks of atoms are calculated as separate frames.\n");
+  printf("--trajectory, -t <FILE>\tAmber ASCII trajectory (mdcrd). Requires --radii\n");
+  printf("--radii,      -r <FILE>\tRadius of each atom of the trajectory\n");
+  printf("--box,        -b       \tThe trajectory has a box line after each frame\n");
+  printf("--version,    -v       \tDisplays the version\n");
+  printf("--help,       -h       \tThis help message\n");
+  printf("--usage                \tSame as \"--help\"\n");
+}
+
+const struct option long_opts[] =
+  {
+    {"help",0,NULL,'h'},
+    {"usage",0,NULL,'h'},
+    {"version",0,NULL,'v'},
+    {"input",1,NULL,'i'},
+    {"trajectory",1,NULL,'t'},
+    {"radii",1,NULL,'r'},
+    {"box",0,NULL,'b'},
+    {NULL,0,NULL,0}
+  };
+const char short_opts[] = "hi:t:r:bv";
+
+static FILE* open_input(const char *filename)
+{
+  FILE *returnMe = fopen(filename,"r");
+  if(returnMe == NULL)
+    {
+      fprintf(stderr,"Could not open %s\nReason: %s\n",filename,strerror(errno));
+      exit(errno);
+    }
+  return returnMe;
+}
+
+int main(int argc, char **argv)
+{
+  FILE *input = stdin, *trajectory = NULL, *radii_file = NULL;
+  char buffer[LINE_LENGTH];
+  int curr_opt, has_box = 0, failed_frames = 0;
+  long natoms, frame;
+  REAL_T *crds[3],*radii;
+  REAL_T area;
+  int retval;
+
+  while((curr_opt = getopt_long(argc,argv,short_opts,long_opts,NULL)) != -1)
+    {
+      switch(curr_opt)
+	{
+	case 'i':
+	  input = open_input(optarg);
+	  break;
+	case 't':
+	  trajectory = open_input(optarg);
+	  break;
+	case 'r':
+	  radii_file = open_input(optarg);
+	  break;
+	case 'b':
+	  has_box = 1;
+	  break;
+	case 'h':
+	  print_help();
+	  exit(0);
+	  break;
+	case 'v':
+	  printf("xyz2sas %s\n",PACKAGE_VERSION);
+	  exit(0);
+	default:
+	  fprintf(stderr,"Unknown flag: %c\n",curr_opt);
+	  break;
+	}
+    }
+
+  if(optind >= argc)
+    {
+      fprintf(stderr,"At least the number of atoms is needed.\n");
+      return EINVAL;
+    }
+
+  natoms = atol(argv[optind]);
+  if(natoms <= 0)
+    {
+      fprintf(stderr,"No atoms provided: %s\n",argv[optind]);
+      return 0;
+    }
+  if(trajectory != NULL && radii_file == NULL)
+    {
+      fprintf(stderr,"A trajectory needs a radii file (--radii).\n");
+      return EINVAL;
+    }
+
+  /* arrays are allocated once and reused by every frame */
+  for(retval = 0;retval < 3;retval++)
+    crds[retval] = (REAL_T*)malloc(natoms*sizeof(REAL_T));
+  radii = (REAL_T*)malloc(natoms*sizeof(REAL_T));
+  if(crds[0] == NULL || crds[1] == NULL || crds[2] == NULL || radii == NULL)
+    {
+      fprintf(stderr,"Could not allocate memory for %ld atoms.\n",natoms);
+      return ENOMEM;
+    }
+
+  fprintf(stderr,"Loading %ld coordinates\n",natoms);
+  if(trajectory != NULL)
+    {
+      retval = load_radii(radii,natoms,radii_file);
+      fclose(radii_file);
+      if(retval != natoms)
+	{
+	  fprintf(stderr,"Could not load all radii (expected: %ld). Retval: %d\n",natoms,retval);
+	  return (retval < 0) ? -retval : 1;
+	}
+      if(fgets(buffer,LINE_LENGTH,trajectory) == NULL)/* title */
+	{
+	  fprintf(stderr,"The trajectory is empty.\n");
+	  return 1;
+	}
+      input = trajectory;
+    }
+
+  for(frame = 0;;frame++)
+    {
+      if(trajectory != NULL)
+	retval = load_mdcrd_frame(crds[0],crds[1],crds[2],natoms,has_box,trajectory);
+      else
+	retval = load_coordinates(crds[0],crds[1],crds[2],radii,natoms,input);
+      if(retval == 0 && frame > 0)
+	break;
+      if(retval != natoms)
+	{
+	  fprintf(stderr,"Could not load all atoms of frame %ld (expected: %ld). Retval: %d\n",frame + 1,natoms,retval);
+	  return (retval < 0) ? -retval : 1;
+	}
+
+      retval = molsurf_calc(crds[0],crds[1],crds[2],radii,natoms,0,NULL,&area);
+      if(retval != MOLSURF_OK)
+	{
+	  fprintf(stderr,"Could not calculate the surface area of frame %ld: %s\n",frame + 1,molsurf_strerror(retval));
+	  printf("nan\n");
+	  failed_frames++;
+	  continue;
+	}
+      printf("%lf\n",area);
+    }
+
+  for(retval = 0;retval < 3;retval++)
+    free(crds[retval]);
+  free(radii);
+  if(input != stdin)
+    fclose(input);
+
+  return (failed_frames) ? 1 : 0;
+
+}